@@ -59,14 +59,22 @@ SET(LCB_CORE_CXXSRC
     src/getconfig.cc
     src/nodeinfo.cc
     src/handler.cc
+    src/hedge.cc
+    src/coalesce.cc
+    src/nearcache.cc
+    src/counteragg.cc
+    src/rowflow.cc
+    src/ftsmerge.cc
     src/hostlist.cc
     src/http/http.cc
     src/http/http_io.cc
+    src/http/dispatch.cc
     src/lcbht/lcbht.cc
     src/newconfig.cc
     src/n1ql/params.cc
     src/n1ql/n1ql.cc
     src/n1ql/ixmgmt.cc
+    src/n1ql/group.cc
     src/cbft.cc
     src/operations/cbflush.cc
     src/operations/counter.cc
@@ -86,6 +94,7 @@ SET(LCB_CORE_CXXSRC
     src/mcserver/negotiate.cc
     src/retrychk.cc
     src/retryq.cc
+    src/slowops.cc
     src/views/docreq.cc
     src/views/viewreq.cc
     src/cntl.cc
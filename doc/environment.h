@@ -61,6 +61,15 @@
  *
  * @committed
  *
+ * @subsection LCB_LOGASYNC
+ *
+ * If set, the console logger writes messages from a background thread
+ * rather than formatting and writing them synchronously. Messages are
+ * dropped (and counted) rather than blocking if they are logged faster
+ * than they can be written. See @ref LCB_CNTL_CONLOGGER_ASYNC
+ *
+ * @uncommitted
+ *
  * @subsection LCB_SSL_MODE
  *
  * Specify the _mode_ to use for SSL. Mode can either be `0` (for no SSL),
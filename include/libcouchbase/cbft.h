@@ -57,11 +57,28 @@ typedef struct {
 typedef void (*lcb_FTSCALLBACK)(lcb_t, int, const lcb_RESPFTS *);
 typedef struct lcb_FTSREQ* lcb_FTSHANDLE;
 
+/**
+ * @uncommitted
+ * Query each partition of the index directly (in parallel, on the node which
+ * holds it), and merge the hits by score within the library. Hits are passed
+ * to the callback as soon as their position in the merged results is known.
+ *
+ * The partitions are found using the FTS configuration (`/api/cfg`), which
+ * the credentials must be allowed to read. If the partitions cannot be found,
+ * or if the query uses facets or a sort order other than by descending score,
+ * the index is queried normally.
+ *
+ * The final callback contains merged metadata: the `status`, `total_hits`,
+ * `max_score` and `took` fields. lcb_RESPFTS::htresp is not set for the
+ * hits, since each may come from a different response.
+ */
+#define LCB_CMDFTS_F_SCATTER 1 << 16
+
 /**
  * @brief Search Command
  */
 typedef struct {
-    /** Modifiers for command. Currently none are defined */
+    /** Modifiers for command. See @ref LCB_CMDFTS_F_SCATTER */
     lcb_U32 cmdflags;
     /** Encoded JSON query */
     const char *query;
@@ -100,6 +117,23 @@ LIBCOUCHBASE_API
 void
 lcb_fts_cancel(lcb_t, lcb_FTSHANDLE);
 
+/**
+ * @uncommitted
+ * Pause the delivery of rows for a full-text query in progress. See
+ * lcb_n1ql_pause(); the same semantics apply.
+ */
+LIBCOUCHBASE_API
+void
+lcb_fts_pause(lcb_t, lcb_FTSHANDLE);
+
+/**
+ * @uncommitted
+ * Resume a full-text query paused by lcb_fts_pause(). See lcb_n1ql_resume().
+ */
+LIBCOUCHBASE_API
+void
+lcb_fts_resume(lcb_t, lcb_FTSHANDLE);
+
 /**
  * @}
  */
@@ -924,8 +924,449 @@ typedef const char *lcb_BUCKETCRED[2];
  */
 #define LCB_CNTL_READ_CHUNKSIZE 0x42
 
+/**
+ * @uncommitted
+ * When a host resolves to more than one address (for example, both an IPv6
+ * and an IPv4 address when @ref LCB_CNTL_IP6POLICY allows both), connection
+ * attempts are raced rather than tried one after the other: if an attempt
+ * has not completed within this interval, the next address is tried in
+ * parallel, and the first one to connect is used. The default is 250ms.
+ * Setting this to 0 disables racing, trying addresses in order.
+ *
+ * @note This setting only works for event-style I/O plugins.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"connect_race_delay"` with lcb_cntl_string() (value in seconds)
+ */
+#define LCB_CNTL_CONNECT_RACE_DELAY 0x43
+
+/**
+ * @uncommitted
+ * Number of nodes to request the initial cluster configuration from at once.
+ * Normally the bootstrap nodes are tried one after the other, so an
+ * unresponsive node delays lcb_connect() by up to
+ * @ref LCB_CNTL_CONFIG_NODE_TIMEOUT. With a value greater than 1, that many
+ * nodes are queried concurrently and the first valid configuration is used.
+ * Connections to the other nodes which have already been established are
+ * kept in the pool to be used for data operations.
+ *
+ * This currently applies to the CCCP (memcached) configuration provider.
+ * The default is 1.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"bootstrap_race"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_BOOTSTRAP_RACE 0x44
+
+/**
+ * @uncommitted
+ * Get the time it took (in microseconds) from lcb_connect() until the first
+ * cluster configuration was received. This is 0 if the instance has not
+ * yet been bootstrapped. See also lcb_get_bootstrap_status()
+ *
+ * @cntl_arg_getonly{lcb_U32*}
+ */
+#define LCB_CNTL_BOOTSTRAP_TIME 0x45
+
+/**
+ * @uncommitted
+ * Set the minimum number of idle HTTP (view, N1QL and FTS) connections to
+ * keep open to each node. When a new cluster configuration is received, the
+ * library connects to each node in the background to fill the pool, and
+ * replaces pooled connections as they are closed. Idle connections within
+ * this count are not closed when they time out.
+ *
+ * The value is capped by @ref LCB_CNTL_HTTP_POOLSIZE. The default is 0,
+ * meaning connections are only established when a request needs them.
+ *
+ * @cntl_arg_both{lcb_SIZE*}
+ *
+ * Use `"http_pool_minidle"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_HTTP_POOL_MINIDLE 0x46
+
+/**
+ * @uncommitted
+ *
+ * Enable asynchronous mode for the console logger. Rather than formatting
+ * and writing each message on the calling thread, messages are copied into a
+ * per-thread buffer and written out by a background thread. If messages are
+ * logged faster than they can be written, they are dropped rather than
+ * blocking the caller (see @ref LCB_CNTL_CONLOGGER_DROPPED).
+ *
+ * Like @ref LCB_CNTL_CONLOGGER_FP, this setting is global and does not
+ * require a library handle. The background thread only runs while at least
+ * one handle exists; destroying the last handle, or disabling this setting,
+ * waits until all pending messages have been written. This may also be
+ * enabled by setting `LCB_LOGASYNC` in the environment.
+ *
+ * @cntl_arg_both{int* (as boolean)}
+ *
+ * Use `"console_log_async"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_CONLOGGER_ASYNC 0x47
+
+/**
+ * @uncommitted
+ * Get the number of messages which the asynchronous console logger has
+ * dropped because its buffers were full.
+ *
+ * @cntl_arg_getonly{lcb_U32*}
+ */
+#define LCB_CNTL_CONLOGGER_DROPPED 0x48
+
+/**
+ * @uncommitted
+ *
+ * Set the threshold (in microseconds) above which an operation is considered
+ * slow. When set, each operation records the time spent in each stage of its
+ * lifetime (scheduled, queued for write, written, waiting for the server,
+ * and dispatched to the callback). Operations exceeding the threshold are
+ * logged periodically at the `WARN` level, together with this breakdown.
+ *
+ * A value of 0 (the default) disables tracing. Setting it back to 0 logs
+ * any slow operations collected since the last report.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"slowop_threshold"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_SLOWOP_THRESHOLD 0x49
+
+/**
+ * @uncommitted
+ *
+ * Set the interval (in microseconds) at which slow operations are reported.
+ * See @ref LCB_CNTL_SLOWOP_THRESHOLD.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"slowop_interval"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_SLOWOP_INTERVAL 0x4A
+
+/**
+ * @uncommitted
+ *
+ * Adapt the durability polling interval to the observed replication and
+ * persistence latency of each node (see @ref LCB_CNTL_DURABILITY_LAG).
+ * Rather than polling at a fixed @ref LCB_CNTL_DURABILITY_INTERVAL, the next
+ * poll is scheduled for when the operation is predicted to complete. If the
+ * criteria are still not satisfied by then, the interval grows exponentially
+ * from 1ms up to @ref LCB_CNTL_DURABILITY_INTERVAL.
+ *
+ * This has no effect on operations which specify their own interval in
+ * lcb_durability_opts_t.
+ *
+ * @cntl_arg_both{int* (as boolean)}
+ *
+ * Use `"durability_adaptive"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_DURABILITY_ADAPTIVE 0x4B
+
+/**
+ * Structure for @ref LCB_CNTL_DURABILITY_LAG
+ */
+typedef struct {
+    int server_index; /**< **Input** index of the server */
+    lcb_U32 replicate_lag; /**< **Output** replication lag (microseconds) */
+    lcb_U32 persist_lag; /**< **Output** persistence lag (microseconds) */
+} lcb_DURABILITYLAG;
+
+/**
+ * @uncommitted
+ *
+ * Get the estimated time it takes for a mutation to be replicated to, and
+ * persisted on a given server. These are moving averages updated by
+ * durability operations (lcb_endure3_ctxnew()), and are 0 if no estimate is
+ * available yet. The replication lag of a server is only measured for
+ * vBuckets for which it is a replica.
+ *
+ * @cntl_arg_getonly{lcb_DURABILITYLAG*}
+ */
+#define LCB_CNTL_DURABILITY_LAG 0x4C
+
+/**
+ * @uncommitted
+ *
+ * Set the latency percentile after which a read made with
+ * @ref LCB_CMDGET_F_HEDGE is also sent to a replica. For example, a value of
+ * 95 means that a replica read is sent if the active node has not responded
+ * within the time in which 95% of its recent responses arrived. This must be
+ * between 1 and 100.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"hedge_percentile"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_HEDGE_PERCENTILE 0x4D
+
+/**
+ * @uncommitted
+ *
+ * Limit the number of replica reads sent for @ref LCB_CMDGET_F_HEDGE, as a
+ * percentage of the hedged reads made.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"hedge_budget"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_HEDGE_BUDGET 0x4E
+
+/**
+ * Structure for @ref LCB_CNTL_HEDGE_STATS
+ */
+typedef struct {
+    lcb_U64 issued; /**< Number of replica reads sent */
+    lcb_U64 won; /**< Number of replica reads whose response was used */
+} lcb_HEDGESTATS;
+
+/**
+ * @uncommitted
+ *
+ * Get statistics about reads made with @ref LCB_CMDGET_F_HEDGE
+ *
+ * @cntl_arg_getonly{lcb_HEDGESTATS*}
+ */
+#define LCB_CNTL_HEDGE_STATS 0x4F
+
+/**
+ * @uncommitted
+ *
+ * Share in-flight GETs. When enabled, a plain GET (i.e. one which does not
+ * lock the item or modify its expiry) for a key which already has a GET
+ * outstanding is not sent to the server. Instead, it receives the response
+ * of the outstanding GET. This reduces the load placed on the server by
+ * many concurrent reads of the same key, at the cost of possibly receiving
+ * a value which was read before the GET was scheduled.
+ *
+ * @cntl_arg_both{int* (as boolean)}
+ *
+ * Use `"get_coalesce"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_GET_COALESCE 0x50
+
+/**
+ * @uncommitted
+ *
+ * Set the maximum number of items kept in the near cache, a client-side
+ * cache of the values returned by plain GETs (i.e. those which do not lock
+ * the item or modify its expiry). While an item is cached, plain GETs for it
+ * are answered without contacting the server. A value of 0 (the default)
+ * disables the cache. Setting this empties the cache.
+ *
+ * An item is removed from the cache when this instance modifies or locks
+ * it, and expires after @ref LCB_CNTL_NEARCACHE_TTL. Modifications made by
+ * other clients are only seen once the item expires, so this should only be
+ * used for items which are rarely modified.
+ *
+ * Responses delivered from the cache have a `NULL` lcb_RESPGET::bufh.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"nearcache_size"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_NEARCACHE_SIZE 0x51
+
+/**
+ * @uncommitted
+ *
+ * Set how long an item may be served from the near cache
+ * (see @ref LCB_CNTL_NEARCACHE_SIZE) before it must be fetched again.
+ *
+ * @cntl_arg_both{lcb_U32* (microseconds)}
+ *
+ * Use `"nearcache_ttl"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_NEARCACHE_TTL 0x52
+
+/**
+ * @uncommitted
+ *
+ * When an item in the near cache has expired, check whether it is unchanged
+ * on the server by requesting only its metadata (GET_META) and comparing its
+ * CAS. If it is unchanged the cached value is used; otherwise the item is
+ * fetched again.
+ *
+ * @cntl_arg_both{int* (as boolean)}
+ *
+ * Use `"nearcache_revalidate"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_NEARCACHE_REVALIDATE 0x53
+
+/**
+ * Structure for @ref LCB_CNTL_NEARCACHE_STATS
+ */
+typedef struct {
+    lcb_U64 hits; /**< GETs answered from the cache */
+    lcb_U64 misses; /**< GETs which were sent to the server */
+    lcb_U64 revalidated; /**< Expired items confirmed to be unchanged */
+    lcb_U64 evicted; /**< Items replaced by more frequently read items */
+} lcb_NEARCACHESTATS;
+
+/**
+ * @uncommitted
+ *
+ * Get statistics about the near cache (see @ref LCB_CNTL_NEARCACHE_SIZE)
+ *
+ * @cntl_arg_getonly{lcb_NEARCACHESTATS*}
+ */
+#define LCB_CNTL_NEARCACHE_STATS 0x54
+
+/**
+ * @uncommitted
+ *
+ * Aggregate counter operations. When set to a non-zero duration,
+ * lcb_counter3() does not send a command right away. Instead, the deltas of
+ * all counter operations on the same key (with the same `initial` and
+ * `create` values) scheduled within this duration of the first are summed,
+ * and a single increment or decrement by the sum is sent to the server.
+ *
+ * Operations with an expiry or a custom hash key are never aggregated.
+ *
+ * The following guarantees apply to aggregated operations:
+ *
+ * - Every participating operation receives the response to the combined
+ *   command, in the order in which they were scheduled. They therefore all
+ *   receive the same resulting value and CAS, which reflects all of their
+ *   deltas.
+ * - The combined command is sent when the window closes (or see
+ *   @ref LCB_CNTL_COUNTER_WINDOW_OPS), so other operations on the key which
+ *   were scheduled after a participating operation may be executed before
+ *   it.
+ * - The server applies the net delta. A decrement which would have been
+ *   clamped at zero had it been sent alone may thus have a different
+ *   effect when combined with increments.
+ *
+ * @cntl_arg_both{lcb_U32* (microseconds)}
+ *
+ * Use `"counter_window"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_COUNTER_WINDOW 0x55
+
+/**
+ * @uncommitted
+ *
+ * Limit the number of counter operations which may be combined by
+ * @ref LCB_CNTL_COUNTER_WINDOW. Once this many operations have been
+ * scheduled for a key, the combined command is sent when the scheduling
+ * context is left, without waiting for the window to close. 0 (the default)
+ * means no limit.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"counter_window_ops"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_COUNTER_WINDOW_OPS 0x56
+
+/**
+ * @uncommitted
+ *
+ * Limit the rows buffered by a paused N1QL or full-text query (see
+ * lcb_n1ql_pause() and lcb_fts_pause()). While a query is paused, the rows
+ * it has already received are kept until it is resumed. The response
+ * continues to be read until the buffered rows occupy this many bytes,
+ * so that the next rows are ready once the query is resumed. The default
+ * of 0 stops reading as soon as the query is paused.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"rowbuf_highwat"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_ROWBUF_HIGHWAT 0x57
+
+/**
+ * @uncommitted
+ *
+ * Once reading has been stopped by @ref LCB_CNTL_ROWBUF_HIGHWAT, it is
+ * restarted when the buffered rows occupy no more than this many bytes.
+ * Values above the high watermark are treated as the high watermark.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"rowbuf_lowwat"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_ROWBUF_LOWWAT 0x58
+
+/**
+ * @uncommitted
+ *
+ * Set how long an idle HTTP connection is kept in the pool (see
+ * @ref LCB_CNTL_HTTP_POOLSIZE) before it is closed. If the server indicates
+ * a shorter timeout in its `Keep-Alive` response header, the connection is
+ * closed before the server would close it. The default is 10 seconds.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"http_pool_timeout"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_HTTP_POOL_TIMEOUT 0x59
+
+/**
+ * @uncommitted
+ *
+ * Limit the number of view, N1QL and full-text requests in progress on each
+ * node. Further requests for the node are queued, and are started (in the
+ * order they were made) as earlier ones complete. Queued requests still time
+ * out normally. The default of 0 means there is no limit.
+ *
+ * Regardless of this setting, each request is sent to the node which has
+ * the fewest such requests in progress.
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"http_max_concurrent"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_HTTP_MAXCONCURRENT 0x5A
+
+/**
+ * @uncommitted
+ *
+ * Automatically use prepared statements for ad-hoc N1QL statements which are
+ * issued often, as if @ref LCB_CMDN1QL_F_PREPCACHE were set. This is the
+ * number of times a statement must be seen before it is prepared; statements
+ * differing only in whitespace outside of string literals count as one.
+ * Counts are approximate, and decay over time. The default of 0 disables
+ * this.
+ *
+ * Only `SELECT`, `INSERT`, `UPSERT`, `UPDATE`, `DELETE` and `MERGE`
+ * statements are prepared. If preparing a statement fails, it is issued
+ * ad-hoc instead, and is not prepared automatically again until the cache
+ * is cleared (see @ref LCB_CNTL_N1QL_CLEARACHE).
+ *
+ * @cntl_arg_both{lcb_U32*}
+ *
+ * Use `"n1ql_autoprepare"` with lcb_cntl_string()
+ */
+#define LCB_CNTL_N1QL_AUTOPREPARE 0x5B
+
+/**
+ * Structure for @ref LCB_CNTL_NETBUF_STATS
+ */
+typedef struct {
+    int server_index; /**< **Input** index of the server */
+    lcb_SIZE allocated; /**< **Output** bytes allocated for buffers */
+    lcb_SIZE used; /**< **Output** bytes used by requests not yet completed */
+    lcb_SIZE cached; /**< **Output** bytes in empty buffers kept for reuse */
+    /** **Output** bytes which can't be used until other requests complete */
+    lcb_SIZE wasted;
+} lcb_NETBUFSTATS;
+
+/**
+ * @uncommitted
+ *
+ * Get the memory used to buffer requests to a given server. The size of
+ * new buffers follows the size of recent requests, and buffers which stay
+ * empty for longer than the operation timeout are freed.
+ *
+ * @cntl_arg_getonly{lcb_NETBUFSTATS*}
+ */
+#define LCB_CNTL_NETBUF_STATS 0x5C
+
 /** This is not a command, but rather an indicator of the last item */
-#define LCB_CNTL__MAX                    0x43
+#define LCB_CNTL__MAX                    0x5D
 /**@}*/
 
 #ifdef __cplusplus
@@ -760,6 +760,21 @@ lcb_strcbtype(int cbtype);
  */
 #define LCB_CMDGET_F_CLEAREXP (1<<16)
 
+/**
+ * @uncommitted
+ *
+ * If this bit is set in lcb_CMDGET::cmdflags, and the active node has not
+ * responded within its recent @ref LCB_CNTL_HEDGE_PERCENTILE latency, the
+ * item is also requested from a replica. The first successful response is
+ * delivered, and the other is discarded. Note that the value returned by a
+ * replica may be older than the one on the active node.
+ *
+ * The number of extra requests is limited by @ref LCB_CNTL_HEDGE_BUDGET.
+ * This flag is ignored for locking and touching reads, and if the bucket has
+ * no replicas.
+ */
+#define LCB_CMDGET_F_HEDGE (1<<17)
+
 /**@brief Command for retrieving a single item
  *
  * @see lcb_get3()
@@ -872,7 +887,13 @@ typedef enum {
 
     /**Query the specific replica specified by the
      * lcb_rget3_cmd_t#index field */
-    LCB_REPLICA_SELECT = 0x02
+    LCB_REPLICA_SELECT = 0x02,
+
+    /**@uncommitted
+     * Like ::LCB_REPLICA_FIRST, but query the replicas in order of their
+     * recent latency and number of outstanding requests, so that a slow or
+     * busy node is only queried if the others fail */
+    LCB_REPLICA_FASTEST = 0x03
 } lcb_replica_t;
 
 /**
@@ -901,6 +922,8 @@ typedef struct {
      * a callback for each reply</li>
      * <li>::LCB_REPLICA_SELECT - queries a specific replica indicated in the
      * #index field</li>
+     * <li>::LCB_REPLICA_FASTEST - like ::LCB_REPLICA_FIRST, but tries the
+     * least loaded replica first</li>
      * </ul>
      *
      * @note When ::LCB_REPLICA_ALL is selected, the callback will be invoked
@@ -2408,6 +2431,58 @@ typedef enum {
  */
 #define LCB_CMDHTTP_F_NOUPASS 1<<18
 
+/**
+ * @uncommitted
+ * Send the body from multiple buffers. The lcb_CMDHTTP::body field points to
+ * an array of ::lcb_IOV structures, and lcb_CMDHTTP::nbody is the number of
+ * elements in the array.
+ *
+ * The array itself is copied, but the buffers are not: they are written to
+ * the network directly, and must remain valid until the final callback for
+ * the request has been invoked.
+ */
+#define LCB_CMDHTTP_F_BODYIOV 1<<19
+
+/**
+ * @uncommitted
+ * Read the body from a callback while it is being sent. The lcb_CMDHTTP::body
+ * field points to an ::lcb_HTTPBODYSOURCE structure (which is copied), and
+ * lcb_CMDHTTP::nbody is ignored.
+ *
+ * Since the body cannot be read twice, a request whose body has been read
+ * (even partially) is neither retried nor redirected.
+ */
+#define LCB_CMDHTTP_F_BODYSTREAM 1<<20
+
+/**
+ * @uncommitted
+ * Callback supplying the body of a request made with
+ * @ref LCB_CMDHTTP_F_BODYSTREAM. It is invoked whenever more of the body can
+ * be sent.
+ *
+ * @param cookie the lcb_HTTPBODYSOURCE::cookie field
+ * @param buf the buffer to copy the next part of the body into
+ * @param nbuf the size of the buffer
+ * @return the number of bytes copied into the buffer (which may be less than
+ * `nbuf`), 0 once the entire body has been supplied, or -1 to fail the
+ * request with @ref LCB_EINVAL.
+ */
+typedef lcb_SSIZE (*lcb_HTTPBODY_cb)(void *cookie, char *buf, lcb_SIZE nbuf);
+
+/**
+ * @uncommitted
+ * Source of the body for @ref LCB_CMDHTTP_F_BODYSTREAM
+ */
+typedef struct {
+    lcb_HTTPBODY_cb read; /**< Invoked to read the body */
+    void *cookie; /**< Passed to the callback */
+
+    /** Length of the body. If 0, the length is not known in advance and the
+     * body is sent with chunked transfer encoding. Otherwise, the callback
+     * must supply exactly this many bytes */
+    lcb_SIZE length;
+} lcb_HTTPBODYSOURCE;
+
 /**
  * Structure for performing an HTTP request.
  * Note that the key and nkey fields indicate the _path_ for the API
@@ -2422,7 +2497,8 @@ typedef struct {
     lcb_http_method_t method; /**< HTTP Method to use */
 
     /** If the request requires a body (e.g. `PUT` or `POST`) then it will
-     * go here. Be sure to indicate the length of the body too. */
+     * go here. Be sure to indicate the length of the body too. See also
+     * @ref LCB_CMDHTTP_F_BODYIOV and @ref LCB_CMDHTTP_F_BODYSTREAM */
     const char *body;
 
     /** Length of the body for the request */
@@ -2444,7 +2520,9 @@ typedef struct {
     const char *password;
 
     /** If set, this must be a string in the form of `http://host:port`. Should
-     * only be used for raw requests. */
+     * only be used for raw requests, or for view, N1QL and FTS requests which
+     * must be sent to a specific node of the service (such requests are not
+     * retried on another node). */
     const char *host;
 } lcb_CMDHTTP;
 
@@ -235,6 +235,9 @@ typedef struct {
     /**
      * How often to check status (microseconds).
      * Default is 500 milliseconds (500000)
+     *
+     * The time between checks doubles after each check in which none of the
+     * indexes changed state, up to #max_interval.
      */
     lcb_U32 interval;
 
@@ -245,6 +248,22 @@ typedef struct {
      * The callback is only invoked once.
      */
     lcb_N1XMGMTCALLBACK callback;
+
+    /**
+     * Longest time between checks (microseconds). Default is ten times
+     * #interval. Set this to the same value as #interval to check at a
+     * fixed interval.
+     */
+    lcb_U32 max_interval;
+
+    /**
+     * Optional callback to invoke as the indexes change state, before
+     * #callback is invoked. lcb_RESPN1XMGMT::specs contains the indexes whose
+     * state changed (including those whose state was first seen), with
+     * lcb_N1XSPEC::state set to the new state. The specs are only valid
+     * within the callback.
+     */
+    lcb_N1XMGMTCALLBACK state_callback;
 } lcb_CMDN1XWATCH;
 
 /**
@@ -252,6 +271,9 @@ typedef struct {
  * Poll indexes being built. This allows you to wait until the specified indexes
  * which are being built (using lcb_n1x_startbuild()) have been fully
  * created.
+ *
+ * All the indexes being watched on an instance are checked by a single
+ * query, which only returns those indexes.
  */
 LIBCOUCHBASE_API
 lcb_error_t
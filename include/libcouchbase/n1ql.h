@@ -254,7 +254,9 @@ lcb_n1p_mkcmd(lcb_N1QLPARAMS *params, lcb_CMDN1QL *cmd);
 
 /**
  * Prepare and cache the query if required. This may be used on frequently
- * issued queries, so they perform better.
+ * issued queries, so they perform better. See also
+ * @ref LCB_CNTL_N1QL_AUTOPREPARE, which does this for statements as they are
+ * found to be frequent.
  */
 #define LCB_CMDN1QL_F_PREPCACHE 1<<16
 
@@ -354,6 +356,126 @@ lcb_n1ql_query(lcb_t instance, const void *cookie, const lcb_CMDN1QL *cmd);
 LIBCOUCHBASE_API
 void
 lcb_n1ql_cancel(lcb_t instance, lcb_N1QLHANDLE handle);
+
+/**
+ * @uncommitted
+ * Pause the delivery of rows for an in-progress request.
+ *
+ * No further callbacks are invoked for the request (including the final
+ * one) until lcb_n1ql_resume() is called. Rows which have already been
+ * received are buffered until then, and reading of the response stops once
+ * they exceed @ref LCB_CNTL_ROWBUF_HIGHWAT bytes. This allows an application
+ * which cannot keep up with the rows to bound the memory used by the query.
+ *
+ * This may be called from within the row callback. Note that the request
+ * timeout still applies while the request is paused.
+ *
+ * @param instance the instance
+ * @param handle the handle for the request (see lcb_CMDN1QL::handle)
+ */
+LIBCOUCHBASE_API
+void
+lcb_n1ql_pause(lcb_t instance, lcb_N1QLHANDLE handle);
+
+/**
+ * @uncommitted
+ * Resume a request paused by lcb_n1ql_pause(). Buffered rows are delivered
+ * from the event loop, rather than from within this function. Rows delivered
+ * after having been buffered have a NULL lcb_RESPN1QL::htresp. If the final
+ * response was received while rows were buffered, the final callback's
+ * lcb_RESPN1QL::htresp only carries the status (lcb_RESPHTTP::rc and
+ * lcb_RESPHTTP::htstatus); its headers and body are not available.
+ *
+ * @param instance the instance
+ * @param handle the handle for the request
+ */
+LIBCOUCHBASE_API
+void
+lcb_n1ql_resume(lcb_t instance, lcb_N1QLHANDLE handle);
+
+typedef struct lcb_N1QLGROUP* lcb_N1QLGROUPHANDLE;
+
+/**
+ * Callback for the statements of a group (see lcb_n1ql_group()).
+ * @param instance the instance
+ * @param index the index of the statement in lcb_CMDN1QLGROUP::cmds
+ * @param resp the response, as for lcb_n1ql_query(). lcb_RESPN1QL::cookie is
+ *        the cookie passed to lcb_n1ql_group()
+ */
+typedef void (*lcb_N1QLGROUPCALLBACK)(lcb_t instance, size_t index,
+        const lcb_RESPN1QL *resp);
+
+/**
+ * @uncommitted
+ * Command structure for a group of independent N1QL statements
+ */
+typedef struct {
+    /** Modifiers for the group. Currently none are defined */
+    lcb_U32 cmdflags;
+
+    /** The statements. Only the lcb_CMDN1QL::cmdflags, lcb_CMDN1QL::query and
+     * lcb_CMDN1QL::nquery fields are used. The queries are copied, and need
+     * not remain valid once lcb_n1ql_group() returns */
+    const lcb_CMDN1QL *cmds;
+    /** Number of statements in #cmds */
+    size_t ncmds;
+
+    /**
+     * Limit the statements in progress to this many per query node. Each
+     * statement is sent to the node with the shortest expected wait, given
+     * the requests already in progress on each node and their recent
+     * completion times, among the nodes with fewer than this many of the
+     * group's statements in progress. 0 issues all the statements at once.
+     *
+     * See also @ref LCB_CNTL_HTTP_MAXCONCURRENT, which limits all requests
+     * to each node.
+     */
+    unsigned max_per_node;
+
+    /** Callback for the rows of all the statements. Must be supplied */
+    lcb_N1QLGROUPCALLBACK callback;
+
+    /** If set, receives the handle which may be passed to
+     * lcb_n1ql_group_cancel(). The handle is valid until the final callback
+     * of the last statement returns (or the group is cancelled) */
+    lcb_N1QLGROUPHANDLE *handle;
+} lcb_CMDN1QLGROUP;
+
+/**
+ * @uncommitted
+ *
+ * Execute a group of independent N1QL statements, spreading them over the
+ * query nodes of the cluster.
+ *
+ * The rows of all the statements are passed to lcb_CMDN1QLGROUP::callback,
+ * along with the index of the statement they belong to. Statements complete
+ * independently and in any order. Each receives one final callback (with
+ * ::LCB_RESP_F_FINAL set) containing its metadata or error. This includes
+ * statements which could not be issued. The group is done once every
+ * statement has had its final callback.
+ *
+ * @param instance the instance
+ * @param cookie pointer to application data, passed in each response
+ * @param cmd the statements
+ * @return LCB_SUCCESS if the group was scheduled, or ::LCB_EINVAL if the
+ * command is invalid (no callback, or a statement without a query)
+ */
+LIBCOUCHBASE_API
+lcb_error_t
+lcb_n1ql_group(lcb_t instance, const void *cookie, const lcb_CMDN1QLGROUP *cmd);
+
+/**
+ * @uncommitted
+ * Cancel a group of statements. No further callbacks are delivered for any
+ * of its statements, and those not yet issued are dropped.
+ *
+ * This must not be called once the group is done: the handle is freed when
+ * the final callback of its last statement returns. It may be called from
+ * within any of the group's callbacks, including that one.
+ */
+LIBCOUCHBASE_API
+void
+lcb_n1ql_group_cancel(lcb_t instance, lcb_N1QLGROUPHANDLE handle);
 /**@}*/
 
 /**@}*/
@@ -311,6 +311,47 @@ LIBCOUCHBASE_API
 int
 lcb_sdresult_next(const lcb_RESPSUBDOC *resp, lcb_SDENTRY *out, size_t *iter);
 
+/**
+ * @uncommitted
+ * Get the number of results in a subdocument response.
+ *
+ * The results are indexed once, when the response is received, so this and
+ * lcb_sdresult_at() do not need to parse the response again.
+ *
+ * @warning
+ * As with lcb_sdresult_next(), this function _must_ be called from within the
+ * callback.
+ *
+ * @param resp the response received from within the callback.
+ * @return the number of results. For multi mutations this is only the number
+ * of specs for which a result was returned.
+ */
+LIBCOUCHBASE_API
+size_t
+lcb_sdresult_count(const lcb_RESPSUBDOC *resp);
+
+/**
+ * @uncommitted
+ * Get a result of a subdocument response by its position.
+ *
+ * This allows access to the results in any order, without iterating over
+ * the preceding ones. The value of the entry refers to the response's
+ * buffer, and is not copied.
+ *
+ * @warning
+ * This function _must_ be called from within the callback.
+ *
+ * @param resp the response received from within the callback.
+ * @param ix the position of the result, less than lcb_sdresult_count(). For
+ * multi lookups this is the index of the spec; for multi mutations, use
+ * lcb_SDENTRY::index to find the spec which the result belongs to.
+ * @param[out] out structure to store the result
+ * @return nonzero if `out` contains a valid entry, 0 if `ix` is out of range.
+ */
+LIBCOUCHBASE_API
+int
+lcb_sdresult_at(const lcb_RESPSUBDOC *resp, size_t ix, lcb_SDENTRY *out);
+
 /**@}*/
 #ifdef __cplusplus
 }
@@ -108,6 +108,10 @@ typedef struct {
      * Setting this value will attempt to throttle the number of get requests,
      * so that no more than this number of requests will be in progress at any
      * given time.
+     *
+     * By default the number of requests in progress is adjusted according to
+     * the rate at which rows arrive and the time taken to fetch each document,
+     * up to a limit of 256.
      */
     unsigned docs_concurrent_max;
 
@@ -78,6 +78,8 @@ void Bootstrap::config_callback(EventType event, ConfigInfo *info) {
 
     if (state < S_BOOTSTRAPPED) {
         state = S_BOOTSTRAPPED;
+        bootstrap_time = gethrtime() - bootstrap_start;
+        lcb_log(LOGARGS(instance, INFO), "Received first configuration in %uus", LCB_NS2US(bootstrap_time));
         lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
 
         if (instance->type == LCB_TYPE_BUCKET &&
@@ -140,6 +142,8 @@ Bootstrap::Bootstrap(lcb_t instance)
       tm(parent->iotable, this),
       last_refresh(0),
       errcounter(0),
+      bootstrap_start(0),
+      bootstrap_time(0),
       state(S_INITIAL_PRE) {
     parent->confmon->add_listener(this);
 }
@@ -171,6 +175,7 @@ lcb_error_t Bootstrap::bootstrap(unsigned options) {
 
     if (options == BS_REFRESH_INITIAL) {
         state = S_INITIAL_PRE;
+        bootstrap_start = now;
         parent->confmon->prepare();
         tm.rearm(LCBT_SETTING(parent, config_timeout));
         lcb_aspend_add(&parent->pendops, LCB_PENDTYPE_COUNTER, NULL);
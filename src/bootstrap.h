@@ -55,6 +55,13 @@ public:
     size_t get_errcounter() const {
         return errcounter;
     }
+    /**
+     * Time it took to receive the first configuration, counting from the
+     * initial lcb_connect(). Returns 0 if not yet bootstrapped
+     */
+    hrtime_t get_bootstrap_time() const {
+        return bootstrap_time;
+    }
 
 private:
     // Override
@@ -94,6 +101,12 @@ private:
      */
     unsigned errcounter;
 
+    /** When the initial bootstrap was started */
+    hrtime_t bootstrap_start;
+
+    /** Time between bootstrap_start and receipt of the first configuration */
+    hrtime_t bootstrap_time;
+
     enum State {
         /** Initial 'blank' state */
         S_INITIAL_PRE = 0,
@@ -28,12 +28,12 @@
 #include <lcbio/lcbio.h>
 #include <lcbio/timer-cxx.h>
 #include <lcbio/ssl.h>
-#include "ctx-log-inl.h"
 #define LOGARGS(cccp, lvl) cccp->parent->settings, "cccp", LCB_LOG_##lvl, __FILE__, __LINE__
 #define LOGFMT "<%s:%s> "
-#define LOGID(cccp) get_ctx_host(cccp->ioctx), get_ctx_port(cccp->ioctx)
+#define LOGID(attempt) attempt->host.host, attempt->host.port
 
 struct CccpCookie;
+struct CccpAttempt;
 
 using namespace lcb::clconfig;
 
@@ -42,12 +42,15 @@ struct CccpProvider : public Provider {
     ~CccpProvider();
 
     void release_socket(bool can_reuse);
+    void release_attempt(CccpAttempt *attempt, bool can_reuse);
+    void start_attempt(const lcb_host_t& host);
     lcb_error_t schedule_next_request(lcb_error_t why, bool can_rollover);
-    lcb_error_t mcio_error(lcb_error_t why);
-    void on_timeout() { mcio_error(LCB_ETIMEDOUT); }
+    lcb_error_t mcio_error(CccpAttempt *attempt, lcb_error_t why);
+    void on_timeout();
     lcb_error_t update(const char *host, const char* data);
-    void request_config();
-    void on_io_read();
+    void request_config(CccpAttempt *attempt);
+    void on_io_read(CccpAttempt *attempt);
+    size_t max_attempts() const;
 
     bool pause(); // Override
     void configure_nodes(const lcb::Hostlist&); // Override
@@ -73,9 +76,27 @@ struct CccpProvider : public Provider {
     bool server_active;
     lcb::io::Timer<CccpProvider, &CccpProvider::on_timeout> timer;
     lcb_t instance;
+
+    /**
+     * Dedicated connections used to fetch the configuration. There is
+     * normally at most one, unless the initial bootstrap is racing several
+     * nodes (see lcb_settings::bootstrap_race)
+     */
+    std::list<CccpAttempt*> attempts;
+    CccpCookie *cmdcookie;
+};
+
+/** A dedicated connection to a single node used to fetch the configuration */
+struct CccpAttempt {
+    CccpAttempt(CccpProvider *parent_, const lcb_host_t& host_)
+        : parent(parent_), ioctx(NULL), host(host_) {
+        std::memset(&creq, 0, sizeof creq);
+    }
+
+    CccpProvider *parent;
     lcbio_CONNREQ creq;
     lcbio_CTX *ioctx;
-    CccpCookie *cmdcookie;
+    lcb_host_t host;
 };
 
 struct CccpCookie {
@@ -101,21 +122,61 @@ pooled_close_cb(lcbio_SOCKET *sock, int reusable, void *arg)
     }
 }
 
+void
+CccpProvider::release_attempt(CccpAttempt *attempt, bool can_reuse)
+{
+    attempts.remove(attempt);
+    lcbio_connreq_cancel(&attempt->creq);
+
+    if (attempt->ioctx) {
+        lcbio_ctx_close(attempt->ioctx, pooled_close_cb, &can_reuse);
+    }
+    delete attempt;
+}
+
+/**
+ * Release all dedicated connections. Sockets which are idle (i.e. which do
+ * not have a response pending) are placed back into the pool if `can_reuse`
+ * is true, so that a racing bootstrap leaves behind warm connections for
+ * the data pipelines.
+ */
 void
 CccpProvider::release_socket(bool can_reuse)
 {
     if (cmdcookie) {
         cmdcookie->ignore_errors = 1;
         cmdcookie =  NULL;
-        return;
     }
 
-    lcbio_connreq_cancel(&creq);
+    while (!attempts.empty()) {
+        release_attempt(attempts.front(), can_reuse);
+    }
+}
 
-    if (ioctx) {
-        lcbio_ctx_close(ioctx, pooled_close_cb, &can_reuse);
-        ioctx = NULL;
+size_t
+CccpProvider::max_attempts() const
+{
+    /* Racing is only useful when we don't yet have any configuration (and
+     * thus no existing connections to request one from) */
+    if (instance->cur_configinfo == NULL && settings().bootstrap_race > 1) {
+        return settings().bootstrap_race;
     }
+    return 1;
+}
+
+void
+CccpProvider::start_attempt(const lcb_host_t& host)
+{
+    CccpAttempt *attempt = new CccpAttempt(this, host);
+    lcbio_pMGRREQ preq;
+
+    lcb_log(LOGARGS(this, INFO), "Requesting connection to node %s:%s for CCCP configuration", host.host, host.port);
+    attempts.push_back(attempt);
+    preq = lcbio_mgr_get(
+            instance->memd_sockpool, &attempt->host,
+            settings().config_node_timeout,
+            on_connected, attempt);
+    LCBIO_CONNREQ_MKPOOLED(&attempt->creq, preq);
 }
 
 lcb_error_t
@@ -124,6 +185,10 @@ CccpProvider::schedule_next_request(lcb_error_t err, bool can_rollover)
     lcb::Server *server;
     lcb_host_t *next_host = nodes->next(can_rollover);
     if (!next_host) {
+        if (!attempts.empty()) {
+            /* Other (racing) attempts are still in progress */
+            return LCB_SUCCESS;
+        }
         timer.cancel();
         parent->provider_failed(this, err);
         server_active = false;
@@ -139,14 +204,13 @@ CccpProvider::schedule_next_request(lcb_error_t err, bool can_rollover)
         instance->request_config(cookie, server);
 
     } else {
-        lcbio_pMGRREQ preq;
+        size_t maxattempts = max_attempts();
+        start_attempt(*next_host);
 
-        lcb_log(LOGARGS(this, INFO), "Requesting connection to node %s:%s for CCCP configuration", next_host->host, next_host->port);
-        preq = lcbio_mgr_get(
-                instance->memd_sockpool, next_host,
-                settings().config_node_timeout,
-                on_connected, this);
-        LCBIO_CONNREQ_MKPOOLED(&creq, preq);
+        while (attempts.size() < maxattempts &&
+                (next_host = nodes->next(false)) != NULL) {
+            start_attempt(*next_host);
+        }
     }
 
     server_active = true;
@@ -154,16 +218,28 @@ CccpProvider::schedule_next_request(lcb_error_t err, bool can_rollover)
 }
 
 lcb_error_t
-CccpProvider::mcio_error(lcb_error_t err)
+CccpProvider::mcio_error(CccpAttempt *attempt, lcb_error_t err)
 {
+    if (attempt == NULL) {
+        release_socket(err == LCB_NOT_SUPPORTED);
+        return schedule_next_request(err, false);
+    }
+
     if (err != LCB_NOT_SUPPORTED && err != LCB_UNKNOWN_COMMAND) {
-        lcb_log(LOGARGS(this, ERR), LOGFMT "Got I/O Error=0x%x", LOGID(this), err);
+        lcb_log(LOGARGS(this, ERR), LOGFMT "Got I/O Error=0x%x", LOGID(attempt), err);
     }
 
-    release_socket(err == LCB_NOT_SUPPORTED);
+    release_attempt(attempt, err == LCB_NOT_SUPPORTED);
     return schedule_next_request(err, false);
 }
 
+void
+CccpProvider::on_timeout()
+{
+    release_socket(false);
+    schedule_next_request(LCB_ETIMEDOUT, false);
+}
+
 /** Update the configuration from a server. */
 lcb_error_t
 lcb::clconfig::cccp_update(Provider *provider, const char *host, const char *data) {
@@ -185,7 +261,7 @@ CccpProvider::update(const char *host, const char *data)
     rv = lcbvb_load_json(vbc, data);
 
     if (rv) {
-        lcb_log(LOGARGS(this, ERROR), LOGFMT "Failed to parse config", LOGID(this));
+        lcb_log(LOGARGS(this, ERROR), "<%s> Failed to parse config", host);
         lcb_log_badconfig(LOGARGS(this, ERROR), vbc, data);
         lcbvb_destroy(vbc);
         return LCB_PROTOCOL_ERROR;
@@ -227,7 +303,7 @@ void lcb::clconfig::cccp_update(
     }
 
     if (err != LCB_SUCCESS && ck->ignore_errors == 0) {
-        cccp->mcio_error(err);
+        cccp->mcio_error(NULL, err);
     }
 
     free(ck);
@@ -237,35 +313,36 @@ static void
 on_connected(lcbio_SOCKET *sock, void *data, lcb_error_t err, lcbio_OSERR)
 {
     lcbio_CTXPROCS ioprocs;
-    CccpProvider *cccp = reinterpret_cast<CccpProvider*>(data);
+    CccpAttempt *attempt = reinterpret_cast<CccpAttempt*>(data);
+    CccpProvider *cccp = attempt->parent;
     lcb_settings *settings = cccp->parent->settings;
 
-    LCBIO_CONNREQ_CLEAR(&cccp->creq);
+    LCBIO_CONNREQ_CLEAR(&attempt->creq);
     if (err != LCB_SUCCESS) {
         if (sock) {
             lcbio_mgr_discard(sock);
         }
-        cccp->mcio_error(err);
+        cccp->mcio_error(attempt, err);
         return;
     }
 
     if (lcbio_protoctx_get(sock, LCBIO_PROTOCTX_SESSINFO) == NULL) {
         lcb::SessionRequest *sreq = lcb::SessionRequest::start(
                 sock, settings, settings->config_node_timeout, on_connected,
-                cccp);
-        LCBIO_CONNREQ_MKGENERIC(&cccp->creq, sreq, lcb::sessreq_cancel);
+                attempt);
+        LCBIO_CONNREQ_MKGENERIC(&attempt->creq, sreq, lcb::sessreq_cancel);
         return;
     }
 
     ioprocs.cb_err = io_error_handler;
     ioprocs.cb_read = io_read_handler;
-    cccp->ioctx = lcbio_ctx_new(sock, data, &ioprocs);
-    cccp->ioctx->subsys = "bc_cccp";
-    cccp->request_config();
+    attempt->ioctx = lcbio_ctx_new(sock, data, &ioprocs);
+    attempt->ioctx->subsys = "bc_cccp";
+    cccp->request_config(attempt);
 }
 
 lcb_error_t CccpProvider::refresh() {
-    if (creq.u.p_generic || server_active || cmdcookie) {
+    if (!attempts.empty() || server_active || cmdcookie) {
         return LCB_BUSY;
     }
 
@@ -341,22 +418,24 @@ CccpProvider::config_updated(lcbvb_CONFIG *vbc)
 static void
 io_error_handler(lcbio_CTX *ctx, lcb_error_t err)
 {
-    CccpProvider *cccp = reinterpret_cast<CccpProvider*>(lcbio_ctx_data(ctx));
-    cccp->mcio_error(err);
+    CccpAttempt *attempt = reinterpret_cast<CccpAttempt*>(lcbio_ctx_data(ctx));
+    attempt->parent->mcio_error(attempt, err);
 }
 
 static void io_read_handler(lcbio_CTX *ioctx, unsigned) {
-    reinterpret_cast<CccpProvider*>(lcbio_ctx_data(ioctx))->on_io_read();
+    CccpAttempt *attempt = reinterpret_cast<CccpAttempt*>(lcbio_ctx_data(ioctx));
+    attempt->parent->on_io_read(attempt);
 }
 
 void
-CccpProvider::on_io_read()
+CccpProvider::on_io_read(CccpAttempt *attempt)
 {
     unsigned required;
+    lcbio_CTX *ioctx = attempt->ioctx;
 
 #define return_error(e) \
     resp.release(ioctx); \
-    mcio_error(e); \
+    mcio_error(attempt, e); \
     return
 
     lcb::MemcachedResponse resp;
@@ -367,7 +446,7 @@ CccpProvider::on_io_read()
     }
 
     if (resp.status() != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-        lcb_log(LOGARGS(this, WARN), LOGFMT "CCCP Packet responded with 0x%x; nkey=%d, nbytes=%lu, cmd=0x%x, seq=0x%x", LOGID(this),
+        lcb_log(LOGARGS(this, WARN), LOGFMT "CCCP Packet responded with 0x%x; nkey=%d, nbytes=%lu, cmd=0x%x, seq=0x%x", LOGID(attempt),
                 resp.status(), resp.keylen(), (unsigned long)resp.bodylen(),
                 resp.opcode(), resp.opaque());
 
@@ -390,6 +469,9 @@ CccpProvider::on_io_read()
     std::string hoststr(lcbio_get_host(lcbio_ctx_sock(ioctx))->host);
 
     resp.release(ioctx);
+    if (attempts.size() > 1) {
+        lcb_log(LOGARGS(this, INFO), LOGFMT "Received configuration first. Cancelling %u other attempt(s)", LOGID(attempt), (unsigned)attempts.size() - 1);
+    }
     release_socket(true);
 
     lcb_error_t err = update(hoststr.c_str(), jsonstr.c_str());
@@ -404,8 +486,9 @@ CccpProvider::on_io_read()
 #undef return_error
 }
 
-void CccpProvider::request_config()
+void CccpProvider::request_config(CccpAttempt *attempt)
 {
+    lcbio_CTX *ioctx = attempt->ioctx;
     lcb::MemcachedRequest req(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG);
     req.opaque(0xF00D);
     lcbio_ctx_put(ioctx, req.data(), req.size());
@@ -422,14 +505,20 @@ void CccpProvider::dump(FILE *fp) const {
     fprintf(fp, "## BEGIN CCCP PROVIDER DUMP ##\n");
     fprintf(fp, "TIMER ACTIVE: %s\n", timer.is_armed() ? "YES" : "NO");
     fprintf(fp, "PIPELINE RESPONSE COOKIE: %p\n", (void*)cmdcookie);
-    if (ioctx) {
-        fprintf(fp, "CCCP Owns connection:\n");
-        lcbio_ctx_dump(ioctx, fp);
-    } else if (creq.u.p_generic) {
-        fprintf(fp, "CCCP Is connecting\n");
-    } else {
+    if (attempts.empty()) {
         fprintf(fp, "CCCP does not have a dedicated connection\n");
     }
+    for (std::list<CccpAttempt*>::const_iterator it = attempts.begin();
+            it != attempts.end(); ++it) {
+        const CccpAttempt *attempt = *it;
+        if (attempt->ioctx) {
+            fprintf(fp, "CCCP Owns connection:\n");
+            lcbio_ctx_dump(attempt->ioctx, fp);
+        } else {
+            fprintf(fp, "CCCP Is connecting to %s:%s\n",
+                attempt->host.host, attempt->host.port);
+        }
+    }
 
     for (size_t ii = 0; ii < nodes->size(); ii++) {
         const lcb_host_t &curhost = (*nodes)[ii];
@@ -445,9 +534,7 @@ CccpProvider::CccpProvider(Confmon *mon)
       server_active(false),
       timer(mon->iot, this),
       instance(NULL),
-      ioctx(NULL),
       cmdcookie(NULL) {
-    std::memset(&creq, 0, sizeof creq);
 }
 
 Provider* lcb::clconfig::new_cccp_provider(Confmon *mon) {
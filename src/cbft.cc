@@ -20,33 +20,92 @@
 #include "internal.h"
 #include "http/http.h"
 #include "logging.h"
+#include "rowflow.h"
+#include "ftsmerge.h"
 #include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
+#include <stdlib.h>
+#include <algorithm>
 #include <string>
+#include <vector>
+
+/* Stop reading a partition once this many bytes of its hits are waiting for
+ * the other partitions. A partition without buffered hits is never paused,
+ * so the merge can always make progress */
+#define PARTITION_HIGHWAT (1 << 20)
 
 #define LOGFMT "(FTR=%p) "
 #define LOGID(req) static_cast<const void*>(req)
 #define LOGARGS(req, lvl) req->instance->settings, "n1ql", LCB_LOG_##lvl, __FILE__, __LINE__
 
-struct lcb_FTSREQ : lcb::jsparse::Parser::Actions {
+struct lcb_FTSREQ;
+
+namespace {
+/** A partition of the index, queried directly in scatter mode */
+struct FtsPartition : lcb::jsparse::Parser::Actions {
+    FtsPartition(lcb_FTSREQ *parent_, size_t ix_, const std::string& name_,
+        const std::string& host_)
+    : parent(parent_), ix(ix_), name(name_), host(host_), htreq(NULL),
+      parser(new lcb::jsparse::Parser(lcb::jsparse::Parser::MODE_FTS, this)),
+      rc(LCB_SUCCESS), htstatus(0), paused(false) {
+    }
+    ~FtsPartition();
+    void JSPARSE_on_row(const lcb::jsparse::Row& datum);
+    void JSPARSE_on_error(const std::string&);
+    void JSPARSE_on_complete(const std::string&) {
+        // Nothing
+    }
+
+    lcb_FTSREQ *parent;
+    size_t ix;
+    std::string name; /**< Partition (pindex) name */
+    std::string host; /**< Base URL of the node holding the partition */
+    lcb_http_request_t htreq;
+    lcb::jsparse::Parser *parser;
+    std::string meta; /**< Response metadata, once complete */
+    lcb_error_t rc;
+    short htstatus;
+    bool paused;
+};
+}
+
+struct lcb_FTSREQ : lcb::jsparse::Parser::Actions, lcb::RowFlow::Sink {
     const lcb_RESPHTTP *cur_htresp;
     lcb_http_request_t htreq;
     lcb::jsparse::Parser *parser;
+    lcb::RowFlow flow;
     const void *cookie;
     lcb_FTSCALLBACK callback;
     lcb_t instance;
     size_t nrows;
     lcb_error_t lasterr;
+
+    /* Scatter mode (LCB_CMDFTS_F_SCATTER) */
+    Json::Value query; /**< Kept until the partitions are known */
+    lcb_http_request_t cfgreq;
+    std::vector<FtsPartition*> partitions;
+    lcb::cbft::HitMerger *merger;
+    size_t npending; /**< Partitions whose responses are not complete */
+    std::string meta; /**< Merged metadata for the final callback */
+
     void invoke_row(lcb_RESPFTS *resp);
     void invoke_last();
+    void cancel();
+
+    lcb_error_t issue_query(Json::Value& root);
+    lcb_error_t issue_http(const std::string& path, Json::Value& root,
+        const char *host, lcb_http_request_t *handle, void *reqcookie);
+    lcb_error_t start_scatter(const lcb_RESPHTTP *resp);
+    std::string partition_host(const std::string& hostport) const;
+    void partition_row(FtsPartition *part, const char *row, size_t nrow);
+    void partition_done(FtsPartition *part, const lcb_RESPHTTP *resp);
+    void merge_rows();
+    void finish_scatter();
 
     lcb_FTSREQ(lcb_t, const void *, const lcb_CMDFTS *);
     ~lcb_FTSREQ();
     void JSPARSE_on_row(const lcb::jsparse::Row& datum) {
-        lcb_RESPFTS resp = { 0 };
-        resp.row = static_cast<const char*>(datum.row.iov_base);
-        resp.nrow = datum.row.iov_len;
         nrows++;
-        invoke_row(&resp);
+        flow.row(static_cast<const char*>(datum.row.iov_base), datum.row.iov_len);
     }
     void JSPARSE_on_error(const std::string&) {
         lasterr = LCB_PROTOCOL_ERROR;
@@ -54,6 +113,20 @@ struct lcb_FTSREQ : lcb::jsparse::Parser::Actions {
     void JSPARSE_on_complete(const std::string&) {
         // Nothing
     }
+    void flow_row(const char *row, size_t nrow, bool buffered) {
+        lcb_RESPFTS resp = { 0 };
+        resp.row = row;
+        resp.nrow = nrow;
+        if (buffered) {
+            cur_htresp = NULL;
+        }
+        invoke_row(&resp);
+    }
+    void flow_done() {
+        cur_htresp = flow.final_response();
+        invoke_last();
+        delete this;
+    }
 };
 
 static void
@@ -70,6 +143,13 @@ chunk_callback(lcb_t, int, const lcb_RESPBASE *rb)
     }
 
     if (rh->rflags & LCB_RESP_F_FINAL) {
+        if (req->flow.hold_final(rh)) {
+            // Completed once the buffered rows are delivered. The HTTP
+            // request is finished, and must not be cancelled later on
+            req->htreq = NULL;
+            req->cur_htresp = NULL;
+            return;
+        }
         req->invoke_last();
         delete req;
 
@@ -82,6 +162,88 @@ chunk_callback(lcb_t, int, const lcb_RESPBASE *rb)
     }
 }
 
+/* Scatter mode merges hits by score, so it can't be used with a different
+ * sort order, and facets can't be combined from the partitions' results */
+static bool
+can_scatter(const Json::Value& root)
+{
+    const Json::Value& facets = root["facets"];
+    if (!facets.isNull() && !(facets.isObject() && facets.empty())) {
+        return false;
+    }
+    const Json::Value& sort = root["sort"];
+    if (sort.isNull()) {
+        return true;
+    }
+    return sort.isArray() && sort.size() == 1 &&
+            sort[0u].isString() && sort[0u].asString() == "-_score";
+}
+
+static void
+cfg_callback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPHTTP *rh = (const lcb_RESPHTTP *)rb;
+    lcb_FTSREQ *req = static_cast<lcb_FTSREQ*>(rh->cookie);
+
+    req->cfgreq = NULL;
+    if (req->callback == NULL) {
+        delete req;
+        return;
+    }
+
+    lcb_error_t rc = req->start_scatter(rh);
+    if (rc != LCB_SUCCESS) {
+        // The index could not be queried by partition; query it as a whole
+        lcb_log(LOGARGS(req, INFO), LOGFMT "Not using scatter mode (0x%x). Querying the index", LOGID(req), rc);
+        rc = req->issue_query(req->query);
+    }
+    req->query = Json::Value();
+    if (rc != LCB_SUCCESS) {
+        req->lasterr = rc;
+        req->invoke_last();
+        delete req;
+    }
+}
+
+static void
+partition_callback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPHTTP *rh = (const lcb_RESPHTTP *)rb;
+    FtsPartition *part = static_cast<FtsPartition*>(rh->cookie);
+    lcb_FTSREQ *req = part->parent;
+
+    if (rh->rflags & LCB_RESP_F_FINAL) {
+        part->htreq = NULL;
+        req->partition_done(part, rh);
+    } else if (req->callback == NULL) {
+        /* Cancelled */
+        delete req;
+    } else {
+        part->parser->feed(static_cast<const char*>(rh->body), rh->nbody);
+    }
+}
+
+FtsPartition::~FtsPartition()
+{
+    if (htreq != NULL) {
+        lcb_cancel_http_request(parent->instance, htreq);
+    }
+    delete parser;
+}
+
+void
+FtsPartition::JSPARSE_on_row(const lcb::jsparse::Row& datum)
+{
+    parent->partition_row(this,
+        static_cast<const char*>(datum.row.iov_base), datum.row.iov_len);
+}
+
+void
+FtsPartition::JSPARSE_on_error(const std::string&)
+{
+    rc = LCB_PROTOCOL_ERROR;
+}
+
 void
 lcb_FTSREQ::invoke_row(lcb_RESPFTS *resp)
 {
@@ -100,29 +262,41 @@ lcb_FTSREQ::invoke_last()
     resp.rflags |= LCB_RESP_F_FINAL;
     resp.rc = lasterr;
 
-    if (parser) {
-        lcb_IOV meta;
-        parser->get_postmortem(meta);
-        resp.row = static_cast<const char*>(meta.iov_base);
-        resp.nrow = meta.iov_len;
+    if (merger) {
+        resp.row = meta.c_str();
+        resp.nrow = meta.size();
+    } else if (parser) {
+        lcb_IOV postmortem;
+        parser->get_postmortem(postmortem);
+        resp.row = static_cast<const char*>(postmortem.iov_base);
+        resp.nrow = postmortem.iov_len;
     }
     invoke_row(&resp);
     callback = NULL;
 }
 
+void
+lcb_FTSREQ::cancel()
+{
+    callback = NULL;
+    flow.cancel();
+    /* Read the rest of the partitions' responses, so that they complete */
+    for (size_t ii = 0; ii < partitions.size(); ii++) {
+        FtsPartition *part = partitions[ii];
+        if (part->htreq && part->paused) {
+            part->paused = false;
+            part->htreq->resume();
+        }
+    }
+}
+
 lcb_FTSREQ::lcb_FTSREQ(lcb_t instance_, const void *cookie_, const lcb_CMDFTS *cmd)
 : lcb::jsparse::Parser::Actions(),
   cur_htresp(NULL), htreq(NULL),
   parser(new lcb::jsparse::Parser(lcb::jsparse::Parser::MODE_FTS, this)),
-  cookie(cookie_), callback(cmd->callback), instance(instance_), nrows(0),
-  lasterr(LCB_SUCCESS)
+  flow(instance_, &htreq, this), cookie(cookie_), callback(cmd->callback), instance(instance_), nrows(0),
+  lasterr(LCB_SUCCESS), cfgreq(NULL), merger(NULL), npending(0)
 {
-    lcb_CMDHTTP htcmd = { 0 };
-    htcmd.type = LCB_HTTP_TYPE_FTS;
-    htcmd.method = LCB_HTTP_METHOD_POST;
-    htcmd.reqhandle = &htreq;
-    htcmd.content_type = "application/json";
-    htcmd.cmdflags |= LCB_CMDHTTP_F_STREAM;
     if (!callback) {
         lasterr = LCB_EINVAL;
         return;
@@ -142,12 +316,55 @@ lcb_FTSREQ::lcb_FTSREQ(lcb_t instance_, const void *cookie_, const lcb_CMDFTS *c
         return;
     }
 
+    if ((cmd->cmdflags & LCB_CMDFTS_F_SCATTER) && can_scatter(constRoot)) {
+        // Get the partitions from the FTS configuration first
+        lcb_CMDHTTP htcmd = { 0 };
+        htcmd.type = LCB_HTTP_TYPE_FTS;
+        htcmd.method = LCB_HTTP_METHOD_GET;
+        htcmd.reqhandle = &cfgreq;
+        LCB_CMD_SET_KEY(&htcmd, "api/cfg", strlen("api/cfg"));
+        lasterr = lcb_http3(instance, this, &htcmd);
+        if (lasterr == LCB_SUCCESS) {
+            cfgreq->set_callback(cfg_callback);
+            query.swap(root);
+        }
+    } else {
+        lasterr = issue_query(root);
+    }
+
+    if (lasterr == LCB_SUCCESS && cmd->handle) {
+        *cmd->handle = reinterpret_cast<lcb_FTSREQ*>(this);
+    }
+}
+
+lcb_error_t
+lcb_FTSREQ::issue_query(Json::Value& root)
+{
     std::string url;
-    url.append("api/index/").append(j_ixname.asCString()).append("/query");
+    url.append("api/index/").append(root["indexName"].asString()).append("/query");
+    lcb_error_t rc = issue_http(url, root, NULL, &htreq, this);
+    if (rc == LCB_SUCCESS) {
+        htreq->set_callback(chunk_callback);
+    }
+    return rc;
+}
+
+lcb_error_t
+lcb_FTSREQ::issue_http(const std::string& url, Json::Value& root,
+    const char *host, lcb_http_request_t *handle, void *reqcookie)
+{
+    lcb_CMDHTTP htcmd = { 0 };
+    htcmd.type = LCB_HTTP_TYPE_FTS;
+    htcmd.method = LCB_HTTP_METHOD_POST;
+    htcmd.reqhandle = handle;
+    htcmd.content_type = "application/json";
+    htcmd.cmdflags |= LCB_CMDHTTP_F_STREAM;
+    htcmd.host = host;
     LCB_CMD_SET_KEY(&htcmd, url.c_str(), url.size());
 
     // Making a copy here to ensure that we don't accidentally create a new
     // 'ctl' field.
+    const Json::Value& constRoot = root;
     const Json::Value& ctl = constRoot["value"];
     if (ctl.isObject()) {
         const Json::Value& tmo = ctl["timeout"];
@@ -163,13 +380,243 @@ lcb_FTSREQ::lcb_FTSREQ(lcb_t instance_, const void *cookie_, const lcb_CMDFTS *c
     htcmd.body = qbody.c_str();
     htcmd.nbody = qbody.size();
 
-    lasterr = lcb_http3(instance, this, &htcmd);
-    if (lasterr == LCB_SUCCESS) {
-        htreq->set_callback(chunk_callback);
-        if (cmd->handle) {
-            *cmd->handle = reinterpret_cast<lcb_FTSREQ*>(this);
+    return lcb_http3(instance, reqcookie, &htcmd);
+}
+
+/* Get the base URL for a node, given its address in the FTS configuration */
+std::string
+lcb_FTSREQ::partition_host(const std::string& hostport) const
+{
+    size_t colon = hostport.rfind(':');
+    if (colon == std::string::npos) {
+        return std::string();
+    }
+    std::string host = hostport.substr(0, colon);
+    unsigned port = strtoul(hostport.c_str() + colon + 1, NULL, 10);
+    if (host.size() > 2 && host[0] == '[') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    /* Use the node's address (and port) for the configured mode, if it is
+     * part of the cluster configuration */
+    lcbvb_CONFIG *vbc = LCBT_VBCONFIG(instance);
+    lcbvb_SVCMODE mode = LCBT_SETTING(instance, sslopts) ?
+            LCBVB_SVCMODE_SSL : LCBVB_SVCMODE_PLAIN;
+    for (unsigned ii = 0; vbc && ii < LCBVB_NSERVERS(vbc); ii++) {
+        std::string cur(lcbvb_get_hostname(vbc, ii));
+        if (cur.size() > 2 && cur[0] == '[') {
+            cur = cur.substr(1, cur.size() - 2);
         }
+        if (cur == host &&
+                lcbvb_get_port(vbc, ii, LCBVB_SVCTYPE_FTS, LCBVB_SVCMODE_PLAIN) == port) {
+            const char *url = lcbvb_get_resturl(vbc, ii, LCBVB_SVCTYPE_FTS, mode);
+            return url ? url : "";
+        }
+    }
+    if (mode == LCBVB_SVCMODE_SSL) {
+        return std::string();
     }
+    return "http://" + hostport;
+}
+
+lcb_error_t
+lcb_FTSREQ::start_scatter(const lcb_RESPHTTP *resp)
+{
+    Json::Value cfg;
+    if (resp->rc != LCB_SUCCESS || resp->htstatus != 200) {
+        return resp->rc ? resp->rc : LCB_HTTP_ERROR;
+    }
+    const char *body = static_cast<const char*>(resp->body);
+    if (!Json::Reader().parse(body, body + resp->nbody, cfg) || !cfg.isObject()) {
+        return LCB_PROTOCOL_ERROR;
+    }
+
+    const Json::Value& constCfg = cfg;
+    const Json::Value& constQuery = query;
+    const Json::Value& plans = constCfg["planPIndexes"]["planPIndexes"];
+    const Json::Value& nodes = constCfg["nodeDefsWanted"]["nodeDefs"];
+    const std::string ixname = constQuery["indexName"].asString();
+    if (!plans.isObject() || !nodes.isObject()) {
+        return LCB_PROTOCOL_ERROR;
+    }
+
+    // Partition names and the base URLs of the nodes to query them on
+    std::vector<std::pair<std::string, std::string> > targets;
+    std::vector<std::string> names = plans.getMemberNames();
+    for (size_t ii = 0; ii < names.size(); ii++) {
+        const Json::Value& plan = plans[names[ii]];
+        if (plan["indexName"].asString() != ixname) {
+            continue;
+        }
+
+        // Query the readable copy with the best (lowest) priority
+        const Json::Value& pnodes = plan["nodes"];
+        std::vector<std::string> uuids = pnodes.getMemberNames();
+        std::string best;
+        int best_prio = 0;
+        for (size_t jj = 0; jj < uuids.size(); jj++) {
+            const Json::Value& pnode = pnodes[uuids[jj]];
+            int prio = pnode["priority"].asInt();
+            if (pnode["canRead"].asBool() && (best.empty() || prio < best_prio)) {
+                best = uuids[jj];
+                best_prio = prio;
+            }
+        }
+        if (best.empty()) {
+            return LCB_NOT_SUPPORTED;
+        }
+        std::string host = partition_host(nodes[best]["hostPort"].asString());
+        if (host.empty()) {
+            return LCB_NOT_SUPPORTED;
+        }
+        targets.push_back(std::make_pair(names[ii], host));
+    }
+    if (targets.empty()) {
+        return LCB_NOT_SUPPORTED;
+    }
+
+    // Each partition must return enough hits for the requested page
+    const Json::Value& j_from = constQuery["from"];
+    const Json::Value& j_size = constQuery["size"];
+    size_t from = j_from.isNumeric() ? j_from.asLargestUInt() : 0;
+    size_t size = j_size.isNumeric() ? j_size.asLargestUInt() : 10;
+    Json::Value pquery = query;
+    pquery["from"] = 0;
+    pquery["size"] = Json::Value::UInt64(from + size);
+
+    merger = new lcb::cbft::HitMerger(targets.size(), from, size);
+    for (size_t ii = 0; ii < targets.size(); ii++) {
+        FtsPartition *part =
+                new FtsPartition(this, ii, targets[ii].first, targets[ii].second);
+        partitions.push_back(part);
+        Json::Value cur = pquery;
+        std::string url;
+        url.append("api/pindex/").append(part->name).append("/query");
+
+        lcb_error_t rc = issue_http(url, cur, part->host.c_str(), &part->htreq, part);
+        if (rc != LCB_SUCCESS) {
+            // Cancel the ones already issued; the query is made normally
+            for (size_t jj = 0; jj < partitions.size(); jj++) {
+                delete partitions[jj];
+            }
+            partitions.clear();
+            delete merger;
+            merger = NULL;
+            return rc;
+        }
+        part->htreq->set_callback(partition_callback);
+    }
+
+    lcb_log(LOGARGS(this, DEBUG), LOGFMT "Querying %lu partitions of %s", LOGID(this), (unsigned long)partitions.size(), ixname.c_str());
+    npending = partitions.size();
+    return LCB_SUCCESS;
+}
+
+void
+lcb_FTSREQ::partition_row(FtsPartition *part, const char *row, size_t nrow)
+{
+    nrows++;
+    if (!merger->add(part->ix, row, nrow)) {
+        part->rc = LCB_PROTOCOL_ERROR;
+    }
+    merge_rows();
+}
+
+void
+lcb_FTSREQ::partition_done(FtsPartition *part, const lcb_RESPHTTP *resp)
+{
+    lcb_IOV postmortem;
+    part->parser->get_postmortem(postmortem);
+    part->meta.assign(static_cast<const char*>(postmortem.iov_base), postmortem.iov_len);
+    part->htstatus = resp->htstatus;
+    if (resp->rc != LCB_SUCCESS) {
+        part->rc = resp->rc;
+    } else if (resp->htstatus != 200 && part->rc == LCB_SUCCESS) {
+        part->rc = LCB_HTTP_ERROR;
+    }
+
+    merger->done(part->ix);
+    merge_rows();
+    if (--npending == 0) {
+        finish_scatter();
+    }
+}
+
+/* Pass on the hits which are known to be next, and stop reading from
+ * partitions which are too far ahead of the others */
+void
+lcb_FTSREQ::merge_rows()
+{
+    std::string row;
+    while (merger->next(row)) {
+        flow.row(row.c_str(), row.size());
+    }
+
+    for (size_t ii = 0; ii < partitions.size(); ii++) {
+        FtsPartition *part = partitions[ii];
+        size_t nbuf = merger->buffered(ii);
+        if (!part->htreq) {
+            continue;
+        }
+        if (!part->paused && nbuf >= PARTITION_HIGHWAT && callback) {
+            part->paused = true;
+            part->htreq->pause();
+        } else if (part->paused && (nbuf <= PARTITION_HIGHWAT / 2 || !callback)) {
+            part->paused = false;
+            part->htreq->resume();
+        }
+    }
+}
+
+/* Combine the partitions' metadata, in the same form as a query of the whole
+ * index */
+void
+lcb_FTSREQ::finish_scatter()
+{
+    Json::Value out;
+    Json::Value& status = out["status"];
+    lcb_U64 total_hits = 0;
+    double max_score = 0, took = 0;
+    unsigned nfailed = 0;
+
+    for (size_t ii = 0; ii < partitions.size(); ii++) {
+        FtsPartition *part = partitions[ii];
+        Json::Value pmeta;
+        Json::Reader().parse(part->meta, pmeta);
+        if (part->rc != LCB_SUCCESS) {
+            nfailed++;
+            status["errors"][part->name] = part->meta.empty() ?
+                    Json::Value(lcb_strerror(NULL, part->rc)) : Json::Value(part->meta);
+            if (lasterr == LCB_SUCCESS || part->htstatus != 200) {
+                lasterr = part->rc;
+            }
+            continue;
+        }
+        if (pmeta["total_hits"].isNumeric()) {
+            total_hits += pmeta["total_hits"].asLargestUInt();
+        }
+        if (pmeta["max_score"].isNumeric()) {
+            max_score = std::max(max_score, pmeta["max_score"].asDouble());
+        }
+        if (pmeta["took"].isNumeric()) {
+            took = std::max(took, pmeta["took"].asDouble());
+        }
+    }
+    status["total"] = Json::Value::UInt64(partitions.size());
+    status["failed"] = nfailed;
+    status["successful"] = Json::Value::UInt64(partitions.size() - nfailed);
+    out["total_hits"] = Json::Value::UInt64(total_hits);
+    out["max_score"] = max_score;
+    out["took"] = took;
+    out["facets"] = Json::Value();
+    meta = Json::FastWriter().write(out);
+
+    if (flow.hold_final()) {
+        // Completed once the buffered rows are delivered
+        return;
+    }
+    invoke_last();
+    delete this;
 }
 
 lcb_FTSREQ::~lcb_FTSREQ()
@@ -182,6 +629,14 @@ lcb_FTSREQ::~lcb_FTSREQ()
         delete parser;
         parser = NULL;
     }
+    if (cfgreq != NULL) {
+        lcb_cancel_http_request(instance, cfgreq);
+        cfgreq = NULL;
+    }
+    for (size_t ii = 0; ii < partitions.size(); ii++) {
+        delete partitions[ii];
+    }
+    delete merger;
 }
 
 LIBCOUCHBASE_API
@@ -201,5 +656,19 @@ LIBCOUCHBASE_API
 void
 lcb_fts_cancel(lcb_t, lcb_FTSHANDLE handle)
 {
-    handle->callback = NULL;
+    handle->cancel();
+}
+
+LIBCOUCHBASE_API
+void
+lcb_fts_pause(lcb_t, lcb_FTSHANDLE handle)
+{
+    handle->flow.pause();
+}
+
+LIBCOUCHBASE_API
+void
+lcb_fts_resume(lcb_t, lcb_FTSHANDLE handle)
+{
+    handle->flow.resume();
 }
@@ -16,6 +16,9 @@
  */
 #include "internal.h"
 #include "bucketconfig/clconfig.h"
+#include "slowops.h"
+#include "hedge.h"
+#include "nearcache.h"
 #include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
 #include <lcbio/iotable.h>
 #include <mcserver/negotiate.h>
@@ -79,6 +82,10 @@ static lcb_uint32_t *get_timeout_field(lcb_t instance, int cmd)
     case LCB_CNTL_HTCONFIG_IDLE_TIMEOUT: return &settings->bc_http_stream_time;
     case LCB_CNTL_RETRY_INTERVAL: return &settings->retry_interval;
     case LCB_CNTL_RETRY_NMV_INTERVAL: return &settings->retry_nmv_interval;
+    case LCB_CNTL_CONNECT_RACE_DELAY: return &settings->connect_race_delay;
+    case LCB_CNTL_SLOWOP_INTERVAL: return &settings->slowop_interval;
+    case LCB_CNTL_NEARCACHE_TTL: return &settings->nearcache_ttl;
+    case LCB_CNTL_COUNTER_WINDOW: return &settings->counter_window;
     default: return NULL;
     }
 }
@@ -147,6 +154,9 @@ HANDLER(retry_backoff_handler) {
 HANDLER(http_poolsz_handler) {
     RETURN_GET_SET(lcb_SIZE, instance->http_sockpool->maxidle)
 }
+HANDLER(http_minidle_handler) {
+    RETURN_GET_SET(lcb_SIZE, instance->http_sockpool->minidle)
+}
 HANDLER(http_refresh_config_handler) {
     RETURN_GET_SET(int, LCBT_SETTING(instance, refresh_on_hterr))
 }
@@ -183,6 +193,16 @@ HANDLER(kv_hg_handler) {
 HANDLER(read_chunk_size_handler) {
     RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, read_chunk_size));
 }
+HANDLER(bootstrap_race_handler) {
+    if (mode == LCB_CNTL_SET && *reinterpret_cast<lcb_U32*>(arg) < 1) {
+        return LCB_ECTL_BADARG;
+    }
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, bootstrap_race));
+}
+HANDLER(bootstrap_time_handler) {
+    RETURN_GET_ONLY(lcb_U32, (instance->bs_state ?
+        LCB_NS2US(instance->bs_state->get_bootstrap_time()) : 0));
+}
 
 HANDLER(get_kvb) {
     lcb_cntl_vbinfo_st *vbi = reinterpret_cast<lcb_cntl_vbinfo_st*>(arg);
@@ -400,19 +420,34 @@ HANDLER(console_log_handler) {
     (void)cmd; return LCB_SUCCESS;
 }
 
+HANDLER(console_async_handler) {
+    struct lcb_CONSOLELOGGER *logger =
+            (struct lcb_CONSOLELOGGER*)lcb_console_logprocs;
+    (void)instance;
+    if (mode == LCB_CNTL_SET) {
+        return lcb_console_log_setasync(*reinterpret_cast<int*>(arg));
+    }
+    RETURN_GET_ONLY(int, logger->async)
+}
+
+HANDLER(console_dropped_handler) {
+    (void)instance;
+    RETURN_GET_ONLY(lcb_U32, lcb_console_log_dropped())
+}
+
 HANDLER(console_fp_handler) {
     struct lcb_CONSOLELOGGER *logger =
             (struct lcb_CONSOLELOGGER*)lcb_console_logprocs;
     if (mode == LCB_CNTL_GET) {
         *(FILE **)arg = logger->fp;
     } else if (mode == LCB_CNTL_SET) {
-        logger->fp = *(FILE**)arg;
+        lcb_console_log_setfp(*(FILE**)arg);
     } else if (mode == CNTL__MODE_SETSTRING) {
         FILE *fp = fopen(reinterpret_cast<const char*>(arg), "w");
         if (!fp) {
             return LCB_ERROR;
         } else {
-            logger->fp = fp;
+            lcb_console_log_setfp(fp);
         }
     }
     (void)cmd; (void)instance;
@@ -518,6 +553,147 @@ HANDLER(bucket_auth_handler) {
     return LCB_SUCCESS;
 }
 
+HANDLER(slowop_threshold_handler) {
+    (void)cmd;
+    if (mode == LCB_CNTL_SET) {
+        lcb_U32 threshold = *reinterpret_cast<lcb_U32*>(arg);
+        LCBT_SETTING(instance, slowop_threshold) = threshold;
+        instance->cmdq.trace = threshold != 0;
+        if (threshold && !instance->slowops) {
+            instance->slowops = new lcb::SlowOps(instance);
+        } else if (!threshold && instance->slowops) {
+            /* Reports what was collected so far. Packets still in flight
+             * keep their traces until they are released */
+            delete instance->slowops;
+            instance->slowops = NULL;
+        }
+    } else {
+        *reinterpret_cast<lcb_U32*>(arg) = LCBT_SETTING(instance, slowop_threshold);
+    }
+    return LCB_SUCCESS;
+}
+
+HANDLER(dur_adaptive_handler) {
+    RETURN_GET_SET(int, LCBT_SETTING(instance, dur_adaptive))
+}
+
+HANDLER(dur_lag_handler) {
+    lcb_DURABILITYLAG *lag = reinterpret_cast<lcb_DURABILITYLAG*>(arg);
+    (void)cmd;
+
+    if (mode != LCB_CNTL_GET) { return LCB_ECTL_UNSUPPMODE; }
+    if (lag->server_index < 0 ||
+            lag->server_index >= (int)LCBT_NSERVERS(instance)) {
+        return LCB_ECTL_BADARG;
+    }
+    const lcb::Server *server = instance->get_server(lag->server_index);
+    lag->replicate_lag = server->dur_replicate_est;
+    lag->persist_lag = server->dur_persist_est;
+    return LCB_SUCCESS;
+}
+
+HANDLER(hedge_percentile_handler) {
+    if (mode == LCB_CNTL_SET) {
+        lcb_U32 pct = *reinterpret_cast<lcb_U32*>(arg);
+        if (pct < 1 || pct > 100) {
+            return LCB_ECTL_BADARG;
+        }
+    }
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, hedge_percentile))
+}
+
+HANDLER(hedge_budget_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, hedge_budget))
+}
+
+HANDLER(hedge_stats_handler) {
+    lcb_HEDGESTATS *stats = reinterpret_cast<lcb_HEDGESTATS*>(arg);
+    (void)cmd;
+
+    if (mode != LCB_CNTL_GET) { return LCB_ECTL_UNSUPPMODE; }
+    if (instance->hedger) {
+        stats->issued = instance->hedger->nissued;
+        stats->won = instance->hedger->nwon;
+    } else {
+        stats->issued = stats->won = 0;
+    }
+    return LCB_SUCCESS;
+}
+
+HANDLER(get_coalesce_handler) {
+    RETURN_GET_SET(int, LCBT_SETTING(instance, get_coalesce))
+}
+
+HANDLER(nearcache_size_handler) {
+    if (mode == LCB_CNTL_SET && instance->nearcache) {
+        instance->nearcache->clear();
+    }
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, nearcache_size))
+}
+
+HANDLER(nearcache_revalidate_handler) {
+    RETURN_GET_SET(int, LCBT_SETTING(instance, nearcache_revalidate))
+}
+
+HANDLER(nearcache_stats_handler) {
+    lcb_NEARCACHESTATS *stats = reinterpret_cast<lcb_NEARCACHESTATS*>(arg);
+    (void)cmd;
+
+    if (mode != LCB_CNTL_GET) { return LCB_ECTL_UNSUPPMODE; }
+    if (instance->nearcache) {
+        stats->hits = instance->nearcache->nhits;
+        stats->misses = instance->nearcache->nmisses;
+        stats->revalidated = instance->nearcache->nrevalidated;
+        stats->evicted = instance->nearcache->nevicted;
+    } else {
+        stats->hits = stats->misses = stats->revalidated = stats->evicted = 0;
+    }
+    return LCB_SUCCESS;
+}
+
+HANDLER(counter_window_ops_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, counter_window_ops))
+}
+
+HANDLER(rowbuf_highwat_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, rowbuf_highwat))
+}
+
+HANDLER(rowbuf_lowwat_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, rowbuf_lowwat))
+}
+
+HANDLER(http_pool_timeout_handler) {
+    RETURN_GET_SET(lcb_U32, instance->http_sockpool->tmoidle)
+}
+
+HANDLER(http_maxconcurrent_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, http_maxconcurrent))
+}
+
+HANDLER(n1ql_autoprepare_handler) {
+    RETURN_GET_SET(lcb_U32, LCBT_SETTING(instance, n1ql_autoprepare))
+}
+
+HANDLER(netbuf_stats_handler) {
+    lcb_NETBUFSTATS *out = reinterpret_cast<lcb_NETBUFSTATS*>(arg);
+    (void)cmd;
+
+    if (mode != LCB_CNTL_GET) { return LCB_ECTL_UNSUPPMODE; }
+    if (out->server_index < 0 ||
+            out->server_index >= (int)LCBT_NSERVERS(instance)) {
+        return LCB_ECTL_BADARG;
+    }
+    lcb::Server *server = instance->get_server(out->server_index);
+    nb_STATS stats = { 0 };
+    netbuf_get_stats(&server->nbmgr, &stats);
+    netbuf_get_stats(&server->reqpool, &stats);
+    out->allocated = stats.allocated;
+    out->used = stats.used;
+    out->cached = stats.cached;
+    out->wasted = stats.wasted;
+    return LCB_SUCCESS;
+}
 
 static ctl_handler handlers[] = {
     timeout_common, /* LCB_CNTL_OP_TIMEOUT */
@@ -586,7 +762,33 @@ static ctl_handler handlers[] = {
     client_string_handler, /* LCB_CNTL_CLIENT_STRING */
     bucket_auth_handler, /* LCB_CNTL_BUCKET_CRED */
     timeout_common, /* LCB_CNTL_RETRY_NMV_DELAY */
-    read_chunk_size_handler /*LCB_CNTL_READ_CHUNKSIZE */
+    read_chunk_size_handler, /*LCB_CNTL_READ_CHUNKSIZE */
+    timeout_common, /* LCB_CNTL_CONNECT_RACE_DELAY */
+    bootstrap_race_handler, /* LCB_CNTL_BOOTSTRAP_RACE */
+    bootstrap_time_handler, /* LCB_CNTL_BOOTSTRAP_TIME */
+    http_minidle_handler, /* LCB_CNTL_HTTP_POOL_MINIDLE */
+    console_async_handler, /* LCB_CNTL_CONLOGGER_ASYNC */
+    console_dropped_handler, /* LCB_CNTL_CONLOGGER_DROPPED */
+    slowop_threshold_handler, /* LCB_CNTL_SLOWOP_THRESHOLD */
+    timeout_common, /* LCB_CNTL_SLOWOP_INTERVAL */
+    dur_adaptive_handler, /* LCB_CNTL_DURABILITY_ADAPTIVE */
+    dur_lag_handler, /* LCB_CNTL_DURABILITY_LAG */
+    hedge_percentile_handler, /* LCB_CNTL_HEDGE_PERCENTILE */
+    hedge_budget_handler, /* LCB_CNTL_HEDGE_BUDGET */
+    hedge_stats_handler, /* LCB_CNTL_HEDGE_STATS */
+    get_coalesce_handler, /* LCB_CNTL_GET_COALESCE */
+    nearcache_size_handler, /* LCB_CNTL_NEARCACHE_SIZE */
+    timeout_common, /* LCB_CNTL_NEARCACHE_TTL */
+    nearcache_revalidate_handler, /* LCB_CNTL_NEARCACHE_REVALIDATE */
+    nearcache_stats_handler, /* LCB_CNTL_NEARCACHE_STATS */
+    timeout_common, /* LCB_CNTL_COUNTER_WINDOW */
+    counter_window_ops_handler, /* LCB_CNTL_COUNTER_WINDOW_OPS */
+    rowbuf_highwat_handler, /* LCB_CNTL_ROWBUF_HIGHWAT */
+    rowbuf_lowwat_handler, /* LCB_CNTL_ROWBUF_LOWWAT */
+    http_pool_timeout_handler, /* LCB_CNTL_HTTP_POOL_TIMEOUT */
+    http_maxconcurrent_handler, /* LCB_CNTL_HTTP_MAXCONCURRENT */
+    n1ql_autoprepare_handler, /* LCB_CNTL_N1QL_AUTOPREPARE */
+    netbuf_stats_handler /* LCB_CNTL_NETBUF_STATS */
 };
 
 /* Union used for conversion to/from string functions */
@@ -645,7 +847,14 @@ static lcb_error_t convert_int(const char *arg, u_STRCONVERT *u) {
 }
 
 static lcb_error_t convert_u32(const char *arg, u_STRCONVERT *u) {
-    return convert_timeout(arg, u);
+    unsigned long lu;
+    // sscanf's %lu silently wraps negative input around
+    while (isspace((unsigned char)*arg)) { arg++; }
+    if (*arg == '-') { return LCB_ECTL_BADARG; }
+    int rv = sscanf(arg, "%lu", &lu);
+    if (rv != 1) { return LCB_ECTL_BADARG; }
+    u->u32 = lu;
+    return LCB_SUCCESS;
 }
 static lcb_error_t convert_float(const char *arg, u_STRCONVERT *u) {
     double d;
@@ -738,6 +947,26 @@ static cntl_OPCODESTRS stropcode_map[] = {
         {"retry_nmv_delay", LCB_CNTL_RETRY_NMV_INTERVAL, convert_timeout},
         {"bucket_cred", LCB_CNTL_BUCKET_CRED, NULL},
         {"read_chunk_size", LCB_CNTL_READ_CHUNKSIZE, convert_u32},
+        {"connect_race_delay", LCB_CNTL_CONNECT_RACE_DELAY, convert_timeout},
+        {"bootstrap_race", LCB_CNTL_BOOTSTRAP_RACE, convert_u32},
+        {"http_pool_minidle", LCB_CNTL_HTTP_POOL_MINIDLE, convert_SIZE },
+        {"console_log_async", LCB_CNTL_CONLOGGER_ASYNC, convert_intbool },
+        {"slowop_threshold", LCB_CNTL_SLOWOP_THRESHOLD, convert_timeout },
+        {"slowop_interval", LCB_CNTL_SLOWOP_INTERVAL, convert_timeout },
+        {"durability_adaptive", LCB_CNTL_DURABILITY_ADAPTIVE, convert_intbool },
+        {"hedge_percentile", LCB_CNTL_HEDGE_PERCENTILE, convert_u32 },
+        {"hedge_budget", LCB_CNTL_HEDGE_BUDGET, convert_u32 },
+        {"get_coalesce", LCB_CNTL_GET_COALESCE, convert_intbool },
+        {"nearcache_size", LCB_CNTL_NEARCACHE_SIZE, convert_u32 },
+        {"nearcache_ttl", LCB_CNTL_NEARCACHE_TTL, convert_timeout },
+        {"nearcache_revalidate", LCB_CNTL_NEARCACHE_REVALIDATE, convert_intbool },
+        {"counter_window", LCB_CNTL_COUNTER_WINDOW, convert_timeout },
+        {"counter_window_ops", LCB_CNTL_COUNTER_WINDOW_OPS, convert_u32 },
+        {"rowbuf_highwat", LCB_CNTL_ROWBUF_HIGHWAT, convert_u32 },
+        {"rowbuf_lowwat", LCB_CNTL_ROWBUF_LOWWAT, convert_u32 },
+        {"http_pool_timeout", LCB_CNTL_HTTP_POOL_TIMEOUT, convert_timeout },
+        {"http_max_concurrent", LCB_CNTL_HTTP_MAXCONCURRENT, convert_u32 },
+        {"n1ql_autoprepare", LCB_CNTL_N1QL_AUTOPREPARE, convert_u32 },
         {NULL, -1}
 };
 
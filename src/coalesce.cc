@@ -0,0 +1,164 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "coalesce.h"
+
+namespace lcb {
+struct CoalescedGet : mc_REQDATAEX {
+    CoalescedGet(const void *cookie, lcb_t instance, int vb, const std::string& key);
+
+    lcb_t instance;
+    int vbucket;
+    std::string key;
+    bool registered; /**< Whether this is in GetCoalescer::inflight */
+    std::vector<const void*> waiters; /**< Cookies of the attached GETs */
+};
+}
+
+using namespace lcb;
+
+static void
+coalesce_callback(mc_PIPELINE *, mc_PACKET *pkt, lcb_error_t, const void *arg)
+{
+    CoalescedGet *cg = static_cast<CoalescedGet*>(pkt->u_rdata.exdata);
+    lcb_RESPGET *resp = reinterpret_cast<lcb_RESPGET*>(const_cast<void*>(arg));
+    lcb_t instance = cg->instance;
+
+    /* Detach first, so that GETs made from within the callbacks are sent
+     * to the server rather than attached to this (stale) response */
+    if (instance->getcoalescer) {
+        instance->getcoalescer->remove(cg);
+    }
+
+    lcb_RESPCALLBACK callback = lcb_find_callback(instance, LCB_CALLBACK_GET);
+    resp->rflags |= LCB_RESP_F_FINAL;
+    callback(instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)resp);
+    for (size_t ii = 0; ii < cg->waiters.size(); ii++) {
+        resp->cookie = const_cast<void*>(cg->waiters[ii]);
+        callback(instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)resp);
+    }
+    delete cg;
+}
+
+static void
+coalesce_dtor(mc_PACKET *pkt)
+{
+    CoalescedGet *cg = static_cast<CoalescedGet*>(pkt->u_rdata.exdata);
+    if (cg->instance->getcoalescer) {
+        cg->instance->getcoalescer->remove(cg);
+    }
+    delete cg;
+}
+
+static mc_REQDATAPROCS coalesce_procs = {
+        coalesce_callback,
+        coalesce_dtor
+};
+
+CoalescedGet::CoalescedGet(const void *cookie_, lcb_t instance_, int vbucket_,
+    const std::string& key_)
+    : mc_REQDATAEX(cookie_, coalesce_procs, gethrtime()),
+      instance(instance_), vbucket(vbucket_), key(key_), registered(false) {
+}
+
+GetCoalescer::~GetCoalescer()
+{
+    /* The cookies are owned by their packets */
+    std::map<Key, CoalescedGet*>::iterator it;
+    for (it = inflight.begin(); it != inflight.end(); ++it) {
+        it->second->registered = false;
+    }
+}
+
+bool
+GetCoalescer::join(int vbid, const lcb_KEYBUF *kb, const void *cookie)
+{
+    if (inflight.empty()) {
+        return false;
+    }
+
+    Key key(vbid, std::string((const char *)kb->contig.bytes, kb->contig.nbytes));
+    std::map<Key, CoalescedGet*>::iterator it = inflight.find(key);
+    if (it == inflight.end()) {
+        return false;
+    }
+
+    it->second->waiters.push_back(cookie);
+    uncommitted.push_back(it->second);
+    return true;
+}
+
+void
+GetCoalescer::lead(lcb_t instance, mc_PACKET *pkt, int vbid, const void *cookie)
+{
+    protocol_binary_request_header hdr;
+    const char *kptr;
+    mcreq_read_hdr(pkt, &hdr);
+    kptr = SPAN_BUFFER(&pkt->kh_span) + sizeof(hdr.bytes) + hdr.request.extlen;
+
+    CoalescedGet *cg = new CoalescedGet(cookie, instance, vbid,
+        std::string(kptr, ntohs(hdr.request.keylen)));
+    pkt->u_rdata.exdata = cg;
+    pkt->flags |= MCREQ_F_REQEXT;
+
+    inflight[Key(vbid, cg->key)] = cg;
+    cg->registered = true;
+}
+
+void
+GetCoalescer::remove(CoalescedGet *cg)
+{
+    if (!cg->registered) {
+        return;
+    }
+    inflight.erase(Key(cg->vbucket, cg->key));
+    cg->registered = false;
+}
+
+void
+GetCoalescer::invalidate(const mc_PACKET *request)
+{
+    if (inflight.empty()) {
+        return;
+    }
+
+    protocol_binary_request_header hdr;
+    const void *kptr;
+    lcb_size_t nkey;
+    mcreq_read_hdr(request, &hdr);
+    mcreq_get_key(request, &kptr, &nkey);
+
+    std::map<Key, CoalescedGet*>::iterator it = inflight.find(
+        Key(ntohs(hdr.request.vbucket), std::string((const char *)kptr, nkey)));
+    if (it != inflight.end()) {
+        /* GETs already attached still receive the in-flight response; they
+         * were issued before the mutation */
+        remove(it->second);
+    }
+}
+
+void
+GetCoalescer::sched_fail()
+{
+    /* The context's own leaders are wiped with their packets. GETs attached
+     * to earlier packets are detached here, newest first */
+    while (!uncommitted.empty()) {
+        uncommitted.back()->waiters.pop_back();
+        uncommitted.pop_back();
+    }
+}
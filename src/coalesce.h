@@ -0,0 +1,86 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_COALESCE_H
+#define LCB_COALESCE_H
+
+#include <mc/mcreq.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * @brief Single-flight GET coalescing
+ *
+ * @details
+ * When @ref LCB_CNTL_GET_COALESCE is enabled, a plain GET for a key which
+ * already has a GET in flight does not get a packet of its own. Instead its
+ * cookie is attached to the in-flight packet, and the response to that
+ * packet is delivered once for each attached cookie.
+ */
+
+namespace lcb {
+struct CoalescedGet;
+
+class GetCoalescer {
+public:
+    GetCoalescer() {}
+    ~GetCoalescer();
+
+    /**
+     * Attach a GET to an in-flight GET for the same key, if there is one.
+     * @param vbid the vBucket of the key
+     * @param key the key
+     * @param cookie the user's cookie
+     * @return true if the GET was attached, false if it needs its own packet
+     */
+    bool join(int vbid, const lcb_KEYBUF *key, const void *cookie);
+
+    /**
+     * Make the given GET packet the one to which subsequent GETs for the same
+     * key are attached. This must be called before the packet is scheduled.
+     */
+    void lead(lcb_t instance, mc_PACKET *pkt, int vbid, const void *cookie);
+
+    /** Stop attaching GETs to the given packet's cookie */
+    void remove(CoalescedGet *cg);
+
+    /**
+     * Stop attaching GETs to an in-flight GET for the key of the given
+     * (mutation) request. This must be called before the request is
+     * scheduled, so that subsequent GETs are sent after it and observe its
+     * effect rather than an older value.
+     */
+    void invalidate(const mc_PACKET *request);
+
+    /** Called when the scheduling context is left; attached GETs are final */
+    void sched_leave() { uncommitted.clear(); }
+
+    /** Called when the scheduling context fails; detaches the GETs attached
+     * within it */
+    void sched_fail();
+
+private:
+    typedef std::pair<int, std::string> Key;
+    std::map<Key, CoalescedGet*> inflight;
+    /** GETs attached in the current scheduling context, oldest first */
+    std::vector<CoalescedGet*> uncommitted;
+};
+}
+
+#endif
@@ -0,0 +1,241 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "counteragg.h"
+#include <algorithm>
+#include <limits>
+
+namespace lcb {
+struct CounterBatch {
+    CounterBatch(lcb_t instance, const std::string& key, lcb_U64 initial,
+        int create, hrtime_t deadline);
+
+    /* Must be first; this is the cookie of the (internal) counter command */
+    lcb_RESPCALLBACK callback;
+    lcb_t instance;
+    std::string key;
+    lcb_U64 initial;
+    int create;
+    lcb_S64 delta; /**< Sum of the participating deltas */
+    std::vector<const void*> cookies; /**< In scheduling order */
+    hrtime_t deadline;
+};
+}
+
+using namespace lcb;
+
+extern "C" {
+static void
+batch_callback(lcb_t instance, int cbtype, const lcb_RESPBASE *rb)
+{
+    CounterBatch *batch = reinterpret_cast<CounterBatch*>(rb->cookie);
+    lcb_RESPBASE *resp = const_cast<lcb_RESPBASE*>(rb);
+    lcb_RESPCALLBACK callback = lcb_find_callback(instance, LCB_CALLBACK_COUNTER);
+
+    /* The response is modified in place (rather than copied) so that the
+     * mutation token which follows it remains available */
+    for (size_t ii = 0; ii < batch->cookies.size(); ii++) {
+        resp->cookie = const_cast<void*>(batch->cookies[ii]);
+        callback(instance, cbtype, resp);
+    }
+    delete batch;
+}
+}
+
+CounterBatch::CounterBatch(lcb_t instance_, const std::string& key_,
+    lcb_U64 initial_, int create_, hrtime_t deadline_)
+    : callback(batch_callback), instance(instance_), key(key_),
+      initial(initial_), create(create_), delta(0), deadline(deadline_) {
+}
+
+bool
+CounterAggregator::BatchKey::operator<(const BatchKey& other) const
+{
+    if (key != other.key) {
+        return key < other.key;
+    }
+    if (initial != other.initial) {
+        return initial < other.initial;
+    }
+    return create < other.create;
+}
+
+CounterAggregator::CounterAggregator(lcb_t instance_)
+    : instance(instance_), loop_referenced(false),
+      timer(instance_->iotable, this)
+{
+}
+
+CounterAggregator::~CounterAggregator()
+{
+    for (size_t ii = 0; ii < by_deadline.size(); ii++) {
+        delete by_deadline[ii];
+    }
+    if (loop_referenced) {
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    }
+}
+
+bool
+CounterAggregator::add(const lcb_CMDCOUNTER *cmd, const void *cookie)
+{
+    BatchKey bk;
+    bk.key.assign((const char *)cmd->key.contig.bytes, cmd->key.contig.nbytes);
+    bk.initial = cmd->initial;
+    bk.create = cmd->create;
+
+    CounterBatch *batch;
+    std::map<BatchKey, CounterBatch*>::iterator it = open.find(bk);
+    if (it != open.end()) {
+        batch = it->second;
+        /* The sum must remain representable (and negatable) */
+        const lcb_S64 smax = std::numeric_limits<lcb_S64>::max();
+        if ((cmd->delta > 0 && batch->delta > smax - cmd->delta) ||
+                (cmd->delta < 0 && batch->delta < -smax - cmd->delta)) {
+            return false;
+        }
+    } else {
+        lcb_U32 window = LCBT_SETTING(instance, counter_window);
+        batch = new CounterBatch(instance, bk.key, bk.initial, bk.create,
+            gethrtime() + LCB_US2NS(window));
+        open[bk] = batch;
+        by_deadline.push_back(batch);
+        if (by_deadline.size() == 1) {
+            timer.rearm(window);
+        }
+    }
+
+    batch->delta += cmd->delta;
+    batch->cookies.push_back(cookie);
+    Addition addition = { batch, cmd->delta };
+    uncommitted.push_back(addition);
+    return true;
+}
+
+void
+CounterAggregator::sched_leave()
+{
+    uncommitted.clear();
+    send_full();
+    update_loop_ref();
+}
+
+void
+CounterAggregator::sched_fail()
+{
+    while (!uncommitted.empty()) {
+        Addition& addition = uncommitted.back();
+        CounterBatch *batch = addition.batch;
+        batch->delta -= addition.delta;
+        batch->cookies.pop_back();
+        uncommitted.pop_back();
+
+        if (batch->cookies.empty()) {
+            BatchKey bk = { batch->key, batch->initial, batch->create };
+            open.erase(bk);
+            by_deadline.erase(
+                std::find(by_deadline.begin(), by_deadline.end(), batch));
+            delete batch;
+        }
+    }
+    update_loop_ref();
+}
+
+void
+CounterAggregator::send(CounterBatch *batch)
+{
+    BatchKey bk = { batch->key, batch->initial, batch->create };
+    open.erase(bk);
+    by_deadline.erase(std::find(by_deadline.begin(), by_deadline.end(), batch));
+
+    lcb_CMDCOUNTER cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, batch->key.c_str(), batch->key.size());
+    cmd.delta = batch->delta;
+    cmd.initial = batch->initial;
+    cmd.create = batch->create;
+    cmd.cmdflags |= LCB_CMD_F_INTERNAL_CALLBACK;
+
+    lcb_error_t err = lcb_counter3(instance, batch, &cmd);
+    if (err != LCB_SUCCESS) {
+        lcb_RESPCOUNTER resp = { 0 };
+        resp.key = batch->key.c_str();
+        resp.nkey = batch->key.size();
+        resp.rc = err;
+        resp.rflags = LCB_RESP_F_FINAL;
+        resp.cookie = batch;
+        batch_callback(instance, LCB_CALLBACK_COUNTER, (const lcb_RESPBASE *)&resp);
+    }
+}
+
+void
+CounterAggregator::send_full()
+{
+    lcb_U32 limit = LCBT_SETTING(instance, counter_window_ops);
+    if (!limit) {
+        return;
+    }
+
+    std::vector<CounterBatch*> full;
+    for (size_t ii = 0; ii < by_deadline.size(); ii++) {
+        if (by_deadline[ii]->cookies.size() >= limit) {
+            full.push_back(by_deadline[ii]);
+        }
+    }
+    if (full.empty()) {
+        return;
+    }
+
+    /* Without a scheduling context of our own, sending would re-enter
+     * sched_leave() (via the implicit leave of each lcb_counter3()), and
+     * send the remaining batches from within it */
+    lcb_sched_enter(instance);
+    for (size_t ii = 0; ii < full.size(); ii++) {
+        send(full[ii]);
+    }
+    lcb_sched_leave(instance);
+}
+
+void
+CounterAggregator::send_expired()
+{
+    hrtime_t now = gethrtime();
+    lcb_sched_enter(instance);
+    while (!by_deadline.empty() && by_deadline.front()->deadline <= now) {
+        send(by_deadline.front());
+    }
+    lcb_sched_leave(instance);
+
+    if (!by_deadline.empty()) {
+        timer.rearm(LCB_NS2US(by_deadline.front()->deadline - now));
+    }
+    update_loop_ref();
+}
+
+void
+CounterAggregator::update_loop_ref()
+{
+    /* Keep lcb_wait() running until all the batches have been sent */
+    if (!by_deadline.empty() && !loop_referenced) {
+        lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        loop_referenced = true;
+    } else if (by_deadline.empty() && loop_referenced) {
+        loop_referenced = false;
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        lcb_maybe_breakout(instance);
+    }
+}
@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_COUNTERAGG_H
+#define LCB_COUNTERAGG_H
+
+#include <lcbio/timer-cxx.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * @brief Counter aggregation
+ *
+ * @details
+ * When @ref LCB_CNTL_COUNTER_WINDOW is set, lcb_counter3() does not send a
+ * command right away. Instead, the deltas of all counter operations for the
+ * same key within the window are summed, and a single INCR/DECR is sent
+ * once the window closes. Its response is delivered to each participating
+ * operation.
+ */
+
+namespace lcb {
+struct CounterBatch;
+
+class CounterAggregator {
+public:
+    CounterAggregator(lcb_t instance);
+    ~CounterAggregator();
+
+    /**
+     * Add a counter operation to the batch for its key.
+     * @return true if the operation was added, false if it must be sent by
+     * itself
+     */
+    bool add(const lcb_CMDCOUNTER *cmd, const void *cookie);
+
+    /** Called when the scheduling context is left. Sends full batches */
+    void sched_leave();
+
+    /** Called when the scheduling context fails. Removes the operations added
+     * within it */
+    void sched_fail();
+
+private:
+    struct BatchKey {
+        std::string key;
+        lcb_U64 initial;
+        int create;
+        bool operator<(const BatchKey& other) const;
+    };
+
+    struct Addition {
+        CounterBatch *batch;
+        lcb_S64 delta;
+    };
+
+    void send(CounterBatch *batch);
+    void send_expired();
+    void send_full();
+    void update_loop_ref();
+
+    lcb_t instance;
+    std::map<BatchKey, CounterBatch*> open;
+    std::deque<CounterBatch*> by_deadline; /**< Open (or cancelled) batches */
+    std::vector<Addition> uncommitted; /**< Additions in the current context */
+    bool loop_referenced;
+    lcb::io::Timer<CounterAggregator, &CounterAggregator::send_expired> timer;
+};
+}
+
+#endif
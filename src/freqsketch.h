@@ -0,0 +1,136 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_FREQSKETCH_H
+#define LCB_FREQSKETCH_H
+
+#include <libcouchbase/couchbase.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * @brief Approximate counting of recently seen keys
+ *
+ * @details
+ * A count-min sketch: each key increments one counter in each of several
+ * rows, chosen by a different hash per row, and its count is the smallest of
+ * these. Collisions can only raise the count of a key, never lower it. The
+ * memory used is fixed, however many distinct keys are seen.
+ *
+ * All the counts are halved once a number of keys proportional to the
+ * capacity have been counted, so that keys which were frequent long ago
+ * don't keep a high count.
+ */
+
+namespace lcb {
+
+/**
+ * @tparam T the type of each counter
+ * @tparam MaxCount the count at which a counter saturates
+ */
+template <typename T = lcb_U8, unsigned MaxCount = 15>
+class FrequencySketch {
+public:
+    /** @param capacity see resize(). A sketch of capacity 0 counts nothing */
+    explicit FrequencySketch(size_t capacity = 0)
+        : nadded(0), mask(0), reset_at(0) {
+        if (capacity) {
+            resize(capacity);
+        }
+    }
+
+    /** Size the sketch for tracking `capacity` hot keys. Clears all counts */
+    void resize(size_t capacity) {
+        size_t width = 64;
+        while (width < capacity * 4) {
+            width <<= 1;
+        }
+        counters.assign(width * DEPTH, 0);
+        mask = width - 1;
+        nadded = 0;
+        reset_at = capacity * 10;
+    }
+
+    /**
+     * Count an occurrence of the key
+     * @return its estimated count, including this occurrence
+     */
+    unsigned increment(const std::string& key) {
+        if (counters.empty()) {
+            return 0;
+        }
+        unsigned freq = MaxCount;
+        for (unsigned ii = 0; ii < DEPTH; ii++) {
+            T& counter = counters[index(key, ii)];
+            if (counter < MaxCount) {
+                counter++;
+            }
+            freq = std::min(freq, (unsigned)counter);
+        }
+
+        /* Age the counts, so that keys which were once hot can be replaced */
+        if (++nadded >= reset_at) {
+            for (size_t ii = 0; ii < counters.size(); ii++) {
+                counters[ii] /= 2;
+            }
+            nadded = 0;
+        }
+        return freq;
+    }
+
+    /** Estimated number of recent occurrences of the key */
+    unsigned frequency(const std::string& key) const {
+        if (counters.empty()) {
+            return 0;
+        }
+        unsigned freq = MaxCount;
+        for (unsigned ii = 0; ii < DEPTH; ii++) {
+            freq = std::min(freq, (unsigned)counters[index(key, ii)]);
+        }
+        return freq;
+    }
+
+    /** Reset all counts, keeping the size */
+    void clear() {
+        counters.assign(counters.size(), 0);
+        nadded = 0;
+    }
+
+private:
+    static const unsigned DEPTH = 4;
+
+    size_t index(const std::string& key, unsigned row) const {
+        /* FNV-1a, seeded differently for each row */
+        lcb_U64 hash = 14695981039346656037ULL ^ (row * 0x9E3779B97F4A7C15ULL);
+        for (size_t ii = 0; ii < key.size(); ii++) {
+            hash ^= (lcb_U8)key[ii];
+            hash *= 1099511628211ULL;
+        }
+        return row * (mask + 1) + (size_t)((hash ^ (hash >> 32)) & mask);
+    }
+
+    std::vector<T> counters; /**< DEPTH rows of (mask + 1) counters */
+    size_t nadded;
+    size_t mask;
+    size_t reset_at; /**< Halve all counts after this many increments */
+};
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "ftsmerge.h"
+#include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
+#include <algorithm>
+
+using namespace lcb::cbft;
+
+HitMerger::HitMerger(size_t npartitions, size_t skip_, size_t limit_)
+    : partitions(npartitions), nwaiting(npartitions), skip(skip_),
+      limit(limit_), maxadded(skip_ + limit_), nreturned(0)
+{
+    heap.reserve(npartitions);
+}
+
+/* Whether partition `a` should be below `b` in the heap. Equal scores are
+ * taken from the lower numbered partition first, so that the order is
+ * stable */
+bool
+HitMerger::Order::operator()(size_t a, size_t b) const
+{
+    double sa = partitions[a].hits.front().score;
+    double sb = partitions[b].hits.front().score;
+    if (sa != sb) {
+        return sa < sb;
+    }
+    return a > b;
+}
+
+bool
+HitMerger::add(size_t ix, const char *row, size_t nrow)
+{
+    Json::Value hit;
+    if (!Json::Reader().parse(row, row + nrow, hit) || !hit.isObject()) {
+        return false;
+    }
+
+    Partition& part = partitions[ix];
+    /* A partition can't contribute more than this many hits */
+    if (part.done || nreturned == limit || part.nadded >= maxadded) {
+        return true;
+    }
+    part.nadded++;
+
+    const Json::Value& score = hit["score"];
+    part.hits.push_back(Hit());
+    part.hits.back().score = score.isNumeric() ? score.asDouble() : 0;
+    part.hits.back().row.assign(row, nrow);
+    part.nbytes += nrow;
+
+    if (part.hits.size() == 1) {
+        nwaiting--;
+        heap.push_back(ix);
+        std::push_heap(heap.begin(), heap.end(), Order(partitions));
+    }
+    return true;
+}
+
+void
+HitMerger::done(size_t ix)
+{
+    Partition& part = partitions[ix];
+    if (part.done) {
+        return;
+    }
+    part.done = true;
+    if (part.hits.empty()) {
+        nwaiting--;
+    }
+}
+
+bool
+HitMerger::next(std::string& row)
+{
+    /* A partition which has nothing buffered may yet return a higher hit */
+    while (nwaiting == 0 && !heap.empty() && nreturned < limit) {
+        std::pop_heap(heap.begin(), heap.end(), Order(partitions));
+        size_t ix = heap.back();
+        heap.pop_back();
+
+        Partition& part = partitions[ix];
+        Hit& hit = part.hits.front();
+        part.nbytes -= hit.row.size();
+
+        bool wanted = skip == 0;
+        if (wanted) {
+            row.swap(hit.row);
+            nreturned++;
+        } else {
+            skip--;
+        }
+        part.hits.pop_front();
+
+        if (!part.hits.empty()) {
+            heap.push_back(ix);
+            std::push_heap(heap.begin(), heap.end(), Order(partitions));
+        } else if (!part.done) {
+            nwaiting++;
+        }
+
+        if (wanted) {
+            return true;
+        }
+    }
+
+    if (nreturned == limit) {
+        /* Nothing else will be returned */
+        for (size_t ii = 0; ii < partitions.size(); ii++) {
+            partitions[ii].hits.clear();
+            partitions[ii].nbytes = 0;
+            partitions[ii].done = true;
+        }
+        heap.clear();
+        nwaiting = 0;
+    }
+    return false;
+}
@@ -0,0 +1,115 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_FTSMERGE_H
+#define LCB_FTSMERGE_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * @file
+ * @brief Merging of full-text hits from several index partitions
+ *
+ * @details
+ * Each partition returns its hits in descending score order. A hit may be
+ * passed on once every partition which has not yet finished has a hit
+ * buffered: the highest of these is then the highest of all the hits which
+ * remain. Only the first hit of each partition is kept in the heap, so that
+ * selecting the next hit costs O(log(partitions)).
+ */
+
+namespace lcb {
+namespace cbft {
+
+class HitMerger {
+public:
+    /**
+     * @param npartitions the number of partitions
+     * @param skip the number of (merged) hits to drop from the start, as in
+     *        the `from` field of a query
+     * @param limit the maximum number of hits to return after those skipped,
+     *        as in the `size` field of a query
+     */
+    HitMerger(size_t npartitions, size_t skip, size_t limit);
+
+    /**
+     * Add the next hit of a partition. Hits beyond those which may be
+     * returned are dropped.
+     * @return false if the hit is not a JSON object
+     */
+    bool add(size_t partition, const char *row, size_t nrow);
+
+    /** Indicate that a partition has no more hits */
+    void done(size_t partition);
+
+    /**
+     * Get the next hit in score order, if it is known.
+     * @param[out] row the hit
+     * @return true if a hit was returned, false if none can be returned until
+     * more are added (or all of them have been returned)
+     */
+    bool next(std::string& row);
+
+    /** The size of the hits buffered for a partition */
+    size_t buffered(size_t partition) const {
+        return partitions[partition].nbytes;
+    }
+
+    /** Whether all the hits which will be returned have been */
+    bool finished() const {
+        return nreturned == limit || (nwaiting == 0 && heap.empty());
+    }
+
+private:
+    struct Hit {
+        double score;
+        std::string row;
+    };
+    struct Partition {
+        Partition() : nbytes(0), nadded(0), done(false) {}
+        std::deque<Hit> hits;
+        size_t nbytes;
+        size_t nadded;
+        bool done;
+    };
+    struct Order {
+        Order(const std::vector<Partition>& partitions_)
+            : partitions(partitions_) {}
+        bool operator()(size_t a, size_t b) const;
+        const std::vector<Partition>& partitions;
+    };
+
+    std::vector<Partition> partitions;
+    /** Partitions with buffered hits, as a max-heap of their first hit */
+    std::vector<size_t> heap;
+    /** Partitions without buffered hits, which are not done */
+    size_t nwaiting;
+    /** Hits still to be dropped from the start */
+    size_t skip;
+    size_t limit;
+    /** The most hits a partition may contribute, i.e. the original skip+limit */
+    const size_t maxadded;
+    size_t nreturned;
+};
+
+}
+}
+
+#endif
@@ -20,6 +20,9 @@
 #include "mc/mcreq.h"
 #include "mc/compress.h"
 #include "trace.h"
+#include "slowops.h"
+#include "nearcache.h"
+#include <vector>
 
 using lcb::MemcachedResponse;
 
@@ -309,10 +312,32 @@ H_get(mc_PIPELINE *pipeline, mc_PACKET *request, MemcachedResponse* response,
     void *freeptr = NULL;
     maybe_decompress(o, response, &resp, &freeptr);
     TRACE_GET_END(response, &resp);
-    invoke_callback(request, o, &resp, LCB_CALLBACK_GET);
+    if (o->nearcache && response->opcode() == PROTOCOL_BINARY_CMD_GET &&
+            (request->flags & MCREQ_F_PRIVCALLBACK) == 0) {
+        o->nearcache->store(request, &resp);
+    }
+    if (request->flags & MCREQ_F_REQEXT) {
+        request->u_rdata.exdata->procs->handler(pipeline, request, resp.rc, &resp);
+    } else {
+        invoke_callback(request, o, &resp, LCB_CALLBACK_GET);
+    }
     free(freeptr);
 }
 
+/* Only sent by the near cache, to revalidate an entry */
+static void
+H_getmeta(mc_PIPELINE *pipeline, mc_PACKET *request, MemcachedResponse *response,
+          lcb_error_t immerr)
+{
+    lcb_RESPGET resp = { 0 };
+    lcb_t o = get_instance(pipeline);
+    init_resp(o, response, request, immerr, &resp);
+    resp.rflags |= LCB_RESP_F_FINAL;
+    if (request->flags & MCREQ_F_REQEXT) {
+        request->u_rdata.exdata->procs->handler(pipeline, request, resp.rc, &resp);
+    }
+}
+
 static void
 H_getreplica(mc_PIPELINE *pipeline, mc_PACKET *request,
              MemcachedResponse *response, lcb_error_t immerr)
@@ -340,12 +365,136 @@ H_getreplica(mc_PIPELINE *pipeline, mc_PACKET *request,
     free(freeptr);
 }
 
+namespace {
+/**
+ * Index of the results in a subdoc response. The response body is decoded
+ * once, when it arrives, so that the results can be accessed in any order
+ * (and any number of times) without parsing it again. The entries point
+ * into the response's buffer.
+ */
+class SubdocResults {
+public:
+    SubdocResults() : nresults(0) {
+    }
+
+    void decode(const MemcachedResponse *response, bool multi);
+
+    size_t size() const {
+        return nresults;
+    }
+
+    const lcb_SDENTRY& operator[](size_t ix) const {
+        return ix < NINLINE ? inline_results[ix] : more_results[ix - NINLINE];
+    }
+
+private:
+    /* A multi-path command has at most 16 specs */
+    static const size_t NINLINE = 16;
+
+    void add(const void *value, size_t nvalue, lcb_U16 status, lcb_U8 index);
+    void decode_lookup(const char *buf, const char *buf_end);
+    void decode_mutate(const char *buf, const char *buf_end);
+
+    size_t nresults;
+    lcb_SDENTRY inline_results[NINLINE];
+    std::vector<lcb_SDENTRY> more_results;
+};
+}
+
+void
+SubdocResults::add(const void *value, size_t nvalue, lcb_U16 status, lcb_U8 index)
+{
+    lcb_SDENTRY ent;
+    ent.status = map_error(NULL, status);
+    ent.index = index;
+    if (ent.status == LCB_SUCCESS) {
+        ent.value = value;
+        ent.nvalue = nvalue;
+    } else {
+        ent.value = NULL;
+        ent.nvalue = 0;
+    }
+
+    if (nresults < NINLINE) {
+        inline_results[nresults] = ent;
+    } else {
+        more_results.push_back(ent);
+    }
+    nresults++;
+}
+
+void
+SubdocResults::decode_lookup(const char *buf, const char *buf_end)
+{
+    /* status(2), value length(4), value */
+    while (buf_end - buf >= 6) {
+        uint16_t rc;
+        uint32_t vlen;
+        memcpy(&rc, buf, 2);
+        memcpy(&vlen, buf + 2, 4);
+        rc = ntohs(rc);
+        vlen = ntohl(vlen);
+        buf += 6;
+        if ((size_t)(buf_end - buf) < vlen) {
+            break;
+        }
+        add(buf, vlen, rc, static_cast<lcb_U8>(nresults));
+        buf += vlen;
+    }
+}
+
+void
+SubdocResults::decode_mutate(const char *buf, const char *buf_end)
+{
+    /* index(1), status(2), and if successful, value length(4), value */
+    while (buf_end - buf >= 3) {
+        lcb_U8 index = *(const lcb_U8 *)buf;
+        uint16_t rc;
+        uint32_t vlen = 0;
+        memcpy(&rc, buf + 1, 2);
+        rc = ntohs(rc);
+        buf += 3;
+
+        if (rc == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            if (buf_end - buf < 4) {
+                break;
+            }
+            memcpy(&vlen, buf, 4);
+            vlen = ntohl(vlen);
+            buf += 4;
+            if ((size_t)(buf_end - buf) < vlen) {
+                break;
+            }
+        }
+        add(buf, vlen, rc, index);
+        buf += vlen;
+    }
+}
+
+void
+SubdocResults::decode(const MemcachedResponse *response, bool multi)
+{
+    const char *buf = response->value();
+    const char *buf_end = buf + response->vallen();
+
+    if (!multi) {
+        /* The whole body is the value, whatever the status */
+        add(buf, response->vallen(), PROTOCOL_BINARY_RESPONSE_SUCCESS, 0);
+        inline_results[0].status = map_error(NULL, response->status());
+    } else if (response->opcode() == PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP) {
+        decode_lookup(buf, buf_end);
+    } else {
+        decode_mutate(buf, buf_end);
+    }
+}
+
 static void
 H_subdoc(mc_PIPELINE *pipeline, mc_PACKET *request,
          MemcachedResponse *response, lcb_error_t immerr)
 {
     lcb_t o = get_instance(pipeline);
     ResponsePack<lcb_RESPSUBDOC> w = {{ 0 }};
+    SubdocResults results;
     lcb_CALLBACKTYPE cbtype;
     init_resp(o, response, request, immerr, &w.resp);
     w.resp.rflags |= LCB_RESP_F_FINAL;
@@ -368,139 +517,60 @@ H_subdoc(mc_PIPELINE *pipeline, mc_PACKET *request,
     if (response->opcode() == PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP ||
             response->opcode() == PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION) {
         if (w.resp.rc == LCB_SUCCESS || w.resp.rc == LCB_SUBDOC_MULTI_FAILURE) {
-            w.resp.responses = response;
+            results.decode(response, true);
+            w.resp.responses = &results;
         }
     } else {
         /* Single response */
         w.resp.rflags |= LCB_RESP_F_SDSINGLE;
         if (w.resp.rc == LCB_SUCCESS) {
-            w.resp.responses = response;
+            results.decode(response, false);
+            w.resp.responses = &results;
         } else if (LCB_EIFSUBDOC(w.resp.rc)) {
-            w.resp.responses = response;
+            results.decode(response, false);
+            w.resp.responses = &results;
             w.resp.rc = LCB_SUBDOC_MULTI_FAILURE;
         }
     }
     invoke_callback(request, o, &w.resp, cbtype);
 }
 
-static int
-sdlookup_next(const MemcachedResponse *response, lcb_SDENTRY *ent, size_t *iter)
+LIBCOUCHBASE_API
+int
+lcb_sdresult_next(const lcb_RESPSUBDOC *resp, lcb_SDENTRY *ent, size_t *iter)
 {
-    const char *buf;
-    uint16_t rc;
-    uint32_t vlen;
-
-    if (*iter == response->vallen()) {
-        return 0;
+    size_t iter_s = 0;
+    if (!iter) {
+        /* Single response */
+        iter = &iter_s;
     }
-
-    buf = response->value();
-    buf += *iter;
-
-    memcpy(&rc, buf, 2);
-    memcpy(&vlen, buf + 2, 4);
-
-    rc = ntohs(rc);
-    vlen = ntohl(vlen);
-
-    ent->status = map_error(NULL, rc);
-    ent->nvalue = vlen;
-
-    if (ent->status == LCB_SUCCESS) {
-        ent->value = buf + 6;
-    } else {
-        ent->value = NULL;
-        ent->nvalue = 0;
+    if (!lcb_sdresult_at(resp, *iter, ent)) {
+        return 0;
     }
-
-    *iter += (6 + vlen);
+    ++*iter;
     return 1;
 }
 
-static int
-sdmutate_next(const MemcachedResponse *response, lcb_SDENTRY *ent, size_t *iter)
+LIBCOUCHBASE_API
+size_t
+lcb_sdresult_count(const lcb_RESPSUBDOC *resp)
 {
-    const char *buf, *buf_end;
-    uint16_t rc;
-    uint32_t vlen;
-
-    if (*iter == response->vallen()) {
-        return 0;
-    }
-
-    buf_end = (const char *)response->value() + response->vallen();
-    buf = ((const char *)(response->value())) + *iter;
-
-    #define ADVANCE_BUF(sz) \
-        buf += sz; \
-        *iter += sz; \
-        assert(buf <= buf_end); \
-
-    /* Index */
-    ent->index = *(lcb_U8*)buf;
-    ADVANCE_BUF(1);
-
-    /* Status */
-    memcpy(&rc, buf, 2);
-    ADVANCE_BUF(2);
-
-    rc = ntohs(rc);
-    ent->status = map_error(NULL, rc);
-
-    if (rc == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-        memcpy(&vlen, buf, 4);
-        ADVANCE_BUF(4);
-
-        vlen = ntohl(vlen);
-        ent->nvalue = vlen;
-        ent->value = buf;
-        ADVANCE_BUF(vlen);
-
-    } else {
-        ent->value = NULL;
-        ent->nvalue = 0;
-    }
-
-    return 1;
-    #undef ADVANCE_BUF
+    const SubdocResults *results =
+            reinterpret_cast<const SubdocResults*>(resp->responses);
+    return results ? results->size() : 0;
 }
 
 LIBCOUCHBASE_API
 int
-lcb_sdresult_next(const lcb_RESPSUBDOC *resp, lcb_SDENTRY *ent, size_t *iter)
+lcb_sdresult_at(const lcb_RESPSUBDOC *resp, size_t ix, lcb_SDENTRY *ent)
 {
-    size_t iter_s = 0;
-    const MemcachedResponse *response =
-                reinterpret_cast<const MemcachedResponse*>(resp->responses);
-    if (!response) {
+    const SubdocResults *results =
+            reinterpret_cast<const SubdocResults*>(resp->responses);
+    if (!results || ix >= results->size()) {
         return 0;
     }
-    if (!iter) {
-        /* Single response */
-        iter = &iter_s;
-    }
-
-    switch (response->opcode()) {
-    case PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP:
-        return sdlookup_next(response, ent, iter);
-    case PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION:
-        return sdmutate_next(response, ent, iter);
-    default:
-        if (*iter) {
-            return 0;
-        }
-        *iter = 1;
-
-        if (resp->rc == LCB_SUCCESS || resp->rc == LCB_SUBDOC_MULTI_FAILURE) {
-            ent->status = map_error(NULL, response->status());
-            ent->value = response->value();
-            ent->nvalue = response->vallen();
-            ent->index = 0;
-            return 1;
-        } else {
-            return 0;
-        }
-    }
+    *ent = (*results)[ix];
+    return 1;
 }
 
 static void
@@ -784,12 +854,20 @@ H_config(mc_PIPELINE *pipeline, mc_PACKET *request, MemcachedResponse *response,
 }
 
 static void
-record_metrics(mc_PIPELINE *pipeline, mc_PACKET *req, MemcachedResponse *)
+record_metrics(mc_PIPELINE *pipeline, mc_PACKET *req, MemcachedResponse *res,
+               lcb_error_t immerr)
 {
     lcb_t instance = get_instance(pipeline);
+    hrtime_t duration = gethrtime() - MCREQ_PKT_RDATA(req)->start;
     if (instance->kv_timings) {
-        lcb_histogram_record(instance->kv_timings,
-            gethrtime() - MCREQ_PKT_RDATA(req)->start);
+        lcb_histogram_record(instance->kv_timings, duration);
+    }
+    if (immerr == LCB_SUCCESS) {
+        static_cast<lcb::Server*>(pipeline)->latency.record(duration);
+    }
+    if (req->trace && instance->slowops) {
+        instance->slowops->record(
+            static_cast<lcb::Server*>(pipeline), req, res, immerr);
     }
 }
 
@@ -803,12 +881,53 @@ dispatch_ufwd_error(mc_PIPELINE *pipeline, mc_PACKET *req, lcb_error_t immerr)
     instance->callbacks.pktfwd(instance, MCREQ_PKT_COOKIE(req), immerr, &resp);
 }
 
+/**
+ * Drop the near cache's entry for the key of a request which modifies (or
+ * locks) an item
+ */
+static void
+invalidate_nearcache(mc_PIPELINE *pipeline, mc_PACKET *req, lcb_U8 opcode)
+{
+    lcb_t instance = get_instance(pipeline);
+    if (!instance->nearcache) {
+        return;
+    }
+
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GET_META:
+    case PROTOCOL_BINARY_CMD_GET_REPLICA:
+    case PROTOCOL_BINARY_CMD_SUBDOC_GET:
+    case PROTOCOL_BINARY_CMD_SUBDOC_EXISTS:
+    case PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT:
+    case PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP:
+    case PROTOCOL_BINARY_CMD_OBSERVE:
+    case PROTOCOL_BINARY_CMD_OBSERVE_SEQNO:
+    case PROTOCOL_BINARY_CMD_STAT:
+    case PROTOCOL_BINARY_CMD_VERSION:
+    case PROTOCOL_BINARY_CMD_VERBOSITY:
+    case PROTOCOL_BINARY_CMD_NOOP:
+    case PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG:
+        break;
+
+    case PROTOCOL_BINARY_CMD_FLUSH:
+        instance->nearcache->clear();
+        break;
+
+    default:
+        instance->nearcache->invalidate(req);
+        break;
+    }
+}
+
 int
 mcreq_dispatch_response(
         mc_PIPELINE *pipeline, mc_PACKET *req, MemcachedResponse *res,
         lcb_error_t immerr)
 {
-    record_metrics(pipeline, req, res);
+    record_metrics(pipeline, req, res, immerr);
+    invalidate_nearcache(pipeline, req, res->opcode());
 
     if (req->flags & MCREQ_F_UFWD) {
         dispatch_ufwd_error(pipeline, req, immerr);
@@ -862,6 +981,9 @@ mcreq_dispatch_response(
     case PROTOCOL_BINARY_CMD_GET_REPLICA:
         INVOKE_OP(H_getreplica);
 
+    case PROTOCOL_BINARY_CMD_GET_META:
+        INVOKE_OP(H_getmeta);
+
     case PROTOCOL_BINARY_CMD_UNLOCK_KEY:
         INVOKE_OP(H_unlock);
 
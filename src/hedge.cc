@@ -0,0 +1,219 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "hedge.h"
+#include <algorithm>
+#include <string>
+
+#define LOGARGS(instance, lvl) (instance)->settings, "hedge", LCB_LOG_##lvl, __FILE__, __LINE__
+
+/* Maximum number of replica reads which may be sent in a burst */
+#define HEDGE_MAX_TOKENS 10.0
+
+namespace lcb {
+struct HedgeCookie : mc_REQDATAEX, lcb_list_t {
+    HedgeCookie(const void *cookie, lcb_t instance, int vb);
+    ~HedgeCookie() { lcb_list_delete(this); }
+
+    void incref() { refcount++; }
+    void decref() {
+        if (!--refcount) {
+            delete this;
+        }
+    }
+
+    lcb_t instance;
+    std::string key;
+    unsigned refcount;
+    int vbucket;
+    bool done; /**< Set once a response has been delivered (or failed) */
+};
+}
+
+using namespace lcb;
+
+static void
+hedge_callback(mc_PIPELINE *, mc_PACKET *pkt, lcb_error_t err, const void *arg)
+{
+    HedgeCookie *hc = static_cast<HedgeCookie*>(pkt->u_rdata.exdata);
+    lcb_RESPGET *resp = reinterpret_cast<lcb_RESPGET*>(const_cast<void*>(arg));
+    lcb_t instance = hc->instance;
+    protocol_binary_request_header hdr;
+
+    mcreq_read_hdr(pkt, &hdr);
+    bool is_replica = hdr.request.opcode == PROTOCOL_BINARY_CMD_GET_REPLICA;
+
+    /* The active node's response is always conclusive. A replica's response
+     * is only used if successful, since the replica may simply not have the
+     * item yet */
+    if (!hc->done && (!is_replica || err == LCB_SUCCESS)) {
+        hc->done = true;
+        if (is_replica && instance->hedger) {
+            instance->hedger->nwon++;
+        }
+        resp->rflags |= LCB_RESP_F_FINAL;
+        lcb_RESPCALLBACK callback = lcb_find_callback(instance, LCB_CALLBACK_GET);
+        callback(instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)resp);
+    }
+    hc->decref();
+}
+
+static void
+hedge_dtor(mc_PACKET *pkt)
+{
+    HedgeCookie *hc = static_cast<HedgeCookie*>(pkt->u_rdata.exdata);
+    /* Scheduling failed. Make sure we don't send a replica read for it */
+    hc->done = true;
+    hc->decref();
+}
+
+static mc_REQDATAPROCS hedge_procs = {
+        hedge_callback,
+        hedge_dtor
+};
+
+HedgeCookie::HedgeCookie(const void *cookie_, lcb_t instance_, int vbucket_)
+    : mc_REQDATAEX(cookie_, hedge_procs, gethrtime()),
+      instance(instance_), refcount(1), vbucket(vbucket_), done(false) {
+}
+
+Hedger::Hedger(lcb_t instance_)
+    : nissued(0), nwon(0), instance(instance_), tokens(HEDGE_MAX_TOKENS),
+      timer(instance_->iotable, this)
+{
+    lcb_list_init(&live);
+}
+
+Hedger::~Hedger()
+{
+    lcb_list_t *ll, *ll_next;
+    LCB_LIST_SAFE_FOR(ll, ll_next, &live) {
+        delete static_cast<HedgeCookie*>(ll);
+    }
+}
+
+void
+Hedger::add(Server *server, mc_PACKET *pkt, const void *cookie)
+{
+    protocol_binary_request_header hdr;
+    mcreq_read_hdr(pkt, &hdr);
+
+    HedgeCookie *hc = new HedgeCookie(cookie, instance, ntohs(hdr.request.vbucket));
+    lcb_list_append(&live, hc);
+    pkt->u_rdata.exdata = hc;
+    pkt->flags |= MCREQ_F_REQEXT;
+
+    /* Each hedgeable read earns a fraction of a replica read */
+    tokens = std::min(HEDGE_MAX_TOKENS,
+        tokens + LCBT_SETTING(instance, hedge_budget) / 100.0);
+
+    lcb_U32 budget = server->latency.percentile(
+        LCBT_SETTING(instance, hedge_percentile));
+    if (!budget) {
+        /* Don't know enough about this server yet */
+        return;
+    }
+
+    const void *key;
+    lcb_SIZE nkey;
+    mcreq_get_key(pkt, &key, &nkey);
+    hc->key.assign(static_cast<const char*>(key), nkey);
+
+    Entry ent;
+    ent.deadline = hc->start + LCB_US2NS(budget);
+    ent.cookie = hc;
+    hc->incref();
+
+    pending.push_back(ent);
+    std::push_heap(pending.begin(), pending.end());
+    if (pending.front().cookie == hc) {
+        timer.rearm(budget);
+    }
+}
+
+void
+Hedger::hedge(HedgeCookie *hc)
+{
+    mc_CMDQUEUE *cq = &instance->cmdq;
+    if (!cq->config || tokens < 1) {
+        return;
+    }
+
+    std::vector<unsigned> order;
+    if (!rank_replicas(cq, hc->vbucket, order)) {
+        return;
+    }
+    int ix = lcbvb_vbreplica(cq->config, hc->vbucket, order[0]);
+
+    mc_PIPELINE *pl = cq->pipelines[ix];
+    mc_PACKET *pkt = mcreq_allocate_packet(pl);
+    if (!pkt) {
+        return;
+    }
+
+    lcb_KEYBUF kb;
+    LCB_KREQ_SIMPLE(&kb, hc->key.c_str(), hc->key.size());
+
+    protocol_binary_request_header req = {{ 0 }};
+    req.request.magic = PROTOCOL_BINARY_REQ;
+    req.request.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+    req.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    req.request.vbucket = htons((lcb_uint16_t)hc->vbucket);
+    req.request.keylen = htons((lcb_uint16_t)hc->key.size());
+    req.request.bodylen = htonl((lcb_uint32_t)hc->key.size());
+
+    pkt->u_rdata.exdata = hc;
+    pkt->flags |= MCREQ_F_REQEXT;
+    mcreq_reserve_key(pl, pkt, sizeof(req.bytes), &kb);
+    req.request.opaque = pkt->opaque;
+    mcreq_write_hdr(pkt, &req);
+
+    hc->incref();
+    tokens -= 1;
+    nissued++;
+    mcreq_sched_add(pl, pkt);
+}
+
+void
+Hedger::run()
+{
+    hrtime_t now = gethrtime();
+    bool scheduled = false;
+
+    while (!pending.empty() && pending.front().deadline <= now) {
+        HedgeCookie *hc = pending.front().cookie;
+        std::pop_heap(pending.begin(), pending.end());
+        pending.pop_back();
+
+        if (!hc->done) {
+            if (!scheduled) {
+                mcreq_sched_enter(&instance->cmdq);
+                scheduled = true;
+            }
+            hedge(hc);
+        }
+        hc->decref();
+    }
+
+    if (scheduled) {
+        mcreq_sched_leave(&instance->cmdq, 1);
+    }
+    if (!pending.empty()) {
+        timer.rearm(LCB_NS2US(pending.front().deadline - now));
+    }
+}
@@ -0,0 +1,84 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_HEDGE_H
+#define LCB_HEDGE_H
+
+#include <lcbio/timer-cxx.h>
+#include <mc/mcreq.h>
+#include "list.h"
+#include <vector>
+
+/**
+ * @file
+ * @brief Hedged reads
+ *
+ * @details
+ * A GET scheduled with @ref LCB_CMDGET_F_HEDGE is given a deadline based on
+ * the recent latency of its active node. If the active node has not responded
+ * by then, a GET_REPLICA is sent as well, and whichever successful response
+ * arrives first is delivered to the user.
+ */
+
+namespace lcb {
+class Server;
+struct HedgeCookie;
+
+class Hedger {
+public:
+    Hedger(lcb_t instance);
+    ~Hedger();
+
+    /**
+     * Make the given GET packet hedged. This must be called before the packet
+     * is scheduled.
+     * @param server the server the packet is being sent to
+     * @param pkt the packet
+     * @param cookie the user's cookie
+     */
+    void add(Server *server, mc_PACKET *pkt, const void *cookie);
+
+    /** Send replica reads for all packets past their deadline */
+    void run();
+
+    lcb_U64 nissued; /**< Number of replica reads sent */
+    lcb_U64 nwon; /**< Number of replica reads which were used */
+
+private:
+    struct Entry {
+        hrtime_t deadline;
+        HedgeCookie *cookie;
+        bool operator<(const Entry& other) const {
+            return deadline > other.deadline;
+        }
+    };
+
+    void hedge(HedgeCookie *hc);
+
+    lcb_t instance;
+    double tokens; /**< Replica reads currently allowed by the budget */
+    std::vector<Entry> pending; /**< Min-heap, by deadline */
+    lcb::io::Timer<Hedger, &Hedger::run> timer;
+
+    /** All cookies still referenced by a packet or by #pending. Packets
+     * which are still in flight when the instance is destroyed are never
+     * completed, so their cookies are released from here */
+    lcb_list_t live;
+};
+}
+
+#endif
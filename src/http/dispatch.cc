@@ -0,0 +1,247 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "http/http-priv.h"
+#include "dispatch.h"
+#include <algorithm>
+#include <stdio.h>
+
+using namespace lcb::http;
+
+Dispatcher::Dispatcher(lcb_t instance_)
+    : instance(instance_), rotation(0), last_quota(0),
+      timer(instance_->iotable, this)
+{
+}
+
+Dispatcher *
+Dispatcher::get(lcb_t instance)
+{
+    if (!instance->http_dispatcher) {
+        instance->http_dispatcher = new Dispatcher(instance);
+    }
+    return instance->http_dispatcher;
+}
+
+/* Node name in the same form as Request::host and Request::port */
+static std::string
+node_name(lcbvb_CONFIG *vbc, unsigned ix, unsigned port)
+{
+    std::string host(lcbvb_get_hostname(vbc, ix));
+    if (host.size() > 2 && host[0] == '[' && host[host.size()-1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    char buf[16];
+    sprintf(buf, ":%u", port);
+    return host + buf;
+}
+
+hrtime_t
+Dispatcher::cost(const std::string& name, hrtime_t deflatency) const
+{
+    size_t load = 1;
+    std::map<std::string, Node>::const_iterator it = nodes.find(name);
+    if (it != nodes.end()) {
+        load += it->second.outstanding + it->second.waiting.size();
+    }
+
+    std::map<std::string, hrtime_t>::const_iterator lit = latencies.find(name);
+    return load * (lit != latencies.end() ? lit->second : deflatency);
+}
+
+bool
+Dispatcher::quota_full(unsigned id, const std::string& name) const
+{
+    std::map<unsigned, Quota>::const_iterator it = quotas.find(id);
+    if (it == quotas.end()) {
+        return false;
+    }
+    std::map<std::string, unsigned>::const_iterator nit =
+            it->second.inflight.find(name);
+    return nit != it->second.inflight.end() && nit->second >= it->second.per_node;
+}
+
+int
+Dispatcher::select(lcbvb_CONFIG *vbc, lcbvb_SVCTYPE svc, lcbvb_SVCMODE mode,
+    const int *used, unsigned quota)
+{
+    unsigned nsrv = LCBVB_NSERVERS(vbc);
+    int best = -1;
+    hrtime_t best_cost = 0;
+
+    /* Nodes without any completed requests are assumed to be as fast as the
+     * fastest of the others */
+    hrtime_t deflatency = 0;
+    std::map<std::string, hrtime_t>::const_iterator lit;
+    for (lit = latencies.begin(); lit != latencies.end(); ++lit) {
+        if (!deflatency || lit->second < deflatency) {
+            deflatency = lit->second;
+        }
+    }
+    if (!deflatency) {
+        deflatency = 1;
+    }
+
+    /* Start at a different node each time, so that ties are spread evenly.
+     * The quota is ignored (in the second pass) if it is used up everywhere */
+    for (int pass = quota ? 0 : 1; pass < 2 && best == -1; pass++) {
+        for (unsigned ii = 0; ii < nsrv; ii++) {
+            unsigned ix = (rotation + ii) % nsrv;
+            unsigned port = lcbvb_get_port(vbc, ix, svc, mode);
+            if ((used && used[ix]) || !port || !lcbvb_get_resturl(vbc, ix, svc, mode)) {
+                continue;
+            }
+
+            std::string name = node_name(vbc, ix, port);
+            if (pass == 0 && quota_full(quota, name)) {
+                continue;
+            }
+            hrtime_t cur = cost(name, deflatency);
+            if (best == -1 || cur < best_cost) {
+                best = ix;
+                best_cost = cur;
+            }
+        }
+    }
+    rotation++;
+    return best;
+}
+
+unsigned
+Dispatcher::create_quota(unsigned per_node)
+{
+    /* Skip 0, which means no quota, when wrapping around */
+    if (!++last_quota) {
+        ++last_quota;
+    }
+    quotas[last_quota].per_node = per_node;
+    return last_quota;
+}
+
+void
+Dispatcher::destroy_quota(unsigned id)
+{
+    quotas.erase(id);
+}
+
+bool
+Dispatcher::quota_available(lcbvb_CONFIG *vbc, lcbvb_SVCTYPE svc,
+    lcbvb_SVCMODE mode, unsigned id) const
+{
+    bool found = false;
+    for (unsigned ix = 0; ix < LCBVB_NSERVERS(vbc); ix++) {
+        unsigned port = lcbvb_get_port(vbc, ix, svc, mode);
+        if (!port || !lcbvb_get_resturl(vbc, ix, svc, mode)) {
+            continue;
+        }
+        if (!quota_full(id, node_name(vbc, ix, port))) {
+            return true;
+        }
+        found = true;
+    }
+    return !found;
+}
+
+bool
+Dispatcher::acquire(Request *req, const std::string& name)
+{
+    lcb_U32 limit = LCBT_SETTING(instance, http_maxconcurrent);
+    Node& node = nodes[name];
+
+    std::map<unsigned, Quota>::iterator qit = quotas.find(req->dispatch_quota);
+    if (qit != quotas.end()) {
+        qit->second.inflight[name]++;
+    }
+
+    /* Don't overtake requests which are already waiting */
+    if (limit && (node.outstanding >= limit || !node.waiting.empty())) {
+        node.waiting.push_back(req);
+        return false;
+    }
+    node.outstanding++;
+    req->dispatch_start = gethrtime();
+    return true;
+}
+
+void
+Dispatcher::release(Request *req, const std::string& name, bool queued)
+{
+    std::map<unsigned, Quota>::iterator qit = quotas.find(req->dispatch_quota);
+    if (qit != quotas.end()) {
+        std::map<std::string, unsigned>::iterator nit = qit->second.inflight.find(name);
+        if (nit != qit->second.inflight.end() && !--nit->second) {
+            qit->second.inflight.erase(nit);
+        }
+    }
+
+    std::map<std::string, Node>::iterator it = nodes.find(name);
+    if (it == nodes.end()) {
+        return;
+    }
+
+    Node& node = it->second;
+    if (queued) {
+        std::deque<Request*>::iterator ii =
+                std::find(node.waiting.begin(), node.waiting.end(), req);
+        if (ii != node.waiting.end()) {
+            node.waiting.erase(ii);
+        }
+    } else {
+        hrtime_t elapsed = gethrtime() - req->dispatch_start;
+        hrtime_t& avg = latencies[name];
+        avg = avg ? avg - avg / 8 + elapsed / 8 : elapsed + 1;
+
+        node.outstanding--;
+        if (!node.waiting.empty()) {
+            /* Don't start requests from within the completion of another */
+            timer.signal();
+        }
+    }
+
+    if (!node.outstanding && node.waiting.empty()) {
+        nodes.erase(it);
+    }
+}
+
+void
+Dispatcher::dispatch()
+{
+    lcb_U32 limit = LCBT_SETTING(instance, http_maxconcurrent);
+    std::vector<Request*> ready;
+
+    /* Collect them first, since starting a request may fail and complete it
+     * (and others) */
+    std::map<std::string, Node>::iterator it;
+    for (it = nodes.begin(); it != nodes.end(); ++it) {
+        Node& node = it->second;
+        while (!node.waiting.empty() && (!limit || node.outstanding < limit)) {
+            Request *req = node.waiting.front();
+            node.waiting.pop_front();
+            node.outstanding++;
+            req->dispatch_queued = false;
+            req->dispatch_start = gethrtime();
+            req->incref();
+            ready.push_back(req);
+        }
+    }
+
+    for (size_t ii = 0; ii < ready.size(); ii++) {
+        ready[ii]->start_queued();
+        ready[ii]->decref();
+    }
+}
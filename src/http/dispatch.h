@@ -0,0 +1,145 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_HTTP_DISPATCH_H
+#define LCB_HTTP_DISPATCH_H
+
+#include <libcouchbase/couchbase.h>
+#include <libcouchbase/vbucket.h>
+#include <lcbio/timer-cxx.h>
+#include <deque>
+#include <map>
+#include <string>
+
+/**
+ * @file
+ * @brief Distribution of data API requests over the nodes
+ *
+ * @details
+ * View, N1QL and full-text requests are sent to the node (with the
+ * requested service) where they are expected to complete soonest: the one
+ * with the lowest product of the requests in progress (plus one) and the
+ * moving average of its recent request times. A slow node therefore does not
+ * accumulate a backlog while others are idle.
+ *
+ * When @ref LCB_CNTL_HTTP_MAXCONCURRENT is set, a request which would exceed
+ * the limit for its node waits in a queue for that node. Queued requests are
+ * started in the order they were made, as earlier requests complete.
+ *
+ * A caller may also limit its own requests on each node with a quota (see
+ * Dispatcher::create_quota()). Requests made with a quota are placed on the
+ * nodes where it is not used up.
+ */
+
+namespace lcb {
+namespace http {
+
+struct Request;
+
+class Dispatcher {
+public:
+    Dispatcher(lcb_t instance);
+
+    /** Get the instance's Dispatcher, creating it if necessary */
+    static Dispatcher *get(lcb_t instance);
+
+    /**
+     * Select the node for a request
+     * @param vbc the current configuration
+     * @param svc the service of the request
+     * @param mode the service mode (plain or SSL)
+     * @param used nodes which must not be selected (non-zero entries). May be
+     *        NULL
+     * @param quota the quota of the request, or 0. Nodes where it is used up
+     *        are only selected if no other node can be
+     * @return the index of the node, or -1 if no node has the service
+     */
+    int select(lcbvb_CONFIG *vbc, lcbvb_SVCTYPE svc, lcbvb_SVCMODE mode,
+        const int *used, unsigned quota = 0);
+
+    /**
+     * Create a quota, limiting the requests of one caller (such as a group of
+     * N1QL statements) in progress on each node. A request made with the
+     * quota (see Request::dispatch_quota) is counted against its node from
+     * acquire() until release().
+     * @param per_node the number of requests allowed on each node
+     * @return the identifier of the quota, which is never 0
+     */
+    unsigned create_quota(unsigned per_node);
+
+    /** Remove a quota. Its requests still in progress are no longer counted */
+    void destroy_quota(unsigned id);
+
+    /**
+     * Whether a request may be made with a quota without exceeding it on the
+     * node it would be sent to. This is also true if no node has the service,
+     * so that the request fails rather than waiting
+     */
+    bool quota_available(lcbvb_CONFIG *vbc, lcbvb_SVCTYPE svc,
+        lcbvb_SVCMODE mode, unsigned id) const;
+
+    /**
+     * Count a request as in progress on a node (and against its quota)
+     * @param req the request
+     * @param node the node, as `host:port`
+     * @return true if the request may be started, false if it was queued.
+     * Request::start_queued() is invoked once it may be started.
+     */
+    bool acquire(Request *req, const std::string& node);
+
+    /**
+     * Called when a request passed to acquire() has completed (or is being
+     * sent elsewhere)
+     * @param queued whether the request is still queued
+     */
+    void release(Request *req, const std::string& node, bool queued);
+
+private:
+    struct Node {
+        Node() : outstanding(0) {}
+        unsigned outstanding; /**< Requests which have been started */
+        std::deque<Request*> waiting;
+    };
+    struct Quota {
+        unsigned per_node;
+        /** Requests acquired (including queued ones) on each node */
+        std::map<std::string, unsigned> inflight;
+    };
+
+    void dispatch();
+
+    /** Whether a quota has no room left on a node */
+    bool quota_full(unsigned id, const std::string& name) const;
+
+    /** Expected time for a new request on a node, relative to other nodes */
+    hrtime_t cost(const std::string& name, hrtime_t deflatency) const;
+
+    lcb_t instance;
+    std::map<std::string, Node> nodes;
+    /** Moving average of the time (in nanoseconds) taken by the requests of
+     * each node. Unlike #nodes, this is kept while a node is idle */
+    std::map<std::string, hrtime_t> latencies;
+    unsigned rotation; /**< First node considered by select() */
+    std::map<unsigned, Quota> quotas;
+    unsigned last_quota; /**< Identifier of the last quota created */
+    lcb::io::Timer<Dispatcher, &Dispatcher::dispatch> timer;
+};
+
+}
+}
+
+#endif
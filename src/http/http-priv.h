@@ -25,6 +25,7 @@
 #include <lcbht/lcbht.h>
 #include "contrib/http_parser/http_parser.h"
 #include "http.h"
+#include <deque>
 #include <string>
 #include <vector>
 #include <set>
@@ -32,6 +33,8 @@
 namespace lcb {
 namespace http {
 
+class Dispatcher;
+
 // Simple object for header key and value
 struct Header {
     std::string key;
@@ -41,6 +44,52 @@ struct Header {
     }
 };
 
+/**
+ * Accumulates the body of a non-chunked response.
+ *
+ * Body fragments are left in the read buffers they were received into, which
+ * are pinned (see rdb_seg_ref()) until the response has been delivered. If
+ * the body arrived in a single fragment it is passed to the callback as-is;
+ * otherwise the fragments are copied once into a buffer of the final size.
+ */
+class ResponseBody {
+public:
+    ResponseBody() : nbytes(0), expected(0) {}
+    ~ResponseBody() { clear(); }
+
+    /** Size hint, from the Content-Length of the response */
+    void expect(size_t n) { expected = n; }
+
+    /**
+     * Add a body fragment
+     * @param seg the read buffer containing the fragment. If NULL (or if the
+     *        fragment does not lie within it) the fragment is copied
+     * @param buf the fragment
+     * @param n the size of the fragment
+     */
+    void add(rdb_ROPESEG *seg, const char *buf, size_t n);
+
+    /** Get the complete body. Valid until the next call to add() or clear() */
+    void get(const char **buf, size_t *n);
+
+    /** Release all the fragments */
+    void clear();
+
+private:
+    struct Fragment {
+        rdb_ROPESEG *seg;
+        const char *buf;
+        size_t n;
+    };
+
+    void flatten();
+
+    std::vector<Fragment> fragments; /**< Pinned fragments, after `joined` */
+    std::string joined; /**< Fragments which have already been copied */
+    size_t nbytes; /**< Total size of the body */
+    size_t expected;
+};
+
 struct Request {
     /**
      * Initializes the request. This simply copies the relevant fields from the
@@ -49,9 +98,13 @@ struct Request {
      */
     inline Request(lcb_t instance, const void *cookie, const lcb_CMDHTTP* cmd);
 
-    /** Creates a new request object and verifies the input (setup_inputs()) */
+    /**
+     * Creates a new request object and verifies the input (setup_inputs())
+     * @param quota the Dispatcher quota to count the request against, or 0
+     *        (see Dispatcher::create_quota())
+     */
     static Request * create(lcb_t instance, const void *cookie,
-        const lcb_CMDHTTP *cmd, lcb_error_t *rc);
+        const lcb_CMDHTTP *cmd, lcb_error_t *rc, unsigned quota = 0);
 
     /** Pause IO on this request */
     void pause();
@@ -139,6 +192,45 @@ struct Request {
         request_headers.push_back(Header(key, value));
     }
 
+    /** Whether the body is sent from the caller's buffers or from a
+     * callback (LCB_CMDHTTP_F_BODYIOV or LCB_CMDHTTP_F_BODYSTREAM) */
+    bool is_body_streamed() const {
+        return !body_iov.empty() || body_source.read != NULL;
+    }
+
+    /** Whether the body was (at least partially) read from body_source, in
+     * which case it cannot be sent again */
+    bool is_body_consumed() const {
+        return upload_pulled || upload_eof;
+    }
+
+    /** Whether the whole of a streamed body (including the final chunk, if
+     * chunked) has been written. If not, the server may have responded
+     * early, and the rest of the body must not reach the next request on
+     * the connection */
+    bool is_upload_done() const {
+        return upload.empty() && !upload_submitted &&
+            (!body_source.read || upload_eof);
+    }
+
+    /** Begin writing a request with a streamed body on the current context */
+    void start_upload();
+
+    /** Write as much of the request as possible. This is the flush_ready
+     * handler for requests with a streamed body */
+    void flush_upload();
+
+    /** Handle the completion of a write issued by flush_upload() */
+    void upload_flushed(lcbio_CTX *ctx, unsigned expected, unsigned actual);
+
+    /**
+     * Read the next part of the body from body_source, and append it to
+     * ::upload
+     * @return true if data was added, false if the body is complete (or an
+     * error occurred)
+     */
+    bool pull_body();
+
     // Helper methods to populate request buffer
     inline void add_to_preamble(const char *);
     inline void add_to_preamble(const std::string&);
@@ -151,6 +243,18 @@ struct Request {
      */
     lcb_error_t start_io(lcb_host_t&);
 
+    /** Request a connection to the destination from the pool */
+    lcb_error_t connect(lcb_host_t&);
+
+    /** Get the instance's Dispatcher, creating it if necessary */
+    Dispatcher *get_dispatcher();
+
+    /** Called by the Dispatcher when a queued request may be started */
+    void start_queued();
+
+    /** No longer count this request against its node in the Dispatcher */
+    void release_node();
+
     /**
      * Release any I/O resources attached to this request.
      */
@@ -225,6 +329,13 @@ struct Request {
 
     const std::vector<char> body; /**< Input body (for POST/PUT) */
 
+    /** Caller's body buffers, for LCB_CMDHTTP_F_BODYIOV */
+    std::vector<lcb_IOV> body_iov;
+
+    /** Body source for LCB_CMDHTTP_F_BODYSTREAM. Its callback is NULL
+     * otherwise */
+    lcb_HTTPBODYSOURCE body_source;
+
     /** Request buffer (excluding body). Reassembled from inputs */
     std::vector<char> preamble;
 
@@ -243,6 +354,12 @@ struct Request {
      */
     bool passed_data;
 
+    /**
+     * Whether the request was made to a specific node (via lcb_CMDHTTP::host),
+     * in which case it is not retried on another node
+     */
+    bool fixed_node;
+
     /** Sparse map indicating which nodes the request was already sent to */
     std::vector<int> used_nodes;
 
@@ -308,8 +425,28 @@ struct Request {
     /** HTTP Protocol parser */
     lcb::htparse::Parser* parser;
 
+    /** Body of the current response, if not chunked */
+    ResponseBody response_body;
+
     /** overrides default timeout if nonzero */
     const uint32_t user_timeout;
+
+    // State for requests with a streamed body. See start_upload()
+    std::deque<lcb_IOV> upload; /**< Buffers which are yet to be written */
+    size_t upload_submitted; /**< Bytes at the front of ::upload being written */
+    size_t upload_pulled; /**< Bytes read from ::body_source */
+    bool upload_eof; /**< ::body_source has supplied the entire body */
+    std::vector<char> upload_chunk; /**< Last part read from ::body_source */
+    char upload_chunkhdr[16]; /**< Chunk header for ::upload_chunk */
+    lcbio_pTIMER upload_timer; /**< Resumes writing (completion I/O only) */
+
+    /** Node (`host:port`) this request is counted against in the
+     * Dispatcher. Empty if none */
+    std::string dispatch_node;
+    bool dispatch_queued; /**< Waiting for the Dispatcher to start it */
+    unsigned dispatch_quota; /**< Dispatcher quota of this request, or 0 */
+    lcb_host_t queued_host; /**< Destination of a queued request */
+    hrtime_t dispatch_start; /**< When the Dispatcher started the request */
 };
 
 } // namespace: http
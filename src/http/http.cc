@@ -19,6 +19,7 @@
 #include "bucketconfig/clconfig.h"
 #include "http/http.h"
 #include "http/http-priv.h"
+#include "http/dispatch.h"
 using namespace lcb::http;
 
 #define LOGFMT "<%s:%s> "
@@ -51,6 +52,11 @@ Request::decref()
         timer = NULL;
     }
 
+    if (upload_timer) {
+        lcbio_timer_destroy(upload_timer);
+        upload_timer = NULL;
+    }
+
     delete this;
 }
 
@@ -67,6 +73,11 @@ Request::finish_or_retry(lcb_error_t rc)
         finish(rc);
         return;
     }
+    if (is_body_consumed()) {
+        lcb_log(LOGARGS(this, WARN), LOGFMT "Not retrying. Body already read from the caller", LOGID(this));
+        finish(rc);
+        return;
+    }
 
     // Not a 'data API'. Request may be node-specific
     if (!is_data_request()) {
@@ -74,6 +85,11 @@ Request::finish_or_retry(lcb_error_t rc)
         finish(rc);
         return;
     }
+    if (fixed_node) {
+        lcb_log(LOGARGS(this, WARN), LOGFMT "Not retrying. Request is for a specific node", LOGID(this));
+        finish(rc);
+        return;
+    }
 
     // See if we can find an API node.
     const char *nextnode = get_api_node();
@@ -165,6 +181,7 @@ Request::finish(lcb_error_t error)
     }
 
     status |= FINISHED;
+    release_node();
 
     if (!(status & NOLCB)) {
         /* Remove from wait queue */
@@ -252,6 +269,7 @@ Request::submit()
         // was a success
         if (parser) {
             parser->reset();
+            response_body.clear();
         } else {
             parser = new lcb::htparse::Parser(instance->settings);
         }
@@ -342,6 +360,12 @@ Request::redirect()
         }
     }
 
+    if (is_body_consumed()) {
+        lcb_log(LOGARGS(this, WARN), LOGFMT "Not following redirect. Body already read from the caller", LOGID(this));
+        finish(LCB_HTTP_ERROR);
+        return;
+    }
+
     memset(&url_info, 0, sizeof url_info);
     url = pending_redirect;
     pending_redirect.clear();
@@ -396,7 +420,7 @@ Request::get_api_node(lcb_error_t &rc)
     }
     used_nodes.resize(LCBVB_NSERVERS(vbc));
 
-    int ix = lcbvb_get_randhost_ex(vbc, svc, mode, &used_nodes[0]);
+    int ix = get_dispatcher()->select(vbc, svc, mode, &used_nodes[0], dispatch_quota);
     if (ix < 0) {
         rc = LCB_NOT_SUPPORTED;
         return NULL;
@@ -410,7 +434,7 @@ Request::setup_inputs(const lcb_CMDHTTP *cmd)
 {
     const char *base = NULL, *username, *password;
     size_t nbase = 0;
-    lcb_error_t rc;
+    lcb_error_t rc = LCB_SUCCESS;
 
     if (method > LCB_HTTP_METHOD_MAX) {
         return LCB_EINVAL;
@@ -424,7 +448,7 @@ Request::setup_inputs(const lcb_CMDHTTP *cmd)
             return LCB_EINVAL;
         }
     } else {
-        if (cmd->host) {
+        if (cmd->host && !is_data_request()) {
             return LCB_EINVAL;
         }
         if (cmd->cmdflags & LCB_CMDHTTP_F_NOUPASS) {
@@ -438,7 +462,12 @@ Request::setup_inputs(const lcb_CMDHTTP *cmd)
             }
         }
 
-        base = get_api_node(rc);
+        if (cmd->host) {
+            base = cmd->host;
+            fixed_node = true;
+        } else {
+            base = get_api_node(rc);
+        }
         if (base == NULL || *base == '\0') {
             if (rc == LCB_SUCCESS) {
                 return LCB_EINTERNAL;
@@ -475,10 +504,33 @@ Request::setup_inputs(const lcb_CMDHTTP *cmd)
         add_header("Authorization", std::string("Basic ") + auth);
     }
 
-    if (!body.empty()) {
+    if ((cmd->cmdflags & LCB_CMDHTTP_F_BODYIOV) &&
+            (cmd->cmdflags & LCB_CMDHTTP_F_BODYSTREAM)) {
+        return LCB_EINVAL;
+    }
+    if ((cmd->cmdflags & LCB_CMDHTTP_F_BODYSTREAM) && body_source.read == NULL) {
+        return LCB_EINVAL;
+    }
+    if ((cmd->cmdflags & LCB_CMDHTTP_F_BODYIOV) && cmd->nbody && !cmd->body) {
+        return LCB_EINVAL;
+    }
+
+    size_t nbody = body.size();
+    for (size_t ii = 0; ii < body_iov.size(); ii++) {
+        nbody += body_iov[ii].iov_len;
+    }
+    if (body_source.read) {
+        nbody = body_source.length;
+    }
+
+    if (body_source.read && !nbody) {
+        add_header("Transfer-Encoding", "chunked");
+    } else if (nbody) {
         char lenbuf[64];
-        sprintf(lenbuf, "%ld", body.size());
+        sprintf(lenbuf, "%lu", (unsigned long)nbody);
         add_header("Content-Length", lenbuf);
+    }
+    if (nbody || body_source.read) {
         if (cmd->content_type) {
             add_header("Content-Type", cmd->content_type);
         }
@@ -489,7 +541,8 @@ Request::setup_inputs(const lcb_CMDHTTP *cmd)
 
 Request::Request(lcb_t instance_, const void *cookie, const lcb_CMDHTTP* cmd)
 : instance(instance_),
-  body(cmd->body, cmd->body + cmd->nbody),
+  body(cmd->cmdflags & (LCB_CMDHTTP_F_BODYIOV|LCB_CMDHTTP_F_BODYSTREAM) ?
+      std::vector<char>() : std::vector<char>(cmd->body, cmd->body + cmd->nbody)),
   method(cmd->method),
   chunked(cmd->cmdflags & LCB_CMDHTTP_F_STREAM),
   paused(false),
@@ -497,6 +550,7 @@ Request::Request(lcb_t instance_, const void *cookie, const lcb_CMDHTTP* cmd)
   refcount(1),
   redircount(0),
   passed_data(false),
+  fixed_node(false),
   last_vbcrev(-1),
   reqtype(cmd->type),
   status(ONGOING),
@@ -505,9 +559,28 @@ Request::Request(lcb_t instance_, const void *cookie, const lcb_CMDHTTP* cmd)
   ioctx(NULL),
   timer(NULL),
   parser(NULL),
-  user_timeout(cmd->cmdflags & LCB_CMDHTTP_F_CASTMO ? cmd->cas : 0)
+  user_timeout(cmd->cmdflags & LCB_CMDHTTP_F_CASTMO ? cmd->cas : 0),
+  upload_submitted(0),
+  upload_pulled(0),
+  upload_eof(false),
+  upload_timer(NULL),
+  dispatch_queued(false),
+  dispatch_quota(0),
+  dispatch_start(0)
 {
     memset(&creq, 0, sizeof creq);
+    memset(&body_source, 0, sizeof body_source);
+
+    if (cmd->cmdflags & LCB_CMDHTTP_F_BODYIOV && cmd->body) {
+        const lcb_IOV *iov = reinterpret_cast<const lcb_IOV*>(cmd->body);
+        for (size_t ii = 0; ii < cmd->nbody; ii++) {
+            if (iov[ii].iov_len) {
+                body_iov.push_back(iov[ii]);
+            }
+        }
+    } else if (cmd->cmdflags & LCB_CMDHTTP_F_BODYSTREAM && cmd->body) {
+        body_source = *reinterpret_cast<const lcb_HTTPBODYSOURCE*>(cmd->body);
+    }
 }
 
 uint32_t
@@ -529,13 +602,14 @@ Request::timeout() const
 
 Request *
 Request::create(lcb_t instance,
-    const void *cookie, const lcb_CMDHTTP *cmd, lcb_error_t *rc)
+    const void *cookie, const lcb_CMDHTTP *cmd, lcb_error_t *rc, unsigned quota)
 {
     Request *req = new Request(instance, cookie, cmd);
     if (!req) {
         *rc = LCB_CLIENT_ENOMEM;
         return NULL;
     }
+    req->dispatch_quota = quota;
 
     *rc = req->setup_inputs(cmd);
     if (*rc != LCB_SUCCESS) {
@@ -19,9 +19,13 @@
 #include "settings.h"
 #include "http-priv.h"
 #include "http.h"
+#include "dispatch.h"
 #include "ctx-log-inl.h"
 #include "sllist.h"
 #include <lcbio/ssl.h>
+#include <lcbio/iotable.h>
+#include <stdlib.h>
+#include <algorithm>
 
 using namespace lcb::http;
 
@@ -43,6 +47,68 @@ Request::assign_response_headers(const lcb::htparse::Response& resp)
     response_headers_clist.push_back(NULL);
 }
 
+void
+ResponseBody::add(rdb_ROPESEG *seg, const char *buf, size_t n)
+{
+    nbytes += n;
+    if (seg == NULL || buf < RDB_SEG_RBUF(seg) ||
+            buf + n > RDB_SEG_RBUF(seg) + seg->nused) {
+        flatten();
+        joined.append(buf, n);
+        return;
+    }
+
+    if (!fragments.empty()) {
+        Fragment& last = fragments.back();
+        if (last.seg == seg && last.buf + last.n == buf) {
+            last.n += n;
+            return;
+        }
+    }
+    Fragment frag = { seg, buf, n };
+    rdb_seg_ref(seg);
+    fragments.push_back(frag);
+}
+
+void
+ResponseBody::flatten()
+{
+    if (fragments.empty()) {
+        return;
+    }
+    joined.reserve(std::max(nbytes, expected));
+    for (size_t ii = 0; ii < fragments.size(); ii++) {
+        joined.append(fragments[ii].buf, fragments[ii].n);
+        rdb_seg_unref(fragments[ii].seg);
+    }
+    fragments.clear();
+}
+
+void
+ResponseBody::get(const char **buf, size_t *n)
+{
+    if (joined.empty() && fragments.size() == 1) {
+        *buf = fragments[0].buf;
+        *n = fragments[0].n;
+        return;
+    }
+    flatten();
+    *buf = joined.c_str();
+    *n = joined.size();
+}
+
+void
+ResponseBody::clear()
+{
+    for (size_t ii = 0; ii < fragments.size(); ii++) {
+        rdb_seg_unref(fragments[ii].seg);
+    }
+    fragments.clear();
+    std::string().swap(joined);
+    nbytes = 0;
+    expected = 0;
+}
+
 int
 Request::handle_parse_chunked(const char *buf, unsigned nbuf)
 {
@@ -61,6 +127,10 @@ Request::handle_parse_chunked(const char *buf, unsigned nbuf)
         /* Got headers now for the first time */
         if (diff & Parser::S_HEADER) {
             assign_response_headers(res);
+            const char *clen = res.get_header_value("Content-Length");
+            if (clen != NULL && !chunked) {
+                response_body.expect(strtoul(clen, NULL, 10));
+            }
             if (res.status >=  300 && res.status <= 400) {
                 const char *redir = res.get_header_value("Location");
                 if (redir != NULL) {
@@ -86,7 +156,8 @@ Request::handle_parse_chunked(const char *buf, unsigned nbuf)
                 callback(instance, LCB_CALLBACK_HTTP, (const lcb_RESPBASE *)&htresp);
 
             } else {
-                res.body.append(rbody, nbody);
+                response_body.add(ioctx ?
+                    rdb_get_first_segment(&ioctx->ior) : NULL, rbody, nbody);
             }
         }
 
@@ -96,22 +167,21 @@ Request::handle_parse_chunked(const char *buf, unsigned nbuf)
 
     if ( (parse_state & Parser::S_DONE) && is_ongoing()) {
         lcb_RESPHTTP resp = { 0 };
-        if (chunked) {
-            buf = NULL;
-            nbuf = 0;
-        } else {
-            buf = res.body.c_str();
-            nbuf = res.body.size();
+        if (!chunked) {
+            const char *rbody;
+            size_t nbody;
+            response_body.get(&rbody, &nbody);
+            resp.body = rbody;
+            resp.nbody = nbody;
         }
 
         init_resp(&resp);
         resp.rflags = LCB_RESP_F_FINAL;
         resp.rc = LCB_SUCCESS;
-        resp.body = buf;
-        resp.nbody = nbuf;
         passed_data = true;
         callback(instance, LCB_CALLBACK_HTTP, (const lcb_RESPBASE*)&resp);
         status |= Request::CBINVOKED;
+        response_body.clear();
     }
     return parse_state;
 }
@@ -214,6 +284,172 @@ request_timed_out(void *arg)
     (reinterpret_cast<Request*>(arg))->finish(LCB_ETIMEDOUT);
 }
 
+static void
+upload_flush_ready(lcbio_CTX *ctx)
+{
+    reinterpret_cast<Request*>(lcbio_ctx_data(ctx))->flush_upload();
+}
+
+static void
+upload_flush_done(lcbio_CTX *ctx, unsigned expected, unsigned actual)
+{
+    Request *req = reinterpret_cast<Request*>(lcbio_ctx_data(ctx));
+    req->upload_flushed(ctx, expected, actual);
+}
+
+static void
+upload_resume(void *arg)
+{
+    Request *req = reinterpret_cast<Request*>(arg);
+    if (req->ioctx) {
+        lcbio_ctx_wwant(req->ioctx);
+        lcbio_ctx_schedule(req->ioctx);
+    }
+}
+
+/* Size of the parts read from lcb_HTTPBODYSOURCE */
+#define UPLOAD_CHUNK_SIZE 16384
+
+void
+Request::start_upload()
+{
+    upload.clear();
+    upload_submitted = 0;
+
+    lcb_IOV iov;
+    iov.iov_base = &preamble[0];
+    iov.iov_len = preamble.size();
+    upload.push_back(iov);
+    upload.insert(upload.end(), body_iov.begin(), body_iov.end());
+
+    lcbio_ctx_wflush(ioctx);
+}
+
+void
+Request::flush_upload()
+{
+    for (;;) {
+        lcb_IOV iov[16];
+        unsigned niov = 0;
+        size_t nb = 0, skip = upload_submitted;
+
+        /* Skip the buffers which are already being written */
+        std::deque<lcb_IOV>::const_iterator ii = upload.begin();
+        for (; ii != upload.end() && niov < 16; ++ii) {
+            if (skip >= ii->iov_len) {
+                skip -= ii->iov_len;
+                continue;
+            }
+            iov[niov].iov_base = reinterpret_cast<char*>(ii->iov_base) + skip;
+            iov[niov].iov_len = ii->iov_len - skip;
+            nb += iov[niov++].iov_len;
+            skip = 0;
+        }
+
+        if (!nb) {
+            /* The chunk buffer may only be reused once it has been written */
+            if (upload_submitted || !pull_body()) {
+                return;
+            }
+            continue;
+        }
+
+        upload_submitted += nb;
+        /* Released by upload_flushed(), which may be invoked after the
+         * context has been closed */
+        incref();
+        if (!lcbio_ctx_put_ex(ioctx, iov, niov, nb)) {
+            lcbio_ctx_wwant(ioctx);
+            return;
+        }
+    }
+}
+
+void
+Request::upload_flushed(lcbio_CTX *ctx, unsigned expected, unsigned actual)
+{
+    if (ctx == ioctx) {
+        upload_submitted -= expected;
+        while (actual) {
+            lcb_IOV& front = upload.front();
+            if (actual < front.iov_len) {
+                front.iov_base = reinterpret_cast<char*>(front.iov_base) + actual;
+                front.iov_len -= actual;
+                break;
+            }
+            actual -= front.iov_len;
+            upload.pop_front();
+        }
+
+        /* For completion-based I/O, flush_upload() returns once everything
+         * has been submitted, and must be invoked again for the rest of the
+         * body. The context cannot be scheduled from here */
+        bool more = !upload.empty() || (body_source.read && !upload_eof);
+        if (!IOT_IS_EVENT(ctx->io) && !upload_submitted && more) {
+            if (!upload_timer) {
+                upload_timer = lcbio_timer_new(io, this, upload_resume);
+            }
+            lcbio_async_signal(upload_timer);
+        }
+    }
+    decref();
+}
+
+bool
+Request::pull_body()
+{
+    static const char crlf[] = "\r\n";
+    static const char lastchunk[] = "0\r\n\r\n";
+
+    if (!body_source.read || upload_eof) {
+        return false;
+    }
+
+    lcb_IOV iov;
+    upload_chunk.resize(UPLOAD_CHUNK_SIZE);
+    lcb_SSIZE nr = body_source.read(body_source.cookie,
+        &upload_chunk[0], upload_chunk.size());
+
+    size_t remaining = body_source.length - upload_pulled;
+    if (nr < 0 || static_cast<size_t>(nr) > upload_chunk.size() ||
+            (body_source.length && (static_cast<size_t>(nr) > remaining ||
+                    (nr == 0 && remaining)))) {
+        lcb_log(LOGARGS(this, ERR), LOGFMT "Body callback failed (returned %ld after %lu bytes)", LOGID(this), (long)nr, (unsigned long)upload_pulled);
+        upload_eof = true;
+        lcbio_ctx_senderr(ioctx, LCB_EINVAL);
+        return false;
+    }
+
+    if (nr == 0) {
+        upload_eof = true;
+        if (body_source.length) {
+            return false;
+        }
+        iov.iov_base = const_cast<char*>(lastchunk);
+        iov.iov_len = sizeof(lastchunk) - 1;
+        upload.push_back(iov);
+        return true;
+    }
+
+    upload_pulled += nr;
+    if (!body_source.length) {
+        iov.iov_base = upload_chunkhdr;
+        iov.iov_len = sprintf(upload_chunkhdr, "%x\r\n", (unsigned)nr);
+        upload.push_back(iov);
+    }
+    iov.iov_base = &upload_chunk[0];
+    iov.iov_len = nr;
+    upload.push_back(iov);
+    if (!body_source.length) {
+        iov.iov_base = const_cast<char*>(crlf);
+        iov.iov_len = sizeof(crlf) - 1;
+        upload.push_back(iov);
+    } else if (upload_pulled == body_source.length) {
+        upload_eof = true;
+    }
+    return true;
+}
+
 static void
 on_connected(lcbio_SOCKET *sock, void *arg, lcb_error_t err, lcbio_OSERR syserr)
 {
@@ -233,11 +469,23 @@ on_connected(lcbio_SOCKET *sock, void *arg, lcb_error_t err, lcbio_OSERR syserr)
 
     procs.cb_err = io_error;
     procs.cb_read = io_read;
+    if (req->is_body_streamed()) {
+        procs.cb_flush_ready = upload_flush_ready;
+        procs.cb_flush_done = upload_flush_done;
+    } else {
+        procs.cb_flush_ready = NULL;
+        procs.cb_flush_done = NULL;
+    }
     req->ioctx = lcbio_ctx_new(sock, arg, &procs);
     req->ioctx->subsys = "mgmt/capi";
-    lcbio_ctx_put(req->ioctx, &req->preamble[0], req->preamble.size());
-    if (!req->body.empty()) {
-        lcbio_ctx_put(req->ioctx, &req->body[0], req->body.size());
+    if (req->is_body_streamed()) {
+        /* Written directly from the buffers, via lcbio_ctx_put_ex() */
+        req->start_upload();
+    } else {
+        lcbio_ctx_put(req->ioctx, &req->preamble[0], req->preamble.size());
+        if (!req->body.empty()) {
+            lcbio_ctx_put(req->ioctx, &req->body[0], req->body.size());
+        }
     }
     lcbio_ctx_rwant(req->ioctx, 1);
     lcbio_ctx_schedule(req->ioctx);
@@ -245,7 +493,7 @@ on_connected(lcbio_SOCKET *sock, void *arg, lcb_error_t err, lcbio_OSERR syserr)
 }
 
 lcb_error_t
-Request::start_io(lcb_host_t& dest)
+Request::connect(lcb_host_t& dest)
 {
     lcbio_MGR *pool = instance->http_sockpool;
     lcbio_pMGRREQ poolreq;
@@ -256,6 +504,28 @@ Request::start_io(lcb_host_t& dest)
     }
 
     LCBIO_CONNREQ_MKPOOLED(&creq, poolreq);
+    return LCB_SUCCESS;
+}
+
+lcb_error_t
+Request::start_io(lcb_host_t& dest)
+{
+    if (is_data_request()) {
+        dispatch_node = host + ":" + port;
+        if (!get_dispatcher()->acquire(this, dispatch_node)) {
+            lcb_log(LOGARGS(this, DEBUG), "<%s> Request queued. Too many in progress", dispatch_node.c_str());
+            dispatch_queued = true;
+            queued_host = dest;
+        }
+    }
+
+    if (!dispatch_queued) {
+        lcb_error_t rc = connect(dest);
+        if (rc != LCB_SUCCESS) {
+            release_node();
+            return rc;
+        }
+    }
 
     if (!timer) {
         timer = lcbio_timer_new(io, this, request_timed_out);
@@ -268,36 +538,99 @@ Request::start_io(lcb_host_t& dest)
     return LCB_SUCCESS;
 }
 
+Dispatcher *
+Request::get_dispatcher()
+{
+    return Dispatcher::get(instance);
+}
+
+void
+Request::start_queued()
+{
+    if (!is_ongoing()) {
+        return;
+    }
+    lcb_error_t rc = connect(queued_host);
+    if (rc != LCB_SUCCESS) {
+        finish_or_retry(rc);
+    }
+}
+
+void
+Request::release_node()
+{
+    if (dispatch_node.empty()) {
+        return;
+    }
+    instance->http_dispatcher->release(this, dispatch_node, dispatch_queued);
+    dispatch_node.clear();
+    dispatch_queued = false;
+}
+
+/* Passed to pool_close_cb() */
+struct KeepAlive {
+    int close_ok; /* whether the connection may be reused */
+    lcb_U32 tmoidle; /* idle time the server allows, or 0 for the pool's */
+};
+
 static void
 pool_close_cb(lcbio_SOCKET *sock, int reusable, void *arg)
 {
-    int close_ok = *(int *)arg;
+    const KeepAlive *ka = reinterpret_cast<const KeepAlive*>(arg);
 
     lcbio_ref(sock);
-    if (reusable && close_ok) {
-        lcbio_mgr_put(sock);
+    if (reusable && ka->close_ok) {
+        lcbio_mgr_put_ex(sock, ka->tmoidle);
     } else {
         lcbio_mgr_discard(sock);
     }
 }
 
+/**
+ * Get the idle timeout indicated by a `Keep-Alive: timeout=N` response
+ * header, in microseconds. The connection is given up a second early, so
+ * that it is not reused just as the server closes it.
+ * @return the timeout, 0 if none was indicated, or -1 if the connection
+ * should not be kept
+ */
+static long
+keepalive_timeout(const lcb::htparse::Response& resp)
+{
+    const char *hdr = resp.get_header_value("Keep-Alive");
+    const char *tmo = hdr ? strstr(hdr, "timeout=") : NULL;
+    if (!tmo) {
+        return 0;
+    }
+    long secs = strtol(tmo + sizeof("timeout=") - 1, NULL, 10);
+    if (secs <= 1) {
+        return -1;
+    } else if (secs > 3600) {
+        return 0;
+    }
+    return LCB_S2US(secs - 1);
+}
+
 void
 Request::close_io()
 {
     lcbio_connreq_cancel(&creq);
+    release_node();
 
     if (!ioctx) {
         return;
     }
 
-    int can_ka;
-
+    KeepAlive ka = { 0, 0 };
     if (parser && is_data_request()) {
-        can_ka = parser->can_keepalive();
-    } else {
-        can_ka = 0;
+        ka.close_ok = parser->can_keepalive() && is_upload_done();
+        long tmo = keepalive_timeout(parser->get_cur_response());
+        if (tmo < 0) {
+            ka.close_ok = 0;
+        } else {
+            ka.tmoidle = tmo;
+        }
     }
 
-    lcbio_ctx_close(ioctx, pool_close_cb, &can_ka);
+    lcbio_ctx_close(ioctx, pool_close_cb, &ka);
     ioctx = NULL;
 }
@@ -20,6 +20,12 @@
 #include "logging.h"
 #include "hostlist.h"
 #include "http/http.h"
+#include "http/dispatch.h"
+#include "slowops.h"
+#include "hedge.h"
+#include "coalesce.h"
+#include "nearcache.h"
+#include "counteragg.h"
 #include "bucketconfig/clconfig.h"
 #include <lcbio/iotable.h>
 #include <lcbio/ssl.h>
@@ -376,6 +382,7 @@ lcb_error_t lcb_create(lcb_t *instance,
         err = LCB_CLIENT_ENOMEM;
         goto GT_DONE;
     }
+    lcb_console_log_attach();
     if (!(settings = lcb_settings_new())) {
         err = LCB_CLIENT_ENOMEM;
         goto GT_DONE;
@@ -480,6 +487,9 @@ sync_dtor_cb(void *arg)
 
 extern "C" {
 void lcbdur_destroy(void*);
+void lcbdur_seqno_poller_destroy(lcb_SEQNOPOLLER*);
+void lcb_n1x_poller_destroy(lcb_N1XWATCHPOLLER*);
+void lcb_n1ql_groups_destroy(lcb_N1QLGROUPS*);
 }
 
 LIBCOUCHBASE_API
@@ -527,6 +537,15 @@ void lcb_destroy(lcb_t instance)
     }
 
     DESTROY(delete, retryq);
+    DESTROY(delete, slowops);
+    DESTROY(delete, hedger);
+    DESTROY(delete, getcoalescer);
+    DESTROY(delete, nearcache);
+    DESTROY(delete, counteragg);
+    DESTROY(lcb_n1ql_groups_destroy, n1ql_groups);
+    DESTROY(delete, http_dispatcher);
+    DESTROY(lcbdur_seqno_poller_destroy, seqno_poller);
+    DESTROY(lcb_n1x_poller_destroy, n1x_poller);
     DESTROY(delete, confmon);
     DESTROY(lcbio_mgr_destroy, memd_sockpool);
     DESTROY(lcbio_mgr_destroy, http_sockpool);
@@ -559,6 +578,7 @@ void lcb_destroy(lcb_t instance)
     }
 
     delete[] instance->dcpinfo;
+    lcb_console_log_detach();
     memset(instance, 0xff, sizeof(*instance));
     free(instance);
 #undef DESTROY
@@ -680,12 +700,32 @@ LIBCOUCHBASE_API
 void
 lcb_sched_leave(lcb_t instance)
 {
+    if (instance->getcoalescer) {
+        instance->getcoalescer->sched_leave();
+    }
+    if (instance->nearcache) {
+        instance->nearcache->sched_leave();
+    }
+    if (instance->counteragg) {
+        instance->counteragg->sched_leave();
+    }
     mcreq_sched_leave(&instance->cmdq, LCBT_SETTING(instance, sched_implicit_flush));
 }
 LIBCOUCHBASE_API
 void
 lcb_sched_fail(lcb_t instance)
 {
+    /* Must precede the failing of the packets, which may own the cookies
+     * to which GETs were attached */
+    if (instance->getcoalescer) {
+        instance->getcoalescer->sched_fail();
+    }
+    if (instance->nearcache) {
+        instance->nearcache->sched_fail();
+    }
+    if (instance->counteragg) {
+        instance->counteragg->sched_fail();
+    }
     mcreq_sched_fail(&instance->cmdq);
 }
 
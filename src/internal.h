@@ -58,10 +58,27 @@ class Connspec;
 struct Spechost;
 class RetryQueue;
 class Bootstrap;
+class SlowOps;
+class Hedger;
+class GetCoalescer;
+class NearCache;
+class CounterAggregator;
 namespace clconfig {
 struct Confmon;
 class ConfigInfo;
 }
+namespace durability {
+class SeqnoPoller;
+}
+namespace http {
+class Dispatcher;
+}
+namespace n1x {
+class WatchPoller;
+}
+namespace n1ql {
+class GroupList;
+}
 }
 extern "C" {
 #endif
@@ -99,12 +116,30 @@ typedef lcb::RetryQueue lcb_RETRYQ;
 typedef lcb::clconfig::Confmon* lcb_pCONFMON;
 typedef lcb::clconfig::ConfigInfo *lcb_pCONFIGINFO;
 typedef lcb::Bootstrap lcb_BOOTSTRAP;
+typedef lcb::SlowOps lcb_SLOWOPS;
+typedef lcb::Hedger lcb_HEDGER;
+typedef lcb::GetCoalescer lcb_GETCOALESCER;
+typedef lcb::NearCache lcb_NEARCACHE;
+typedef lcb::CounterAggregator lcb_COUNTERAGG;
+typedef lcb::durability::SeqnoPoller lcb_SEQNOPOLLER;
+typedef lcb::http::Dispatcher lcb_HTTPDISPATCHER;
+typedef lcb::n1x::WatchPoller lcb_N1XWATCHPOLLER;
+typedef lcb::n1ql::GroupList lcb_N1QLGROUPS;
 #else
 typedef struct lcb_SCRATCHBUF* lcb_pSCRATCHBUF;
 typedef struct lcb_RETRYQ_st lcb_RETRYQ;
 typedef struct lcb_CONFMON_st* lcb_pCONFMON;
 typedef struct lcb_CONFIGINFO_st* lcb_pCONFIGINFO;
 typedef struct lcb_BOOTSTRAP_st lcb_BOOTSTRAP;
+typedef struct lcb_SLOWOPS_st lcb_SLOWOPS;
+typedef struct lcb_HEDGER_st lcb_HEDGER;
+typedef struct lcb_GETCOALESCER_st lcb_GETCOALESCER;
+typedef struct lcb_NEARCACHE_st lcb_NEARCACHE;
+typedef struct lcb_COUNTERAGG_st lcb_COUNTERAGG;
+typedef struct lcb_SEQNOPOLLER_st lcb_SEQNOPOLLER;
+typedef struct lcb_HTTPDISPATCHER_st lcb_HTTPDISPATCHER;
+typedef struct lcb_N1XWATCHPOLLER_st lcb_N1XWATCHPOLLER;
+typedef struct lcb_N1QLGROUPS_st lcb_N1QLGROUPS;
 #endif
 
 struct lcb_st {
@@ -130,6 +165,15 @@ struct lcb_st {
     lcb_N1QLCACHE *n1ql_cache;
     lcb_MUTATION_TOKEN *dcpinfo; /**< Mapping of known vbucket to {uuid,seqno} info */
     lcbio_pTIMER dtor_timer; /**< Asynchronous destruction timer */
+    lcb_SLOWOPS *slowops; /**< Slow operation tracker (if enabled) */
+    lcb_SEQNOPOLLER *seqno_poller; /**< Shared OBSERVE_SEQNO poller for durability */
+    lcb_HEDGER *hedger; /**< Hedged read scheduler */
+    lcb_GETCOALESCER *getcoalescer; /**< In-flight GETs which may be shared */
+    lcb_NEARCACHE *nearcache; /**< Cache of recently read items */
+    lcb_COUNTERAGG *counteragg; /**< Counter operations being merged */
+    lcb_HTTPDISPATCHER *http_dispatcher; /**< Data API requests per node */
+    lcb_N1XWATCHPOLLER *n1x_poller; /**< Shared poll of index build states */
+    lcb_N1QLGROUPS *n1ql_groups; /**< N1QL statement groups in progress */
     int type; /**< Type of connection */
 
     #ifdef __cplusplus
@@ -47,6 +47,17 @@ typedef enum {
     CS_ERROR
 } connect_state;
 
+/**
+ * A single address attempt used when racing connections across several
+ * resolved addresses (RFC 8305). Only used for event-based I/O.
+ */
+typedef struct {
+    lcb_socket_t fd;
+    void *event;
+    struct addrinfo *ai;
+    struct lcbio_CONNSTART *cs;
+} cs_RACER;
+
 typedef struct lcbio_CONNSTART {
     lcbio_CONNDONE_cb handler;
     lcbio_SOCKET *sock;
@@ -61,8 +72,18 @@ typedef struct lcbio_CONNSTART {
     lcb_error_t pending;
     lcbio_ASYNC *async;
     char *hoststr;
+    hrtime_t start; /* When the connection was started */
+    unsigned nattempts; /* Number of addresses attempted */
+
+    /* Racing state. Only used if racers is not NULL */
+    lcbio_pTIMER stagger; /* Launches the next attempt if no result yet */
+    cs_RACER *racers; /* One entry per launched attempt */
+    unsigned nracers; /* Number of attempts launched */
+    unsigned nactive; /* Number of attempts still in progress */
 } lcbio_CONNSTART;
 
+static void race_cleanup(lcbio_CONNSTART *cs);
+
 static void
 cs_unwatch(lcbio_CONNSTART *cs)
 {
@@ -86,6 +107,10 @@ cs_handler(void *cookie)
     lcb_error_t err;
     lcbio_SOCKET *s = cs->sock;
 
+    if (cs->racers) {
+        race_cleanup(cs);
+    }
+
     if (s && cs->event) {
         cs_unwatch(cs);
         IOT_V0EV(s->io).destroy(IOT_ARG(s->io), cs->event);
@@ -113,7 +138,9 @@ cs_handler(void *cookie)
     if (s) {
         lcbio__load_socknames(s);
         if (err == LCB_SUCCESS) {
-            lcb_log(LOGARGS(s, INFO), CSLOGFMT "Connected ", CSLOGID(s));
+            s->info->connect_us = LCB_NS2US(gethrtime() - cs->start);
+            s->info->nattempts = cs->nattempts;
+            lcb_log(LOGARGS(s, INFO), CSLOGFMT "Connected in %uus (attempts=%u)", CSLOGID(s), s->info->connect_us, cs->nattempts);
 
             if (s->settings->tcp_nodelay) {
                 lcb_error_t ndrc = lcbio_disable_nagle(s);
@@ -199,6 +226,7 @@ ensure_sock(lcbio_CONNSTART *cs)
         while (s->u.fd == INVALID_SOCKET && cs->ai != NULL) {
             s->u.fd = lcbio_E_ai2sock(io, &cs->ai, &errtmp);
             if (s->u.fd != INVALID_SOCKET) {
+                cs->nattempts++;
                 return 0;
             }
         }
@@ -210,6 +238,7 @@ ensure_sock(lcbio_CONNSTART *cs)
         while (s->u.sd == NULL && cs->ai != NULL) {
             s->u.sd = lcbio_C_ai2sock(io, &cs->ai, &errtmp);
             if (s->u.sd) {
+                cs->nattempts++;
                 s->u.sd->lcbconn = (void *) cs->sock;
                 s->u.sd->parent = IOT_ARG(io);
                 return 0;
@@ -412,6 +441,265 @@ C_connect(lcbio_CONNSTART *cs)
     }
 }
 
+/**
+ * @name Connection Racing
+ *
+ * When a host resolves to more than one address, waiting for each address
+ * to fail (or time out) before trying the next one means a single black-holed
+ * route costs the entire connection timeout. Instead, a new attempt is started
+ * every `connect_race_delay` microseconds (or immediately if an attempt fails)
+ * while the previous attempts remain in flight. The first attempt to connect
+ * wins and the remaining ones are closed. See RFC 8305.
+ * @{
+ */
+
+/**
+ * Reorder the address list so that address families alternate, starting with
+ * the family of the first (i.e. preferred) address.
+ */
+static void
+race_interleave(struct addrinfo **root)
+{
+    struct addrinfo *primary = NULL, **p_tail = &primary;
+    struct addrinfo *secondary = NULL, **s_tail = &secondary;
+    struct addrinfo *cur, **tail = root;
+    int family = (*root)->ai_family;
+
+    for (cur = *root; cur; cur = cur->ai_next) {
+        if (cur->ai_family == family) {
+            *p_tail = cur;
+            p_tail = &cur->ai_next;
+        } else {
+            *s_tail = cur;
+            s_tail = &cur->ai_next;
+        }
+    }
+    *p_tail = NULL;
+    *s_tail = NULL;
+
+    while (primary || secondary) {
+        if (primary) {
+            *tail = primary;
+            primary = primary->ai_next;
+            tail = &(*tail)->ai_next;
+        }
+        if (secondary) {
+            *tail = secondary;
+            secondary = secondary->ai_next;
+            tail = &(*tail)->ai_next;
+        }
+    }
+    *tail = NULL;
+}
+
+/** Close an attempt which has not connected (or whose result is unwanted) */
+static void
+race_close(cs_RACER *r)
+{
+    lcbio_TABLE *io = r->cs->sock->io;
+    if (r->fd == INVALID_SOCKET) {
+        return;
+    }
+    IOT_V0EV(io).cancel(IOT_ARG(io), r->fd, r->event);
+    IOT_V0EV(io).destroy(IOT_ARG(io), r->event);
+    IOT_V0IO(io).close(IOT_ARG(io), r->fd);
+    r->fd = INVALID_SOCKET;
+    r->event = NULL;
+    r->cs->nactive--;
+}
+
+/** Close all attempts and release racing resources. */
+static void
+race_cleanup(lcbio_CONNSTART *cs)
+{
+    unsigned ii;
+    for (ii = 0; ii < cs->nracers; ii++) {
+        race_close(cs->racers + ii);
+    }
+    lcbio_timer_destroy(cs->stagger);
+    free(cs->racers);
+    cs->stagger = NULL;
+    cs->racers = NULL;
+}
+
+/**
+ * Hand the winning attempt's descriptor over to the socket and close the
+ * others.
+ */
+static void
+race_win(cs_RACER *r)
+{
+    lcbio_CONNSTART *cs = r->cs;
+    lcbio_SOCKET *s = cs->sock;
+    lcbio_TABLE *io = s->io;
+    unsigned ii;
+
+    IOT_V0EV(io).cancel(IOT_ARG(io), r->fd, r->event);
+    IOT_V0EV(io).destroy(IOT_ARG(io), r->event);
+    s->u.fd = r->fd;
+    r->fd = INVALID_SOCKET;
+    r->event = NULL;
+    cs->nactive--;
+
+    lcb_log(LOGARGS(s, DEBUG), CSLOGFMT "Attempt #%u won the race. Closing %u other attempt(s)", CSLOGID(s), (unsigned)(r - cs->racers) + 1, cs->nactive);
+    for (ii = 0; ii < cs->nracers; ii++) {
+        race_close(cs->racers + ii);
+    }
+    lcbio_timer_disarm(cs->stagger);
+    cs_state_signal(cs, CS_CONNECTED, LCB_SUCCESS);
+}
+
+/**
+ * Invoke connect() on the attempt.
+ * @return 1 if connected, 0 if pending, and -1 if the attempt failed (in which
+ * case it is closed).
+ */
+static int
+race_connect(cs_RACER *r)
+{
+    lcbio_SOCKET *s = r->cs->sock;
+    lcbio_TABLE *io = s->io;
+    int retry_once = 0;
+
+    GT_CONNECT:
+    if (IOT_V0IO(io).connect0(IOT_ARG(io), r->fd, r->ai->ai_addr,
+                              (unsigned)r->ai->ai_addrlen) == 0) {
+        return 1;
+    }
+
+    lcbio_mksyserr(IOT_ERRNO(io), &r->cs->syserr);
+    switch (lcbio_mkcserr(IOT_ERRNO(io))) {
+    case LCBIO_CSERR_INTR:
+        goto GT_CONNECT;
+
+    case LCBIO_CSERR_CONNECTED:
+        return 1;
+
+    case LCBIO_CSERR_BUSY:
+        return 0;
+
+    case LCBIO_CSERR_EINVAL:
+        if (!retry_once) {
+            retry_once = 1;
+            goto GT_CONNECT;
+        }
+        /* fallthrough */
+
+    case LCBIO_CSERR_EFAIL:
+    default:
+        lcb_log(LOGARGS(s, TRACE), CSLOGFMT "Attempt #%u failed. os_error=%d [%s]", CSLOGID(s), (unsigned)(r - r->cs->racers) + 1, IOT_ERRNO(io), strerror(IOT_ERRNO(io)));
+        race_close(r);
+        return -1;
+    }
+}
+
+static void race_launch(lcbio_CONNSTART *cs);
+
+static void
+E_race(lcb_socket_t sock, short events, void *arg)
+{
+    cs_RACER *r = arg;
+    lcbio_CONNSTART *cs = r->cs;
+    int rv;
+
+    if (events & LCB_ERROR_EVENT) {
+        socklen_t errlen = sizeof(int);
+        int sockerr = 0;
+        getsockopt(r->fd, SOL_SOCKET, SO_ERROR, (char *)&sockerr, &errlen);
+        lcbio_mksyserr(sockerr, &cs->syserr);
+        race_close(r);
+        rv = -1;
+    } else {
+        rv = race_connect(r);
+    }
+
+    if (rv == 1) {
+        race_win(r);
+    } else if (rv == 0) {
+        lcbio_TABLE *io = cs->sock->io;
+        IOT_V0EV(io).watch(IOT_ARG(io), r->fd, r->event, LCB_WRITE_EVENT, r, E_race);
+    } else {
+        /* Don't wait for the stagger delay if an attempt fails */
+        lcbio_timer_disarm(cs->stagger);
+        race_launch(cs);
+    }
+    (void)sock;
+}
+
+/**
+ * Start attempts on the next address(es). This returns once an attempt is
+ * pending or connected, or once no addresses remain.
+ */
+static void
+race_launch(lcbio_CONNSTART *cs)
+{
+    lcbio_SOCKET *s = cs->sock;
+    lcbio_TABLE *io = s->io;
+
+    while (cs->state == CS_PENDING && cs->ai) {
+        cs_RACER *r;
+        int errtmp = 0, rv;
+        lcb_socket_t fd = lcbio_E_ai2sock(io, &cs->ai, &errtmp);
+
+        if (fd == INVALID_SOCKET) {
+            lcbio_mksyserr(errtmp, &cs->syserr);
+            break;
+        }
+
+        r = cs->racers + cs->nracers++;
+        r->cs = cs;
+        r->fd = fd;
+        r->ai = cs->ai;
+        r->event = IOT_V0EV(io).create(IOT_ARG(io));
+        cs->ai = cs->ai->ai_next;
+        cs->nactive++;
+        cs->nattempts++;
+
+        lcb_log(LOGARGS(s, TRACE), CSLOGFMT "Starting attempt #%u (AF=%d). Active=%u", CSLOGID(s), cs->nracers, r->ai->ai_family, cs->nactive);
+
+        rv = race_connect(r);
+        if (rv == 1) {
+            race_win(r);
+            return;
+        } else if (rv == 0) {
+            IOT_V0EV(io).watch(IOT_ARG(io), r->fd, r->event, LCB_WRITE_EVENT, r, E_race);
+            if (cs->ai) {
+                lcbio_timer_rearm(cs->stagger, s->settings->connect_race_delay);
+            }
+            return;
+        }
+    }
+
+    if (cs->state == CS_PENDING && cs->nactive == 0) {
+        cs_state_signal(cs, CS_ERROR, LCB_CONNECT_ERROR);
+    }
+}
+
+static void
+race_stagger_cb(void *arg)
+{
+    race_launch(arg);
+}
+
+static void
+race_start(lcbio_CONNSTART *cs)
+{
+    struct addrinfo *ai;
+    unsigned naddrs = 0;
+
+    race_interleave(&cs->ai_root);
+    for (ai = cs->ai_root; ai; ai = ai->ai_next) {
+        naddrs++;
+    }
+
+    cs->ai = cs->ai_root;
+    cs->racers = calloc(naddrs, sizeof(*cs->racers));
+    cs->stagger = lcbio_timer_new(cs->sock->io, cs, race_stagger_cb);
+    race_launch(cs);
+}
+
+/**@}*/
+
 struct lcbio_CONNSTART *
 lcbio_connect(lcbio_TABLE *iot, lcb_settings *settings, const lcb_host_t *dest,
               uint32_t timeout, lcbio_CONNDONE_cb handler, void *arg)
@@ -445,6 +733,7 @@ lcbio_connect(lcbio_TABLE *iot, lcb_settings *settings, const lcb_host_t *dest,
     ret->arg = arg;
     ret->sock = s;
     ret->async = lcbio_timer_new(iot, ret, cs_handler);
+    ret->start = gethrtime();
 
     lcbio_timer_rearm(ret->async, timeout);
     lcb_log(LOGARGS(s, INFO), CSLOGFMT "Starting. Timeout=%uus", CSLOGID(s), timeout);
@@ -469,7 +758,10 @@ lcbio_connect(lcbio_TABLE *iot, lcb_settings *settings, const lcb_host_t *dest,
         ret->ai = ret->ai_root;
 
         /** Figure out how to connect */
-        if (IOT_IS_EVENT(iot)) {
+        if (IOT_IS_EVENT(iot) && settings->connect_race_delay &&
+                ret->ai->ai_next) {
+            race_start(ret);
+        } else if (IOT_IS_EVENT(iot)) {
             E_connect(-1, LCB_WRITE_EVENT, ret);
         } else {
             C_connect(ret);
@@ -64,6 +64,8 @@ typedef struct {
     struct sockaddr_storage sa_remote;
     struct sockaddr_storage sa_local;
     lcb_host_t ep;
+    lcb_U32 connect_us; /**< Time taken to connect (including lookup) */
+    unsigned nattempts; /**< Number of addresses tried until connected */
 } lcbio_CONNINFO;
 
 
@@ -109,7 +111,10 @@ typedef void (*lcbio_CONNDONE_cb)
  * @param dest the endpoint to connect to
  * @param timeout number of time to wait for connection. The handler will be
  *        invoked with an error of `LCB_ETIMEDOUT` if a successful connection
- *        cannot be established in time.
+ *        cannot be established in time. If the endpoint resolves to several
+ *        addresses, attempts on them are raced according to the
+ *        lcb_settings::connect_race_delay setting; the timeout applies to the
+ *        race as a whole.
  * @param handler a handler to invoke with the result. The handler will always
  *        be invoked unless the request has been cancelled. You should inspect
  *        the socket and error code in the handler to see if the connection has
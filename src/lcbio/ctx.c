@@ -578,6 +578,22 @@ lcbio_ctx_wwant(lcbio_CTX *ctx)
     }
 }
 
+void
+lcbio_ctx_wflush(lcbio_CTX *ctx)
+{
+    if (IOT_IS_EVENT(ctx->io) == 0 || ctx->entered || ctx->err ||
+            ctx->state != ES_ACTIVE || (ctx->output && ctx->output->rb.nbytes)) {
+        /* Buffered output must be written first; leave it to the handler */
+        lcbio_ctx_wwant(ctx);
+        return;
+    }
+
+    /* The socket is non-blocking, so write right away. The flush_ready
+     * callback calls lcbio_ctx_wwant() itself if the socket would block */
+    ctx->wwant = 0;
+    ctx->procs.cb_flush_ready(ctx);
+}
+
 void
 lcbio_ctx_senderr(lcbio_CTX *ctx, lcb_error_t err)
 {
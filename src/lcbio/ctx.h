@@ -305,6 +305,23 @@ lcbio_ctx_put(lcbio_CTX *ctx, const void *buf, unsigned nbuf);
 void
 lcbio_ctx_wwant(lcbio_CTX *ctx);
 
+/**
+ * @brief Flush pending data now, rather than when the socket is writable.
+ *
+ * This behaves like lcbio_ctx_wwant(), except that for event-based models the
+ * lcbio_CTXPROCS#cb_flush_ready() callback is invoked immediately. Since
+ * the socket is non-blocking, the data is written directly and write events
+ * are only requested (via the lcbio_ctx_wwant() in the callback) if the
+ * socket would block. This saves an event loop iteration, and a watcher
+ * update, for each flush.
+ *
+ * If called from within a handler of the context, or if data added with
+ * lcbio_ctx_put() is still pending, this is the same as lcbio_ctx_wwant().
+ * As with lcbio_ctx_wwant(), lcbio_ctx_schedule() should be called afterwards.
+ */
+void
+lcbio_ctx_wflush(lcbio_CTX *ctx);
+
 /**
  * @brief Flush data from the lcbio_CTXPROCS#cb_flush_ready() callback
  *
@@ -45,6 +45,13 @@ typedef struct lcbio_MGRHOST {
     lcbio_pASYNC async;
     unsigned n_total; /* number of total connections */
     unsigned refcount;
+    unsigned n_connected; /* number of successful connections */
+    lcb_U64 connect_us_total; /* sum of connect latencies, for averaging */
+    lcb_U32 connect_us_min; /* fastest connect latency */
+    lcb_U32 connect_us_max; /* slowest connect latency */
+    unsigned n_hits; /* requests satisfied from an idle connection */
+    unsigned n_misses; /* requests which had to wait for a connection */
+    lcb_HISTOGRAM *wait_hg; /* time from request to assignment */
 } mgr_HOST;
 
 typedef struct mgr_CINFO_st {
@@ -55,6 +62,7 @@ typedef struct mgr_CINFO_st {
     struct lcbio_CONNSTART *cs;
     lcbio_pTIMER idle_timer;
     int state;
+    int server_expiry; /* idle timer is the server's keep-alive timeout */
 } mgr_CINFO;
 
 typedef struct lcbio_MGRREQ {
@@ -66,12 +74,14 @@ typedef struct lcbio_MGRREQ {
     int state;
     lcbio_SOCKET *sock;
     lcb_error_t err;
+    hrtime_t start;
 } mgr_REQ;
 
 #define HE_NPEND(he) LCB_CLIST_SIZE(&(he)->ll_pending)
 #define HE_NIDLE(he) LCB_CLIST_SIZE(&(he)->ll_idle)
 #define HE_NREQS(he) LCB_CLIST_SIZE(&(he)->requests)
 #define HE_NLEASED(he) ((he)->n_total - (HE_NIDLE(he) + HE_NPEND(he)))
+#define MGR_MINIDLE(mgr) ((mgr)->minidle < (mgr)->maxidle ? (mgr)->minidle : (mgr)->maxidle)
 
 static void on_idle_timeout(void *cookie);
 static void he_available_notify(void *cookie);
@@ -101,6 +111,14 @@ cinfo_from_sock(lcbio_SOCKET *sock)
 static void
 destroy_cinfo(mgr_CINFO *info)
 {
+    mgr_HOST *he = info->parent;
+
+    /* Only refill for connections which were once established, so that an
+     * unreachable host does not cause a reconnect loop */
+    if (info->state != CS_PENDING && he->async && MGR_MINIDLE(he->parent)) {
+        lcbio_async_signal(he->async);
+    }
+
     info->parent->n_total--;
     if (info->state == CS_IDLE) {
         lcb_clist_delete(&info->parent->ll_idle, &info->llnode);
@@ -178,6 +196,7 @@ he_unref(mgr_HOST *host)
     }
 
     mgr_unref(host->parent);
+    lcb_histogram_destroy(host->wait_hg);
     free(host);
 }
 
@@ -220,6 +239,7 @@ invoke_request(mgr_REQ *req)
         info->state = CS_LEASED;
         req->state = RS_ASSIGNED;
         lcbio_timer_disarm(info->idle_timer);
+        lcb_histogram_record(info->parent->wait_hg, gethrtime() - req->start);
         lcb_log(LOGARGS(info->parent->parent, DEBUG), HE_LOGFMT "Assigning R=%p SOCKET=%p",HE_LOGID(info->parent), (void*)req, (void*)req->sock);
     }
 
@@ -285,6 +305,16 @@ on_connected(lcbio_SOCKET *sock, void *arg, lcb_error_t err, lcbio_OSERR oserr)
         destroy_cinfo(info);
 
     } else {
+        lcb_U32 connect_us = sock->info->connect_us;
+        if (!he->n_connected || connect_us < he->connect_us_min) {
+            he->connect_us_min = connect_us;
+        }
+        if (connect_us > he->connect_us_max) {
+            he->connect_us_max = connect_us;
+        }
+        he->connect_us_total += connect_us;
+        he->n_connected++;
+
         info->state = CS_IDLE;
         info->sock = sock;
         lcbio_ref(info->sock);
@@ -347,25 +377,41 @@ async_invoke_request(void *cookie)
     invoke_request(req);
 }
 
-mgr_REQ *
-lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
-              lcbio_CONNDONE_cb handler, void *arg)
+/**
+ * Opens new connections until the host has at least `minidle` connections
+ * which are either idle or about to become idle, without exceeding
+ * `maxtotal` connections in all.
+ */
+static void
+he_refill(mgr_HOST *he)
+{
+    lcbio_MGR *mgr = he->parent;
+    unsigned minidle = MGR_MINIDLE(mgr);
+
+    while (HE_NIDLE(he) + HE_NPEND(he) < minidle) {
+        if (mgr->maxtotal && he->n_total >= mgr->maxtotal) {
+            lcb_log(LOGARGS(mgr, DEBUG), HE_LOGFMT "Not creating new connection. Already have maximum total (%u)", HE_LOGID(he), mgr->maxtotal);
+            break;
+        }
+        lcb_log(LOGARGS(mgr, DEBUG), HE_LOGFMT "Creating new connection to maintain minimum idle count (%u)", HE_LOGID(he), minidle);
+        start_new_connection(he, mgr->settings->config_node_timeout);
+    }
+}
+
+static mgr_HOST *
+he_get(lcbio_MGR *pool, const lcb_host_t *dest)
 {
     mgr_HOST *he;
-    lcb_list_t *cur;
-    mgr_REQ *req = calloc(1, sizeof(*req));
     mgr_KEY key = { 0 };
 
     sprintf(key, "%s:%s", dest->host, dest->port);
 
-    req->callback = handler;
-    req->arg = arg;
-
     he = genhash_find(pool->ht, key, strlen(key));
     if (!he) {
         he = calloc(1, sizeof(*he));
         he->parent = pool;
         he->async = lcbio_timer_new(pool->io, he, he_available_notify);
+        he->wait_hg = lcb_histogram_create();
         strcpy(he->key, key);
 
         lcb_clist_init(&he->ll_idle);
@@ -377,7 +423,22 @@ lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
         he_ref(he);
         mgr_ref(pool);
     }
+    return he;
+}
 
+mgr_REQ *
+lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
+              lcbio_CONNDONE_cb handler, void *arg)
+{
+    mgr_HOST *he;
+    lcb_list_t *cur;
+    mgr_REQ *req = calloc(1, sizeof(*req));
+
+    req->callback = handler;
+    req->arg = arg;
+    req->start = gethrtime();
+
+    he = he_get(pool, dest);
     req->host = he;
 
     GT_POPAGAIN:
@@ -399,6 +460,7 @@ lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
         }
 
         lcbio_timer_disarm(info->idle_timer);
+        he->n_hits++;
         req->sock = info->sock;
         req->state = RS_ASSIGNED;
         req->timer = lcbio_timer_new(pool->io, req, async_invoke_request);
@@ -407,6 +469,7 @@ lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
         lcb_log(LOGARGS(pool, INFO), HE_LOGFMT "Found ready connection in pool. Reusing socket and not creating new connection", HE_LOGID(he));
 
     } else {
+        he->n_misses++;
         req->state = RS_PENDING;
         req->timer = lcbio_timer_new(pool->io, req, on_request_timeout);
         lcbio_timer_rearm(req->timer, timeout);
@@ -424,14 +487,26 @@ lcbio_mgr_get(lcbio_MGR *pool, lcb_host_t *dest, uint32_t timeout,
     return req;
 }
 
+void
+lcbio_mgr_warmup(lcbio_MGR *pool, const lcb_host_t *dest)
+{
+    if (!MGR_MINIDLE(pool)) {
+        return;
+    }
+    he_refill(he_get(pool, dest));
+}
+
 /**
  * Invoked when a new socket is available for allocation within the
- * request queue.
+ * request queue, or when a connection has been closed and the pool may need
+ * to be refilled
  */
 static void
 he_available_notify(void *cookie)
 {
-    connection_available((mgr_HOST *)cookie);
+    mgr_HOST *he = cookie;
+    connection_available(he);
+    he_refill(he);
 }
 
 void
@@ -460,6 +535,13 @@ static void
 on_idle_timeout(void *cookie)
 {
     mgr_CINFO *info = cookie;
+    mgr_HOST *he = info->parent;
+
+    /* Connections the server is about to close are not worth keeping */
+    if (HE_NIDLE(he) <= MGR_MINIDLE(he->parent) && !info->server_expiry) {
+        lcbio_timer_rearm(info->idle_timer, he->parent->tmoidle);
+        return;
+    }
 
     lcb_log(LOGARGS(info->parent->parent, DEBUG), HE_LOGFMT "Idle connection expired", HE_LOGID(info->parent));
 
@@ -468,6 +550,12 @@ on_idle_timeout(void *cookie)
 
 void
 lcbio_mgr_put(lcbio_SOCKET *sock)
+{
+    lcbio_mgr_put_ex(sock, 0);
+}
+
+void
+lcbio_mgr_put_ex(lcbio_SOCKET *sock, uint32_t tmoidle)
 {
     mgr_HOST *he;
     lcbio_MGR *mgr;
@@ -489,7 +577,8 @@ lcbio_mgr_put(lcbio_SOCKET *sock)
     }
 
     lcb_log(LOGARGS(mgr, INFO), HE_LOGFMT "Placing socket back into the pool. I=%p,C=%p", HE_LOGID(he), (void*)info, (void*)sock);
-    lcbio_timer_rearm(info->idle_timer, mgr->tmoidle);
+    info->server_expiry = tmoidle && tmoidle < mgr->tmoidle;
+    lcbio_timer_rearm(info->idle_timer, info->server_expiry ? tmoidle : mgr->tmoidle);
     lcb_clist_append(&he->ll_idle, &info->llnode);
     info->state = CS_IDLE;
 }
@@ -536,6 +625,17 @@ he_dump(mgr_HOST *he, FILE *out)
     fprintf(out, "HOST=%s", he->key);
     fprintf(out, "Requests=%d, Idle=%d, Pending=%d, Leased=%d\n",
             (int)HE_NREQS(he), (int)HE_NIDLE(he), (int)HE_NPEND(he), (int)HE_NLEASED(he));
+    if (he->n_connected) {
+        fprintf(out, CONN_INDENT "Connect latency: Count=%u, Min=%uus, Avg=%uus, Max=%uus\n",
+                he->n_connected, he->connect_us_min,
+                (unsigned)(he->connect_us_total / he->n_connected),
+                he->connect_us_max);
+    }
+    fprintf(out, CONN_INDENT "Pool hits=%u, misses=%u\n", he->n_hits, he->n_misses);
+    if (he->n_hits + he->n_misses) {
+        fprintf(out, CONN_INDENT "Wait time:\n");
+        lcb_histogram_print(he->wait_hg, out);
+    }
 
     fprintf(out, CONN_INDENT "Idle Connections:\n");
     write_he_list(&he->ll_idle, out);
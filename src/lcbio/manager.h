@@ -59,8 +59,18 @@ typedef struct lcbio_MGR {
      * before being closed
      */
     uint32_t tmoidle;
+    /**
+     * Maximum number of connections per host, including leased ones, which
+     * may be opened to maintain #minidle. 0 means no limit
+     */
     unsigned maxtotal;
     unsigned maxidle; /**< Maximum number of idle connections, per host */
+    /**
+     * Minimum number of idle connections to keep open, per host. Connections
+     * are established in the background to maintain this count (capped by
+     * #maxidle), and idle connections within it are not expired.
+     */
+    unsigned minidle;
     unsigned refcount;
 } lcbio_MGR;
 
@@ -99,6 +109,17 @@ struct lcbio_MGRREQ *
 lcbio_mgr_get(lcbio_MGR *mgr, lcb_host_t *dest, uint32_t timeout,
               lcbio_CONNDONE_cb handler, void *arg);
 
+/**
+ * Establish connections to the given host in the background so that the pool
+ * contains at least lcbio_MGR::minidle connections. This does nothing if
+ * `minidle` is 0.
+ * @param mgr
+ * @param dest the host to connect to
+ */
+LCB_INTERNAL_API
+void
+lcbio_mgr_warmup(lcbio_MGR *mgr, const lcb_host_t *dest);
+
 /**
  * Cancel a pending request. The callback for the request must have not already
  * been invoked (if it has, use sockpool_put)
@@ -117,6 +138,15 @@ lcbio_mgr_cancel(struct lcbio_MGRREQ *req);
 LCB_INTERNAL_API
 void lcbio_mgr_put(lcbio_SOCKET *sock);
 
+/**
+ * Like lcbio_mgr_put(), but the socket is closed once it has been idle for
+ * `tmoidle` microseconds, if that is sooner than lcbio_MGR::tmoidle. This is
+ * used when the server has indicated when it will close an idle connection.
+ * Such connections are not kept open for lcbio_MGR::minidle.
+ */
+LCB_INTERNAL_API
+void lcbio_mgr_put_ex(lcbio_SOCKET *sock, uint32_t tmoidle);
+
 /**
  * Mark a slot as available but discard the current connection. This should be
  * done if the connection itself is "dirty", i.e. has a protocol error on it
@@ -80,11 +80,15 @@ static void console_log(struct lcb_logprocs_st *procs,
                         const char *fmt,
                         va_list ap);
 
+static int logq_push(unsigned iid, const char *subsys, int severity,
+                     int srcline, hrtime_t now, const char *fmt, va_list ap);
+
 static struct lcb_CONSOLELOGGER console_logprocs = {
         {0 /* version */, {{console_log} /* v1 */} /*v*/},
         NULL,
         /** Minimum severity */
-        LCB_LOG_INFO
+        LCB_LOG_INFO,
+        0 /* async */
 };
 
 struct lcb_logprocs_st *lcb_console_logprocs = &console_logprocs.base;
@@ -142,6 +146,10 @@ static void console_log(struct lcb_logprocs_st *procs,
         now++;
     }
 
+    if (vprocs->async && logq_push(iid, subsys, severity, srcline, now, fmt, ap)) {
+        return;
+    }
+
     fp = vprocs->fp ? vprocs->fp : stderr;
 
     flockfile(fp);
@@ -162,6 +170,872 @@ static void console_log(struct lcb_logprocs_st *procs,
 }
 
 
+/**
+ * Asynchronous console logging.
+ *
+ * Each thread which logs has its own single-producer/single-consumer ring
+ * buffer. Rather than formatting the message, the producer copies the
+ * format string pointer and the arguments (as decoded from the format string)
+ * into the ring; a background thread drains all the rings, formats the
+ * messages and writes them out. If a ring is full the message is dropped and
+ * counted; the producer never blocks.
+ *
+ * Format strings and subsystem names are stored by pointer and must therefore
+ * have static storage (as is the case for all lcb_log() call sites). String
+ * arguments are copied.
+ */
+#if defined(_MSC_VER)
+#define LOGQ_TLS __declspec(thread)
+#define LOGQ_BARRIER() MemoryBarrier()
+#define LOGQ_CASPTR(p, o, n) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(p), (n), (o)) == (o))
+#define LOGQ_CASINT(p, o, n) \
+    (InterlockedCompareExchange((LONG volatile *)(p), (n), (o)) == (o))
+#define LOGQ_INCR(p) InterlockedIncrement((LONG volatile *)(p))
+#define LOGQ_DECR(p) InterlockedDecrement((LONG volatile *)(p))
+#elif defined(__GNUC__) && !defined(_WIN32)
+#define LOGQ_TLS __thread
+#define LOGQ_BARRIER() __sync_synchronize()
+#define LOGQ_CASPTR(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#define LOGQ_CASINT(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#define LOGQ_INCR(p) __sync_add_and_fetch(p, 1)
+#define LOGQ_DECR(p) __sync_sub_and_fetch(p, 1)
+#else
+#define LOGQ_DISABLED
+#endif
+
+#define LOGQ_RINGSIZE 65536 /* Must be a power of two */
+#define LOGQ_MAXREC 2048 /* Largest single record */
+#define LOGQ_MAXLINE 4096 /* Largest formatted line */
+#define LOGQ_BACKOFF_MS 2 /* How long to back off while the writer lock is contended */
+#define LOGQ_ALIGN(n) (((n) + 7) & ~7)
+#define LOGQ_F_SKIP 0x01 /* Padding up until the end of the ring */
+
+typedef union {
+    lcb_S64 i;
+    lcb_U64 u;
+    double d;
+    const void *p;
+} logq_ARG;
+
+typedef struct {
+    lcb_U32 size; /* Size of the entire record, including this header */
+    lcb_U32 flags;
+    hrtime_t time;
+    const char *subsys;
+    const char *fmt;
+    unsigned iid;
+    int severity;
+    int srcline;
+} logq_HDR;
+
+typedef struct logq_RING_st {
+    struct logq_RING_st *next;
+    volatile lcb_U32 head; /* Modified only by the producer */
+    volatile lcb_U32 tail; /* Modified only by the writer */
+    volatile lcb_U32 dropped; /* Modified only by the producer */
+    lcb_U32 dropped_seen;
+    volatile int orphaned; /* Owning thread has exited */
+    char tid[32];
+    char scratch[LOGQ_MAXREC];
+    char buf[LOGQ_RINGSIZE];
+} logq_RING;
+
+/** A parsed conversion specification */
+typedef struct {
+    char flags[8];
+    int width; /* -1 if absent */
+    int prec; /* -1 if absent */
+    int width_star;
+    int prec_star;
+    char length; /* 0, 'H' (hh), 'h', 'l', 'q' (ll), 'j', 'z', 't', 'L' */
+    char conv;
+} logq_SPEC;
+
+#ifndef LOGQ_DISABLED
+static logq_RING * volatile logq_rings = NULL;
+static LOGQ_TLS logq_RING *logq_curring = NULL;
+/* 0: not running, 1: starting or stopping, 2: running */
+static volatile int logq_state = 0;
+static volatile int logq_stopping = 0;
+/* Held by the writer while it drains, and by anyone replacing the FILE */
+static volatile int logq_writing = 0;
+static volatile int logq_waiters = 0;
+/* Set by the writer while it waits for messages */
+static volatile int logq_idle = 0;
+/* Number of live instances; the writer only runs while there are any */
+static volatile int logq_instances = 0;
+
+#ifdef _WIN32
+static HANDLE logq_thread;
+static HANDLE logq_event;
+#define logq_sleep() Sleep(LOGQ_BACKOFF_MS)
+#else
+#include <time.h>
+static pthread_t logq_thread;
+static pthread_key_t logq_key;
+static int logq_key_created = 0;
+static pthread_mutex_t logq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logq_cond = PTHREAD_COND_INITIALIZER;
+static void logq_sleep(void)
+{
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = LOGQ_BACKOFF_MS * 1000000;
+    nanosleep(&ts, NULL);
+}
+#endif
+
+static int logq_pending(void);
+
+/**
+ * Block the writer until logq_wake() is called. This returns immediately if
+ * there is already something to do. Producers only check logq_idle after
+ * publishing a record, and the writer only checks for records after setting
+ * it, so that (with the barriers in between) either the writer sees the
+ * record or the producer sees that the writer must be woken.
+ */
+static void
+logq_wait(void)
+{
+#ifdef _WIN32
+    logq_idle = 1;
+    LOGQ_BARRIER();
+    if (!logq_pending()) {
+        WaitForSingleObject(logq_event, INFINITE);
+    }
+    logq_idle = 0;
+#else
+    pthread_mutex_lock(&logq_mutex);
+    logq_idle = 1;
+    LOGQ_BARRIER();
+    if (!logq_pending()) {
+        pthread_cond_wait(&logq_cond, &logq_mutex);
+    }
+    logq_idle = 0;
+    pthread_mutex_unlock(&logq_mutex);
+#endif
+}
+
+/** Wake the writer if it is waiting in logq_wait() */
+static void
+logq_wake(void)
+{
+    LOGQ_BARRIER();
+    if (!logq_idle) {
+        return;
+    }
+#ifdef _WIN32
+    SetEvent(logq_event);
+#else
+    pthread_mutex_lock(&logq_mutex);
+    pthread_cond_signal(&logq_cond);
+    pthread_mutex_unlock(&logq_mutex);
+#endif
+}
+
+/**
+ * Parse a conversion specification. `p` points to the character following the
+ * `%`. Returns a pointer past the specification, or NULL if it could not be
+ * understood
+ */
+static const char *
+logq_parse_spec(const char *p, logq_SPEC *spec)
+{
+    size_t nflags = 0;
+    memset(spec, 0, sizeof(*spec));
+    spec->width = -1;
+    spec->prec = -1;
+
+    while (*p && strchr("-+ #0", *p)) {
+        if (nflags < sizeof(spec->flags) - 1) {
+            spec->flags[nflags++] = *p;
+        }
+        p++;
+    }
+    if (*p == '*') {
+        spec->width_star = 1;
+        p++;
+    } else if (isdigit((unsigned char)*p)) {
+        spec->width = (int)strtol(p, (char **)&p, 10);
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->prec_star = 1;
+            p++;
+        } else {
+            spec->prec = (int)strtol(p, (char **)&p, 10);
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        spec->length = (p[1] == 'h') ? 'H' : 'h';
+        p += (p[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        spec->length = (p[1] == 'l') ? 'q' : 'l';
+        p += (p[1] == 'l') ? 2 : 1;
+        break;
+    case 'q': case 'j': case 'z': case 't': case 'L':
+        spec->length = *p++;
+        break;
+    case 'I':
+        /* Win32 I64, I32, I */
+        if (p[1] == '6' && p[2] == '4') {
+            spec->length = 'q';
+            p += 3;
+        } else if (p[1] == '3' && p[2] == '2') {
+            p += 3;
+        } else {
+            spec->length = 'z';
+            p++;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!*p || !strchr("diouxXcsfFeEgGaApn%", *p)) {
+        return NULL;
+    }
+    spec->conv = *p++;
+    return p;
+}
+
+static logq_RING *
+logq_get_ring(void)
+{
+    logq_RING *ring;
+
+    if (logq_curring) {
+        return logq_curring;
+    }
+
+    /* Reuse a ring whose thread has exited */
+    for (ring = logq_rings; ring; ring = ring->next) {
+        if (ring->orphaned && LOGQ_CASINT(&ring->orphaned, 1, 0)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        logq_RING *head;
+        if ((ring = calloc(1, sizeof(*ring))) == NULL) {
+            return NULL;
+        }
+        do {
+            head = logq_rings;
+            ring->next = head;
+        } while (!LOGQ_CASPTR(&logq_rings, head, ring));
+    }
+
+    sprintf(ring->tid, "%"THREAD_ID_FMT, GET_THREAD_ID());
+#ifndef _WIN32
+    pthread_setspecific(logq_key, ring);
+#endif
+    logq_curring = ring;
+    return ring;
+}
+
+/**
+ * Serialize the arguments for `fmt` into `buf`. Returns the number of bytes
+ * written
+ */
+static size_t
+logq_serialize(char *buf, size_t nbuf, const char *fmt, va_list ap)
+{
+    size_t pos = 0;
+    const char *p = fmt;
+
+    #define LOGQ_PUT(arg) \
+        if (pos + sizeof(arg) > nbuf) { return pos; } \
+        memcpy(buf + pos, &arg, sizeof(arg)); pos += sizeof(arg);
+
+    while ((p = strchr(p, '%')) != NULL) {
+        logq_SPEC spec;
+        logq_ARG arg;
+
+        if ((p = logq_parse_spec(p + 1, &spec)) == NULL) {
+            break;
+        }
+        if (spec.width_star) {
+            arg.i = va_arg(ap, int);
+            LOGQ_PUT(arg);
+        }
+        if (spec.prec_star) {
+            arg.i = va_arg(ap, int);
+            spec.prec = (int)arg.i;
+            LOGQ_PUT(arg);
+        }
+
+        switch (spec.conv) {
+        case 'd': case 'i':
+            switch (spec.length) {
+            case 'l': arg.i = va_arg(ap, long); break;
+            case 'q': arg.i = va_arg(ap, lcb_S64); break;
+            case 'j': arg.i = va_arg(ap, lcb_S64); break;
+            case 'z': arg.i = va_arg(ap, lcb_SSIZE); break;
+            case 't': arg.i = va_arg(ap, ptrdiff_t); break;
+            default: arg.i = va_arg(ap, int); break;
+            }
+            LOGQ_PUT(arg);
+            break;
+
+        case 'o': case 'u': case 'x': case 'X':
+            switch (spec.length) {
+            case 'l': arg.u = va_arg(ap, unsigned long); break;
+            case 'q': arg.u = va_arg(ap, lcb_U64); break;
+            case 'j': arg.u = va_arg(ap, lcb_U64); break;
+            case 'z': arg.u = va_arg(ap, lcb_SIZE); break;
+            case 't': arg.u = va_arg(ap, ptrdiff_t); break;
+            default: arg.u = va_arg(ap, unsigned int); break;
+            }
+            LOGQ_PUT(arg);
+            break;
+
+        case 'c':
+            arg.i = va_arg(ap, int);
+            LOGQ_PUT(arg);
+            break;
+
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            if (spec.length == 'L') {
+                arg.d = (double)va_arg(ap, long double);
+            } else {
+                arg.d = va_arg(ap, double);
+            }
+            LOGQ_PUT(arg);
+            break;
+
+        case 'p':
+            arg.p = va_arg(ap, void *);
+            LOGQ_PUT(arg);
+            break;
+
+        case 'n':
+            (void)va_arg(ap, void *);
+            break;
+
+        case 's': {
+            const char *str = va_arg(ap, const char *);
+            lcb_U32 nstr;
+            if (str == NULL) {
+                str = "(null)";
+            }
+            if (spec.prec >= 0) {
+                const char *end = memchr(str, '\0', spec.prec);
+                nstr = end ? (lcb_U32)(end - str) : (lcb_U32)spec.prec;
+            } else {
+                nstr = (lcb_U32)strlen(str);
+            }
+            if (pos + sizeof(nstr) > nbuf) {
+                return pos;
+            }
+            if (nstr > nbuf - pos - sizeof(nstr)) {
+                nstr = (lcb_U32)(nbuf - pos - sizeof(nstr));
+            }
+            memcpy(buf + pos, &nstr, sizeof(nstr));
+            memcpy(buf + pos + sizeof(nstr), str, nstr);
+            pos += LOGQ_ALIGN(sizeof(nstr) + nstr);
+            if (pos > nbuf) {
+                pos = nbuf;
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+    #undef LOGQ_PUT
+    return pos;
+}
+
+static int
+logq_push(unsigned iid, const char *subsys, int severity, int srcline,
+          hrtime_t now, const char *fmt, va_list ap)
+{
+    logq_RING *ring;
+    logq_HDR *hdr;
+    lcb_U32 head, used, offset, contig, need;
+    va_list aq;
+
+    if (logq_state != 2 || (ring = logq_get_ring()) == NULL) {
+        return 0;
+    }
+
+    hdr = (logq_HDR *)ring->scratch;
+    hdr->flags = 0;
+    hdr->time = now;
+    hdr->subsys = subsys;
+    hdr->fmt = fmt;
+    hdr->iid = iid;
+    hdr->severity = severity;
+    hdr->srcline = srcline;
+
+    va_copy(aq, ap);
+    need = (lcb_U32)logq_serialize(ring->scratch + sizeof(*hdr),
+        LOGQ_MAXREC - sizeof(*hdr), fmt, aq);
+    va_end(aq);
+    need = LOGQ_ALIGN(need + sizeof(*hdr));
+    hdr->size = need;
+
+    head = ring->head;
+    used = head - ring->tail;
+    LOGQ_BARRIER();
+    offset = head & (LOGQ_RINGSIZE - 1);
+    contig = LOGQ_RINGSIZE - offset;
+
+    if (contig < need) {
+        /* Pad until the end of the buffer and place the record at the start */
+        if (LOGQ_RINGSIZE - used < contig + need) {
+            ring->dropped++;
+            return 1;
+        }
+        ((logq_HDR *)(ring->buf + offset))->size = contig;
+        ((logq_HDR *)(ring->buf + offset))->flags = LOGQ_F_SKIP;
+        head += contig;
+        offset = 0;
+    } else if (LOGQ_RINGSIZE - used < need) {
+        ring->dropped++;
+        return 1;
+    }
+
+    memcpy(ring->buf + offset, ring->scratch, need);
+    LOGQ_BARRIER();
+    ring->head = head + need;
+    logq_wake();
+    return 1;
+}
+
+/** Append formatted output to the line buffer */
+static void
+logq_append(char *line, size_t *pos, const char *fmt, ...)
+{
+    int rv;
+    va_list ap;
+    if (*pos >= LOGQ_MAXLINE - 1) {
+        return;
+    }
+    va_start(ap, fmt);
+    rv = vsnprintf(line + *pos, LOGQ_MAXLINE - *pos, fmt, ap);
+    va_end(ap);
+    if (rv < 0 || (size_t)rv >= LOGQ_MAXLINE - *pos) {
+        *pos = LOGQ_MAXLINE - 1;
+    } else {
+        *pos += rv;
+    }
+}
+
+/** Format a single record into `line`, returning its length */
+static size_t
+logq_format(const logq_RING *ring, const logq_HDR *hdr, char *line)
+{
+    const char *p = hdr->fmt, *prev = hdr->fmt;
+    const char *args = (const char *)(hdr + 1);
+    const char *args_end = (const char *)hdr + hdr->size;
+    size_t pos = 0;
+
+    #define LOGQ_GET(arg) \
+        if (args + sizeof(arg) > args_end) { goto GT_DONE; } \
+        memcpy(&arg, args, sizeof(arg)); args += sizeof(arg);
+
+    logq_append(line, &pos, "%lums [I%d] {%s} [%s] (%s - L:%d) ",
+        (unsigned long)(hdr->time - start_time) / 1000000, hdr->iid,
+        ring->tid, level_to_string(hdr->severity), hdr->subsys, hdr->srcline);
+
+    while ((p = strchr(p, '%')) != NULL) {
+        logq_SPEC spec;
+        logq_ARG arg;
+        char specbuf[64];
+        size_t nspec;
+
+        logq_append(line, &pos, "%.*s", (int)(p - prev), prev);
+        if ((p = logq_parse_spec(p + 1, &spec)) == NULL) {
+            goto GT_DONE;
+        }
+        prev = p;
+
+        if (spec.width_star) {
+            LOGQ_GET(arg);
+            spec.width = (int)arg.i;
+        }
+        if (spec.prec_star) {
+            LOGQ_GET(arg);
+            spec.prec = (int)arg.i;
+        }
+
+        nspec = sprintf(specbuf, "%%%s", spec.flags);
+        if (spec.width >= 0) {
+            nspec += sprintf(specbuf + nspec, "%d", spec.width);
+        }
+        if (spec.prec >= 0 && spec.conv != 's') {
+            nspec += sprintf(specbuf + nspec, ".%d", spec.prec);
+        }
+
+        switch (spec.conv) {
+        case 'd': case 'i':
+            LOGQ_GET(arg);
+            sprintf(specbuf + nspec, "ll%c", spec.conv);
+            logq_append(line, &pos, specbuf, (long long)arg.i);
+            break;
+
+        case 'o': case 'u': case 'x': case 'X':
+            LOGQ_GET(arg);
+            sprintf(specbuf + nspec, "ll%c", spec.conv);
+            logq_append(line, &pos, specbuf, (unsigned long long)arg.u);
+            break;
+
+        case 'c':
+            LOGQ_GET(arg);
+            sprintf(specbuf + nspec, "c");
+            logq_append(line, &pos, specbuf, (int)arg.i);
+            break;
+
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            LOGQ_GET(arg);
+            sprintf(specbuf + nspec, "%c", spec.conv);
+            logq_append(line, &pos, specbuf, arg.d);
+            break;
+
+        case 'p':
+            LOGQ_GET(arg);
+            sprintf(specbuf + nspec, "p");
+            logq_append(line, &pos, specbuf, arg.p);
+            break;
+
+        case 's': {
+            lcb_U32 nstr;
+            if (args + sizeof(nstr) > args_end) {
+                goto GT_DONE;
+            }
+            memcpy(&nstr, args, sizeof(nstr));
+            if (args + sizeof(nstr) + nstr > args_end) {
+                goto GT_DONE;
+            }
+            sprintf(specbuf + nspec, ".*s");
+            logq_append(line, &pos, specbuf, (int)nstr, args + sizeof(nstr));
+            args += LOGQ_ALIGN(sizeof(nstr) + nstr);
+            break;
+        }
+
+        case '%':
+            logq_append(line, &pos, "%%");
+            break;
+
+        default:
+            break;
+        }
+    }
+    logq_append(line, &pos, "%s", prev);
+
+    GT_DONE:
+    #undef LOGQ_GET
+    line[pos++] = '\n';
+    return pos;
+}
+
+static void
+logq_lock(void)
+{
+    while (!LOGQ_CASINT(&logq_writing, 0, 1)) {
+        logq_sleep();
+    }
+}
+
+static void
+logq_unlock(void)
+{
+    LOGQ_BARRIER();
+    logq_writing = 0;
+}
+
+/**
+ * Take the writer lock from outside the writer thread. Once this returns, the
+ * writer is between drains and will not touch the FILE until logq_unlock()
+ */
+static void
+logq_wait_idle(void)
+{
+    LOGQ_INCR(&logq_waiters);
+    logq_lock();
+    LOGQ_DECR(&logq_waiters);
+}
+
+/**
+ * Drain all rings. Returns the number of records processed. A ring's tail is
+ * only advanced once its records have been flushed to the FILE, so that a
+ * reader observing tail == head knows the output is complete.
+ */
+static unsigned
+logq_drain(void)
+{
+    logq_RING *ring;
+    unsigned nrecs = 0;
+    char line[LOGQ_MAXLINE + 1];
+    FILE *fp;
+
+    logq_lock();
+    fp = console_logprocs.fp ? console_logprocs.fp : stderr;
+
+    for (ring = logq_rings; ring; ring = ring->next) {
+        lcb_U32 tail = ring->tail, head = ring->head, dropped;
+        int written = 0;
+        LOGQ_BARRIER();
+
+        while (tail != head) {
+            const logq_HDR *hdr =
+                    (const logq_HDR *)(ring->buf + (tail & (LOGQ_RINGSIZE - 1)));
+            if (!(hdr->flags & LOGQ_F_SKIP)) {
+                fwrite(line, 1, logq_format(ring, hdr, line), fp);
+                nrecs++;
+                written = 1;
+            }
+            tail += hdr->size;
+        }
+
+        dropped = ring->dropped;
+        if (dropped != ring->dropped_seen) {
+            fprintf(fp, "[{%s} %u log messages dropped]\n", ring->tid,
+                dropped - ring->dropped_seen);
+            ring->dropped_seen = dropped;
+            written = 1;
+        }
+        if (written) {
+            fflush(fp);
+        }
+        LOGQ_BARRIER();
+        ring->tail = tail;
+    }
+    logq_unlock();
+    return nrecs;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI logq_run(LPVOID arg)
+#else
+static void *logq_run(void *arg)
+#endif
+{
+    while (!logq_stopping) {
+        if (logq_waiters) {
+            /* Step aside for whoever is waiting to replace the FILE */
+            logq_sleep();
+        } else if (!logq_drain()) {
+            logq_wait();
+        }
+    }
+    logq_drain();
+    (void)arg;
+    return 0;
+}
+
+/** Whether the writer has anything to do */
+static int
+logq_pending(void)
+{
+    logq_RING *ring;
+    if (logq_stopping || logq_waiters) {
+        return 1;
+    }
+    for (ring = logq_rings; ring; ring = ring->next) {
+        if (ring->head != ring->tail || ring->dropped != ring->dropped_seen) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Stop the writer once it has written all pending messages. Messages logged
+ * from then on are written synchronously until the writer is started again.
+ */
+static void
+logq_stop(void)
+{
+    if (!LOGQ_CASINT(&logq_state, 2, 1)) {
+        return;
+    }
+    LOGQ_BARRIER();
+    logq_stopping = 1;
+#ifdef _WIN32
+    SetEvent(logq_event);
+    WaitForSingleObject(logq_thread, INFINITE);
+    CloseHandle(logq_thread);
+    CloseHandle(logq_event);
+#else
+    pthread_mutex_lock(&logq_mutex);
+    pthread_cond_signal(&logq_cond);
+    pthread_mutex_unlock(&logq_mutex);
+    pthread_join(logq_thread, NULL);
+#endif
+    logq_stopping = 0;
+    LOGQ_BARRIER();
+    logq_state = 0;
+}
+
+#ifndef _WIN32
+static void
+logq_thread_exit(void *arg)
+{
+    logq_RING *ring = arg;
+    ring->orphaned = 1;
+}
+#endif
+
+static int
+logq_start(void)
+{
+    for (;;) {
+        if (logq_state == 2) {
+            return 1;
+        }
+        if (LOGQ_CASINT(&logq_state, 0, 1)) {
+            break;
+        }
+        logq_sleep(); /* Another thread is starting or stopping the writer */
+    }
+
+#ifdef _WIN32
+    logq_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (logq_event == NULL) {
+        logq_state = 0;
+        return 0;
+    }
+    logq_thread = CreateThread(NULL, 0, logq_run, NULL, 0, NULL);
+    if (logq_thread == NULL) {
+        CloseHandle(logq_event);
+        logq_state = 0;
+        return 0;
+    }
+#else
+    /* The key outlives the writer, since rings outlive it too */
+    if (!logq_key_created) {
+        if (pthread_key_create(&logq_key, logq_thread_exit) != 0) {
+            logq_state = 0;
+            return 0;
+        }
+        logq_key_created = 1;
+    }
+    if (pthread_create(&logq_thread, NULL, logq_run, NULL) != 0) {
+        logq_state = 0;
+        return 0;
+    }
+#endif
+    LOGQ_BARRIER();
+    logq_state = 2;
+    return 1;
+}
+
+LCB_INTERNAL_API
+lcb_error_t
+lcb_console_log_setasync(int enabled)
+{
+    if (enabled) {
+        if (!start_time) {
+            start_time = gethrtime();
+        }
+        /* Otherwise the writer is started by the first instance */
+        if (logq_instances && !logq_start()) {
+            return LCB_CLIENT_ENOMEM;
+        }
+        console_logprocs.async = 1;
+    } else {
+        console_logprocs.async = 0;
+        logq_stop();
+    }
+    return LCB_SUCCESS;
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_attach(void)
+{
+    LOGQ_INCR(&logq_instances);
+    if (console_logprocs.async) {
+        logq_start();
+    }
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_detach(void)
+{
+    if (LOGQ_DECR(&logq_instances) == 0) {
+        logq_stop();
+    }
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_setfp(FILE *fp)
+{
+    logq_wait_idle();
+    console_logprocs.fp = fp;
+    logq_unlock();
+}
+
+LCB_INTERNAL_API
+lcb_U32
+lcb_console_log_dropped(void)
+{
+    lcb_U32 ret = 0;
+    logq_RING *ring;
+    for (ring = logq_rings; ring; ring = ring->next) {
+        ret += ring->dropped;
+    }
+    return ret;
+}
+
+#else /* LOGQ_DISABLED */
+static int
+logq_push(unsigned iid, const char *subsys, int severity, int srcline,
+          hrtime_t now, const char *fmt, va_list ap)
+{
+    (void)iid; (void)subsys; (void)severity; (void)srcline; (void)now;
+    (void)fmt; (void)ap;
+    return 0;
+}
+
+LCB_INTERNAL_API
+lcb_error_t
+lcb_console_log_setasync(int enabled)
+{
+    return enabled ? LCB_NOT_SUPPORTED : LCB_SUCCESS;
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_setfp(FILE *fp)
+{
+    console_logprocs.fp = fp;
+}
+
+LCB_INTERNAL_API
+lcb_U32
+lcb_console_log_dropped(void)
+{
+    return 0;
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_attach(void)
+{
+}
+
+LCB_INTERNAL_API
+void
+lcb_console_log_detach(void)
+{
+}
+#endif /* LOGQ_DISABLED */
+
+
 LCB_INTERNAL_API
 void lcb_log(const struct lcb_settings_st *settings,
              const char *subsys,
@@ -224,6 +1098,10 @@ lcb_logprocs * lcb_init_console_logger(void)
         console_logprocs.fp = fp;
     }
 
+    if (lcb_getenv_boolean("LCB_LOGASYNC")) {
+        lcb_console_log_setasync(1);
+    }
+
     if (!lcb_getenv_nonempty("LCB_LOGLEVEL", vbuf, sizeof(vbuf))) {
         return NULL;
     }
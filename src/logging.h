@@ -38,8 +38,47 @@ struct lcb_CONSOLELOGGER {
     struct lcb_logprocs_st base;
     FILE *fp;
     int minlevel;
+    int async; /**< Messages are written by a background thread */
 };
 
+/**
+ * Enable or disable asynchronous mode for the console logger. When disabling,
+ * this waits until all pending messages have been written and the writer
+ * thread has exited.
+ * @return LCB_NOT_SUPPORTED if asynchronous logging is unavailable on this
+ * platform
+ */
+LCB_INTERNAL_API
+lcb_error_t lcb_console_log_setasync(int enabled);
+
+/**
+ * Replace the FILE the console logger writes to. When asynchronous logging is
+ * active this waits for the writer thread to finish its current batch, so the
+ * previous FILE may be closed once this returns.
+ */
+LCB_INTERNAL_API
+void lcb_console_log_setfp(FILE *fp);
+
+/**
+ * Get the number of messages dropped by the asynchronous console logger
+ * because its buffers were full
+ */
+LCB_INTERNAL_API
+lcb_U32 lcb_console_log_dropped(void);
+
+/**
+ * Called when an instance is created and destroyed, respectively. The
+ * asynchronous console logger's writer thread only runs while there are live
+ * instances, so that it does not outlive the library (e.g. across dlclose()).
+ * Destroying the last instance waits until all pending messages have been
+ * written.
+ */
+LCB_INTERNAL_API
+void lcb_console_log_attach(void);
+
+LCB_INTERNAL_API
+void lcb_console_log_detach(void);
+
 /**
  * Log a message via the installed logger. The parameters correlate to the
  * arguments passed to the lcb_logging_callback function.
@@ -23,6 +23,7 @@ extern "C" {
 typedef struct {
     mc_PIPELINE *pl;
     hrtime_t now;
+    hrtime_t tracenow;
 } mc__FLUSHINFO;
 
 /**
@@ -41,7 +42,12 @@ typedef struct {
 static unsigned int
 mcreq_flush_iov_fill(mc_PIPELINE *pipeline, nb_IOV *iov, int niov, int *nused)
 {
-    return netbuf_start_flush(&pipeline->nbmgr, iov, niov, nused);
+    unsigned int ret = netbuf_start_flush(&pipeline->nbmgr, iov, niov, nused);
+    if (ret && pipeline->parent && pipeline->parent->trace &&
+            !pipeline->trace_flushstart) {
+        pipeline->trace_flushstart = gethrtime();
+    }
+    return ret;
 }
 
 static nb_SIZE
@@ -57,6 +63,19 @@ mcreq__pktflush_callback(void *p, nb_SIZE hint, void *arg)
         MCREQ_PKT_RDATA(pkt)->start = info->now;
     }
 
+    if (pkt->trace && hint) {
+        mc_PKTTRACE *trace = pkt->trace;
+        if (!trace->flush_start) {
+            trace->flush_start = info->pl->trace_flushstart;
+        }
+        if (hint >= pktsize) {
+            if (!info->tracenow) {
+                info->tracenow = gethrtime();
+            }
+            trace->flush_done = info->tracenow;
+        }
+    }
+
     if (hint < pktsize) {
         return pktsize;
     }
@@ -88,7 +107,7 @@ mcreq_flush_done_ex(mc_PIPELINE *pl,
     unsigned nflushed, unsigned expected, lcb_U64 now)
 {
     if (nflushed) {
-        mc__FLUSHINFO info = { pl, now };
+        mc__FLUSHINFO info = { pl, now, 0 };
 
         netbuf_end_flush2(&pl->nbmgr, nflushed,
                           mcreq__pktflush_callback,
@@ -97,6 +116,7 @@ mcreq_flush_done_ex(mc_PIPELINE *pl,
     if (nflushed < expected) {
         netbuf_reset_flush(&pl->nbmgr);
     }
+    pl->trace_flushstart = 0;
 }
 
 /* Mainly for tests */
@@ -197,6 +197,7 @@ mcreq_reenqueue_packet(mc_PIPELINE *pipeline, mc_PACKET *packet)
     sllist_root *reqs = &pipeline->requests;
     mcreq_enqueue_packet(pipeline, packet);
     sllist_remove(reqs, &packet->slnode);
+    pipeline->nrequests--;
     sllist_insert_sorted(reqs, &packet->slnode, pkt_tmo_compar);
 }
 
@@ -204,7 +205,11 @@ void
 mcreq_enqueue_packet(mc_PIPELINE *pipeline, mc_PACKET *packet)
 {
     nb_SPAN *vspan = &packet->u_value.single;
+    if (packet->trace) {
+        packet->trace->enqueue = gethrtime();
+    }
     sllist_append(&pipeline->requests, &packet->slnode);
+    pipeline->nrequests++;
     netbuf_enqueue_span(&pipeline->nbmgr, &packet->kh_span);
 
     if (!(packet->flags & MCREQ_F_HASVALUE)) {
@@ -274,6 +279,7 @@ mcreq_allocate_packet(mc_PIPELINE *pipeline)
     ret->alloc_parent = span.parent;
     ret->flags = 0;
     ret->retries = 0;
+    ret->trace = NULL;
     ret->opaque = pipeline->parent->seq++;
     return ret;
 }
@@ -282,6 +288,7 @@ void
 mcreq_release_packet(mc_PIPELINE *pipeline, mc_PACKET *packet)
 {
     nb_SPAN span;
+    free(packet->trace);
     if (packet->flags & MCREQ_F_DETACHED) {
         sllist_iterator iter;
         mc_EXPACKET *epkt = (mc_EXPACKET *)packet;
@@ -326,6 +333,13 @@ mcreq_renew_packet(const mc_PACKET *src)
     dst->slnode.next = NULL;
     dst->retries = src->retries;
 
+    if (src->trace) {
+        dst->trace = malloc(sizeof(*dst->trace));
+        if (dst->trace) {
+            *dst->trace = *src->trace;
+        }
+    }
+
     if (src->flags & MCREQ_F_HASVALUE) {
         /** Get the length */
         if (src->flags & MCREQ_F_VALUE_IOV) {
@@ -532,9 +546,24 @@ mcreq_get_size(const mc_PACKET *packet)
     return sz;
 }
 
+static void
+free_traces(sllist_root *list)
+{
+    sllist_node *ll;
+    SLLIST_FOREACH(list, ll) {
+        mc_PACKET *pkt = SLLIST_ITEM(ll, mc_PACKET, slnode);
+        free(pkt->trace);
+        pkt->trace = NULL;
+    }
+}
+
 void
 mcreq_pipeline_cleanup(mc_PIPELINE *pipeline)
 {
+    /* Any remaining packets are dropped along with the pools they live in,
+     * but their traces are allocated separately */
+    free_traces(&pipeline->requests);
+    free_traces(&pipeline->ctxqueued);
     netbuf_cleanup(&pipeline->nbmgr);
     netbuf_cleanup(&pipeline->reqpool);
 }
@@ -545,12 +574,18 @@ mcreq_pipeline_init(mc_PIPELINE *pipeline)
     nb_SETTINGS settings;
     netbuf_default_settings(&settings);
 
-    /** Initialize datapool */
+    /** Initialize datapool. Size blocks according to the recent packets */
+    settings.data_minalloc = NB_DATA_MINALLOC;
+    settings.data_maxalloc = NB_DATA_MAXALLOC;
     netbuf_init(&pipeline->nbmgr, &settings);
 
-    /** Initialize request pool */
+    /** Initialize request pool. Its allocations are all of the same size */
     settings.data_basealloc = sizeof(mc_PACKET) * 32;
+    settings.data_minalloc = 0;
+    settings.data_maxalloc = 0;
     netbuf_init(&pipeline->reqpool, &settings);
+    pipeline->trace_flushstart = 0;
+    pipeline->nrequests = 0;
     return 0;
 }
 
@@ -602,6 +637,7 @@ mcreq_queue_init(mc_CMDQUEUE *queue)
     queue->scheds = NULL;
     queue->fallback = NULL;
     queue->npipelines = 0;
+    queue->trace = 0;
     return 0;
 }
 
@@ -692,6 +728,12 @@ mcreq_sched_add(mc_PIPELINE *pipeline, mc_PACKET *pkt)
     if (!cq->scheds[pipeline->index]) {
         cq->scheds[pipeline->index] = 1;
     }
+    if (cq->trace && !pkt->trace) {
+        pkt->trace = calloc(1, sizeof(*pkt->trace));
+        if (pkt->trace) {
+            pkt->trace->sched = gethrtime();
+        }
+    }
     sllist_append(&pipeline->ctxqueued, &pkt->slnode);
 }
 
@@ -704,6 +746,7 @@ pipeline_find(mc_PIPELINE *pipeline, lcb_uint32_t opaque, int do_remove)
         if (pkt->opaque == opaque) {
             if (do_remove) {
                 sllist_iter_remove(&pipeline->requests, &iter);
+                pipeline->nrequests--;
             }
             return pkt;
         }
@@ -789,6 +832,7 @@ mcreq_pipeline_timeout(
         }
 
         sllist_iter_remove(&pl->requests, &iter);
+        pl->nrequests--;
         failcb(pl, pkt, err, cbarg);
         mcreq_packet_handled(pl, pkt);
         count++;
@@ -815,6 +859,7 @@ mcreq_iterwipe(mc_CMDQUEUE *queue, mc_PIPELINE *src,
         rv = callback(queue, src, orig, arg);
         if (rv == MCREQ_REMOVE_PACKET) {
             sllist_iter_remove(&src->requests, &iter);
+            src->nrequests--;
         }
     }
 }
@@ -842,6 +887,7 @@ do_fallback_flush(mc_PIPELINE *pipeline)
         mc_PACKET *pkt = SLLIST_ITEM(iter.cur, mc_PACKET, slnode);
         fpl->handler(pipeline->parent, pkt);
         sllist_iter_remove(&pipeline->requests, &iter);
+        pipeline->nrequests--;
         mcreq_packet_handled(pipeline, pkt);
     }
 }
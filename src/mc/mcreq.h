@@ -294,6 +294,22 @@ union mc_USER {
     mc_REQDATAEX *exdata;
 };
 
+/**
+ * @brief Timestamps for each phase of a packet's lifetime.
+ *
+ * This is only allocated if tracing is enabled for the queue (see
+ * mc_CMDQUEUE#trace) when the packet is scheduled. Phases which have not (yet)
+ * happened are 0.
+ */
+typedef struct {
+    hrtime_t sched; /**< Added to the scheduling context (mcreq_sched_add()) */
+    hrtime_t enqueue; /**< Placed in the pipeline's output queue */
+    hrtime_t flush_start; /**< Write containing the packet was started */
+    hrtime_t flush_done; /**< Packet completely written */
+    hrtime_t read; /**< Response received from the network */
+    hrtime_t dispatch; /**< Response handler invoked */
+} mc_PKTTRACE;
+
 /**
  * @brief Packet structure for a single Memcached command
  *
@@ -335,6 +351,9 @@ typedef struct mc_packet_st {
 
     /** Allocation data for the PACKET structure itself */
     nb_MBLOCK *alloc_parent;
+
+    /** Phase timestamps, if tracing. Owned by the packet */
+    mc_PKTTRACE *trace;
 } mc_PACKET;
 
 
@@ -371,6 +390,9 @@ typedef struct mc_pipeline_st {
     /** List of requests. Newer requests are appended at the end */
     sllist_root requests;
 
+    /** Number of packets in `requests` */
+    unsigned nrequests;
+
     /** Parent command queue */
     struct mc_cmdqueue_st *parent;
 
@@ -400,6 +422,9 @@ typedef struct mc_pipeline_st {
 
     /** Allocator for packet structures */
     nb_MGR reqpool;
+
+    /** Time the current write was started, if tracing. @see mc_PKTTRACE */
+    hrtime_t trace_flushstart;
 } mc_PIPELINE;
 
 typedef struct mc_cmdqueue_st {
@@ -435,6 +460,10 @@ typedef struct mc_cmdqueue_st {
     /**Special pipeline used to contain orphaned packets within a scheduling
      * context. This field is used by mcreq_set_fallback_handler() */
     mc_PIPELINE *fallback;
+
+    /** Whether scheduled packets should record their phase timings
+     * (see mc_PKTTRACE) */
+    unsigned trace;
 } mc_CMDQUEUE;
 
 /**
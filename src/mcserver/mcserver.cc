@@ -24,6 +24,7 @@
 #include "mc/mcreq-flush-inl.h"
 #include <lcbio/ssl.h>
 #include "ctx-log-inl.h"
+#include <algorithm>
 
 #define LOGARGS(c, lvl) (c)->settings, "server", LCB_LOG_##lvl, __FILE__, __LINE__
 #define LOGARGS_T(lvl) LOGARGS(this, lvl)
@@ -80,7 +81,8 @@ Server::flush()
         lcbio_ctx_rwant(connctx, 24);
     }
 
-    lcbio_ctx_wwant(connctx);
+    /* Write directly; only sockets which would block wait for the loop */
+    lcbio_ctx_wflush(connctx);
     lcbio_ctx_schedule(connctx);
 
     if (!lcbio_timer_armed(io_timer)) {
@@ -218,6 +220,10 @@ Server::try_read(lcbio_CTX *ctx, rdb_IOROPE *ior)
         request = mcreq_pipeline_remove(this, mcresp.opaque());
     }
 
+    if (request && request->trace) {
+        request->trace->read = trace_read;
+    }
+
     if (!request) {
         lcb_log(LOGARGS_T(WARN), LOGFMT "Found stale packet (OP=0x%x, RC=0x%x, SEQ=%u)", LOGID_T(), mcresp.opcode(), mcresp.status(), mcresp.opaque());
         rdb_consumed(ior, pktsize);
@@ -278,8 +284,15 @@ on_read(lcbio_CTX *ctx, unsigned)
         return;
     }
 
+    if (server->parent->trace && !server->trace_read) {
+        server->trace_read = gethrtime();
+    }
+
     Server::ReadState rv;
     while ((rv = server->try_read(ctx, ior)) == Server::PKT_READ_COMPLETE);
+    if (!rdb_get_nused(ior)) {
+        server->trace_read = 0;
+    }
     lcbio_ctx_schedule(ctx);
     lcb_maybe_breakout(server->instance);
 }
@@ -418,6 +431,16 @@ void Server::io_timeout()
         lcb_log(LOGARGS_T(ERR), LOGFMT "Server timed out. Some commands have failed", LOGID_T());
     }
 
+    /* Free buffer blocks which have gone unused for a whole timeout period.
+     * The timer is always armed, so this also happens while idle */
+    if (now - last_trim >= LCB_US2NS(default_timeout())) {
+        nb_SIZE nfreed = netbuf_trim(&nbmgr) + netbuf_trim(&reqpool);
+        if (nfreed) {
+            lcb_log(LOGARGS_T(DEBUG), LOGFMT "Freed %u bytes of unused buffers", LOGID_T(), nfreed);
+        }
+        last_trim = now;
+    }
+
     uint32_t next_us = next_timeout();
     lcb_log(LOGARGS_T(DEBUG), LOGFMT "Scheduling next timeout for %u ms", LOGID_T(), next_us / 1000);
     lcbio_timer_rearm(io_timer, next_us);
@@ -526,7 +549,9 @@ Server::Server(lcb_t instance_, int ix)
       compsupport(0),
       mutation_tokens(0),
       connctx(NULL),
-      curhost(new lcb_host_t())
+      curhost(new lcb_host_t()),
+      trace_read(0), dur_replicate_est(0), dur_persist_est(0),
+      last_trim(gethrtime())
 {
     std::memset(static_cast<mc_PIPELINE*>(this), 0, sizeof(mc_PIPELINE));
     mcreq_pipeline_init(this);
@@ -549,7 +574,8 @@ Server::Server(lcb_t instance_, int ix)
 Server::Server()
     : state(S_TEMPORARY),
       io_timer(NULL), instance(NULL), settings(NULL), compsupport(0),
-      mutation_tokens(0), connctx(NULL), curhost(NULL)
+      mutation_tokens(0), connctx(NULL), curhost(NULL), trace_read(0),
+      dur_replicate_est(0), dur_persist_est(0), last_trim(0)
 {
 }
 
@@ -722,3 +748,82 @@ Server::check_closed()
     finalize_errored_ctx();
     return 1;
 }
+
+LatencyTracker::LatencyTracker() : count(0), since_decay(0), ewma(0)
+{
+    memset(buckets, 0, sizeof buckets);
+}
+
+void
+LatencyTracker::record(hrtime_t duration)
+{
+    hrtime_t us = LCB_NS2US(duration);
+    unsigned ix = 0;
+    while (us > 1 && ix < NBUCKETS - 1) {
+        us >>= 1;
+        ix++;
+    }
+    buckets[ix]++;
+    count++;
+
+    lcb_U32 sample = LCB_NS2US(duration);
+    if (ewma) {
+        ewma = (lcb_U32)(((lcb_U64)ewma * 7 + sample) / 8);
+    } else {
+        ewma = sample ? sample : 1;
+    }
+
+    if (++since_decay == DECAY_SAMPLES) {
+        count = 0;
+        for (unsigned ii = 0; ii < NBUCKETS; ii++) {
+            buckets[ii] /= 2;
+            count += buckets[ii];
+        }
+        since_decay = 0;
+    }
+}
+
+lcb_U32
+LatencyTracker::percentile(unsigned pct) const
+{
+    if (count < MIN_SAMPLES) {
+        return 0;
+    }
+
+    lcb_U64 target = ((lcb_U64)count * pct + 99) / 100;
+    lcb_U64 seen = 0;
+    for (unsigned ii = 0; ii < NBUCKETS; ii++) {
+        if (seen + buckets[ii] >= target) {
+            /* Interpolate within the bucket */
+            lcb_U64 lo = 1ULL << ii;
+            return (lcb_U32)(lo + lo * (target - seen) / buckets[ii]);
+        }
+        seen += buckets[ii];
+    }
+    return 1U << NBUCKETS;
+}
+
+unsigned
+lcb::rank_replicas(mc_CMDQUEUE *cq, int vbid, std::vector<unsigned>& order)
+{
+    order.clear();
+    if (!cq->config) {
+        return 0;
+    }
+
+    std::vector<std::pair<lcb_U64, unsigned> > costs;
+    for (unsigned ii = 0; ii < LCBVB_NREPLICAS(cq->config); ii++) {
+        int ix = lcbvb_vbreplica(cq->config, vbid, ii);
+        if (ix < 0 || ix >= (int)cq->npipelines) {
+            continue;
+        }
+        const Server *server = static_cast<Server*>(cq->pipelines[ix]);
+        /* Index order breaks ties, so that idle clusters behave like before */
+        costs.push_back(std::make_pair(server->selection_cost(), ii));
+    }
+    std::sort(costs.begin(), costs.end());
+    for (size_t ii = 0; ii < costs.size(); ii++) {
+        order.push_back(costs[ii].second);
+    }
+    return order.size();
+}
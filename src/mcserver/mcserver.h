@@ -24,11 +24,47 @@
 #include <netbuf/netbuf.h>
 
 #ifdef __cplusplus
+#include <vector>
+
 namespace lcb {
 
 class RetryQueue;
 struct RetryOp;
 
+/**
+ * Keeps a decaying histogram of the response times of a server, so that
+ * recent latency percentiles may be estimated cheaply.
+ */
+class LatencyTracker {
+public:
+    LatencyTracker();
+
+    /** Record the time (in nanoseconds) taken for a response */
+    void record(hrtime_t duration);
+
+    /**
+     * Estimate the latency (in microseconds) within which `pct` percent of
+     * recent responses arrived. Returns 0 if there are not enough samples.
+     */
+    lcb_U32 percentile(unsigned pct) const;
+
+    /** Moving average (in microseconds) of recent responses. 0 if unknown */
+    lcb_U32 average() const { return ewma; }
+
+private:
+    /** Bucket `i` holds latencies in [2^i, 2^(i+1)) microseconds */
+    static const unsigned NBUCKETS = 24;
+    /** Halve all the buckets after this many samples */
+    static const unsigned DECAY_SAMPLES = 1024;
+    /** Minimum number of samples before estimating */
+    static const unsigned MIN_SAMPLES = 32;
+
+    lcb_U32 buckets[NBUCKETS];
+    lcb_U32 count;
+    lcb_U32 since_decay;
+    lcb_U32 ewma;
+};
+
 /**
  * The structure representing each couchbase server
  */
@@ -114,6 +150,15 @@ public:
         return connctx != NULL;
     }
 
+    /**
+     * Relative cost of sending another request to this server, based on its
+     * recent latency and the number of requests it has outstanding. Lower
+     * is better.
+     */
+    lcb_U64 selection_cost() const {
+        return ((lcb_U64)latency.average() + 1) * (nrequests + 1);
+    }
+
     /** "Temporary" constructor. Only for use in retry queue */
     Server();
     ~Server();
@@ -205,7 +250,36 @@ public:
 
     /** Request for current connection */
     lcb_host_t *curhost;
+
+    /** Time at which the unparsed data in the read buffer began to arrive.
+     * Only maintained when tracing (see mc_PKTTRACE) */
+    hrtime_t trace_read;
+
+    /** Moving estimates (in microseconds) of how long it takes for a
+     * mutation to be replicated to, and persisted on this server. Updated
+     * by durability polling. 0 if unknown */
+    lcb_U32 dur_replicate_est;
+    lcb_U32 dur_persist_est;
+
+    /** Recent response times */
+    LatencyTracker latency;
+
+    /** Time at which unused buffer memory was last returned */
+    hrtime_t last_trim;
 };
+
+/**
+ * Order the replicas of a vBucket by Server::selection_cost(), cheapest
+ * first. Replicas which are not available in the current configuration
+ * are omitted.
+ *
+ * @param cq the command queue
+ * @param vbid the vBucket
+ * @param[out] order receives the replica indexes, suitable for passing to
+ * lcbvb_vbreplica()
+ * @return the number of replica indexes written to `order`
+ */
+unsigned rank_replicas(mc_CMDQUEUE *cq, int vbid, std::vector<unsigned>& order);
 }
 #endif /* __cplusplus */
 #endif /* LCB_MCSERVER_H */
@@ -0,0 +1,309 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <libcouchbase/couchbase.h>
+#include <libcouchbase/n1ql.h>
+#include "internal.h"
+#include "logging.h"
+#include "http/dispatch.h"
+#include <lcbio/timer-cxx.h>
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+
+#define LOGFMT "(NGR=%p) "
+#define LOGID(req) static_cast<const void*>(req)
+#define LOGARGS(req, lvl) req->instance->settings, "n1ql", LCB_LOG_##lvl, __FILE__, __LINE__
+
+/*
+ * A group of N1QL statements, issued with a limited number in progress at
+ * once. The statements are placed by the HTTP Dispatcher, which sends each to
+ * the query node expected to complete it soonest among those where the group
+ * has fewer than max_per_node in progress (counted by a Dispatcher quota).
+ */
+struct lcb_N1QLGROUP {
+    struct Statement {
+        lcb_N1QLGROUP *parent;
+        size_t index;
+        lcb_U32 cmdflags;
+        std::string query;
+        lcb_N1QLHANDLE handle; /**< Set while in progress */
+    };
+
+    lcb_N1QLGROUP(lcb_t instance, const void *cookie, const lcb_CMDN1QLGROUP *cmd);
+    ~lcb_N1QLGROUP();
+
+    void ref() { refcount++; }
+    void unref() { if (!--refcount) { delete this; } }
+    /** Drop the reference held until all the statements are complete */
+    void finish() {
+        if (!finished) {
+            finished = true;
+            unref();
+        }
+    }
+    void cancel();
+    void issue();
+    void statement_done(Statement *stmt);
+    size_t window() const;
+    bool node_available() const;
+
+    lcb_t instance;
+    const void *cookie;
+    lcb_N1QLGROUPCALLBACK callback;
+    unsigned max_per_node;
+    unsigned quota; /**< Dispatcher quota of the statements, if limited */
+    std::vector<Statement> statements;
+    std::deque<size_t> pending; /**< Statements yet to be issued */
+    size_t nactive; /**< Statements in progress */
+    size_t nremaining; /**< Statements whose final callback is due */
+    unsigned refcount;
+    bool finished;
+    lcb::io::Timer<lcb_N1QLGROUP, &lcb_N1QLGROUP::issue> timer;
+};
+
+namespace lcb {
+namespace n1ql {
+/* The groups in progress. Any left when the instance is destroyed are
+ * deleted along with it, since they hold a pending operation and a timer */
+class GroupList {
+public:
+    ~GroupList() {
+        std::list<lcb_N1QLGROUP*> remaining;
+        remaining.swap(groups);
+        for (std::list<lcb_N1QLGROUP*>::iterator ii = remaining.begin();
+                ii != remaining.end(); ++ii) {
+            delete *ii;
+        }
+    }
+    void add(lcb_N1QLGROUP *group) {
+        groups.push_back(group);
+    }
+    void remove(lcb_N1QLGROUP *group) {
+        groups.remove(group);
+    }
+
+private:
+    std::list<lcb_N1QLGROUP*> groups;
+};
+}
+}
+
+/* Called from lcb_destroy() */
+extern "C" void
+lcb_n1ql_groups_destroy(lcb_N1QLGROUPS *groups)
+{
+    delete groups;
+}
+
+static void
+statement_callback(lcb_t instance, int, const lcb_RESPN1QL *resp)
+{
+    lcb_N1QLGROUP::Statement *stmt =
+            reinterpret_cast<lcb_N1QLGROUP::Statement*>(const_cast<void*>(resp->cookie));
+    lcb_N1QLGROUP *group = stmt->parent;
+    lcb_RESPN1QL cur = *resp;
+
+    group->ref();
+    cur.cookie = const_cast<void*>(group->cookie);
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        stmt->handle = NULL;
+    }
+    if (group->callback) {
+        group->callback(instance, stmt->index, &cur);
+    }
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        group->statement_done(stmt);
+    }
+    group->unref();
+}
+
+lcb_N1QLGROUP::lcb_N1QLGROUP(lcb_t instance_, const void *cookie_,
+    const lcb_CMDN1QLGROUP *cmd)
+    : instance(instance_), cookie(cookie_), callback(cmd->callback),
+      max_per_node(cmd->max_per_node), quota(0), statements(cmd->ncmds), nactive(0),
+      nremaining(cmd->ncmds), refcount(1), finished(false), timer(instance_->iotable, this)
+{
+    for (size_t ii = 0; ii < cmd->ncmds; ii++) {
+        Statement& stmt = statements[ii];
+        stmt.parent = this;
+        stmt.index = ii;
+        stmt.cmdflags = cmd->cmds[ii].cmdflags;
+        stmt.query.assign(cmd->cmds[ii].query, cmd->cmds[ii].nquery);
+        stmt.handle = NULL;
+        pending.push_back(ii);
+    }
+    if (max_per_node) {
+        quota = lcb::http::Dispatcher::get(instance)->create_quota(max_per_node);
+    }
+    lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    if (!instance->n1ql_groups) {
+        instance->n1ql_groups = new lcb::n1ql::GroupList();
+    }
+    instance->n1ql_groups->add(this);
+
+    /* Issue the statements from the event loop, so that any failures are
+     * reported through the callback rather than within lcb_n1ql_group() */
+    timer.signal();
+}
+
+lcb_N1QLGROUP::~lcb_N1QLGROUP()
+{
+    if (instance->n1ql_groups) {
+        instance->n1ql_groups->remove(this);
+    }
+    if (quota && instance->http_dispatcher) {
+        instance->http_dispatcher->destroy_quota(quota);
+    }
+    lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    lcb_maybe_breakout(instance);
+}
+
+/* The number of statements which may be in progress at once. This also bounds
+ * the statements waiting for a PREPARE, which are not yet counted by the
+ * quota */
+size_t
+lcb_N1QLGROUP::window() const
+{
+    if (!max_per_node) {
+        return statements.size();
+    }
+
+    size_t nnodes = 0;
+    lcbvb_CONFIG *vbc = LCBT_VBCONFIG(instance);
+    lcbvb_SVCMODE mode = LCBT_SETTING(instance, sslopts) ?
+            LCBVB_SVCMODE_SSL : LCBVB_SVCMODE_PLAIN;
+    for (unsigned ii = 0; vbc && ii < LCBVB_NSERVERS(vbc); ii++) {
+        if (lcbvb_get_port(vbc, ii, LCBVB_SVCTYPE_N1QL, mode)) {
+            nnodes++;
+        }
+    }
+    return max_per_node * (nnodes ? nnodes : 1);
+}
+
+/* Whether the next statement can be placed on a node where the group has
+ * fewer than max_per_node in progress */
+bool
+lcb_N1QLGROUP::node_available() const
+{
+    lcbvb_CONFIG *vbc = LCBT_VBCONFIG(instance);
+    if (!quota || !vbc || !nactive) {
+        return true;
+    }
+    lcbvb_SVCMODE mode = LCBT_SETTING(instance, sslopts) ?
+            LCBVB_SVCMODE_SSL : LCBVB_SVCMODE_PLAIN;
+    return instance->http_dispatcher->quota_available(
+        vbc, LCBVB_SVCTYPE_N1QL, mode, quota);
+}
+
+void
+lcb_N1QLGROUP::issue()
+{
+    ref();
+    size_t limit = window();
+    while (callback && !pending.empty() && nactive < limit && node_available()) {
+        Statement& stmt = statements[pending.front()];
+        pending.pop_front();
+
+        lcb_CMDN1QL qcmd = { 0 };
+        qcmd.cmdflags = stmt.cmdflags;
+        qcmd.query = stmt.query.c_str();
+        qcmd.nquery = stmt.query.size();
+        qcmd.callback = statement_callback;
+        qcmd.handle = &stmt.handle;
+
+        lcb_error_t rc = lcb_n1ql_query_quota(instance, &stmt, &qcmd, quota);
+        if (rc == LCB_SUCCESS) {
+            nactive++;
+            continue;
+        }
+
+        lcb_log(LOGARGS(this, WARN), LOGFMT "Couldn't issue statement %lu: 0x%x", LOGID(this), (unsigned long)stmt.index, rc);
+        lcb_RESPN1QL resp = { 0 };
+        resp.rc = rc;
+        resp.rflags = LCB_RESP_F_FINAL;
+        resp.cookie = const_cast<void*>(cookie);
+        stmt.query.clear();
+        callback(instance, stmt.index, &resp);
+        nremaining--;
+    }
+    if (nremaining == 0) {
+        finish();
+    }
+    unref();
+}
+
+void
+lcb_N1QLGROUP::statement_done(Statement *stmt)
+{
+    std::string().swap(stmt->query);
+    nactive--;
+    if (--nremaining == 0) {
+        finish();
+    } else if (callback) {
+        /* The statement's request is only released from its node once this
+         * callback returns */
+        timer.signal();
+    }
+}
+
+void
+lcb_N1QLGROUP::cancel()
+{
+    if (!callback) {
+        return;
+    }
+    callback = NULL;
+    pending.clear();
+    for (size_t ii = 0; ii < statements.size(); ii++) {
+        if (statements[ii].handle) {
+            lcb_n1ql_cancel(instance, statements[ii].handle);
+            statements[ii].handle = NULL;
+        }
+    }
+    timer.cancel();
+    /* Cancelled statements receive no further callbacks */
+    finish();
+}
+
+LIBCOUCHBASE_API
+lcb_error_t
+lcb_n1ql_group(lcb_t instance, const void *cookie, const lcb_CMDN1QLGROUP *cmd)
+{
+    if (cmd->callback == NULL || cmd->ncmds == 0 || cmd->cmds == NULL) {
+        return LCB_EINVAL;
+    }
+    for (size_t ii = 0; ii < cmd->ncmds; ii++) {
+        if (cmd->cmds[ii].query == NULL) {
+            return LCB_EINVAL;
+        }
+    }
+
+    lcb_N1QLGROUP *group = new lcb_N1QLGROUP(instance, cookie, cmd);
+    if (cmd->handle) {
+        *cmd->handle = group;
+    }
+    return LCB_SUCCESS;
+}
+
+LIBCOUCHBASE_API
+void
+lcb_n1ql_group_cancel(lcb_t, lcb_N1QLGROUPHANDLE handle)
+{
+    handle->cancel();
+}
@@ -18,11 +18,14 @@
 #include <libcouchbase/ixmgmt.h>
 #include <string>
 #include <set>
+#include <list>
+#include <map>
 #include <algorithm>
 
 #include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
 #include "lcbio/lcbio.h"
 #include "lcbio/timer-ng.h"
+#include "lcbio/timer-cxx.h"
 #include "settings.h"
 #include "internal.h"
 
@@ -554,69 +557,113 @@ lcb_n1x_startbuild(lcb_t instance, const void *cookie, const lcb_CMDN1XMGMT *cmd
     return rc;
 }
 
-struct WatchIndexCtx : public IndexOpCtx {
-    // Interval timer
-    lcbio_pTIMER m_timer;
-    uint32_t m_interval;
-    uint64_t m_tsend;
-    lcb_t m_instance;
-    std::map<std::string,IndexSpec*> m_defspend;
-    std::vector<IndexSpec*> m_defsok;
+namespace lcb {
+namespace n1x {
+
+/** A lcb_n1x_watchbuild() request */
+struct Watcher : public IndexOpCtx {
+    struct Index {
+        Index() : spec(NULL) {}
+        IndexSpec *spec;
+        std::string state; /**< Last known state. Empty until first seen */
+    };
+    typedef std::map<std::string, std::string> StateMap;
 
-    inline void read_state(const lcb_RESPN1XMGMT *resp);
-    inline void reschedule();
-    inline lcb_error_t do_poll();
+    inline Watcher(lcb_t, const void *, const lcb_CMDN1XWATCH*);
+    inline ~Watcher();
     inline lcb_error_t load_defs(const lcb_CMDN1XWATCH *);
-    inline WatchIndexCtx(lcb_t, const void *, const lcb_CMDN1XWATCH*);
-    inline ~WatchIndexCtx();
-    inline void finish(lcb_error_t rc, const lcb_RESPN1XMGMT *);
+    inline void update(const StateMap& states, const lcb_RESPN1QL *inner);
+    inline void backoff(bool changed);
+    inline void finish(lcb_error_t rc, const lcb_RESPN1QL *inner);
+
+    lcb_t m_instance;
+    lcb_N1XMGMTCALLBACK m_state_callback;
+    std::map<std::string, Index> m_defspend;
+    std::vector<IndexSpec*> m_defsok;
+    uint64_t m_tsend; /**< When the watch times out */
+    uint64_t m_tsnext; /**< When the indexes should next be checked */
+    uint32_t m_interval;
+    uint32_t m_min_interval;
+    uint32_t m_max_interval;
+    bool m_polled; /**< Included in the check in progress */
 };
 
-static void
-cb_watchix_tm(void *arg)
-{
-    WatchIndexCtx *ctx = reinterpret_cast<WatchIndexCtx*>(arg);
-    uint64_t now = lcb_nstime();
-    if (now >= ctx->m_tsend) {
-        ctx->finish(LCB_ETIMEDOUT, NULL);
-    } else {
-        ctx->do_poll();
+/**
+ * Checks the state of the indexes of all the Watchers of an instance with
+ * one query. Each check lists only the indexes still being watched, and its
+ * results are passed to every Watcher which was waiting when it was issued.
+ * A check is issued when the first Watcher is due; Watchers which are due
+ * while a check is in progress wait for it to complete.
+ */
+class WatchPoller {
+public:
+    WatchPoller(lcb_t instance)
+        : m_instance(instance), m_req(NULL), m_timer(instance->iotable, this) {
     }
-}
+    ~WatchPoller();
+
+    void add(Watcher *watcher) {
+        m_watchers.push_back(watcher);
+        m_timer.signal();
+    }
+    void remove(Watcher *watcher) {
+        m_watchers.remove(watcher);
+    }
+    void on_row(const lcb_RESPN1QL *resp);
+    void on_done(lcb_error_t rc, const lcb_RESPN1QL *resp);
+
+    lcb_t m_instance;
+
+private:
+    void tick();
+    void poll();
+    void reschedule();
+
+    std::list<Watcher*> m_watchers;
+    Watcher::StateMap m_states; /**< States returned by the current check */
+    lcb_N1QLHANDLE m_req;
+    lcb::io::Timer<WatchPoller, &WatchPoller::tick> m_timer;
+};
+
+} // namespace n1x
+} // namespace lcb
+
+using lcb::n1x::Watcher;
+using lcb::n1x::WatchPoller;
 
 #define DEFAULT_WATCH_TIMEOUT LCB_S2US(30)
 #define DEFAULT_WATCH_INTERVAL LCB_MS2US(500)
 
-WatchIndexCtx::WatchIndexCtx(lcb_t instance, const void *cookie_, const lcb_CMDN1XWATCH *cmd)
-: m_instance(instance)
+Watcher::Watcher(lcb_t instance, const void *cookie_, const lcb_CMDN1XWATCH *cmd)
+: m_instance(instance), m_state_callback(cmd->state_callback), m_polled(false)
 {
     uint64_t now = lcb_nstime();
     uint32_t timeout = cmd->timeout ? cmd->timeout : DEFAULT_WATCH_TIMEOUT;
-    m_interval = cmd->interval ? cmd->interval : DEFAULT_WATCH_INTERVAL;
-    m_interval = std::min(m_interval, timeout);
+    m_min_interval = cmd->interval ? cmd->interval : DEFAULT_WATCH_INTERVAL;
+    m_min_interval = std::min(m_min_interval, timeout);
+    m_max_interval = cmd->max_interval ? cmd->max_interval : m_min_interval * 10;
+    m_max_interval = std::max(m_max_interval, m_min_interval);
+    m_interval = m_min_interval;
     m_tsend = now + LCB_US2NS(timeout);
+    m_tsnext = now;
 
     this->callback = cmd->callback;
     this->cookie = const_cast<void*>(cookie_);
 
-    m_timer = lcbio_timer_new(instance->iotable, this, cb_watchix_tm);
     lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
 }
 
-WatchIndexCtx::~WatchIndexCtx()
+Watcher::~Watcher()
 {
-    if (m_timer) {
-        lcbio_timer_destroy(m_timer);
-    }
     if (m_instance) {
         lcb_aspend_del(&m_instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
         lcb_maybe_breakout(m_instance);
     }
 
     std::for_each(m_defsok.begin(), m_defsok.end(), my_delete<IndexSpec*>);
-    for (std::map<string,IndexSpec*>::iterator ii = m_defspend.begin();
+    for (std::map<string,Index>::iterator ii = m_defspend.begin();
             ii != m_defspend.end(); ++ii) {
-        delete ii->second;
+        delete ii->second.spec;
     }
 }
 
@@ -636,39 +683,45 @@ IndexSpec::to_key(const lcb_N1XSPEC* spec, std::string& s)
 }
 
 void
-WatchIndexCtx::read_state(const lcb_RESPN1XMGMT *resp)
+Watcher::update(const StateMap& states, const lcb_RESPN1QL *inner)
 {
-    // We examine the indexes here to see which ones have been completed
-    // Make them all into an std::map
-    if (resp->rc != LCB_SUCCESS) {
-        lcb_log(LOGARGS(this, INFO), LOGFMT "Error 0x%x while listing indexes. Rescheduling", LOGID(this), resp->rc);
-        reschedule();
-        return;
-    }
-
-    std::map<std::string, const lcb_N1XSPEC*> in_specs;
-    for (size_t ii = 0; ii < resp->nspecs; ++ii) {
-        std::string key;
-        IndexSpec::to_key(resp->specs[ii], key);
-        in_specs[key] = resp->specs[ii];
-    }
-
-    std::map<std::string, IndexSpec*>::iterator it_remain = m_defspend.begin();
-    while (it_remain != m_defspend.end()) {
-        // See if the index is 'online' yet!
-        std::map<std::string,const lcb_N1XSPEC*>::iterator res;
-        res = in_specs.find(it_remain->first);
-        if (res == in_specs.end()) {
+    std::vector<lcb_N1XSPEC> changed;
+    std::map<std::string, Index>::iterator it_remain = m_defspend.begin();
+    for (; it_remain != m_defspend.end(); ++it_remain) {
+        StateMap::const_iterator res = states.find(it_remain->first);
+        if (res == states.end()) {
             lcb_log(LOGARGS(this, INFO), LOGFMT "Index [%s] not in cluster", LOGID(this), it_remain->first.c_str());
             // We can't find our own index. Someone else deleted it. Bail!
-            finish(LCB_KEY_ENOENT, resp);
+            finish(LCB_KEY_ENOENT, inner);
             return;
         }
 
-        std::string s_state(res->second->state, res->second->nstate);
-        if (s_state == "online") {
-            lcb_log(LOGARGS(this, DEBUG), LOGFMT "Index [%s] is ready", LOGID(this), it_remain->first.c_str());
-            m_defsok.push_back(it_remain->second);
+        Index& ix = it_remain->second;
+        if (ix.state != res->second) {
+            lcb_log(LOGARGS(this, DEBUG), LOGFMT "Index [%s] is %s", LOGID(this), it_remain->first.c_str(), res->second.c_str());
+            ix.state = res->second;
+            changed.push_back(*ix.spec);
+            changed.back().state = ix.state.c_str();
+            changed.back().nstate = ix.state.size();
+        }
+    }
+
+    if (!changed.empty() && m_state_callback) {
+        std::vector<const lcb_N1XSPEC*> speclist;
+        for (size_t ii = 0; ii < changed.size(); ++ii) {
+            speclist.push_back(&changed[ii]);
+        }
+        lcb_RESPN1XMGMT my_resp = { 0 };
+        my_resp.cookie = cookie;
+        my_resp.inner = inner;
+        my_resp.specs = &speclist[0];
+        my_resp.nspecs = speclist.size();
+        m_state_callback(m_instance, LCB_CALLBACK_IXMGMT, &my_resp);
+    }
+
+    for (it_remain = m_defspend.begin(); it_remain != m_defspend.end();) {
+        if (it_remain->second.state == "online") {
+            m_defsok.push_back(it_remain->second.spec);
             m_defspend.erase(it_remain++);
         } else {
             ++it_remain;
@@ -676,20 +729,43 @@ WatchIndexCtx::read_state(const lcb_RESPN1XMGMT *resp)
     }
 
     if (m_defspend.empty()) {
-        finish(LCB_SUCCESS, resp);
+        finish(LCB_SUCCESS, inner);
     } else {
-        reschedule();
+        backoff(!changed.empty());
     }
 }
 
+lcb_U32
+lcb_n1xwatch_backoff(lcb_U32& interval, lcb_U32 min_interval,
+    lcb_U32 max_interval, bool changed)
+{
+    // Check again soon while the indexes are changing, and less often while
+    // they aren't
+    if (changed) {
+        interval = min_interval;
+    }
+    lcb_U32 cur = interval;
+    interval = interval > max_interval / 2 ? max_interval : interval * 2;
+    return cur;
+}
+
+void
+Watcher::backoff(bool changed)
+{
+    lcb_U32 wait = lcb_n1xwatch_backoff(m_interval, m_min_interval, m_max_interval, changed);
+    m_tsnext = lcb_nstime() + LCB_US2NS(wait);
+}
+
 lcb_error_t
-WatchIndexCtx::load_defs(const lcb_CMDN1XWATCH *cmd)
+Watcher::load_defs(const lcb_CMDN1XWATCH *cmd)
 {
     for (size_t ii = 0; ii < cmd->nspec; ++ii) {
         std::string key;
         IndexSpec *extspec = new IndexSpec(cmd->specs[ii]);
         IndexSpec::to_key(extspec, key);
-        m_defspend[key] = extspec;
+        Index& ix = m_defspend[key];
+        delete ix.spec;
+        ix.spec = extspec;
     }
     if (m_defspend.empty()) {
         return LCB_ENO_COMMANDS;
@@ -698,66 +774,227 @@ WatchIndexCtx::load_defs(const lcb_CMDN1XWATCH *cmd)
 }
 
 void
-WatchIndexCtx::finish(lcb_error_t rc, const lcb_RESPN1XMGMT *resp)
+Watcher::finish(lcb_error_t rc, const lcb_RESPN1QL *inner)
 {
     lcb_RESPN1XMGMT my_resp = { 0 };
     my_resp.cookie = cookie;
     my_resp.rc = rc;
-
-    if (resp) {
-        my_resp.inner = resp->inner;
-    }
+    my_resp.inner = inner;
 
     lcb_N1XSPEC **speclist = reinterpret_cast<lcb_N1XSPEC**>(&m_defsok[0]);
     my_resp.specs = speclist;
     my_resp.nspecs = m_defsok.size();
+    m_instance->n1x_poller->remove(this);
     callback(m_instance, LCB_CALLBACK_IXMGMT, &my_resp);
     delete this;
 }
 
+/* Quote a string as a N1QL (JSON) string literal */
+static string
+quote_str(const char *s, size_t n)
+{
+    string ret = Json::FastWriter().write(Json::Value(s, s + n));
+    ret.erase(ret.size()-1); // newline
+    return ret;
+}
+
+static void
+cb_watch_poll(lcb_t, int, const lcb_RESPN1QL *resp)
+{
+    WatchPoller *poller = reinterpret_cast<WatchPoller*>(const_cast<void*>(resp->cookie));
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        lcb_error_t rc = resp->rc;
+        if (rc == LCB_SUCCESS) {
+            rc = get_n1ql_error(resp->row, resp->nrow);
+        }
+        poller->on_done(rc, resp);
+    } else {
+        poller->on_row(resp);
+    }
+}
+
 void
-WatchIndexCtx::reschedule()
+lcb_n1xwatch_statement(const std::set<std::pair<string, string> >& indexes, string& out)
+{
+    string where;
+    std::set<std::pair<string, string> >::const_iterator ii;
+    for (ii = indexes.begin(); ii != indexes.end(); ++ii) {
+        if (!where.empty()) {
+            where += " OR ";
+        }
+        where.append("(keyspace_id=").append(quote_str(ii->first.c_str(), ii->first.size()));
+        if (!ii->second.empty()) {
+            where.append(" AND name=").append(quote_str(ii->second.c_str(), ii->second.size()));
+        } else {
+            where.append(" AND is_primary=true");
+        }
+        where += ')';
+    }
+    out = "SELECT name, keyspace_id, namespace_id, `using`, state, is_primary "
+            "FROM system:indexes WHERE " + where;
+}
+
+void
+WatchPoller::poll()
+{
+    // Only list the indexes which are still being watched
+    std::set<std::pair<string, string> > names;
+    for (std::list<Watcher*>::iterator ii = m_watchers.begin(); ii != m_watchers.end(); ++ii) {
+        Watcher *w = *ii;
+        w->m_polled = true;
+        std::map<string, Watcher::Index>::iterator jj;
+        for (jj = w->m_defspend.begin(); jj != w->m_defspend.end(); ++jj) {
+            const IndexSpec *spec = jj->second.spec;
+            names.insert(std::make_pair(string(spec->keyspace, spec->nkeyspace),
+                string(spec->name, spec->nname)));
+        }
+    }
+
+    string ss;
+    lcb_n1xwatch_statement(names, ss);
+    Json::Value root;
+    root["statement"] = ss;
+    string reqbuf = Json::FastWriter().write(root);
+
+    lcb_CMDN1QL cmd = { 0 };
+    cmd.query = reqbuf.c_str();
+    cmd.nquery = reqbuf.size()-1; /*newline*/
+    cmd.callback = cb_watch_poll;
+    cmd.handle = &m_req;
+
+    m_states.clear();
+    lcb_log(LOGARGS(this, DEBUG), LOGFMT "Checking the state of %lu indexes for %lu watchers", LOGID(this), (unsigned long)names.size(), (unsigned long)m_watchers.size());
+    lcb_error_t rc = lcb_n1ql_query(m_instance, this, &cmd);
+    if (rc != LCB_SUCCESS) {
+        m_req = NULL;
+        on_done(rc, NULL);
+    }
+}
+
+void
+WatchPoller::on_row(const lcb_RESPN1QL *resp)
+{
+    Json::Value row;
+    if (!Json::Reader().parse(resp->row, resp->row + resp->nrow, row) || !row.isObject()) {
+        return;
+    }
+
+    string prefix, suffix;
+    prefix.append(row["namespace_id"].asString()).append(" ");
+    prefix.append(row["keyspace_id"].asString()).append(" ");
+    string ixtype = row["using"].asString();
+    suffix.append(" ").append(ixtype == "gsi" || ixtype == "view" ? ixtype : "<UNKNOWN>");
+    string state = row["state"].asString();
+    m_states[prefix + row["name"].asString() + suffix] = state;
+
+    // A primary index may be watched without its name (as it is created),
+    // which is how it is polled for
+    if (row["is_primary"].asBool()) {
+        m_states[prefix + suffix] = state;
+    }
+}
+
+void
+WatchPoller::on_done(lcb_error_t rc, const lcb_RESPN1QL *resp)
+{
+    m_req = NULL;
+
+    // Watchers may complete (and new ones may be added) in the callbacks
+    std::vector<Watcher*> polled;
+    for (std::list<Watcher*>::iterator ii = m_watchers.begin(); ii != m_watchers.end(); ++ii) {
+        if ((*ii)->m_polled) {
+            (*ii)->m_polled = false;
+            polled.push_back(*ii);
+        }
+    }
+
+    if (rc != LCB_SUCCESS) {
+        lcb_log(LOGARGS(this, INFO), LOGFMT "Error 0x%x while listing indexes. Rescheduling", LOGID(this), rc);
+    }
+    for (size_t ii = 0; ii < polled.size(); ++ii) {
+        if (rc == LCB_SUCCESS) {
+            polled[ii]->update(m_states, resp);
+        } else {
+            polled[ii]->backoff(false);
+        }
+    }
+    m_states.clear();
+    reschedule();
+}
+
+void
+WatchPoller::tick()
 {
-    // Next interval!
     uint64_t now = lcb_nstime();
-    if (now + LCB_US2NS(m_interval) >= m_tsend) {
-        finish(LCB_ETIMEDOUT, NULL);
-    } else {
-        lcbio_timer_rearm(m_timer, m_interval);
+    std::vector<Watcher*> expired;
+    bool due = false;
+    for (std::list<Watcher*>::iterator ii = m_watchers.begin(); ii != m_watchers.end(); ++ii) {
+        if (now >= (*ii)->m_tsend) {
+            expired.push_back(*ii);
+        } else if (now >= (*ii)->m_tsnext) {
+            due = true;
+        }
+    }
+    for (size_t ii = 0; ii < expired.size(); ++ii) {
+        expired[ii]->finish(LCB_ETIMEDOUT, NULL);
+    }
+
+    if (due && m_req == NULL) {
+        poll();
     }
+    reschedule();
 }
 
-static void
-cb_watch_gotlist(lcb_t, int, const lcb_RESPN1XMGMT *resp)
+void
+WatchPoller::reschedule()
 {
-    WatchIndexCtx *ctx = reinterpret_cast<WatchIndexCtx*>(resp->cookie);
-    ctx->read_state(resp);
+    if (m_watchers.empty()) {
+        m_timer.cancel();
+        return;
+    }
+
+    uint64_t next = (uint64_t)-1;
+    for (std::list<Watcher*>::iterator ii = m_watchers.begin(); ii != m_watchers.end(); ++ii) {
+        next = std::min(next, (*ii)->m_tsend);
+        if (m_req == NULL) {
+            next = std::min(next, (*ii)->m_tsnext);
+        }
+    }
+    uint64_t now = lcb_nstime();
+    m_timer.rearm(next > now ? LCB_NS2US(next - now) : 0);
 }
 
-lcb_error_t
-WatchIndexCtx::do_poll()
+WatchPoller::~WatchPoller()
+{
+    std::list<Watcher*> watchers;
+    watchers.swap(m_watchers);
+    std::for_each(watchers.begin(), watchers.end(), my_delete<Watcher*>);
+}
+
+/* Called from lcb_destroy() */
+extern "C" void
+lcb_n1x_poller_destroy(lcb_N1XWATCHPOLLER *poller)
 {
-    lcb_CMDN1XMGMT cmd;
-    memset(&cmd, 0, sizeof cmd);
-    cmd.callback = cb_watch_gotlist;
-    lcb_log(LOGARGS(this, DEBUG), LOGFMT "Will check for index readiness of %lu indexes. %lu completed", LOGID(this), m_defspend.size(), m_defsok.size());
-    return lcb_n1x_list(m_instance, this, &cmd);
+    delete poller;
 }
 
 LIBCOUCHBASE_API
 lcb_error_t
 lcb_n1x_watchbuild(lcb_t instance, const void *cookie, const lcb_CMDN1XWATCH *cmd)
 {
-    WatchIndexCtx *ctx = new WatchIndexCtx(instance, cookie, cmd);
+    if (cmd->callback == NULL) {
+        return LCB_EINVAL;
+    }
+    Watcher *ctx = new Watcher(instance, cookie, cmd);
     lcb_error_t rc;
     if ((rc = ctx->load_defs(cmd)) != LCB_SUCCESS) {
         delete ctx;
         return rc;
     }
-    if ((rc = ctx->do_poll()) != LCB_SUCCESS) {
-        delete ctx;
-        return rc;
+    if (!instance->n1x_poller) {
+        instance->n1x_poller = new WatchPoller(instance);
     }
+    instance->n1x_poller->add(ctx);
     return LCB_SUCCESS;
 }
 
@@ -2,7 +2,10 @@
 #define LCB_N1QL_INTERNAL_H
 
 #ifdef __cplusplus
+#include <set>
 #include <string>
+#include <utility>
+#include <libcouchbase/n1ql.h>
 extern "C" {
 #endif
 
@@ -17,6 +20,28 @@ void lcb_n1qlcache_getplan(lcb_N1QLCACHE *cache,
 
 // Parse timeout value. Exposed for tests
 lcb_U32 lcb_n1qlreq_parsetmo(const std::string& s);
+
+// Normalize a statement for counting by the auto-prepare sketch, and for
+// preparing it. Exposed for tests
+void lcb_n1qlreq_normalize(const std::string& statement, std::string& out);
+
+// Issue a query whose HTTP requests count against a quota of the HTTP
+// Dispatcher (see lcb::http::Dispatcher::create_quota()), or none if 0
+lcb_error_t lcb_n1ql_query_quota(lcb_t instance, const void *cookie,
+    const lcb_CMDN1QL *cmd, unsigned quota);
+
+// Build the statement which lists the state of the indexes watched by
+// lcb_n1x_watchbuild(), given as (keyspace, name) pairs. An empty name is the
+// keyspace's primary index. Exposed for tests
+void lcb_n1xwatch_statement(
+    const std::set<std::pair<std::string, std::string> >& indexes, std::string& out);
+
+// Get the time (in microseconds) until the watched indexes are next checked,
+// and double `interval` (up to `max_interval`) for the check after that.
+// `interval` is first reset to `min_interval` if the indexes have changed.
+// Exposed for tests
+lcb_U32 lcb_n1xwatch_backoff(lcb_U32& interval, lcb_U32 min_interval,
+    lcb_U32 max_interval, bool changed);
 }
 #endif
 #endif
@@ -5,8 +5,11 @@
 #include "auth-priv.h"
 #include "http/http.h"
 #include "logging.h"
+#include "rowflow.h"
+#include "freqsketch.h"
 #include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
 #include <map>
+#include <set>
 #include <string>
 #include <list>
 
@@ -17,6 +20,9 @@
 // Indicate that the 'creds' field is to be used.
 #define F_CMDN1QL_CREDSAUTH 1<<15
 
+// Indicate that the statement is prepared because it was seen often
+#define F_CMDN1QL_AUTOPREP (1<<14)
+
 class Plan {
 private:
     friend struct lcb_N1QLCACHE_st;
@@ -63,14 +69,36 @@ private:
     }
 };
 
+/**
+ * A PREPARE in progress. Requests which need the plan while it is in progress
+ * wait for it, rather than each issuing their own PREPARE.
+ */
+struct PendingPlan {
+    lcb_t instance;
+    std::string key;
+    lcb_N1QLHANDLE prepreq;
+    std::list<struct lcb_N1QLREQ*> waiters;
+};
+
 // LRU Cache structure..
 struct lcb_N1QLCACHE_st {
     typedef std::list<Plan*> LruCache;
     typedef std::map<std::string, LruCache::iterator> Lookup;
+    typedef std::map<std::string, PendingPlan*> Pending;
 
     Lookup by_name;
     LruCache lru;
 
+    /** PREPAREs in progress, by statement */
+    Pending pending;
+
+    /** How often (normalized) ad-hoc statements have been seen. The
+     * autoprepare threshold may exceed what an 8 bit counter can hold */
+    lcb::FrequencySketch<lcb_U16, 0xffff> sketch;
+
+    /** Statements which could not be prepared automatically */
+    std::set<std::string> unpreparable;
+
     /** Maximum number of entries in LRU cache. This is fixed at 5000 */
     static size_t max_size() { return 5000; }
 
@@ -128,6 +156,14 @@ struct lcb_N1QLCACHE_st {
         lru.erase(m2);
     }
 
+    /** Remember that a statement could not be prepared automatically */
+    void add_unpreparable(const std::string& key) {
+        if (unpreparable.size() == max_size()) {
+            unpreparable.clear();
+        }
+        unpreparable.insert(key);
+    }
+
     /** Clears the LRU cache */
     void clear() {
         for (LruCache::iterator ii = lru.begin(); ii != lru.end(); ++ii) {
@@ -135,17 +171,20 @@ struct lcb_N1QLCACHE_st {
         }
         lru.clear();
         by_name.clear();
+        sketch.clear();
+        unpreparable.clear();
     }
 
-    ~lcb_N1QLCACHE_st() {
-        clear();
-    }
+    /* Track up to 256 frequent statements */
+    lcb_N1QLCACHE_st() : sketch(256) {}
+    inline ~lcb_N1QLCACHE_st();
 };
 
-typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
+typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions, lcb::RowFlow::Sink {
     const lcb_RESPHTTP *cur_htresp;
     struct lcb_http_request_st *htreq;
     lcb::jsparse::Parser *parser;
+    lcb::RowFlow flow;
     const void *cookie;
     lcb_N1QLCALLBACK callback;
     lcb_t instance;
@@ -155,8 +194,8 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
     // How many rows were received. Used to avoid parsing the meta
     size_t nrows;
 
-    /** The PREPARE query itself */
-    struct lcb_N1QLREQ *prepare_req;
+    /** The PREPARE this request is waiting for, if any */
+    PendingPlan *pending_plan;
 
     /** Request body as received from the application */
     Json::Value json;
@@ -168,6 +207,9 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
     /** Whether we're retrying this */
     bool was_retried;
 
+    /** HTTP Dispatcher quota the query's requests count against, or 0 */
+    unsigned dispatch_quota;
+
     lcb_N1QLCACHE& cache() { return *instance->n1ql_cache; }
 
     /**
@@ -178,6 +220,21 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
      */
     inline lcb_error_t request_plan();
 
+    /**
+     * Issue the query with the cached plan for the statement, requesting the
+     * plan first if it is not in the cache
+     * @return see issue_htreq()
+     */
+    inline lcb_error_t issue_prepared();
+
+    /**
+     * Determine whether an ad-hoc statement has been seen often enough that
+     * it should be prepared (see @ref LCB_CNTL_N1QL_AUTOPREPARE). If so, the
+     * statement is normalized and the request marked as using the cache.
+     * @return true if the statement should be prepared
+     */
+    inline bool autoprepare();
+
     /**
      * Use the plan to execute the given query, and issues the query
      * @param plan The plan itself
@@ -209,7 +266,9 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
      * Did the application request this query to use prepared statements
      * @return true if using prepared statements
      */
-    inline bool use_prepcache() const { return flags & LCB_CMDN1QL_F_PREPCACHE; }
+    inline bool use_prepcache() const {
+        return flags & (LCB_CMDN1QL_F_PREPCACHE|F_CMDN1QL_AUTOPREP);
+    }
 
     /**
      * Pass a row back to the application
@@ -227,16 +286,21 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
      */
     inline void fail_prepared(const lcb_RESPN1QL *orig, lcb_error_t err);
 
+    /**
+     * Handle a failure to prepare or apply the plan. A statement which was
+     * prepared automatically is instead issued ad-hoc.
+     * @param orig The response from the PREPARE request
+     * @param err The error code
+     */
+    inline void plan_failed(const lcb_RESPN1QL *orig, lcb_error_t err);
+
     inline lcb_N1QLREQ(lcb_t obj, const void *user_cookie, const lcb_CMDN1QL *cmd);
     inline ~lcb_N1QLREQ();
 
     // Parser overrides:
     void JSPARSE_on_row(const lcb::jsparse::Row& row) {
-        lcb_RESPN1QL resp = { 0 };
-        resp.row = static_cast<const char *>(row.row.iov_base);
-        resp.nrow = row.row.iov_len;
         nrows++;
-        invoke_row(&resp, false);
+        flow.row(static_cast<const char *>(row.row.iov_base), row.row.iov_len);
     }
     void JSPARSE_on_error(const std::string&) {
         lasterr = LCB_PROTOCOL_ERROR;
@@ -245,8 +309,35 @@ typedef struct lcb_N1QLREQ : lcb::jsparse::Parser::Actions {
         // Nothing
     }
 
+    // RowFlow overrides:
+    void flow_row(const char *row, size_t nrow, bool buffered) {
+        lcb_RESPN1QL resp = { 0 };
+        resp.row = row;
+        resp.nrow = nrow;
+        if (buffered) {
+            cur_htresp = NULL;
+        }
+        invoke_row(&resp, false);
+    }
+    inline void flow_done();
+
 } N1QLREQ;
 
+lcb_N1QLCACHE_st::~lcb_N1QLCACHE_st()
+{
+    // The PREPAREs themselves are destroyed with the instance's HTTP requests
+    for (Pending::iterator ii = pending.begin(); ii != pending.end(); ++ii) {
+        std::list<N1QLREQ*>& waiters = ii->second->waiters;
+        for (std::list<N1QLREQ*>::iterator jj = waiters.begin(); jj != waiters.end(); ++jj) {
+            (*jj)->pending_plan = NULL;
+            (*jj)->callback = NULL;
+            delete *jj;
+        }
+        delete ii->second;
+    }
+    clear();
+}
+
 static bool
 parse_json(const char *s, size_t n, Json::Value& res)
 {
@@ -408,8 +499,9 @@ lcb_N1QLREQ::~lcb_N1QLREQ()
     if (parser) {
         delete parser;
     }
-    if (prepare_req) {
-        lcb_n1ql_cancel(instance, prepare_req);
+    if (pending_plan) {
+        // The PREPARE continues for any other requests, and for the cache
+        pending_plan->waiters.remove(this);
     }
 }
 
@@ -430,6 +522,11 @@ chunk_callback(lcb_t instance, int ign, const lcb_RESPBASE *rb)
 
     if (rh->rflags & LCB_RESP_F_FINAL) {
         req->htreq = NULL;
+        if (req->flow.hold_final(rh)) {
+            // Completed once the buffered rows are delivered
+            req->cur_htresp = NULL;
+            return;
+        }
         if (!req->maybe_retry()) {
             delete req;
         }
@@ -443,6 +540,15 @@ chunk_callback(lcb_t instance, int ign, const lcb_RESPBASE *rb)
     req->parser->feed(static_cast<const char*>(rh->body), rh->nbody);
 }
 
+void
+N1QLREQ::flow_done()
+{
+    cur_htresp = flow.final_response();
+    if (!maybe_retry()) {
+        delete this;
+    }
+}
+
 #define QUERY_PATH "/query/service"
 
 void
@@ -465,35 +571,64 @@ N1QLREQ::fail_prepared(const lcb_RESPN1QL *orig, lcb_error_t err)
     delete this;
 }
 
+void
+N1QLREQ::plan_failed(const lcb_RESPN1QL *orig, lcb_error_t err)
+{
+    if (flags & F_CMDN1QL_AUTOPREP) {
+        lcb_log(LOGARGS(this, WARN), LOGFMT "Couldn't prepare statement (0x%x). Issuing it ad-hoc", LOGID(this), err);
+        cache().add_unpreparable(statement);
+        flags &= ~F_CMDN1QL_AUTOPREP;
+        json["statement"] = statement;
+        if ((err = issue_htreq()) == LCB_SUCCESS) {
+            return;
+        }
+    }
+    fail_prepared(orig, err);
+}
+
 // Received internally for PREPARE
 static void
 prepare_rowcb(lcb_t instance, int, const lcb_RESPN1QL *row)
 {
-    lcb_N1QLREQ *origreq = reinterpret_cast<lcb_N1QLREQ*>(row->cookie);
+    PendingPlan *pp = reinterpret_cast<PendingPlan*>(const_cast<void*>(row->cookie));
+    lcb_N1QLCACHE& cache = *instance->n1ql_cache;
 
-    lcb_n1ql_cancel(instance, origreq->prepare_req);
-    origreq->prepare_req = NULL;
+    lcb_n1ql_cancel(instance, pp->prepreq);
+    cache.pending.erase(pp->key);
 
-    if (row->rc != LCB_SUCCESS || (row->rflags & LCB_RESP_F_FINAL)) {
-        origreq->fail_prepared(row, row->rc);
-    } else {
+    const Plan *ent = NULL;
+    lcb_error_t rc = row->rc;
+    if (rc == LCB_SUCCESS && !(row->rflags & LCB_RESP_F_FINAL)) {
         // Insert into cache
         Json::Value prepared;
-        if (!parse_json(row->row, row->nrow, prepared)) {
-            lcb_log(LOGARGS(origreq, ERROR), LOGFMT "Invalid JSON returned from PREPARE", LOGID(origreq));
-            origreq->fail_prepared(row, LCB_PROTOCOL_ERROR);
-            return;
+        if (parse_json(row->row, row->nrow, prepared)) {
+            lcb_log(LOGARGS(pp, DEBUG), "(PP=%p) Got prepared statement. Inserting into cache and reissuing %lu requests", (void*)pp, (unsigned long)pp->waiters.size());
+            ent = &cache.add_entry(pp->key, prepared);
+        } else {
+            lcb_log(LOGARGS(pp, ERROR), "(PP=%p) Invalid JSON returned from PREPARE", (void*)pp);
+            rc = LCB_PROTOCOL_ERROR;
         }
+    }
 
-        // Insert plan into cache
-        lcb_log(LOGARGS(origreq, DEBUG), LOGFMT "Got prepared statement. Inserting into cache and reissuing", LOGID(origreq));
-        const Plan& ent =
-                origreq->cache().add_entry(origreq->statement, prepared);
+    std::list<N1QLREQ*> waiters;
+    waiters.swap(pp->waiters);
+    delete pp;
 
+    // A request may be cancelled by the callback of one before it
+    std::list<N1QLREQ*>::iterator ii;
+    for (ii = waiters.begin(); ii != waiters.end(); ++ii) {
+        (*ii)->pending_plan = NULL;
+    }
+    for (ii = waiters.begin(); ii != waiters.end(); ++ii) {
+        N1QLREQ *req = *ii;
+        if (req->callback == NULL) {
+            delete req;
+            continue;
+        }
         // Issue the query with the newly prepared plan
-        lcb_error_t rc = origreq->apply_plan(ent);
-        if (rc != LCB_SUCCESS) {
-            origreq->fail_prepared(row, rc);
+        lcb_error_t rc2 = ent ? req->apply_plan(*ent) : rc;
+        if (ent == NULL || rc2 != LCB_SUCCESS) {
+            req->plan_failed(row, rc2);
         }
     }
 }
@@ -515,7 +650,8 @@ N1QLREQ::issue_htreq(const std::string& body)
     htcmd.reqhandle = &htreq;
     htcmd.cas = timeout;
 
-    lcb_error_t rc = lcb_http3(instance, this, &htcmd);
+    lcb_error_t rc;
+    lcb::http::Request::create(instance, this, &htcmd, &rc, dispatch_quota);
     if (rc == LCB_SUCCESS) {
         htreq->set_callback(chunk_callback);
     }
@@ -525,18 +661,147 @@ N1QLREQ::issue_htreq(const std::string& body)
 lcb_error_t
 N1QLREQ::request_plan()
 {
+    lcb_N1QLCACHE::Pending::iterator existing = cache().pending.find(statement);
+    if (existing != cache().pending.end()) {
+        lcb_log(LOGARGS(this, DEBUG), LOGFMT "Waiting for PREPARE already in progress", LOGID(this));
+        pending_plan = existing->second;
+        pending_plan->waiters.push_back(this);
+        return LCB_SUCCESS;
+    }
+
+    PendingPlan *pp = new PendingPlan();
+    pp->instance = instance;
+    pp->key = statement;
+    pp->prepreq = NULL;
+
     Json::Value newbody(Json::objectValue);
     newbody["statement"] = "PREPARE " + statement;
     lcb_CMDN1QL newcmd = { 0 };
     newcmd.callback = prepare_rowcb;
     newcmd.cmdflags = LCB_CMDN1QL_F_JSONQUERY;
-    newcmd.handle = &prepare_req;
+    newcmd.handle = &pp->prepreq;
     newcmd.query = reinterpret_cast<const char*>(&newbody);
     if (flags & F_CMDN1QL_CREDSAUTH) {
         newcmd.cmdflags |= LCB_CMD_F_MULTIAUTH;
     }
 
-    return lcb_n1ql_query(instance, this, &newcmd);
+    lcb_error_t rc = lcb_n1ql_query(instance, pp, &newcmd);
+    if (rc != LCB_SUCCESS) {
+        delete pp;
+        return rc;
+    }
+    cache().pending[statement] = pp;
+    pending_plan = pp;
+    pp->waiters.push_back(this);
+    return LCB_SUCCESS;
+}
+
+lcb_error_t
+N1QLREQ::issue_prepared()
+{
+    const Plan *cached = cache().get_entry(statement);
+    if (cached != NULL) {
+        return apply_plan(*cached);
+    }
+    lcb_log(LOGARGS(this, DEBUG), LOGFMT "No cached plan found. Issuing prepare", LOGID(this));
+    return request_plan();
+}
+
+/* Whether PREPARE accepts a (normalized) statement */
+static bool
+is_preparable(const std::string& statement)
+{
+    static const char *verbs[] = {
+        "SELECT ", "INSERT ", "UPSERT ", "UPDATE ", "DELETE ", "MERGE ", NULL
+    };
+    for (size_t ii = 0; verbs[ii]; ii++) {
+        size_t n = strlen(verbs[ii]);
+        if (statement.size() > n && strncasecmp(statement.c_str(), verbs[ii], n) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+N1QLREQ::autoprepare()
+{
+    lcb_U32 threshold = LCBT_SETTING(instance, n1ql_autoprepare);
+    if (!threshold || statement.empty() || json_const().isMember("prepared")) {
+        return false;
+    }
+
+    std::string key;
+    lcb_n1qlreq_normalize(statement, key);
+    lcb_N1QLCACHE& c = cache();
+    if (!is_preparable(key) || c.unpreparable.count(key)) {
+        return false;
+    }
+    // Statements which are already prepared (or being prepared) aren't counted
+    if (c.get_entry(key) == NULL && c.pending.find(key) == c.pending.end() &&
+            c.sketch.increment(key) < threshold) {
+        return false;
+    }
+
+    lcb_log(LOGARGS(this, TRACE), LOGFMT "Using prepared plan for frequent statement", LOGID(this));
+    statement.swap(key);
+    flags |= F_CMDN1QL_AUTOPREP;
+    return true;
+}
+
+void
+lcb_n1qlreq_normalize(const std::string& statement, std::string& out)
+{
+    // Collapse whitespace and comments outside of string literals and
+    // identifiers. Since the result is what gets prepared, a comment must
+    // not swallow the rest of the statement once line breaks are gone
+    out.clear();
+    out.reserve(statement.size());
+    char quote = 0;
+    bool space = false;
+    for (size_t ii = 0; ii < statement.size(); ii++) {
+        char c = statement[ii];
+        if (quote) {
+            out += c;
+            if (c == '\\' && ii + 1 < statement.size()) {
+                out += statement[++ii];
+            } else if (c == quote) {
+                quote = 0;
+            }
+            continue;
+        }
+        if (isspace(static_cast<unsigned char>(c))) {
+            space = true;
+            continue;
+        }
+        if (c == '-' && statement.compare(ii, 2, "--") == 0) {
+            ii = statement.find('\n', ii);
+            ii = ii == std::string::npos ? statement.size() : ii;
+            space = true;
+            continue;
+        }
+        if (c == '/' && statement.compare(ii, 2, "/*") == 0) {
+            ii = statement.find("*/", ii + 2);
+            ii = ii == std::string::npos ? statement.size() : ii + 1;
+            space = true;
+            continue;
+        }
+        if (space && !out.empty()) {
+            out += ' ';
+        }
+        space = false;
+        if (c == '"' || c == '\'' || c == '`') {
+            quote = c;
+        }
+        out += c;
+    }
+    // A trailing semicolon doesn't change the statement
+    while (!quote && !out.empty() && out[out.size()-1] == ';') {
+        out.erase(out.size()-1);
+        if (!out.empty() && out[out.size()-1] == ' ') {
+            out.erase(out.size()-1);
+        }
+    }
 }
 
 lcb_error_t
@@ -583,9 +848,9 @@ lcb_N1QLREQ::lcb_N1QLREQ(lcb_t obj,
     const void *user_cookie, const lcb_CMDN1QL *cmd)
     : cur_htresp(NULL), htreq(NULL),
       parser(new lcb::jsparse::Parser(lcb::jsparse::Parser::MODE_N1QL, this)),
-      cookie(user_cookie), callback(cmd->callback), instance(obj),
+      flow(obj, &htreq, this), cookie(user_cookie), callback(cmd->callback), instance(obj),
       lasterr(LCB_SUCCESS), flags(cmd->cmdflags), timeout(0),
-      nrows(0), prepare_req(NULL), was_retried(false)
+      nrows(0), pending_plan(NULL), was_retried(false), dispatch_quota(0)
 {
     if (cmd->handle) {
         *cmd->handle = this;
@@ -649,6 +914,13 @@ lcb_N1QLREQ::lcb_N1QLREQ(lcb_t obj,
 LIBCOUCHBASE_API
 lcb_error_t
 lcb_n1ql_query(lcb_t instance, const void *cookie, const lcb_CMDN1QL *cmd)
+{
+    return lcb_n1ql_query_quota(instance, cookie, cmd, 0);
+}
+
+lcb_error_t
+lcb_n1ql_query_quota(lcb_t instance, const void *cookie,
+    const lcb_CMDN1QL *cmd, unsigned quota)
 {
     lcb_error_t err;
     N1QLREQ *req = NULL;
@@ -664,6 +936,7 @@ lcb_n1ql_query(lcb_t instance, const void *cookie, const lcb_CMDN1QL *cmd)
     if ((err = req->lasterr) != LCB_SUCCESS) {
         goto GT_DESTROY;
     }
+    req->dispatch_quota = quota;
 
     if (cmd->cmdflags & LCB_CMDN1QL_F_PREPCACHE) {
         if (req->statement.empty()) {
@@ -671,16 +944,12 @@ lcb_n1ql_query(lcb_t instance, const void *cookie, const lcb_CMDN1QL *cmd)
             goto GT_DESTROY;
         }
 
-        const Plan *cached = req->cache().get_entry(req->statement);
-        if (cached != NULL) {
-            if ((err = req->apply_plan(*cached)) != LCB_SUCCESS) {
-                goto GT_DESTROY;
-            }
-        } else {
-            lcb_log(LOGARGS(req, DEBUG), LOGFMT "No cached plan found. Issuing prepare", LOGID(req));
-            if ((err = req->request_plan()) != LCB_SUCCESS) {
-                goto GT_DESTROY;
-            }
+        if ((err = req->issue_prepared()) != LCB_SUCCESS) {
+            goto GT_DESTROY;
+        }
+    } else if (req->autoprepare()) {
+        if ((err = req->issue_prepared()) != LCB_SUCCESS) {
+            goto GT_DESTROY;
         }
     } else {
         // No prepare
@@ -705,7 +974,7 @@ lcb_n1ql_query(lcb_t instance, const void *cookie, const lcb_CMDN1QL *cmd)
 
 LIBCOUCHBASE_API
 void
-lcb_n1ql_cancel(lcb_t instance, lcb_N1QLHANDLE handle)
+lcb_n1ql_cancel(lcb_t, lcb_N1QLHANDLE handle)
 {
     // Note that this function is just an elaborate way to nullify the
     // callback. We are very particular about _not_ cancelling the underlying
@@ -716,9 +985,28 @@ lcb_n1ql_cancel(lcb_t instance, lcb_N1QLHANDLE handle)
     // extra network reads; whereas this function itself is intended as a
     // bailout for unexpected destruction.
 
-    if (handle->prepare_req) {
-        lcb_n1ql_cancel(instance, handle->prepare_req);
-        handle->prepare_req = NULL;
+    if (handle->pending_plan) {
+        // Waiting for a PREPARE which others may share. Nothing was sent for
+        // the request itself, so there is no HTTP response to wait for
+        handle->callback = NULL;
+        delete handle;
+        return;
     }
     handle->callback = NULL;
+    // A paused request must still read the rest of its response
+    handle->flow.cancel();
+}
+
+LIBCOUCHBASE_API
+void
+lcb_n1ql_pause(lcb_t, lcb_N1QLHANDLE handle)
+{
+    handle->flow.pause();
+}
+
+LIBCOUCHBASE_API
+void
+lcb_n1ql_resume(lcb_t, lcb_N1QLHANDLE handle)
+{
+    handle->flow.resume();
 }
@@ -0,0 +1,335 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "nearcache.h"
+#include <algorithm>
+
+namespace lcb {
+struct NearCacheRevalidation : mc_REQDATAEX {
+    NearCacheRevalidation(const void *cookie, lcb_t instance, int vb,
+        const std::string& key);
+
+    lcb_t instance;
+    int vbucket;
+    std::string key;
+};
+}
+
+using namespace lcb;
+
+static void
+revalidate_callback(mc_PIPELINE *, mc_PACKET *pkt, lcb_error_t, const void *arg)
+{
+    NearCacheRevalidation *rv = static_cast<NearCacheRevalidation*>(pkt->u_rdata.exdata);
+    const lcb_RESPGET *resp = reinterpret_cast<const lcb_RESPGET*>(arg);
+    lcb_t instance = rv->instance;
+
+    if (instance->nearcache) {
+        instance->nearcache->revalidated(rv, resp);
+    } else {
+        lcb_RESPGET tmp = *resp;
+        tmp.rc = LCB_ERROR;
+        lcb_find_callback(instance, LCB_CALLBACK_GET)(
+            instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)&tmp);
+    }
+    delete rv;
+}
+
+static void
+revalidate_dtor(mc_PACKET *pkt)
+{
+    delete static_cast<NearCacheRevalidation*>(pkt->u_rdata.exdata);
+}
+
+static mc_REQDATAPROCS revalidate_procs = {
+        revalidate_callback,
+        revalidate_dtor
+};
+
+NearCacheRevalidation::NearCacheRevalidation(const void *cookie_,
+    lcb_t instance_, int vbucket_, const std::string& key_)
+    : mc_REQDATAEX(cookie_, revalidate_procs, gethrtime()),
+      instance(instance_), vbucket(vbucket_), key(key_) {
+}
+
+NearCache::NearCache(lcb_t instance_)
+    : nhits(0), nmisses(0), nrevalidated(0), nevicted(0),
+      instance(instance_), sketch_capacity(0), loop_referenced(false),
+      timer(instance_->iotable, this)
+{
+}
+
+NearCache::~NearCache()
+{
+    if (loop_referenced) {
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    }
+}
+
+hrtime_t
+NearCache::ttl() const
+{
+    return LCB_US2NS(LCBT_SETTING(instance, nearcache_ttl));
+}
+
+NearCache::LookupResult
+NearCache::lookup(int vbid, const lcb_KEYBUF *kb, const void *cookie)
+{
+    Key key(vbid, std::string((const char *)kb->contig.bytes, kb->contig.nbytes));
+    check_capacity();
+    sketch.increment(key.second);
+
+    EntryMap::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        nmisses++;
+        return MISS;
+    }
+
+    const Entry& entry = *it->second;
+    if (gethrtime() - entry.stored > ttl()) {
+        if (LCBT_SETTING(instance, nearcache_revalidate)) {
+            return STALE;
+        }
+        erase(key);
+        nmisses++;
+        return MISS;
+    }
+
+    lru.splice(lru.begin(), lru, it->second);
+    Hit hit;
+    hit.cookie = cookie;
+    hit.entry = entry;
+    staged.push_back(hit);
+    nhits++;
+    return HIT;
+}
+
+void
+NearCache::revalidate(mc_PACKET *pkt, int vbid, const void *cookie)
+{
+    const void *kptr;
+    lcb_size_t nkey;
+    mcreq_get_key(pkt, &kptr, &nkey);
+
+    pkt->u_rdata.exdata = new NearCacheRevalidation(
+        cookie, instance, vbid, std::string((const char *)kptr, nkey));
+    pkt->flags |= MCREQ_F_REQEXT;
+}
+
+void
+NearCache::revalidated(const NearCacheRevalidation *rv, const lcb_RESPGET *resp)
+{
+    Key key(rv->vbucket, rv->key);
+    EntryMap::iterator it = entries.find(key);
+
+    if (it != entries.end() && resp->rc == LCB_SUCCESS &&
+            resp->cas == it->second->cas) {
+        /* Unchanged on the server */
+        it->second->stored = gethrtime();
+        lru.splice(lru.begin(), lru, it->second);
+        nrevalidated++;
+        deliver(*it->second, rv->cookie);
+        return;
+    }
+
+    /* Changed, gone, or we couldn't tell. Fetch it properly */
+    if (it != entries.end()) {
+        erase(key);
+    }
+
+    lcb_CMDGET cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, rv->key.c_str(), rv->key.size());
+    lcb_error_t err = lcb_get3(instance, rv->cookie, &cmd);
+    if (err != LCB_SUCCESS) {
+        lcb_RESPGET tmp = *resp;
+        tmp.rc = err;
+        tmp.cas = 0;
+        lcb_find_callback(instance, LCB_CALLBACK_GET)(
+            instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)&tmp);
+    }
+}
+
+void
+NearCache::store(const mc_PACKET *request, const lcb_RESPGET *resp)
+{
+    lcb_U32 capacity = LCBT_SETTING(instance, nearcache_size);
+    if (!capacity || resp->rc != LCB_SUCCESS) {
+        return;
+    }
+    check_capacity();
+
+    protocol_binary_request_header hdr;
+    const void *kptr;
+    lcb_size_t nkey;
+    mcreq_read_hdr(request, &hdr);
+    mcreq_get_key(request, &kptr, &nkey);
+    Key key(ntohs(hdr.request.vbucket), std::string((const char *)kptr, nkey));
+
+    /* Don't cache a value which may predate one of our own mutations */
+    std::map<Key, hrtime_t>::const_iterator tomb = tombstones.find(key);
+    if (tomb != tombstones.end() && tomb->second >= MCREQ_PKT_RDATA(request)->start) {
+        return;
+    }
+
+    EntryMap::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        if (lru.size() >= capacity) {
+            /* Only replace the least recently used entry with a key which is
+             * read more often */
+            Entry& victim = lru.back();
+            if (sketch.frequency(key.second) <= sketch.frequency(victim.key.second)) {
+                return;
+            }
+            erase(victim.key);
+            nevicted++;
+        }
+        lru.push_front(Entry());
+        it = entries.insert(EntryMap::value_type(key, lru.begin())).first;
+    } else {
+        lru.splice(lru.begin(), lru, it->second);
+    }
+
+    Entry& entry = *it->second;
+    entry.key = key;
+    entry.value.assign((const char *)resp->value, resp->nvalue);
+    entry.cas = resp->cas;
+    entry.itmflags = resp->itmflags;
+    entry.datatype = resp->datatype;
+    entry.stored = gethrtime();
+}
+
+void
+NearCache::invalidate(const mc_PACKET *request)
+{
+    if (!LCBT_SETTING(instance, nearcache_size)) {
+        return;
+    }
+
+    protocol_binary_request_header hdr;
+    const void *kptr;
+    lcb_size_t nkey;
+    mcreq_read_hdr(request, &hdr);
+    mcreq_get_key(request, &kptr, &nkey);
+
+    Key key(ntohs(hdr.request.vbucket), std::string((const char *)kptr, nkey));
+    erase(key);
+
+    hrtime_t now = gethrtime();
+    tombstones[key] = now;
+    tombstone_order.push_back(std::make_pair(now, key));
+    prune_tombstones(now);
+}
+
+void
+NearCache::prune_tombstones(hrtime_t now)
+{
+    /* A GET can't be answered once it has timed out, so a tombstone
+     * outliving the operation timeout can't block anything */
+    hrtime_t horizon = LCB_US2NS(LCBT_SETTING(instance, operation_timeout)) * 2;
+    while (!tombstone_order.empty() && now - tombstone_order.front().first > horizon) {
+        std::map<Key, hrtime_t>::iterator it =
+                tombstones.find(tombstone_order.front().second);
+        if (it != tombstones.end() && it->second == tombstone_order.front().first) {
+            tombstones.erase(it);
+        }
+        tombstone_order.pop_front();
+    }
+}
+
+void
+NearCache::check_capacity()
+{
+    lcb_U32 capacity = LCBT_SETTING(instance, nearcache_size);
+    if (sketch_capacity == capacity) {
+        return;
+    }
+    sketch.resize(capacity);
+    sketch_capacity = capacity;
+    while (lru.size() > capacity) {
+        erase(lru.back().key);
+    }
+}
+
+void
+NearCache::erase(const Key& key)
+{
+    EntryMap::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        return;
+    }
+    lru.erase(it->second);
+    entries.erase(it);
+}
+
+void
+NearCache::clear()
+{
+    lru.clear();
+    entries.clear();
+}
+
+void
+NearCache::sched_leave()
+{
+    if (staged.empty()) {
+        return;
+    }
+    ready.insert(ready.end(), staged.begin(), staged.end());
+    staged.clear();
+    if (!loop_referenced) {
+        /* Keep lcb_wait() running until the hits are delivered */
+        lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        loop_referenced = true;
+    }
+    timer.signal();
+}
+
+void
+NearCache::deliver(const Entry& entry, const void *cookie)
+{
+    lcb_RESPGET resp = { 0 };
+    resp.cookie = const_cast<void*>(cookie);
+    resp.key = entry.key.second.c_str();
+    resp.nkey = entry.key.second.size();
+    resp.rc = LCB_SUCCESS;
+    resp.cas = entry.cas;
+    resp.rflags = LCB_RESP_F_FINAL;
+    resp.value = entry.value.c_str();
+    resp.nvalue = entry.value.size();
+    resp.itmflags = entry.itmflags;
+    resp.datatype = entry.datatype;
+    lcb_find_callback(instance, LCB_CALLBACK_GET)(
+        instance, LCB_CALLBACK_GET, (const lcb_RESPBASE *)&resp);
+}
+
+void
+NearCache::deliver_hits()
+{
+    /* Hits made from within the callbacks are left for the next round */
+    std::vector<Hit> hits;
+    hits.swap(ready);
+    for (size_t ii = 0; ii < hits.size(); ii++) {
+        deliver(hits[ii].entry, hits[ii].cookie);
+    }
+
+    if (ready.empty() && loop_referenced) {
+        loop_referenced = false;
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        lcb_maybe_breakout(instance);
+    }
+}
@@ -0,0 +1,150 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_NEARCACHE_H
+#define LCB_NEARCACHE_H
+
+#include <lcbio/timer-cxx.h>
+#include <mc/mcreq.h>
+#include "freqsketch.h"
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * @brief Client-side cache of recently read items
+ *
+ * @details
+ * When @ref LCB_CNTL_NEARCACHE_SIZE is non-zero, the values returned by plain
+ * GETs are kept for @ref LCB_CNTL_NEARCACHE_TTL, and subsequent plain GETs
+ * for the same key are answered from the cache. Entries are replaced in LRU
+ * order, but only by keys which have been read more often than the entry
+ * being replaced (as estimated by a small count-min sketch), so that one-off
+ * reads do not flush out hot keys.
+ *
+ * Entries are dropped when this instance mutates (or locks) the key. Once an
+ * entry has expired it may optionally be revalidated by a GET_META, which
+ * only transfers the item's metadata, rather than by a full GET.
+ */
+
+namespace lcb {
+
+struct NearCacheRevalidation;
+
+class NearCache {
+public:
+    NearCache(lcb_t instance);
+    ~NearCache();
+
+    enum LookupResult {
+        /** The GET must be sent to the server */
+        MISS,
+        /** The GET will be answered from the cache */
+        HIT,
+        /** The GET should be replaced by a GET_META for the key. See
+         * revalidate() */
+        STALE
+    };
+
+    /**
+     * Look up a plain GET.
+     * @param vbid the vBucket of the key
+     * @param key the key
+     * @param cookie the user's cookie, which will receive the response if
+     *        this returns HIT
+     */
+    LookupResult lookup(int vbid, const lcb_KEYBUF *key, const void *cookie);
+
+    /**
+     * Make the given GET_META packet the revalidation of a cache entry for
+     * which lookup() returned STALE. This must be called before the packet is
+     * scheduled.
+     */
+    void revalidate(mc_PACKET *pkt, int vbid, const void *cookie);
+
+    /** Handle the response to a GET_META sent by revalidate() */
+    void revalidated(const NearCacheRevalidation *rv, const lcb_RESPGET *resp);
+
+    /** Cache the successful response to a plain GET */
+    void store(const mc_PACKET *request, const lcb_RESPGET *resp);
+
+    /** Drop any entry for the key of the given (mutation) request */
+    void invalidate(const mc_PACKET *request);
+
+    /** Drop all entries */
+    void clear();
+
+    /** Called when the scheduling context is left; hits are delivered */
+    void sched_leave();
+
+    /** Called when the scheduling context fails; its hits are discarded */
+    void sched_fail() { staged.clear(); }
+
+    lcb_U64 nhits; /**< GETs answered from the cache */
+    lcb_U64 nmisses; /**< GETs sent to the server */
+    lcb_U64 nrevalidated; /**< Expired entries confirmed by GET_META */
+    lcb_U64 nevicted; /**< Entries replaced by more frequently read keys */
+
+private:
+    typedef std::pair<int, std::string> Key;
+
+    struct Entry {
+        Key key;
+        std::string value;
+        lcb_U64 cas;
+        lcb_U32 itmflags;
+        lcb_U8 datatype;
+        hrtime_t stored;
+    };
+
+    struct Hit {
+        const void *cookie;
+        Entry entry;
+    };
+
+    typedef std::list<Entry> EntryList;
+    typedef std::map<Key, EntryList::iterator> EntryMap;
+
+    void deliver(const Entry& entry, const void *cookie);
+    void deliver_hits();
+    void erase(const Key& key);
+    void check_capacity();
+    void prune_tombstones(hrtime_t now);
+    hrtime_t ttl() const;
+
+    lcb_t instance;
+    EntryList lru; /**< Most recently used first */
+    EntryMap entries;
+    FrequencySketch<> sketch; /**< Access counts of recently read keys */
+    size_t sketch_capacity;
+
+    /** Last time each recently mutated key was invalidated, so that GETs
+     * sent before the mutation do not cache a stale value */
+    std::map<Key, hrtime_t> tombstones;
+    std::deque<std::pair<hrtime_t, Key> > tombstone_order;
+
+    std::vector<Hit> staged; /**< Hits in the current scheduling context */
+    std::vector<Hit> ready; /**< Hits waiting to be delivered */
+    bool loop_referenced;
+    lcb::io::Timer<NearCache, &NearCache::deliver_hits> timer;
+};
+}
+
+#endif
@@ -55,6 +55,17 @@ typedef unsigned int nb_SIZE;
 #define NB_DATA_CACHEBLOCKS 16
 /** @brief Default data allocation size */
 #define NB_DATA_BASEALLOC 32768
+
+/**
+ * @brief Smallest size for a data block sized from recent allocations.
+ * Keeping blocks small for small spans limits how much memory a single
+ * long-lived span can hold on to.
+ */
+#define NB_DATA_MINALLOC 8192
+/** @brief Largest size for a data block sized from recent allocations */
+#define NB_DATA_MAXALLOC 1048576
+/** @brief How many spans of the recent average size a new data block holds */
+#define NB_DATA_BLOCKSPANS 128
 /**@}*/
 
 typedef struct {
@@ -64,6 +75,11 @@ typedef struct {
     nb_SIZE dea_basealloc;
     nb_SIZE data_cacheblocks;
     nb_SIZE data_basealloc;
+    /** Range of sizes for new data blocks, chosen according to the sizes of
+     * recent allocations (see NB_DATA_MINALLOC and NB_DATA_MAXALLOC). If
+     * these are 0 (the default), data_basealloc is used */
+    nb_SIZE data_minalloc;
+    nb_SIZE data_maxalloc;
 } nb_SETTINGS;
 
 #ifndef _WIN32
@@ -213,6 +213,24 @@ typedef struct netbuf_mblock_st {
     nb_MBLOCK *cacheblocks;
     nb_SIZE ncacheblocks;
 
+    /**
+     * Range of sizes for new blocks. If maxalloc is nonzero, new blocks are
+     * sized to hold several allocations of the average size, rather than
+     * `basealloc`
+     */
+    nb_SIZE minalloc;
+    nb_SIZE maxalloc;
+
+    /** Moving average of the allocation size, multiplied by 8 so that small
+     * sizes aren't lost to rounding */
+    nb_SIZE avgsize8;
+
+    /**
+     * Smallest number of available blocks since the last netbuf_trim().
+     * This many blocks have gone unused since then
+     */
+    unsigned int minavail;
+
     struct netbuf_st *mgr;
 } nb_MBPOOL;
 
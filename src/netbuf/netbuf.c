@@ -79,6 +79,43 @@ mblock_is_standalone(nb_MBLOCK *block)
     return block->parent == NULL;
 }
 
+/**
+ * Determines the size of a new block, before it is grown to fit the span
+ * it is allocated for.
+ */
+static nb_SIZE
+mblock_target_size(const nb_MBPOOL *pool)
+{
+    nb_SIZE ret, avgsize = pool->avgsize8 / 8;
+
+    if (!pool->maxalloc) {
+        return pool->basealloc;
+    }
+    if (avgsize >= pool->maxalloc / NB_DATA_BLOCKSPANS) {
+        return pool->maxalloc;
+    }
+
+    ret = pool->minalloc;
+    while (ret < avgsize * NB_DATA_BLOCKSPANS) {
+        ret *= 2;
+    }
+    return ret < pool->maxalloc ? ret : pool->maxalloc;
+}
+
+/**
+ * Determines whether an empty block is much larger than recent allocations
+ * need, and should be freed rather than kept for reuse.
+ */
+static int
+mblock_is_oversized(const nb_MBPOOL *pool, const nb_MBLOCK *block)
+{
+    if (!pool->maxalloc) {
+        return 0;
+    }
+    return block->nalloc / 2 > mblock_target_size(pool) &&
+            block->nalloc / 4 > pool->avgsize8 / 8;
+}
+
 /**
  * Allocates a new block with at least the given capacity and places it
  * inside the active list.
@@ -104,7 +141,7 @@ alloc_new_block(nb_MBPOOL *pool, nb_SIZE capacity)
         return NULL;
     }
 
-    ret->nalloc = pool->basealloc;
+    ret->nalloc = mblock_target_size(pool);
 
     while (ret->nalloc < capacity) {
         ret->nalloc *= 2;
@@ -117,6 +154,8 @@ alloc_new_block(nb_MBPOOL *pool, nb_SIZE capacity)
     if (!ret->root) {
         if (mblock_is_standalone(ret)) {
             free(ret);
+        } else {
+            ret->nalloc = 0;
         }
         return NULL;
     }
@@ -126,7 +165,8 @@ alloc_new_block(nb_MBPOOL *pool, nb_SIZE capacity)
 
 /**
  * Finds an available block within the available list. The block will have
- * room for at least capacity bytes.
+ * room for at least capacity bytes. Blocks which are much larger than recent
+ * allocations need are left unused, so that netbuf_trim() can free them.
  */
 static nb_MBLOCK*
 find_free_block(nb_MBPOOL *pool, nb_SIZE capacity)
@@ -134,9 +174,12 @@ find_free_block(nb_MBPOOL *pool, nb_SIZE capacity)
     sllist_iterator iter;
     SLLIST_ITERFOR(&pool->avail, &iter) {
         nb_MBLOCK *cur = SLLIST_ITEM(iter.cur, nb_MBLOCK, slnode);
-        if (cur->nalloc >= capacity) {
+        if (cur->nalloc >= capacity && !mblock_is_oversized(pool, cur)) {
             sllist_iter_remove(&pool->avail, &iter);
             pool->curblocks--;
+            if (pool->curblocks < pool->minavail) {
+                pool->minavail = pool->curblocks;
+            }
             return cur;
         }
     }
@@ -230,6 +273,10 @@ mblock_reserve_data(nb_MBPOOL *pool, nb_SPAN *span)
     return 0;
 #endif
 
+    if (pool->maxalloc) {
+        pool->avgsize8 = pool->avgsize8 - pool->avgsize8 / 8 + span->size;
+    }
+
     if (SLLIST_IS_EMPTY(&pool->active)) {
         return reserve_empty_block(pool, span);
 
@@ -370,7 +417,7 @@ mblock_release_data(nb_MBPOOL *pool,
         }
     }
 
-    if (pool->curblocks < pool->maxblocks) {
+    if (pool->curblocks < pool->maxblocks && !mblock_is_oversized(pool, block)) {
         sllist_append(&pool->avail, &block->slnode);
         pool->curblocks++;
     } else {
@@ -463,6 +510,10 @@ mblock_wipe_block(nb_MBLOCK *block)
 
     if (mblock_is_standalone(block)) {
         free(block);
+    } else {
+        /* Allow the cached block to be used again */
+        block->root = NULL;
+        block->nalloc = 0;
     }
 }
 
@@ -506,6 +557,44 @@ netbuf_mblock_reserve(nb_MGR *mgr, nb_SPAN *span)
     return mblock_reserve_data(&mgr->datapool, span);
 }
 
+/**
+ * Frees available blocks which have not been used since the last call,
+ * largest first.
+ * @return the number of bytes freed
+ */
+static nb_SIZE
+mblock_trim(nb_MBPOOL *pool)
+{
+    nb_SIZE ret = 0;
+
+    while (pool->minavail && !SLLIST_IS_EMPTY(&pool->avail)) {
+        sllist_node *ll;
+        nb_MBLOCK *largest = NULL;
+
+        SLLIST_FOREACH(&pool->avail, ll) {
+            nb_MBLOCK *cur = SLLIST_ITEM(ll, nb_MBLOCK, slnode);
+            if (!largest || cur->nalloc > largest->nalloc) {
+                largest = cur;
+            }
+        }
+
+        sllist_remove(&pool->avail, &largest->slnode);
+        pool->curblocks--;
+        pool->minavail--;
+        ret += largest->nalloc;
+        mblock_wipe_block(largest);
+    }
+
+    pool->minavail = pool->curblocks;
+    return ret;
+}
+
+nb_SIZE
+netbuf_trim(nb_MGR *mgr)
+{
+    return mblock_trim(&mgr->datapool) + mblock_trim(&mgr->sendq.elempool);
+}
+
 /******************************************************************************
  ******************************************************************************
  ** Informational Routines                                                   **
@@ -517,6 +606,49 @@ netbuf_mblock_get_next_size(const nb_MGR *mgr, int allow_wrap)
     return mblock_get_next_size(&mgr->datapool, allow_wrap);
 }
 
+static void
+mblock_get_stats(const nb_MBPOOL *pool, nb_STATS *stats)
+{
+    sllist_node *ll;
+
+    SLLIST_FOREACH(&pool->active, ll) {
+        const nb_MBLOCK *block = SLLIST_ITEM(ll, nb_MBLOCK, slnode);
+        stats->allocated += block->nalloc;
+        if (BLOCK_IS_EMPTY(block)) {
+            continue;
+        }
+
+        stats->used += block->wrap - block->start;
+        if (block->cursor != block->wrap) {
+            /* The end of the block can't be used until the block unwraps */
+            stats->used += block->cursor;
+            stats->wasted += block->nalloc - block->wrap;
+        }
+
+        if (block->deallocs) {
+            sllist_node *dll;
+            SLLIST_FOREACH(&block->deallocs->pending, dll) {
+                const nb_QDEALLOC *qd = SLLIST_ITEM(dll, nb_QDEALLOC, slnode);
+                stats->used -= qd->size;
+                stats->wasted += qd->size;
+            }
+        }
+    }
+
+    SLLIST_FOREACH(&pool->avail, ll) {
+        const nb_MBLOCK *block = SLLIST_ITEM(ll, nb_MBLOCK, slnode);
+        stats->allocated += block->nalloc;
+        stats->cached += block->nalloc;
+    }
+}
+
+void
+netbuf_get_stats(const nb_MGR *mgr, nb_STATS *stats)
+{
+    mblock_get_stats(&mgr->datapool, stats);
+    mblock_get_stats(&mgr->sendq.elempool, stats);
+}
+
 unsigned int
 netbuf_get_niov(nb_MGR *mgr)
 {
@@ -730,6 +862,8 @@ void netbuf_default_settings(nb_SETTINGS *settings)
     settings->dea_cacheblocks = NB_MBDEALLOC_CACHEBLOCKS;
     settings->sndq_basealloc = NB_SNDQ_BASEALLOC;
     settings->sndq_cacheblocks = NB_SNDQ_CACHEBLOCKS;
+    settings->data_minalloc = 0;
+    settings->data_maxalloc = 0;
 }
 
 void
@@ -753,6 +887,12 @@ netbuf_init(nb_MGR *mgr, const nb_SETTINGS *user_settings)
     mblock_init(sqpool);
 
     bufpool->basealloc = mgr->settings.data_basealloc;
+    if (mgr->settings.data_minalloc && mgr->settings.data_maxalloc) {
+        bufpool->minalloc = mgr->settings.data_minalloc;
+        bufpool->maxalloc = mgr->settings.data_maxalloc;
+        /* Start out with blocks of the base size */
+        bufpool->avgsize8 = bufpool->basealloc / NB_DATA_BLOCKSPANS * 8;
+    }
     bufpool->ncacheblocks = mgr->settings.data_cacheblocks;
     bufpool->mgr = mgr;
     mblock_init(bufpool);
@@ -335,6 +335,41 @@ netbuf_get_size(const nb_MGR *mgr);
 nb_SIZE
 netbuf_mblock_get_next_size(const nb_MGR *mgr, int allow_wrap);
 
+/** @brief Memory usage of a manager. See netbuf_get_stats() */
+typedef struct {
+    /** Total size of all blocks */
+    nb_SIZE allocated;
+    /** Bytes in reserved spans and queued IOVs */
+    nb_SIZE used;
+    /** Size of empty blocks kept for reuse */
+    nb_SIZE cached;
+    /**
+     * Bytes which are neither used nor available to new spans until other
+     * spans are released: the unused end of a wrapped block, and spans
+     * released out of order
+     */
+    nb_SIZE wasted;
+} nb_STATS;
+
+/**
+ * Get the memory usage of the manager. This traverses all blocks.
+ * @param mgr
+ * @param stats the statistics of the manager are added to this structure
+ */
+void
+netbuf_get_stats(const nb_MGR *mgr, nb_STATS *stats);
+
+/**
+ * Free empty blocks which have not been used since the last call to this
+ * function. Call this periodically so that memory used during a burst of
+ * activity is returned once it is no longer needed.
+ *
+ * @param mgr
+ * @return the number of bytes freed
+ */
+nb_SIZE
+netbuf_trim(nb_MGR *mgr);
+
 /**
  * @brief Initializes an nb_MGR structure
  * @param mgr the manager to initialize
@@ -305,6 +305,34 @@ replace_config(lcb_t instance, lcbvb_CONFIG *oldconfig, lcbvb_CONFIG *newconfig)
     free(ppold);
 }
 
+/**
+ * Pre-establish pooled HTTP connections to the query, search and view
+ * endpoints, if the pool has been configured to keep idle connections.
+ */
+static void
+warmup_http_pool(lcb_t instance, lcbvb_CONFIG *vbc)
+{
+    static const lcbvb_SVCTYPE svcs[] = {
+        LCBVB_SVCTYPE_N1QL, LCBVB_SVCTYPE_FTS, LCBVB_SVCTYPE_VIEWS
+    };
+    const lcbvb_SVCMODE mode = LCBT_SETTING(instance, sslopts) ?
+            LCBVB_SVCMODE_SSL : LCBVB_SVCMODE_PLAIN;
+
+    if (!instance->http_sockpool->minidle) {
+        return;
+    }
+
+    for (size_t ii = 0; ii < LCBVB_NSERVERS(vbc); ++ii) {
+        for (size_t jj = 0; jj < sizeof(svcs) / sizeof(svcs[0]); ++jj) {
+            lcb_host_t host;
+            const char *hp = lcbvb_get_hostport(vbc, ii, svcs[jj], mode);
+            if (hp && lcb_host_parsez(&host, hp, 80) == LCB_SUCCESS) {
+                lcbio_mgr_warmup(instance->http_sockpool, &host);
+            }
+        }
+    }
+}
+
 void lcb_update_vbconfig(lcb_t instance, lcb_pCONFIGINFO config)
 {
     lcb_configuration_t change_status;
@@ -352,6 +380,8 @@ void lcb_update_vbconfig(lcb_t instance, lcb_pCONFIGINFO config)
         }
     }
 
+    warmup_http_pool(instance, config->vbc);
+
     instance->callbacks.configuration(instance, change_status);
     lcb_maybe_breakout(instance);
 }
@@ -15,7 +15,9 @@
  *   limitations under the License.
  */
 #include "internal.h"
+#include "coalesce.h"
 #include "trace.h"
+#include "counteragg.h"
 
 LIBCOUCHBASE_API
 lcb_error_t
@@ -38,6 +40,20 @@ lcb_counter3(
         return LCB_OPTIONS_CONFLICT;
     }
 
+    /* Merge with other counter operations for the key, if aggregating */
+    if (LCBT_SETTING(instance, counter_window) && cmd->exptime == 0 &&
+            cmd->key.type == LCB_KV_COPY &&
+            cmd->_hashkey.type == LCB_KV_COPY && LCB_KEYBUF_IS_EMPTY(&cmd->_hashkey) &&
+            (cmd->cmdflags & LCB_CMD_F_INTERNAL_CALLBACK) == 0) {
+        if (!instance->counteragg) {
+            instance->counteragg = new lcb::CounterAggregator(instance);
+        }
+        if (instance->counteragg->add(cmd, cookie)) {
+            MAYBE_SCHEDLEAVE(instance);
+            return LCB_SUCCESS;
+        }
+    }
+
     err = mcreq_basic_packet(q, (const lcb_CMDBASE *)cmd, hdr, 20, &packet,
         &pipeline, MCREQ_BASICPACKET_F_FALLBACKOK);
 
@@ -71,7 +87,14 @@ lcb_counter3(
         hdr->request.opcode = PROTOCOL_BINARY_CMD_INCREMENT;
     }
 
+    if (cmd->cmdflags & LCB_CMD_F_INTERNAL_CALLBACK) {
+        packet->flags |= MCREQ_F_PRIVCALLBACK;
+    }
+
     memcpy(SPAN_BUFFER(&packet->kh_span), acmd.bytes, sizeof(acmd.bytes));
+    if (instance->getcoalescer) {
+        instance->getcoalescer->invalidate(packet);
+    }
     TRACE_ARITHMETIC_BEGIN(hdr, cmd);
     LCB_SCHED_ADD(instance, pipeline, packet);
     return LCB_SUCCESS;
@@ -19,6 +19,8 @@
 #include "internal.h"
 #include <libcouchbase/api3.h>
 #include "durability_internal.h"
+#include <lcbio/timer-cxx.h>
+#include <map>
 
 using namespace lcb::durability;
 
@@ -29,6 +31,8 @@ public:
         : Durset(instance_, options) {
     }
 
+    ~SeqnoDurset();
+
     // Override
     lcb_error_t poll_impl();
 
@@ -45,13 +49,112 @@ Durset::createSeqnoDurset(lcb_t instance, const lcb_durability_opts_t *options)
 }
 
 #define ENT_SEQNO(ent) (ent)->reqseqno
+#define LOGARGS(instance, lvl) (instance)->settings, "endure", LCB_LOG_##lvl, __FILE__, __LINE__
+
+namespace lcb {
+namespace durability {
+
+/**
+ * Coalesces OBSERVE_SEQNO probes across all the items (and all the Dursets)
+ * of an instance.
+ *
+ * Items which need to be checked on a given server are attached to a single
+ * probe for their (vbucket, server, uuid). Probes are sent together once the
+ * current event loop iteration completes, and each response is fanned out to
+ * all the items waiting on it. If a probe for the same vbucket and server is
+ * already in flight, new items simply wait for its response: sequence numbers
+ * only grow, so an older response can at worst report that the item is not
+ * yet replicated, causing it to be checked again in the next interval.
+ *
+ * The last known sequence numbers for each (vbucket, server) are also kept so
+ * that items which are already known to be persisted (e.g. because another
+ * item with a higher seqno was already found persisted) need not be probed at
+ * all.
+ */
+class SeqnoPoller {
+public:
+    SeqnoPoller(lcb_t instance_)
+        : instance(instance_), timer(instance_->iotable, this) {
+    }
+
+    ~SeqnoPoller();
+
+    /**
+     * Request that the given item be checked on the given server. This may
+     * complete the item (and possibly its Durset) immediately if the server
+     * is already known to have the item.
+     *
+     * @return true if the item is now waiting for a response (in which case
+     * the Durset's `waiting` counter has been incremented), false if no
+     * probe is needed.
+     */
+    bool add(Item& item, lcb_U16 srvix);
+
+    /** Schedule all pending probes */
+    void flush();
+
+    /**
+     * Forget any items belonging to the given Durset. Called if a Durset is
+     * destroyed while still waiting for responses (i.e. during lcb_destroy())
+     */
+    void cancel(const Durset *dset);
+
+private:
+    struct Key {
+        lcb_U64 uuid;
+        lcb_U16 vbid;
+        lcb_U16 srvix;
+        bool operator<(const Key& other) const {
+            if (vbid != other.vbid) {
+                return vbid < other.vbid;
+            }
+            if (srvix != other.srvix) {
+                return srvix < other.srvix;
+            }
+            return uuid < other.uuid;
+        }
+    };
+
+    struct Probe : CallbackCookie {
+        SeqnoPoller *poller;
+        Key key;
+        bool sent;
+        std::vector<Item*> waiters;
+    };
+
+    /** Last known state of a vbucket on a server */
+    struct Known {
+        const lcb::Server *server;
+        lcb_U64 uuid;
+        lcb_U64 mem_seqno;
+        lcb_U64 persisted_seqno;
+    };
+
+    typedef std::map<Key, Probe*> ProbeMap;
+    typedef std::map<std::pair<lcb_U16, lcb_U16>, Known> KnownMap;
+
+    static void probe_callback(lcb_t, int, const lcb_RESPBASE *);
+    void on_response(Probe *probe, const lcb_RESPOBSEQNO *resp);
+
+    lcb_t instance;
+    ProbeMap probes;
+    KnownMap known;
+    lcb::io::Timer<SeqnoPoller, &SeqnoPoller::flush> timer;
+};
+
+} // namespace durability
+} // namespace lcb
+
+using lcb::durability::SeqnoPoller;
 
+/**
+ * Update a single item with the response from the server, and notify its
+ * parent once all of its outstanding probes have been answered.
+ */
 static void
-seqno_callback(lcb_t, int, const lcb_RESPBASE *rb)
+update_item(Item *ent, const lcb_RESPOBSEQNO *resp)
 {
-    const lcb_RESPOBSEQNO *resp = (const lcb_RESPOBSEQNO*)rb;
     int flags = 0;
-    Item *ent = static_cast<Item*>(reinterpret_cast<CallbackCookie*>(resp->cookie));
 
     /* Now, process the response */
     if (resp->rc != LCB_SUCCESS) {
@@ -91,46 +194,186 @@ seqno_callback(lcb_t, int, const lcb_RESPBASE *rb)
     }
 }
 
+bool
+SeqnoPoller::add(Item& item, lcb_U16 srvix)
+{
+    KnownMap::const_iterator kit = known.find(std::make_pair(item.vbid, srvix));
+    if (kit != known.end() && kit->second.uuid == item.uuid &&
+            kit->second.server == instance->get_server(srvix) &&
+            kit->second.mem_seqno >= ENT_SEQNO(&item)) {
+
+        ServerInfo info;
+        info.server = kit->second.server;
+        info.exists = 1;
+        info.persisted = kit->second.persisted_seqno >= ENT_SEQNO(&item);
+        bool is_master = lcbvb_vbmaster(LCBT_VBCONFIG(instance), item.vbid) == srvix;
+
+        /* Only use what we know if it satisfies the item on this server.
+         * Otherwise a probe is needed anyway, and its response will update
+         * the item */
+        if (item.is_server_done(info, is_master)) {
+            int flags = Item::UPDATE_REPLICATED;
+            if (info.persisted) {
+                flags |= Item::UPDATE_PERSISTED;
+            }
+            item.update(flags, srvix);
+            return false;
+        }
+    }
+
+    Key key;
+    key.uuid = item.uuid;
+    key.vbid = item.vbid;
+    key.srvix = srvix;
+
+    Probe*& probe = probes[key];
+    if (!probe) {
+        probe = new Probe();
+        probe->callback = probe_callback;
+        probe->poller = this;
+        probe->key = key;
+        probe->sent = false;
+        timer.signal();
+    }
+    probe->waiters.push_back(&item);
+    item.parent->waiting++;
+    return true;
+}
+
+void
+SeqnoPoller::flush()
+{
+    unsigned nsent = 0, nitems = 0;
+    std::vector<Probe*> failed;
+
+    lcb_sched_enter(instance);
+    for (ProbeMap::iterator it = probes.begin(); it != probes.end(); ++it) {
+        Probe *probe = it->second;
+        if (probe->sent) {
+            continue;
+        }
+
+        lcb_CMDOBSEQNO cmd = { 0 };
+        cmd.uuid = probe->key.uuid;
+        cmd.vbid = probe->key.vbid;
+        cmd.server_index = probe->key.srvix;
+        cmd.cmdflags = LCB_CMD_F_INTERNAL_CALLBACK;
+
+        lcb_error_t err = lcb_observe_seqno3(instance, &probe->callback, &cmd);
+        if (err == LCB_SUCCESS) {
+            probe->sent = true;
+            nsent++;
+            nitems += probe->waiters.size();
+        } else {
+            lcb_log(LOGARGS(instance, WARN), "Couldn't schedule OBSERVE_SEQNO for vBucket %u on server %u: 0x%x", probe->key.vbid, probe->key.srvix, err);
+            failed.push_back(probe);
+        }
+    }
+    lcb_sched_leave(instance);
+
+    if (nsent) {
+        lcb_log(LOGARGS(instance, TRACE), "Sent %u OBSERVE_SEQNO probes on behalf of %u items", nsent, nitems);
+    }
+
+    for (size_t ii = 0; ii < failed.size(); ii++) {
+        lcb_RESPOBSEQNO resp = { 0 };
+        resp.rc = LCB_SCHEDFAIL_INTERNAL;
+        resp.vbid = failed[ii]->key.vbid;
+        resp.server_index = failed[ii]->key.srvix;
+        on_response(failed[ii], &resp);
+    }
+}
+
+void
+SeqnoPoller::probe_callback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPOBSEQNO *resp = reinterpret_cast<const lcb_RESPOBSEQNO*>(rb);
+    Probe *probe = static_cast<Probe*>(
+        reinterpret_cast<CallbackCookie*>(const_cast<void*>(resp->cookie)));
+    probe->poller->on_response(probe, resp);
+}
+
+void
+SeqnoPoller::on_response(Probe *probe, const lcb_RESPOBSEQNO *resp)
+{
+    ProbeMap::iterator it = probes.find(probe->key);
+    if (it != probes.end() && it->second == probe) {
+        probes.erase(it);
+    }
+
+    if (resp->rc == LCB_SUCCESS && resp->old_uuid == 0) {
+        Known& kn = known[std::make_pair(probe->key.vbid, probe->key.srvix)];
+        kn.server = instance->get_server(probe->key.srvix);
+        kn.uuid = resp->cur_uuid;
+        kn.mem_seqno = resp->mem_seqno;
+        kn.persisted_seqno = resp->persisted_seqno;
+    }
+
+    for (size_t ii = 0; ii < probe->waiters.size(); ii++) {
+        update_item(probe->waiters[ii], resp);
+    }
+    delete probe;
+}
+
+void
+SeqnoPoller::cancel(const Durset *dset)
+{
+    for (ProbeMap::iterator it = probes.begin(); it != probes.end(); ++it) {
+        std::vector<Item*>& waiters = it->second->waiters;
+        size_t oix = 0;
+        for (size_t ii = 0; ii < waiters.size(); ii++) {
+            if (waiters[ii]->parent != dset) {
+                waiters[oix++] = waiters[ii];
+            }
+        }
+        waiters.resize(oix);
+    }
+}
+
+SeqnoPoller::~SeqnoPoller()
+{
+    for (ProbeMap::iterator it = probes.begin(); it != probes.end(); ++it) {
+        delete it->second;
+    }
+}
+
+void
+lcbdur_seqno_poller_destroy(lcb_SEQNOPOLLER *poller)
+{
+    delete poller;
+}
+
+SeqnoDurset::~SeqnoDurset()
+{
+    if (waiting && instance->seqno_poller) {
+        instance->seqno_poller->cancel(this);
+    }
+}
+
 lcb_error_t
 SeqnoDurset::poll_impl()
 {
-    lcb_error_t ret_err = LCB_EINTERNAL; /* This should never be returned */
-    bool has_ops = false;
+    if (!instance->seqno_poller) {
+        instance->seqno_poller = new SeqnoPoller(instance);
+    }
+    SeqnoPoller *poller = instance->seqno_poller;
 
-    lcb_sched_enter(instance);
     for (size_t ii = 0; ii < entries.size(); ii++) {
         Item& ent = entries[ii];
         lcb_U16 servers[4];
-        lcb_CMDOBSEQNO cmd = { 0 };
 
         if (ent.done) {
             continue;
         }
 
-        cmd.uuid = ent.uuid;
-        cmd.vbid = ent.vbid;
-        cmd.cmdflags = LCB_CMD_F_INTERNAL_CALLBACK;
-        ent.callback = seqno_callback;
-
         size_t nservers = ent.prepare(servers);
-        for (size_t jj = 0; jj < nservers; jj++) {
-            lcb_error_t err;
-            cmd.server_index = servers[jj];
-            err = lcb_observe_seqno3(instance, &ent.callback, &cmd);
-            if (err == LCB_SUCCESS) {
-                waiting++;
-                has_ops = true;
-            } else {
-                ent.res().rc = ret_err = err;
-            }
+        for (size_t jj = 0; jj < nservers && !ent.done; jj++) {
+            poller->add(ent, servers[jj]);
         }
     }
-    lcb_sched_leave(instance);
-    if (!has_ops) {
-        return ret_err;
-    } else {
-        return LCB_SUCCESS;
-    }
+
+    /* If nothing was added, `waiting` is still 0 */
+    return LCB_SUCCESS;
 }
 
 lcb_error_t
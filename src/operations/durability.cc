@@ -156,7 +156,9 @@ Item::update(int flags, int srvix)
 
     lcb_t instance = parent->instance;
     bool is_master = lcbvb_vbmaster(LCBT_VBCONFIG(instance), vbid) == srvix;
-    const lcb::Server *server = instance->get_server(srvix);
+    lcb::Server *server = instance->get_server(srvix);
+    bool had_exists = info->server == server && info->exists;
+    bool had_persisted = info->server == server && info->persisted;
 
     memset(info, 0, sizeof(*info));
     info->server = server;
@@ -178,6 +180,11 @@ Item::update(int flags, int srvix)
         }
     }
 
+    /* The master always has the item, so its replication lag is meaningless */
+    parent->record_lag(server,
+        !had_exists && info->exists && !is_master,
+        !had_persisted && info->persisted);
+
     if (is_all_done()) {
         finish(LCB_SUCCESS);
     }
@@ -237,6 +244,95 @@ Item::finish()
     }
 }
 
+/* Smallest interval used when backing off after the predicted time */
+#define ADAPTIVE_MIN_INTERVAL LCB_MS2US(1)
+
+static void
+update_estimate(lcb_U32& est, lcb_U32 sample)
+{
+    if (!est) {
+        est = sample ? sample : 1;
+    } else {
+        /* Exponentially weighted, giving 1/8 to the new sample */
+        lcb_S64 diff = (lcb_S64)sample - (lcb_S64)est;
+        lcb_S64 next = (lcb_S64)est + diff / 8;
+        est = next > 0 ? (lcb_U32)next : 1;
+    }
+}
+
+void
+Durset::record_lag(lcb::Server *server, bool replicated, bool persisted)
+{
+    if (!replicated && !persisted) {
+        return;
+    }
+
+    /* The item reached the server at some point between the previous poll
+     * and this one. Take the midpoint so that estimates can also shrink */
+    hrtime_t when = ns_prevpoll + (ns_lastpoll - ns_prevpoll) / 2;
+    lcb_U32 sample = when > ns_start ? LCB_NS2US(when - ns_start) : 0;
+
+    if (replicated) {
+        update_estimate(server->dur_replicate_est, sample);
+    }
+    if (persisted) {
+        update_estimate(server->dur_persist_est, sample);
+    }
+}
+
+lcb_U32
+Durset::adaptive_interval()
+{
+    lcb_U32 predicted = 0;
+    size_t maxix = 1; /* Only the master */
+    if (opts.persist_to != 1 || opts.replicate_to != 0) {
+        maxix = LCBT_NREPLICAS(instance) + 1;
+    }
+
+    /* Only the servers which the pending items still have to be checked on
+     * are relevant; a lagging server elsewhere shouldn't delay the poll */
+    for (size_t ii = 0; ii < entries.size(); ii++) {
+        if (entries[ii].done) {
+            continue;
+        }
+        for (size_t jj = 0; jj < maxix; jj++) {
+            int ix = lcbvb_vbserver(LCBT_VBCONFIG(instance), entries[ii].vbid, jj);
+            if (ix < 0) {
+                continue;
+            }
+            const lcb::Server *server = instance->get_server(ix);
+            lcb_U32 est = server->dur_replicate_est;
+            if (opts.persist_to) {
+                est = std::max(est, server->dur_persist_est);
+            }
+            predicted = std::max(predicted, est);
+        }
+    }
+
+    if (!predicted) {
+        return opts.interval;
+    }
+
+    hrtime_t now = gethrtime();
+    lcb_U32 elapsed = LCB_NS2US(now - ns_start);
+    lcb_U32 interval = opts.interval;
+
+    if (elapsed + ADAPTIVE_MIN_INTERVAL < predicted) {
+        nbackoff = 0;
+        interval = predicted - elapsed;
+    } else if (nbackoff < 16) {
+        interval = std::min(interval, (lcb_U32)ADAPTIVE_MIN_INTERVAL << nbackoff);
+        nbackoff++;
+    }
+
+    /* Don't let a long prediction skip the last poll before the timeout */
+    if (ns_timeout > now + LCB_US2NS(ADAPTIVE_MIN_INTERVAL * 2)) {
+        interval = std::min(interval,
+            (lcb_U32)LCB_NS2US(ns_timeout - now) - ADAPTIVE_MIN_INTERVAL);
+    }
+    return interval;
+}
+
 /**
  * Called when the last (primitive) OBSERVE response is received for the entry.
  */
@@ -267,12 +363,19 @@ Durset::poll()
     lcb_assert(waiting == 0);
     incref();
 
+    ns_prevpoll = ns_lastpoll;
+    ns_lastpoll = gethrtime();
+
     err = poll_impl();
-    if (err == LCB_SUCCESS) {
+    if (err == LCB_SUCCESS && waiting) {
         incref();
         switch_state(STATE_TIMEOUT);
     } else {
-        lasterr = err;
+        /* Either an error, or nothing to wait for (e.g. no server is
+         * available for any of the items). Try again after the interval */
+        if (err != LCB_SUCCESS) {
+            lasterr = err;
+        }
         switch_state(STATE_OBSPOLL);
     }
 
@@ -373,7 +476,8 @@ Durset::MCTX_done(const void *cookie_) {
 
     cookie = cookie_;
     nremaining = entries.size();
-    ns_timeout = gethrtime() + LCB_US2NS(opts.timeout);
+    ns_start = ns_lastpoll = gethrtime();
+    ns_timeout = ns_start + LCB_US2NS(opts.timeout);
 
     lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_DURABILITY, this);
     switch_state(STATE_INIT);
@@ -422,7 +526,8 @@ Durset::Durset(lcb_t instance_, const lcb_durability_opts_t *options)
     : MultiCmdContext(),
       nremaining(0), waiting(0), refcnt(0), next_state(STATE_OBSPOLL),
       lasterr(LCB_SUCCESS), is_durstore(false), cookie(NULL),
-      ns_timeout(0), timer(NULL), instance(instance_)
+      ns_timeout(0), ns_start(0), ns_prevpoll(0), ns_lastpoll(0),
+      nbackoff(0), adaptive(false), timer(NULL), instance(instance_)
 {
     const lcb_DURABILITYOPTSv0 *opts_in = &options->v.v0;
 
@@ -442,6 +547,8 @@ Durset::Durset(lcb_t instance_, const lcb_durability_opts_t *options)
 
     if (!opts.interval) {
         opts.interval = LCBT_SETTING(instance, durability_interval);
+        /* Only adapt the interval if the user did not ask for one */
+        adaptive = LCBT_SETTING(instance, dur_adaptive);
     }
 
     lcbio_pTABLE io = instance->iotable;
@@ -627,8 +734,9 @@ Durset::switch_state(State state)
             delay = 0;
         }
     } else if (state == STATE_OBSPOLL) {
-        if (now + LCB_US2NS(opts.interval) < ns_timeout) {
-            delay = opts.interval;
+        lcb_U32 interval = adaptive ? adaptive_interval() : opts.interval;
+        if (now + LCB_US2NS(interval) < ns_timeout) {
+            delay = interval;
         } else {
             delay = 0;
             state = STATE_TIMEOUT;
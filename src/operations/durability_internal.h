@@ -47,6 +47,9 @@ void lcbdurctx_set_durstore(lcb_MULTICMD_CTX *ctx, int enabled);
 
 void lcbdur_destroy(void *dset);
 
+/** Destroy the instance's shared OBSERVE_SEQNO poller */
+void lcbdur_seqno_poller_destroy(lcb_SEQNOPOLLER *poller);
+
 /** Called from durability-cas to request an OBSERVE with a special callback */
 lcb_MULTICMD_CTX *lcb_observe_ctx_dur_new(lcb_t instance);
 
@@ -242,7 +245,9 @@ struct Durset : public MultiCmdContext {
 
     /**
      * Called to actually check for persistence/replication. This must be
-     * implemented.
+     * implemented. If nothing could be scheduled, this should return
+     * LCB_SUCCESS and leave `waiting` unset; the poll is retried after the
+     * interval.
      */
     virtual lcb_error_t poll_impl() = 0;
 
@@ -263,6 +268,20 @@ struct Durset : public MultiCmdContext {
     /** Called after timeouts and intervals. */
     inline void tick();
 
+    /**
+     * Update the lag estimates of a server once an item has been found to be
+     * replicated to, or persisted on it.
+     */
+    void record_lag(lcb::Server *server, bool replicated, bool persisted);
+
+    /**
+     * Get the delay until the next poll when adaptive polling is in effect.
+     * This is the time remaining until the item is predicted to satisfy the
+     * criteria, or an exponentially increasing interval once that time has
+     * passed.
+     */
+    lcb_U32 adaptive_interval();
+
     static Durset* createCasDurset(lcb_t, const lcb_durability_opts_t*);
     static Durset* createSeqnoDurset(lcb_t, const lcb_durability_opts_t*);
 
@@ -277,6 +296,11 @@ struct Durset : public MultiCmdContext {
     std::string kvbufs; /**< Backing storage for key buffers */
     const void *cookie; /**< User cookie */
     hrtime_t ns_timeout; /**< Timestamp of next timeout */
+    hrtime_t ns_start; /**< Time the operation was scheduled */
+    hrtime_t ns_prevpoll; /**< Time of the poll before the current one */
+    hrtime_t ns_lastpoll; /**< Time of the current (or last) poll */
+    unsigned nbackoff; /**< Polls since the predicted completion time */
+    bool adaptive; /**< Whether to use adaptive_interval() */
     void *timer;
     lcb_t instance;
 };
@@ -17,6 +17,9 @@
 
 #include "internal.h"
 #include "trace.h"
+#include "hedge.h"
+#include "coalesce.h"
+#include "nearcache.h"
 
 LIBCOUCHBASE_API
 lcb_error_t
@@ -47,16 +50,48 @@ lcb_get3(lcb_t instance, const void *cookie, const lcb_CMDGET *cmd)
         opcode = PROTOCOL_BINARY_CMD_GAT;
     }
 
+    /* Plain GETs may be answered from the near cache, or share the packet
+     * of an identical in-flight GET */
+    bool plain = opcode == PROTOCOL_BINARY_CMD_GET &&
+            cmd->key.type == LCB_KV_COPY &&
+            (cmd->cmdflags & (LCB_CMD_F_INTERNAL_CALLBACK|LCB_CMDGET_F_HEDGE)) == 0;
+    bool coalesce = plain && LCBT_SETTING(instance, get_coalesce);
+    bool nearcache = plain && LCBT_SETTING(instance, nearcache_size) != 0;
+
+    if ((nearcache || (coalesce && instance->getcoalescer)) && q->config) {
+        int vbid, srvix;
+        mcreq_map_key(q, &cmd->key, &cmd->_hashkey, MCREQ_PKT_BASESIZE,
+            &vbid, &srvix);
+
+        if (nearcache) {
+            if (!instance->nearcache) {
+                instance->nearcache = new lcb::NearCache(instance);
+            }
+            switch (instance->nearcache->lookup(vbid, &cmd->key, cookie)) {
+            case lcb::NearCache::HIT:
+                MAYBE_SCHEDLEAVE(instance);
+                return LCB_SUCCESS;
+            case lcb::NearCache::STALE:
+                opcode = PROTOCOL_BINARY_CMD_GET_META;
+                coalesce = false;
+                break;
+            case lcb::NearCache::MISS:
+                break;
+            }
+        }
+        if (coalesce && instance->getcoalescer &&
+                instance->getcoalescer->join(vbid, &cmd->key, cookie)) {
+            MAYBE_SCHEDLEAVE(instance);
+            return LCB_SUCCESS;
+        }
+    }
+
     err = mcreq_basic_packet(q, (const lcb_CMDBASE *)cmd, hdr, extlen, &pkt, &pl,
         MCREQ_BASICPACKET_F_FALLBACKOK);
     if (err != LCB_SUCCESS) {
         return err;
     }
 
-    rdata = &pkt->u_rdata.reqdata;
-    rdata->cookie = cookie;
-    rdata->start = gethrtime();
-
     hdr->request.magic = PROTOCOL_BINARY_REQ;
     hdr->request.opcode = opcode;
     hdr->request.datatype = PROTOCOL_BINARY_RAW_BYTES;
@@ -73,6 +108,29 @@ lcb_get3(lcb_t instance, const void *cookie, const lcb_CMDGET *cmd)
     }
 
     memcpy(SPAN_BUFFER(&pkt->kh_span), gcmd.bytes, MCREQ_PKT_BASESIZE + extlen);
+
+    if ((cmd->cmdflags & LCB_CMDGET_F_HEDGE) &&
+            opcode == PROTOCOL_BINARY_CMD_GET &&
+            (pkt->flags & MCREQ_F_PRIVCALLBACK) == 0 &&
+            pl != q->fallback && LCBT_NREPLICAS(instance)) {
+        if (!instance->hedger) {
+            instance->hedger = new lcb::Hedger(instance);
+        }
+        instance->hedger->add(static_cast<lcb::Server*>(pl), pkt, cookie);
+    } else if (opcode == PROTOCOL_BINARY_CMD_GET_META) {
+        instance->nearcache->revalidate(pkt, ntohs(hdr->request.vbucket), cookie);
+    } else if (coalesce && pl != q->fallback) {
+        if (!instance->getcoalescer) {
+            instance->getcoalescer = new lcb::GetCoalescer();
+        }
+        instance->getcoalescer->lead(
+            instance, pkt, ntohs(hdr->request.vbucket), cookie);
+    } else {
+        rdata = &pkt->u_rdata.reqdata;
+        rdata->cookie = cookie;
+        rdata->start = gethrtime();
+    }
+
     LCB_SCHED_ADD(instance, pl, pkt);
     TRACE_GET_BEGIN(hdr, cmd);
 
@@ -189,12 +247,22 @@ struct RGetCookie : mc_REQDATAEX {
         }
     }
 
+    /** Replica index to use for the `n`th attempt */
+    unsigned replica_at(unsigned n) const {
+        if (order.empty()) {
+            return n;
+        }
+        return n < order.size() ? order[n] : r_max;
+    }
+
     unsigned r_cur;
     unsigned r_max;
     int remaining;
     int vbucket;
     lcb_replica_t strategy;
     lcb_t instance;
+    /** Order in which to try the replicas, for LCB_REPLICA_FASTEST */
+    std::vector<unsigned> order;
 };
 
 static void rget_dtor(mc_PACKET *pkt) {
@@ -226,7 +294,8 @@ rget_callback(mc_PIPELINE *, mc_PACKET *pkt, lcb_error_t err, const void *arg)
         do {
             int nextix;
             rck->r_cur++;
-            nextix = lcbvb_vbreplica(cq->config, rck->vbucket, rck->r_cur);
+            nextix = lcbvb_vbreplica(
+                cq->config, rck->vbucket, rck->replica_at(rck->r_cur));
             if (nextix > -1 && nextix < (int)cq->npipelines) {
                 /* have a valid next index? */
                 nextpl = cq->pipelines[nextix];
@@ -277,6 +346,7 @@ lcb_rget3(lcb_t instance, const void *cookie, const lcb_CMDGETREPLICA *cmd)
     int vbid, ixtmp;
     protocol_binary_request_header req;
     unsigned r0, r1 = 0;
+    std::vector<unsigned> order;
 
     if (LCB_KEYBUF_IS_EMPTY(&cmd->key)) {
         return LCB_EMPTY_KEY;
@@ -311,6 +381,12 @@ lcb_rget3(lcb_t instance, const void *cookie, const lcb_CMDGETREPLICA *cmd)
                 return LCB_NO_MATCHING_SERVER;
             }
         }
+    } else if (cmd->strategy == LCB_REPLICA_FASTEST) {
+        /* r0 and r1 index into the ranked order, rather than the replicas */
+        if (!lcb::rank_replicas(cq, vbid, order)) {
+            return LCB_NO_MATCHING_SERVER;
+        }
+        r0 = r1 = 0;
     } else {
         for (r0 = 0; r0 < LCBT_NREPLICAS(instance); r0++) {
             if ((ixtmp = lcbvb_vbreplica(cq->config, vbid, r0)) > -1) {
@@ -329,6 +405,7 @@ lcb_rget3(lcb_t instance, const void *cookie, const lcb_CMDGETREPLICA *cmd)
 
     /* Initialize the cookie */
     RGetCookie *rck = new RGetCookie(cookie, instance, cmd->strategy, vbid);
+    rck->order.swap(order);
 
     /* Initialize the packet */
     req.request.magic = PROTOCOL_BINARY_REQ;
@@ -346,7 +423,7 @@ lcb_rget3(lcb_t instance, const void *cookie, const lcb_CMDGETREPLICA *cmd)
         mc_PIPELINE *pl;
         mc_PACKET *pkt;
 
-        curix = lcbvb_vbreplica(cq->config, vbid, r0);
+        curix = lcbvb_vbreplica(cq->config, vbid, rck->replica_at(r0));
         /* XXX: this is always expected to be in range. For the FIRST mode
          * it will seek to the first valid index (checked above), and for the
          * ALL mode, it will fail if not all replicas are already online
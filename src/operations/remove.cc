@@ -16,6 +16,7 @@
  */
 
 #include "internal.h"
+#include "coalesce.h"
 #include "trace.h"
 
 LIBCOUCHBASE_API
@@ -49,6 +50,9 @@ lcb_remove3(lcb_t instance, const void *cookie, const lcb_CMDREMOVE * cmd)
     pkt->u_rdata.reqdata.cookie = cookie;
     pkt->u_rdata.reqdata.start = gethrtime();
     memcpy(SPAN_BUFFER(&pkt->kh_span), hdr.bytes, sizeof(hdr.bytes));
+    if (instance->getcoalescer) {
+        instance->getcoalescer->invalidate(pkt);
+    }
     TRACE_REMOVE_BEGIN(&hdr, cmd);
     LCB_SCHED_ADD(instance, pl, pkt);
     return LCB_SUCCESS;
@@ -15,6 +15,7 @@
  *   limitations under the License.
  */
 #include "internal.h"
+#include "coalesce.h"
 #include "mc/compress.h"
 #include "trace.h"
 #include "durability_internal.h"
@@ -300,6 +301,9 @@ do_store3(lcb_t instance, const void *cookie,
             + get_value_size(packet));
 
     memcpy(SPAN_BUFFER(&packet->kh_span), scmd.bytes, hsize);
+    if (instance->getcoalescer) {
+        instance->getcoalescer->invalidate(packet);
+    }
     LCB_SCHED_ADD(instance, pipeline, packet);
     TRACE_STORE_BEGIN(hdr, (lcb_CMDSTORE* )cmd);
     return LCB_SUCCESS;
@@ -15,7 +15,7 @@
  *   limitations under the License.
  */
 #include "internal.h"
-#include <vector>
+#include "coalesce.h"
 #include <string>
 #include <include/libcouchbase/subdoc.h>
 
@@ -156,21 +156,22 @@ find(unsigned mode)
 }
 }
 
+/**
+ * Size of a spec's value, as written by MultiEncoder::write_value(). For IOVs
+ * this is always the sum of their lengths; total_length is only a hint, and
+ * trusting it would let a short total_length overflow the reserved span
+ */
 static size_t
 get_valbuf_size(const lcb_VALBUF& vb)
 {
     if (vb.vtype == LCB_KV_COPY || vb.vtype == LCB_KV_CONTIG) {
         return vb.u_buf.contig.nbytes;
     } else {
-        if (vb.u_buf.multi.total_length) {
-            return vb.u_buf.multi.total_length;
-        } else {
-            size_t tmp = 0;
-            for (size_t ii = 0; ii < vb.u_buf.multi.niov; ++ii) {
-                tmp += vb.u_buf.multi.iov[ii].iov_len;
-            }
-            return tmp;
+        size_t tmp = 0;
+        for (size_t ii = 0; ii < vb.u_buf.multi.niov; ++ii) {
+            tmp += vb.u_buf.multi.iov[ii].iov_len;
         }
+        return tmp;
     }
 }
 
@@ -193,27 +194,17 @@ make_subdoc_flags(const uint32_t user)
     return subdoc_flags;
 }
 
-struct MultiBuilder {
-    MultiBuilder(const lcb_CMDSUBDOC *cmd_)
+/**
+ * Encodes the specs of a multi-path command. The specs are first validated
+ * and measured, so that the body can be reserved in the packet's value and
+ * written there directly, without intermediate buffers or copies.
+ */
+struct MultiEncoder {
+    MultiEncoder(const lcb_CMDSUBDOC *cmd_)
     : cmd(cmd_), payload_size(0), mode(0) {
-        size_t ebufsz = is_lookup() ? cmd->nspecs * 4 : cmd->nspecs * 8;
-        extra_body = new char[ebufsz];
-        bodysz = 0;
     }
 
-    ~MultiBuilder() {
-        if (extra_body != NULL) {
-            delete[] extra_body;
-        }
-    }
-
-    inline MultiBuilder(const MultiBuilder&);
-
-    // IOVs which are fed into lcb_VALBUF for subsequent use
     const lcb_CMDSUBDOC *cmd;
-    std::vector<lcb_IOV> iovs;
-    char *extra_body;
-    size_t bodysz;
 
     // Total size of the payload itself
     size_t payload_size;
@@ -234,53 +225,35 @@ struct MultiBuilder {
         }
     }
 
-    template <typename T> void add_field(T itm, size_t len) {
-        const char *b = reinterpret_cast<const char *>(&itm);
-        memcpy(extra_body + bodysz, b, len);
-        bodysz += len;
+    template <typename T> static char *write_field(char *p, T itm) {
+        memcpy(p, &itm, sizeof itm);
+        return p + sizeof itm;
     }
 
-    const char *extra_mark() const {
-        return extra_body + bodysz;
-    }
-
-    void add_extras_iov(const char *last_begin) {
-        const char *p_end = extra_mark();
-        add_iov(last_begin, p_end - last_begin);
-    }
-
-    void add_iov(const void *b, size_t n) {
-        if (!n) {
-            return;
+    static char *write_bytes(char *p, const void *b, size_t n) {
+        if (n) {
+            memcpy(p, b, n);
         }
-
-        lcb_IOV iov;
-        iov.iov_base = const_cast<void*>(b);
-        iov.iov_len = n;
-        iovs.push_back(iov);
-        payload_size += n;
+        return p + n;
     }
 
-    void add_iov(const lcb_VALBUF& vb) {
+    static char *write_value(char *p, const lcb_VALBUF& vb) {
         if (vb.vtype == LCB_KV_CONTIG || vb.vtype == LCB_KV_COPY) {
-            add_iov(vb.u_buf.contig.bytes, vb.u_buf.contig.nbytes);
-        } else {
-            for (size_t ii = 0; ii < vb.u_buf.contig.nbytes; ++ii) {
-                const lcb_IOV& iov = vb.u_buf.multi.iov[ii];
-                if (!iov.iov_len) {
-                    continue; // Skip it
-                }
-                payload_size += iov.iov_len;
-                iovs.push_back(iov);
-            }
+            return write_bytes(p, vb.u_buf.contig.bytes, vb.u_buf.contig.nbytes);
+        }
+        for (size_t ii = 0; ii < vb.u_buf.multi.niov; ++ii) {
+            const lcb_IOV& iov = vb.u_buf.multi.iov[ii];
+            p = write_bytes(p, iov.iov_base, iov.iov_len);
         }
+        return p;
     }
 
-    inline lcb_error_t add_spec(const lcb_SDSPEC *);
+    inline lcb_error_t measure_spec(const lcb_SDSPEC *);
+    inline char *write_spec(char *p, const lcb_SDSPEC *) const;
 };
 
 lcb_error_t
-MultiBuilder::add_spec(const lcb_SDSPEC *spec)
+MultiEncoder::measure_spec(const lcb_SDSPEC *spec)
 {
     const SubdocCmdTraits::Traits& trait = SubdocCmdTraits::find(spec->sdcmd);
     if (!trait.valid()) {
@@ -292,36 +265,41 @@ MultiBuilder::add_spec(const lcb_SDSPEC *spec)
         return LCB_OPTIONS_CONFLICT;
     }
 
-    const char *p_begin = extra_mark();
-    // opcode
-    add_field(trait.opcode, 1);
-    // flags
-    add_field(make_subdoc_flags(spec->options), 1);
-
-    uint16_t npath = static_cast<uint16_t>(spec->path.contig.nbytes);
-    if (!npath && !trait.chk_allow_empty_path(spec->options)) {
+    if (!spec->path.contig.nbytes && !trait.chk_allow_empty_path(spec->options)) {
         return LCB_EMPTY_PATH;
     }
 
-    // Path length
-    add_field(static_cast<uint16_t>(htons(npath)), 2);
+    // opcode, flags and path length
+    payload_size += 4;
+    if (is_mutate()) {
+        // Mutation needs an additional 'value' length, and the value itself
+        payload_size += 4 + get_valbuf_size(spec->value);
+    }
+    payload_size += static_cast<uint16_t>(spec->path.contig.nbytes);
+    return LCB_SUCCESS;
+}
+
+char *
+MultiEncoder::write_spec(char *p, const lcb_SDSPEC *spec) const
+{
+    const SubdocCmdTraits::Traits& trait = SubdocCmdTraits::find(spec->sdcmd);
+    uint16_t npath = static_cast<uint16_t>(spec->path.contig.nbytes);
+
+    p = write_field(p, trait.opcode);
+    p = write_field(p, make_subdoc_flags(spec->options));
+    p = write_field(p, static_cast<uint16_t>(htons(npath)));
 
     uint32_t vsize = 0;
     if (is_mutate()) {
-        // Mutation needs an additional 'value' spec.
         vsize = get_valbuf_size(spec->value);
-        add_field(static_cast<uint32_t>(htonl(vsize)), 4);
+        p = write_field(p, static_cast<uint32_t>(htonl(vsize)));
     }
 
-    // Finalize the header..
-    add_extras_iov(p_begin);
-
-    // Add the actual path
-    add_iov(spec->path.contig.bytes, spec->path.contig.nbytes);
+    p = write_bytes(p, spec->path.contig.bytes, npath);
     if (vsize) {
-        add_iov(spec->value);
+        p = write_value(p, spec->value);
     }
-    return LCB_SUCCESS;
+    return p;
 }
 
 
@@ -432,6 +410,9 @@ sd3_single(lcb_t instance, const void *cookie, const lcb_CMDSUBDOC *cmd)
         memcpy(SPAN_BUFFER(&packet->kh_span) + sizeof request.bytes, &exptime, 4);
     }
 
+    if (!traits.is_lookup && instance->getcoalescer) {
+        instance->getcoalescer->invalidate(packet);
+    }
     LCB_SCHED_ADD(instance, pipeline, packet);
     return LCB_SUCCESS;
 }
@@ -452,34 +433,30 @@ lcb_subdoc3(lcb_t instance, const void *cookie, const lcb_CMDSUBDOC *cmd)
     uint32_t exp = cmd->exptime;
     lcb_error_t rc = LCB_SUCCESS;
 
-    MultiBuilder ctx(cmd);
-    if (cmd->error_index) {
-        *cmd->error_index = -1;
-    }
-
-    if (exp && !ctx.is_mutate()) {
-        return LCB_OPTIONS_CONFLICT;
-    }
-
+    MultiEncoder ctx(cmd);
     for (size_t ii = 0; ii < cmd->nspecs; ++ii) {
         if (cmd->error_index) {
             *cmd->error_index = ii;
         }
-        rc = ctx.add_spec(cmd->specs + ii);
+        rc = ctx.measure_spec(cmd->specs + ii);
         if (rc != LCB_SUCCESS) {
             return rc;
         }
     }
 
+    if (cmd->error_index) {
+        *cmd->error_index = -1;
+    }
+
+    if (exp && !ctx.is_mutate()) {
+        return LCB_OPTIONS_CONFLICT;
+    }
+
     mc_PIPELINE *pl;
     mc_PACKET *pkt;
     uint8_t extlen = exp ? 4 : 0;
     protocol_binary_request_header hdr;
 
-    if (cmd->error_index) {
-        *cmd->error_index = -1;
-    }
-
     rc = mcreq_basic_packet(
         &instance->cmdq, reinterpret_cast<const lcb_CMDBASE*>(cmd),
         &hdr, extlen, &pkt, &pl, MCREQ_BASICPACKET_F_FALLBACKOK);
@@ -488,18 +465,19 @@ lcb_subdoc3(lcb_t instance, const void *cookie, const lcb_CMDSUBDOC *cmd)
         return rc;
     }
 
-    lcb_VALBUF vb = { LCB_KV_IOVCOPY };
-    vb.u_buf.multi.iov = &ctx.iovs[0];
-    vb.u_buf.multi.niov = ctx.iovs.size();
-    vb.u_buf.multi.total_length = ctx.payload_size;
-    rc = mcreq_reserve_value(pl, pkt, &vb);
-
+    rc = mcreq_reserve_value2(pl, pkt, ctx.payload_size);
     if (rc != LCB_SUCCESS) {
         mcreq_wipe_packet(pl, pkt);
         mcreq_release_packet(pl, pkt);
         return rc;
     }
 
+    char *body = SPAN_BUFFER(&pkt->u_value.single);
+    for (size_t ii = 0; ii < cmd->nspecs; ++ii) {
+        body = ctx.write_spec(body, cmd->specs + ii);
+    }
+    lcb_assert(body == SPAN_BUFFER(&pkt->u_value.single) + ctx.payload_size);
+
     // Set the header fields.
     hdr.request.magic = PROTOCOL_BINARY_REQ;
     if (ctx.is_lookup()) {
@@ -519,6 +497,9 @@ lcb_subdoc3(lcb_t instance, const void *cookie, const lcb_CMDSUBDOC *cmd)
         memcpy(SPAN_BUFFER(&pkt->kh_span) + 24, &exp, 4);
     }
 
+    if (!ctx.is_lookup() && instance->getcoalescer) {
+        instance->getcoalescer->invalidate(pkt);
+    }
     MCREQ_PKT_RDATA(pkt)->cookie = cookie;
     MCREQ_PKT_RDATA(pkt)->start = gethrtime();
     LCB_SCHED_ADD(instance, pl, pkt);
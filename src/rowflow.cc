@@ -0,0 +1,165 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "http/http.h"
+#include "rowflow.h"
+#include <algorithm>
+
+using namespace lcb;
+
+RowFlow::RowFlow(lcb_t instance_, lcb_http_request_t *htreq_, Sink *sink_)
+    : instance(instance_), htreq(htreq_), sink(sink_), nbytes(0),
+      paused(false), reading_paused(false), final_held(false),
+      has_final_resp(false), loop_referenced(false),
+      timer(instance_->iotable, this)
+{
+    memset(&final_resp, 0, sizeof final_resp);
+}
+
+RowFlow::~RowFlow()
+{
+    if (loop_referenced) {
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    }
+}
+
+void
+RowFlow::row(const char *row, size_t nrow)
+{
+    if (!holding()) {
+        sink->flow_row(row, nrow, false);
+        return;
+    }
+    pending.push_back(std::string(row, nrow));
+    nbytes += nrow;
+    update_reading();
+    update_loop_ref();
+}
+
+bool
+RowFlow::hold_final(const lcb_RESPHTTP *resp)
+{
+    if (!holding()) {
+        return false;
+    }
+    final_held = true;
+    if (resp) {
+        final_resp = *resp;
+        final_resp.cookie = NULL;
+        final_resp.headers = NULL;
+        final_resp.body = NULL;
+        final_resp.nbody = 0;
+        final_resp._htreq = NULL;
+        has_final_resp = true;
+    }
+    update_loop_ref();
+    return true;
+}
+
+void
+RowFlow::pause()
+{
+    paused = true;
+    update_reading();
+}
+
+void
+RowFlow::resume()
+{
+    if (!paused) {
+        return;
+    }
+    paused = false;
+    if (!pending.empty() || final_held) {
+        /* Don't invoke the callback from within the caller */
+        timer.signal();
+    }
+    update_reading();
+}
+
+void
+RowFlow::cancel()
+{
+    pending.clear();
+    nbytes = 0;
+    paused = false;
+    if (final_held) {
+        timer.signal();
+    }
+    update_reading();
+    update_loop_ref();
+}
+
+void
+RowFlow::deliver()
+{
+    while (!paused && !pending.empty()) {
+        std::string cur;
+        cur.swap(pending.front());
+        pending.pop_front();
+        nbytes -= cur.size();
+        sink->flow_row(cur.c_str(), cur.size(), true);
+    }
+
+    update_reading();
+    if (final_held && !holding()) {
+        final_held = false;
+        update_loop_ref();
+        sink->flow_done();
+        return;
+    }
+    update_loop_ref();
+}
+
+void
+RowFlow::update_reading()
+{
+    lcb_U32 highwat = LCBT_SETTING(instance, rowbuf_highwat);
+    lcb_U32 lowwat = std::min(highwat, LCBT_SETTING(instance, rowbuf_lowwat));
+
+    /* Keep reading until the buffered rows reach the high watermark. Once
+     * stopped, wait for them to drain to the low watermark */
+    bool stop = holding() &&
+            (nbytes >= highwat || (reading_paused && nbytes > lowwat));
+    reading_paused = stop;
+    if (*htreq == NULL) {
+        return;
+    }
+    /* These are no-ops if the request is already in the desired state */
+    if (stop) {
+        (*htreq)->pause();
+    } else {
+        (*htreq)->resume();
+    }
+}
+
+void
+RowFlow::update_loop_ref()
+{
+    /* Keep lcb_wait() running until the rows and the final response have
+     * been delivered */
+    bool want = !pending.empty() || final_held;
+    if (want && !loop_referenced) {
+        lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        loop_referenced = true;
+    } else if (!want && loop_referenced) {
+        loop_referenced = false;
+        lcb_aspend_del(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        lcb_maybe_breakout(instance);
+    }
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_ROWFLOW_H
+#define LCB_ROWFLOW_H
+
+#include <lcbio/timer-cxx.h>
+#include <deque>
+#include <string>
+
+/**
+ * @file
+ * @brief Flow control for streamed query rows
+ *
+ * @details
+ * N1QL and FTS rows are normally passed to the application as soon as they
+ * are parsed. When the application pauses a query, rows which have already
+ * been received are instead buffered, and delivered once it is resumed.
+ *
+ * The HTTP response is read while the buffered rows occupy fewer than
+ * @ref LCB_CNTL_ROWBUF_HIGHWAT bytes. Once reading has stopped, it is only
+ * restarted when they occupy no more than @ref LCB_CNTL_ROWBUF_LOWWAT bytes,
+ * so that the memory used by a paused query stays bounded.
+ */
+
+namespace lcb {
+
+class RowFlow {
+public:
+    /** Receives the rows of a RowFlow */
+    class Sink {
+    public:
+        /**
+         * Deliver a row to the application.
+         * @param buffered true if the row was buffered, in which case the
+         *        current HTTP response is no longer available
+         */
+        virtual void flow_row(const char *row, size_t nrow, bool buffered) = 0;
+
+        /** Complete the query, once its final response was held by
+         * hold_final() and all the rows have been delivered. This may delete
+         * the RowFlow */
+        virtual void flow_done() = 0;
+
+        virtual ~Sink() {}
+    };
+
+    /**
+     * @param instance the instance
+     * @param htreq the location of the query's current HTTP request, which is
+     *        paused and resumed as needed. The request may change (or become
+     *        NULL) during the lifetime of the query.
+     * @param sink the receiver of the rows
+     */
+    RowFlow(lcb_t instance, lcb_http_request_t *htreq, Sink *sink);
+    ~RowFlow();
+
+    /** Pass a parsed row to the application, or buffer it if paused */
+    void row(const char *row, size_t nrow);
+
+    /**
+     * Called when the final HTTP response has been received.
+     * @param resp the final response, if any. If held, its status (but not
+     *        its headers or body, which don't outlive the response) is kept
+     *        for final_response()
+     * @return true if rows are still to be delivered (or the query is
+     * paused), in which case Sink::flow_done() will be called later on
+     * instead
+     */
+    bool hold_final(const lcb_RESPHTTP *resp = NULL);
+
+    /** The status of the response held by hold_final(), or NULL */
+    const lcb_RESPHTTP *final_response() const {
+        return final_held && has_final_resp ? &final_resp : NULL;
+    }
+
+    void pause();
+    void resume();
+
+    /** Whether the HTTP response is currently being read */
+    bool reading() const { return !reading_paused; }
+
+    /** Drop any buffered rows, and read the rest of the response (so that
+     * the query can complete) */
+    void cancel();
+
+private:
+    bool holding() const {
+        return paused || !pending.empty();
+    }
+    void deliver();
+    void update_reading();
+    void update_loop_ref();
+
+    lcb_t instance;
+    lcb_http_request_t *htreq;
+    Sink *sink;
+    std::deque<std::string> pending;
+    size_t nbytes; /**< Size of the rows in pending */
+    bool paused;
+    bool reading_paused;
+    bool final_held;
+    bool has_final_resp;
+    lcb_RESPHTTP final_resp;
+    bool loop_referenced;
+    lcb::io::Timer<RowFlow, &RowFlow::deliver> timer;
+};
+}
+
+#endif
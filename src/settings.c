@@ -57,6 +57,23 @@ void lcb_default_settings(lcb_settings *settings)
     settings->tcp_nodelay = LCB_DEFAULT_TCP_NODELAY;
     settings->retry_nmv_interval = LCB_DEFAULT_RETRY_NMV_INTERVAL;
     settings->vb_noguess = LCB_DEFAULT_VB_NOGUESS;
+    settings->connect_race_delay = LCB_DEFAULT_CONNECT_RACE_DELAY;
+    settings->bootstrap_race = LCB_DEFAULT_BOOTSTRAP_RACE;
+    settings->slowop_threshold = LCB_DEFAULT_SLOWOP_THRESHOLD;
+    settings->slowop_interval = LCB_DEFAULT_SLOWOP_INTERVAL;
+    settings->dur_adaptive = LCB_DEFAULT_DURABILITY_ADAPTIVE;
+    settings->hedge_percentile = LCB_DEFAULT_HEDGE_PERCENTILE;
+    settings->hedge_budget = LCB_DEFAULT_HEDGE_BUDGET;
+    settings->get_coalesce = LCB_DEFAULT_GET_COALESCE;
+    settings->nearcache_size = LCB_DEFAULT_NEARCACHE_SIZE;
+    settings->nearcache_ttl = LCB_DEFAULT_NEARCACHE_TTL;
+    settings->nearcache_revalidate = LCB_DEFAULT_NEARCACHE_REVALIDATE;
+    settings->counter_window = LCB_DEFAULT_COUNTER_WINDOW;
+    settings->counter_window_ops = LCB_DEFAULT_COUNTER_WINDOW_OPS;
+    settings->rowbuf_highwat = LCB_DEFAULT_ROWBUF_HIGHWAT;
+    settings->rowbuf_lowwat = LCB_DEFAULT_ROWBUF_LOWWAT;
+    settings->http_maxconcurrent = LCB_DEFAULT_HTTP_MAXCONCURRENT;
+    settings->n1ql_autoprepare = LCB_DEFAULT_N1QL_AUTOPREPARE;
 }
 
 LCB_INTERNAL_API
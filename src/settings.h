@@ -85,6 +85,49 @@
 #define LCB_DEFAULT_VB_NOGUESS 1
 #define LCB_DEFAULT_TCP_NODELAY 1
 
+/* 250ms, as recommended by RFC 8305 */
+#define LCB_DEFAULT_CONNECT_RACE_DELAY LCB_MS2US(250)
+
+/* Query a single node at a time */
+#define LCB_DEFAULT_BOOTSTRAP_RACE 1
+
+/* Slow operation tracing is disabled by default */
+#define LCB_DEFAULT_SLOWOP_THRESHOLD 0
+
+/* 10 seconds */
+#define LCB_DEFAULT_SLOWOP_INTERVAL LCB_MS2US(10000)
+
+/* Poll durability at a fixed interval */
+#define LCB_DEFAULT_DURABILITY_ADAPTIVE 0
+
+/* Hedge reads slower than 95% of recent responses.. */
+#define LCB_DEFAULT_HEDGE_PERCENTILE 95
+
+/* ..adding at most 5% of extra reads */
+#define LCB_DEFAULT_HEDGE_BUDGET 5
+
+/* Don't share packets between identical GETs by default */
+#define LCB_DEFAULT_GET_COALESCE 0
+
+/* The near cache is disabled by default */
+#define LCB_DEFAULT_NEARCACHE_SIZE 0
+#define LCB_DEFAULT_NEARCACHE_TTL LCB_MS2US(500)
+#define LCB_DEFAULT_NEARCACHE_REVALIDATE 0
+
+/* Counter operations are not aggregated by default */
+#define LCB_DEFAULT_COUNTER_WINDOW 0
+#define LCB_DEFAULT_COUNTER_WINDOW_OPS 0
+
+/* Stop reading as soon as a query is paused */
+#define LCB_DEFAULT_ROWBUF_HIGHWAT 0
+#define LCB_DEFAULT_ROWBUF_LOWWAT 0
+
+/* Service requests are not limited per node */
+#define LCB_DEFAULT_HTTP_MAXCONCURRENT 0
+
+/* Ad-hoc statements are only prepared on request */
+#define LCB_DEFAULT_N1QL_AUTOPREPARE 0
+
 #include "config.h"
 #include <libcouchbase/couchbase.h>
 
@@ -148,6 +191,9 @@ typedef struct lcb_settings_st {
     unsigned ipv6 : 2;
     unsigned tcp_nodelay : 1;
     unsigned readj_ts_wait : 1;
+    unsigned dur_adaptive : 1;
+    unsigned get_coalesce : 1;
+    unsigned nearcache_revalidate : 1;
 
     short max_redir;
     unsigned refcount;
@@ -166,6 +212,36 @@ typedef struct lcb_settings_st {
     void *dtorarg;
     char *client_string;
     lcb_U32 retry_nmv_interval;
+
+    /** Delay before racing the next resolved address. 0 connects serially */
+    lcb_U32 connect_race_delay;
+
+    /** Number of nodes to request the initial configuration from at once */
+    lcb_U32 bootstrap_race;
+
+    /** KV operations taking longer than this are reported. 0 disables */
+    lcb_U32 slowop_threshold;
+
+    /** How often slow operations are reported */
+    lcb_U32 slowop_interval;
+    lcb_U32 hedge_percentile;
+    lcb_U32 hedge_budget;
+    lcb_U32 nearcache_size;
+    lcb_U32 nearcache_ttl;
+    lcb_U32 counter_window;
+    lcb_U32 counter_window_ops;
+
+    /** Bytes of rows buffered by a paused query before reading stops.. */
+    lcb_U32 rowbuf_highwat;
+
+    /** ..and before it is restarted */
+    lcb_U32 rowbuf_lowwat;
+
+    /** Data API requests in progress per node. 0 for no limit */
+    lcb_U32 http_maxconcurrent;
+
+    /** Times an ad-hoc statement is seen before it is prepared. 0 to disable */
+    lcb_U32 n1ql_autoprepare;
 } lcb_settings;
 
 LCB_INTERNAL_API
@@ -0,0 +1,112 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "internal.h"
+#include "packetutils.h"
+#include "slowops.h"
+#include <algorithm>
+
+#define LOGARGS(instance, lvl) (instance)->settings, "slowops", LCB_LOG_##lvl, __FILE__, __LINE__
+
+using namespace lcb;
+
+SlowOps::SlowOps(lcb_t instance_)
+    : instance(instance_), nslow(0), timer(instance_->iotable, this)
+{
+}
+
+SlowOps::~SlowOps()
+{
+    report();
+}
+
+void
+SlowOps::record(const Server *server, mc_PACKET *pkt,
+                const MemcachedResponse *res, lcb_error_t immerr)
+{
+    mc_PKTTRACE *trace = pkt->trace;
+    trace->dispatch = gethrtime();
+
+    if (trace->dispatch - trace->sched <
+            LCB_US2NS(LCBT_SETTING(instance, slowop_threshold))) {
+        return;
+    }
+
+    Entry ent;
+    ent.trace = *trace;
+    ent.opaque = pkt->opaque;
+    ent.opcode = res->opcode();
+    ent.status = res->status();
+    ent.immerr = immerr;
+    if (server->state != Server::S_TEMPORARY && server->curhost) {
+        ent.node.append(server->curhost->host).append(":").append(server->curhost->port);
+    } else {
+        ent.node = "<none>";
+    }
+
+    nslow++;
+    if (entries.size() < MAX_ENTRIES) {
+        entries.push_back(ent);
+        std::push_heap(entries.begin(), entries.end());
+    } else if (entries.front().total() < ent.total()) {
+        std::pop_heap(entries.begin(), entries.end());
+        entries.back() = ent;
+        std::push_heap(entries.begin(), entries.end());
+    }
+
+    timer.arm_if_disarmed(LCBT_SETTING(instance, slowop_interval));
+}
+
+static std::string
+phase_time(hrtime_t begin, hrtime_t end)
+{
+    if (!begin || !end || end < begin) {
+        return "-";
+    }
+    char buf[32];
+    sprintf(buf, "%uus", (unsigned)LCB_NS2US(end - begin));
+    return buf;
+}
+
+void
+SlowOps::report()
+{
+    if (!nslow) {
+        return;
+    }
+
+    std::sort_heap(entries.begin(), entries.end());
+    lcb_log(LOGARGS(instance, WARN), "%u operation(s) took longer than %uus. Slowest %u:",
+        (unsigned)nslow, LCBT_SETTING(instance, slowop_threshold),
+        (unsigned)entries.size());
+
+    for (size_t ii = 0; ii < entries.size(); ++ii) {
+        const Entry& ent = entries[ii];
+        const mc_PKTTRACE& t = ent.trace;
+        lcb_log(LOGARGS(instance, WARN), "  OP=0x%02x, SEQ=%u, NODE=%s, STATUS=0x%x, ERR=0x%x, TOTAL=%uus [queued=%s, pending=%s, write=%s, server=%s, dispatch=%s]",
+            ent.opcode, ent.opaque, ent.node.c_str(), ent.status, ent.immerr,
+            (unsigned)LCB_NS2US(ent.total()),
+            phase_time(t.sched, t.enqueue).c_str(),
+            phase_time(t.enqueue, t.flush_start).c_str(),
+            phase_time(t.flush_start, t.flush_done).c_str(),
+            phase_time(t.flush_done, t.read).c_str(),
+            phase_time(t.read, t.dispatch).c_str());
+    }
+
+    entries.clear();
+    nslow = 0;
+}
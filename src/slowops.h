@@ -0,0 +1,85 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef LCB_SLOWOPS_H
+#define LCB_SLOWOPS_H
+
+#include <lcbio/timer-cxx.h>
+#include <mc/mcreq.h>
+#include <vector>
+#include <string>
+
+/**
+ * @file
+ * @brief Slow operation reporting
+ *
+ * @details
+ * When @ref LCB_CNTL_SLOWOP_THRESHOLD is set, each memcached packet records
+ * the time at which it passed through each phase of its lifetime (see
+ * mc_PKTTRACE). Operations whose total time exceeds the threshold are
+ * collected here and periodically logged with a breakdown of where the time
+ * was spent.
+ */
+
+namespace lcb {
+class Server;
+class MemcachedResponse;
+
+class SlowOps {
+public:
+    SlowOps(lcb_t instance);
+    ~SlowOps();
+
+    /**
+     * Called when a response (or error) is about to be dispatched for a
+     * traced packet.
+     * @param server the server the packet was sent to
+     * @param pkt the request packet. Its `trace` field must not be NULL
+     * @param res the response
+     * @param immerr the immediate (client side) error, if any
+     */
+    void record(const Server *server, mc_PACKET *pkt,
+                const MemcachedResponse *res, lcb_error_t immerr);
+
+    /** Log and clear the operations collected so far */
+    void report();
+
+    /** Maximum number of operations to describe in each report */
+    static const size_t MAX_ENTRIES = 10;
+
+private:
+    struct Entry {
+        mc_PKTTRACE trace;
+        std::string node;
+        lcb_U32 opaque;
+        lcb_U8 opcode;
+        lcb_U16 status;
+        lcb_error_t immerr;
+        hrtime_t total() const { return trace.dispatch - trace.sched; }
+        bool operator<(const Entry& other) const {
+            return total() > other.total();
+        }
+    };
+
+    lcb_t instance;
+    std::vector<Entry> entries; /**< Slowest operations, kept as a heap */
+    size_t nslow; /**< Operations over the threshold since the last report */
+    lcb::io::Timer<SlowOps, &SlowOps::report> timer;
+};
+
+} // namespace lcb
+#endif
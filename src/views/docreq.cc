@@ -1,6 +1,7 @@
 #include "docreq.h"
 #include "internal.h"
 #include "sllist-inl.h"
+#include <algorithm>
 
 using namespace lcb::docreq;
 
@@ -8,9 +9,8 @@ static void docreq_handler(void *arg);
 static void invoke_pending(Queue*);
 static void doc_callback(lcb_t,int, const lcb_RESPBASE *);
 
-#define MAX_PENDING_DOCREQ 10
-#define MIN_SCHED_SIZE 5
-#define DOCQ_DELAY_US 200000
+#define MAX_PENDING_DOCREQ 256
+#define MIN_SCHED_SIZE 16
 
 Queue::Queue(lcb_t instance_)
     : instance(instance_),
@@ -19,9 +19,13 @@ Queue::Queue(lcb_t instance_)
       cb_ready(NULL), cb_throttle(NULL),
       n_awaiting_schedule(0),
       n_awaiting_response(0),
+      n_undelivered(0),
       max_pending_response(MAX_PENDING_DOCREQ),
       min_batch_size(MIN_SCHED_SIZE),
+      window(MIN_SCHED_SIZE),
+      row_interval(0), latency(0), last_add(0),
       cancelled(false),
+      throttled(false),
       refcount(1)
       {
 
@@ -44,26 +48,62 @@ void Queue::cancel() {
     cancelled = true;
 }
 
-/* Calling this function ensures that the request will be scheduled in due
- * time. This may be done at the next event loop iteration, or after a delay
- * depending on how many items are actually found within the queue. */
+/* Moves `avg` 1/8 of the way towards `sample` */
+void
+Queue::update_average(hrtime_t& avg, hrtime_t sample)
+{
+    if (!avg) {
+        avg = sample ? sample : 1;
+    } else {
+        avg = avg - avg / 8 + sample / 8;
+    }
+}
+
+/* Recalculates the window from the measured latency and row rate. Enough
+ * requests should be in progress to cover the rows which arrive while one
+ * request is waiting for its response. */
+void
+Queue::update_window()
+{
+    unsigned lo = std::min(min_batch_size, max_pending_response);
+    if (!latency || !row_interval) {
+        window = lo;
+        return;
+    }
+
+    hrtime_t want = min_batch_size + 2 * (latency / row_interval);
+    window = std::max(lo, unsigned(std::min(want,
+        hrtime_t(max_pending_response))));
+}
+
+/* Calling this function ensures that pending requests will be scheduled at
+ * the next event loop iteration (so that all rows from the current chunk are
+ * sent as a single batch), if the window allows. It also throttles the rows
+ * if too many are waiting. */
 static void
 docq_poke(Queue *q)
 {
-    if (q->n_awaiting_response < q->max_pending_response) {
-        if (q->n_awaiting_schedule > q->min_batch_size) {
-            lcbio_async_signal(q->timer);
-            q->cb_throttle(q, 0);
-        }
+    if (q->n_awaiting_schedule &&
+            (q->n_undelivered < q->window || q->cancelled)) {
+        lcbio_async_signal(q->timer);
     }
 
-    if (!lcbio_timer_armed(q->timer)) {
-        lcbio_timer_rearm(q->timer, DOCQ_DELAY_US);
+    unsigned throttle = q->n_awaiting_schedule >= q->window && !q->cancelled;
+    if (throttle != q->throttled) {
+        q->throttled = throttle;
+        q->cb_throttle(q, throttle);
     }
 }
 
 void Queue::add(DocRequest *req)
 {
+    hrtime_t now = gethrtime();
+    if (last_add) {
+        update_average(row_interval, now - last_add);
+        update_window();
+    }
+    last_add = now;
+
     sllist_append(&pending_gets, &req->slnode);
     n_awaiting_schedule++;
     req->parent = this;
@@ -79,17 +119,20 @@ docreq_handler(void *arg)
     sllist_iterator iter;
     lcb_t instance = q->instance;
 
+    /* All the requests are issued within a single scheduling context, so that
+     * each server's pipeline is flushed once with all of its requests */
+    q->ref();
     lcb_sched_enter(instance);
     SLLIST_ITERFOR(&q->pending_gets, &iter) {
         DocRequest *cont = SLLIST_ITEM(iter.cur, DocRequest, slnode);
 
-        if (q->n_awaiting_response > q->max_pending_response) {
-            lcbio_timer_rearm(q->timer, DOCQ_DELAY_US);
-            q->cb_throttle(q, 1);
+        if (q->n_undelivered >= q->window && !q->cancelled) {
+            /* Called again when a response is delivered */
             break;
         }
 
         q->n_awaiting_schedule--;
+        q->n_undelivered++;
 
         if (q->cancelled) {
             cont->docresp.rc = LCB_EINTERNAL;
@@ -102,6 +145,7 @@ docreq_handler(void *arg)
             LCB_CMD_SET_KEY(&gcmd, cont->docid.iov_base, cont->docid.iov_len);
             cont->callback = doc_callback;
             gcmd.cmdflags |= LCB_CMD_F_INTERNAL_CALLBACK;
+            cont->start = gethrtime();
             rc = lcb_get3(instance, &cont->callback, &gcmd);
 
             if (rc != LCB_SUCCESS) {
@@ -118,15 +162,12 @@ docreq_handler(void *arg)
     lcb_sched_leave(instance);
     lcb_sched_flush(instance);
 
-    if (q->n_awaiting_schedule < q->min_batch_size) {
-        q->cb_throttle(q, 0);
-    }
+    /* Flush out any bad responses */
+    invoke_pending(q);
 
     /* Ensure we're called again */
     docq_poke(q);
-
-    /* Flush out any bad responses */
-    invoke_pending(q);
+    q->unref();
 }
 
 /* Invokes the callback on all requests which are ready, until a request which
@@ -149,6 +190,7 @@ invoke_pending(Queue *q)
         }
 
         sllist_iter_remove(&q->cb_queue, &iter);
+        q->n_undelivered--;
 
         q->cb_ready(q, dreq);
         if (bufh) {
@@ -169,6 +211,8 @@ doc_callback(lcb_t, int, const lcb_RESPBASE *rb)
     q->ref();
 
     q->n_awaiting_response--;
+    Queue::update_average(q->latency, gethrtime() - dreq->start);
+    q->update_window();
     dreq->docresp = *rg;
     dreq->ready = 1;
     dreq->docresp.key = dreq->docid.iov_base;
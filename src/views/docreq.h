@@ -27,6 +27,12 @@ struct Queue {
         return n_awaiting_response || n_awaiting_schedule;
     }
 
+    /**Recalculates #window from #latency and #row_interval */
+    void update_window();
+
+    /**Moves a moving average 1/8 of the way towards a new sample */
+    static void update_average(hrtime_t& avg, hrtime_t sample);
+
     lcb_t instance;
     void *parent;
     lcbio_pTIMER timer;
@@ -54,9 +60,29 @@ struct Queue {
     unsigned n_awaiting_schedule;
     unsigned n_awaiting_response;
 
+    /**Requests which were issued but not yet passed to cb_ready. These
+     * (including those which have already arrived but are waiting for an
+     * earlier one) are limited by #window */
+    unsigned n_undelivered;
+
+    /**Upper and lower bounds for #window */
     unsigned max_pending_response;
     unsigned min_batch_size;
+
+    /**Current limit on #n_undelivered. This is adjusted so that enough
+     * requests are in progress to cover the time it takes for a response to
+     * arrive, given the rate at which rows arrive. Rows are throttled once
+     * this many are waiting to be scheduled */
+    unsigned window;
+
+    /**Moving averages (in nanoseconds) of the time between rows, and of the
+     * time taken for a document to arrive */
+    hrtime_t row_interval;
+    hrtime_t latency;
+    hrtime_t last_add;
+
     unsigned cancelled;
+    unsigned throttled;
     unsigned refcount;
 };
 
@@ -69,6 +95,7 @@ struct DocRequest {
     /* To be filled in by the subclass */
     lcb_IOV docid;
     unsigned ready;
+    hrtime_t start;
 };
 
 
@@ -48,6 +48,9 @@ TEST_F(CtlTest, testStringCtls)
             {"error_thresh_delay", LCB_CNTL_CONFDELAY_THRESH},
             {"config_total_timeout", LCB_CNTL_CONFIGURATION_TIMEOUT},
             {"config_node_timeout", LCB_CNTL_CONFIG_NODE_TIMEOUT},
+            {"connect_race_delay", LCB_CNTL_CONNECT_RACE_DELAY},
+            {"slowop_threshold", LCB_CNTL_SLOWOP_THRESHOLD},
+            {"slowop_interval", LCB_CNTL_SLOWOP_INTERVAL},
             {NULL,0}
     };
 
@@ -57,6 +60,20 @@ TEST_F(CtlTest, testStringCtls)
         ASSERT_EQ(50000000, lcb_cntl_getu32(instance, cur->opval));
     }
 
+    // Plain integers are not scaled
+    err = lcb_cntl_string(instance, "read_chunk_size", "4096");
+    ASSERT_EQ(LCB_SUCCESS, err);
+    ASSERT_EQ(4096, lcb_cntl_getu32(instance, LCB_CNTL_READ_CHUNKSIZE));
+    err = lcb_cntl_string(instance, "read_chunk_size", "big");
+    ASSERT_EQ(LCB_ECTL_BADARG, err);
+
+    err = lcb_cntl_string(instance, "bootstrap_race", "3");
+    ASSERT_EQ(LCB_SUCCESS, err);
+    ASSERT_EQ(3, lcb_cntl_getu32(instance, LCB_CNTL_BOOTSTRAP_RACE));
+    err = lcb_cntl_string(instance, "bootstrap_race", "-1");
+    ASSERT_EQ(LCB_ECTL_BADARG, err);
+    ASSERT_EQ(3, lcb_cntl_getu32(instance, LCB_CNTL_BOOTSTRAP_RACE));
+
     // try with a boolean
     err = lcb_cntl_string(instance, "randomize_nodes", "false");
     ASSERT_EQ(LCB_SUCCESS, err);
@@ -0,0 +1,177 @@
+#include "config.h"
+#include <gtest/gtest.h>
+#include <libcouchbase/couchbase.h>
+#include "internal.h"
+#include "views/docreq.h"
+#include <vector>
+
+using lcb::docreq::Queue;
+using lcb::docreq::DocRequest;
+
+class DocreqTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+    }
+    void TearDown() {
+        lcb_destroy(instance);
+    }
+    lcb_t instance;
+};
+
+TEST_F(DocreqTest, testAverage)
+{
+    // The first sample is taken as is (but is never 0)
+    hrtime_t avg = 0;
+    Queue::update_average(avg, 800);
+    ASSERT_EQ(800, avg);
+    avg = 0;
+    Queue::update_average(avg, 0);
+    ASSERT_EQ(1, avg);
+
+    // Later ones move it 1/8 of the way
+    avg = 800;
+    Queue::update_average(avg, 1600);
+    ASSERT_EQ(900, avg);
+    Queue::update_average(avg, 100);
+    ASSERT_EQ(900 - 112 + 12, avg);
+}
+
+TEST_F(DocreqTest, testWindow)
+{
+    Queue *q = new Queue(instance);
+    ASSERT_EQ(256, q->max_pending_response);
+    ASSERT_EQ(16, q->min_batch_size);
+
+    // Nothing measured yet
+    q->update_window();
+    ASSERT_EQ(16, q->window);
+    q->row_interval = 1000;
+    q->update_window();
+    ASSERT_EQ(16, q->window);
+
+    // Enough to cover twice the rows arriving during one round trip
+    q->latency = 100000;
+    q->update_window();
+    ASSERT_EQ(16 + 200, q->window);
+
+    // The window grows with the latency, up to the limit...
+    unsigned last = q->window;
+    for (int ii = 0; ii < 40; ii++) {
+        Queue::update_average(q->latency, 1000000);
+        q->update_window();
+        ASSERT_GE(q->window, last);
+        last = q->window;
+    }
+    ASSERT_EQ(256, q->window);
+
+    // ...and shrinks with it, down to the batch size
+    for (int ii = 0; ii < 80; ii++) {
+        Queue::update_average(q->latency, 100);
+        q->update_window();
+        ASSERT_LE(q->window, last);
+        last = q->window;
+    }
+    ASSERT_EQ(16, q->window);
+
+    // Faster rows need a larger window for the same latency
+    q->latency = 100000;
+    q->row_interval = 10000;
+    q->update_window();
+    ASSERT_EQ(16 + 20, q->window);
+    q->row_interval = 5000;
+    q->update_window();
+    ASSERT_EQ(16 + 40, q->window);
+
+    // A limit below the batch size (docs_concurrent_max) takes precedence
+    q->max_pending_response = 8;
+    q->update_window();
+    ASSERT_EQ(8, q->window);
+    q->latency = 0;
+    q->update_window();
+    ASSERT_EQ(8, q->window);
+
+    q->unref();
+}
+
+namespace {
+struct ThrottleState {
+    ThrottleState() : nready(0), nexpected(0) {}
+    std::vector<int> throttled;
+    /** Requests still waiting to be scheduled as each one was delivered */
+    std::vector<unsigned> waiting;
+    size_t nready;
+    size_t nexpected;
+};
+}
+
+extern "C" {
+static void docreq_ready(Queue *q, DocRequest *req)
+{
+    ThrottleState *state = reinterpret_cast<ThrottleState*>(q->parent);
+    state->waiting.push_back(q->n_awaiting_schedule);
+    delete req;
+    if (++state->nready == state->nexpected) {
+        lcb_aspend_del(&q->instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+        lcb_maybe_breakout(q->instance);
+    }
+}
+
+static void docreq_throttle(Queue *q, int enabled)
+{
+    ThrottleState *state = reinterpret_cast<ThrottleState*>(q->parent);
+    state->throttled.push_back(enabled);
+}
+}
+
+TEST_F(DocreqTest, testThrottle)
+{
+    ThrottleState state;
+    Queue *q = new Queue(instance);
+    q->parent = &state;
+    q->cb_ready = docreq_ready;
+    q->cb_throttle = docreq_throttle;
+
+    // The instance has no cluster map, so each request fails as it is
+    // scheduled, and is delivered right away. Requests delivered in the
+    // same batch see the same number still waiting.
+    std::vector<DocRequest*> reqs;
+    for (size_t ii = 0; ii < 20; ii++) {
+        DocRequest *req = new DocRequest();
+        req->docid.iov_base = const_cast<char*>("key");
+        req->docid.iov_len = 3;
+        reqs.push_back(req);
+    }
+
+    // Rows are throttled once a full window is waiting to be scheduled
+    ASSERT_EQ(16, q->window);
+    for (size_t ii = 0; ii < 16; ii++) {
+        q->add(reqs[ii]);
+        ASSERT_EQ(ii == 15 ? 1 : 0, state.throttled.size());
+    }
+    ASSERT_EQ(1, state.throttled[0]);
+
+    // Only as many as the window leaves room for are scheduled at a time,
+    // counting those which were issued but not yet delivered
+    q->n_undelivered = 13;
+    for (size_t ii = 16; ii < 20; ii++) {
+        q->add(reqs[ii]);
+    }
+    state.nexpected = 20;
+    lcb_aspend_add(&instance->pendops, LCB_PENDTYPE_COUNTER, NULL);
+    lcb_wait(instance);
+
+    ASSERT_EQ(20, state.nready);
+    ASSERT_EQ(13, q->n_undelivered);
+    ASSERT_EQ(0, q->n_awaiting_schedule);
+    unsigned expected[] = {
+        17, 17, 17, 14, 14, 14, 11, 11, 11, 8, 8, 8, 5, 5, 5, 2, 2, 2, 0, 0 };
+    ASSERT_EQ(std::vector<unsigned>(expected, expected + 20), state.waiting);
+
+    // Throttling was lifted once fewer than a window were waiting
+    ASSERT_EQ(2, state.throttled.size());
+    ASSERT_EQ(0, state.throttled[1]);
+
+    q->n_undelivered = 0;
+    q->unref();
+}
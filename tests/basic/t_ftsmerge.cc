@@ -0,0 +1,188 @@
+#include "config.h"
+#include <gtest/gtest.h>
+#include <libcouchbase/couchbase.h>
+#include "ftsmerge.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using lcb::cbft::HitMerger;
+
+class FtsMergeTest : public ::testing::Test {
+};
+
+static std::string mkhit(const std::string& id, double score) {
+    char buf[128];
+    sprintf(buf, "{\"id\":\"%s\",\"score\":%g}", id.c_str(), score);
+    return buf;
+}
+
+static void add(HitMerger& m, size_t ix, const std::string& row) {
+    ASSERT_TRUE(m.add(ix, row.c_str(), row.size()));
+}
+
+static std::vector<std::string> drain(HitMerger& m) {
+    std::vector<std::string> ret;
+    std::string row;
+    while (m.next(row)) {
+        ret.push_back(row);
+    }
+    return ret;
+}
+
+TEST_F(FtsMergeTest, testOrder) {
+    HitMerger m(2, 0, 10);
+    add(m, 0, mkhit("a", 5));
+    add(m, 0, mkhit("b", 3));
+
+    // Nothing is known until each partition has a hit, or is done
+    ASSERT_TRUE(drain(m).empty());
+
+    add(m, 1, mkhit("c", 4));
+    std::vector<std::string> rows = drain(m);
+    ASSERT_EQ(2, rows.size());
+    ASSERT_EQ(mkhit("a", 5), rows[0]);
+    ASSERT_EQ(mkhit("c", 4), rows[1]);
+
+    // Partition 1 may still have a hit above 3
+    add(m, 1, mkhit("d", 3.5));
+    rows = drain(m);
+    ASSERT_EQ(1, rows.size());
+    ASSERT_EQ(mkhit("d", 3.5), rows[0]);
+
+    m.done(1);
+    rows = drain(m);
+    ASSERT_EQ(1, rows.size());
+    ASSERT_EQ(mkhit("b", 3), rows[0]);
+    ASSERT_FALSE(m.finished());
+    m.done(0);
+    ASSERT_TRUE(m.finished());
+}
+
+TEST_F(FtsMergeTest, testTies) {
+    HitMerger m(3, 0, 10);
+    add(m, 2, mkhit("c", 1));
+    add(m, 1, mkhit("b", 1));
+    add(m, 0, mkhit("a", 1));
+    m.done(0);
+    m.done(1);
+    m.done(2);
+
+    // Equal scores are returned in partition order
+    std::vector<std::string> rows = drain(m);
+    ASSERT_EQ(3, rows.size());
+    ASSERT_EQ(mkhit("a", 1), rows[0]);
+    ASSERT_EQ(mkhit("b", 1), rows[1]);
+    ASSERT_EQ(mkhit("c", 1), rows[2]);
+    ASSERT_TRUE(m.finished());
+}
+
+TEST_F(FtsMergeTest, testPage) {
+    HitMerger m(2, 2, 3);
+    for (int ii = 0; ii < 10; ii++) {
+        add(m, ii % 2, mkhit("x", 50 - ii));
+    }
+    // Each partition contributes at most from+size hits
+    ASSERT_EQ(5 * mkhit("x", 50).size(), m.buffered(0));
+
+    std::vector<std::string> rows = drain(m);
+    ASSERT_EQ(3, rows.size());
+    ASSERT_EQ(mkhit("x", 48), rows[0]);
+    ASSERT_EQ(mkhit("x", 47), rows[1]);
+    ASSERT_EQ(mkhit("x", 46), rows[2]);
+
+    // Nothing further is kept
+    ASSERT_TRUE(m.finished());
+    ASSERT_EQ(0, m.buffered(0));
+    add(m, 1, mkhit("y", 200));
+    ASSERT_TRUE(drain(m).empty());
+}
+
+TEST_F(FtsMergeTest, testPageSkipped) {
+    // Hits skipped while others are still arriving don't lower the number
+    // a partition may contribute
+    HitMerger m(2, 2, 2);
+    std::vector<std::string> rows;
+    add(m, 1, mkhit("b", 1));
+    m.done(1);
+    for (int ii = 10; ii > 6; ii--) {
+        add(m, 0, mkhit("a", ii));
+        std::vector<std::string> cur = drain(m);
+        rows.insert(rows.end(), cur.begin(), cur.end());
+    }
+    m.done(0);
+    std::vector<std::string> cur = drain(m);
+    rows.insert(rows.end(), cur.begin(), cur.end());
+
+    ASSERT_EQ(2, rows.size());
+    ASSERT_EQ(mkhit("a", 8), rows[0]);
+    ASSERT_EQ(mkhit("a", 7), rows[1]);
+    ASSERT_TRUE(m.finished());
+}
+
+TEST_F(FtsMergeTest, testEmptyPartitions) {
+    HitMerger m(3, 0, 10);
+    m.done(0);
+    add(m, 1, mkhit("a", 2));
+    ASSERT_TRUE(drain(m).empty());
+    m.done(2);
+    ASSERT_EQ(1, drain(m).size());
+    m.done(1);
+    ASSERT_TRUE(m.finished());
+}
+
+TEST_F(FtsMergeTest, testBadHit) {
+    HitMerger m(1, 0, 10);
+    std::string bad("[1,2]");
+    ASSERT_FALSE(m.add(0, bad.c_str(), bad.size()));
+    std::string missing("{\"id\":\"a\"}");
+    ASSERT_TRUE(m.add(0, missing.c_str(), missing.size()));
+    m.done(0);
+    ASSERT_EQ(1, drain(m).size());
+}
+
+TEST_F(FtsMergeTest, testRandomized) {
+    // Merging sorted partitions must give the same result as sorting them
+    srand(1);
+    const size_t npart = 7, nhits = 2000;
+    std::vector<std::vector<int> > parts(npart);
+    std::vector<int> all;
+    for (size_t ii = 0; ii < nhits; ii++) {
+        int score = rand() % 500;
+        parts[rand() % npart].push_back(score);
+        all.push_back(score);
+    }
+    for (size_t ii = 0; ii < npart; ii++) {
+        std::sort(parts[ii].rbegin(), parts[ii].rend());
+    }
+    std::sort(all.rbegin(), all.rend());
+
+    const size_t from = 30, size = 1000;
+    HitMerger m(npart, from, size);
+    std::vector<size_t> pos(npart);
+    std::vector<std::string> rows;
+    size_t remaining = nhits;
+
+    // Feed the partitions in a random interleaving
+    while (remaining) {
+        size_t ix = rand() % npart;
+        if (pos[ix] == parts[ix].size()) {
+            continue;
+        }
+        add(m, ix, mkhit("x", parts[ix][pos[ix]++]));
+        if (pos[ix] == parts[ix].size()) {
+            m.done(ix);
+        }
+        remaining--;
+        std::vector<std::string> cur = drain(m);
+        rows.insert(rows.end(), cur.begin(), cur.end());
+    }
+
+    ASSERT_TRUE(m.finished());
+    ASSERT_EQ(size, rows.size());
+    for (size_t ii = 0; ii < size; ii++) {
+        ASSERT_EQ(mkhit("x", all[from + ii]), rows[ii]);
+    }
+}
@@ -63,3 +63,123 @@ TEST_F(Logger, testLogger)
 
     lcb_destroy(instance);
 }
+
+TEST_F(Logger, testAsyncConsole)
+{
+    lcb_t instance;
+    lcb_error_t err;
+    FILE *fp = tmpfile();
+    ASSERT_FALSE(fp == NULL);
+
+    struct lcb_CONSOLELOGGER *conlogger =
+            (struct lcb_CONSOLELOGGER *)lcb_console_logprocs;
+    int oldlevel = conlogger->minlevel;
+    FILE *oldfp = conlogger->fp;
+
+    err = lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &fp);
+    ASSERT_EQ(LCB_SUCCESS, err);
+
+    int enabled = 1;
+    err = lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_ASYNC, &enabled);
+    if (err == LCB_NOT_SUPPORTED) {
+        fprintf(stderr, "Asynchronous console logging not supported. Skipping\n");
+        lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &oldfp);
+        fclose(fp);
+        return;
+    }
+    ASSERT_EQ(LCB_SUCCESS, err);
+    enabled = 0;
+    err = lcb_cntl(NULL, LCB_CNTL_GET, LCB_CNTL_CONLOGGER_ASYNC, &enabled);
+    ASSERT_EQ(LCB_SUCCESS, err);
+    ASSERT_EQ(1, enabled);
+
+    lcb_create(&instance, NULL);
+    conlogger->minlevel = LCB_LOG_TRACE;
+    err = lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_LOGGER, lcb_console_logprocs);
+    ASSERT_EQ(LCB_SUCCESS, err);
+
+    lcb_log(instance->getSettings(), "asynctest", LCB_LOG_INFO, __FILE__, __LINE__,
+        "int=%d uint=%u long=%ld u64=%llu hex=0x%x str=%s sub=%.*s dbl=%.2f pct=%% c=%c pad=[%5s] star=[%*d]",
+        -42, 42U, 123456789L, (unsigned long long)-1, 255, "hello", 3, "abcdef",
+        3.14159, 'z', "ab", 4, 7);
+    lcb_log(instance->getSettings(), "asynctest", LCB_LOG_DEBUG, __FILE__, __LINE__,
+        "null=%s", (const char *)NULL);
+
+    // Disabling should flush all pending messages
+    enabled = 0;
+    err = lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_ASYNC, &enabled);
+    ASSERT_EQ(LCB_SUCCESS, err);
+
+    lcb_U32 dropped = 1;
+    err = lcb_cntl(NULL, LCB_CNTL_GET, LCB_CNTL_CONLOGGER_DROPPED, &dropped);
+    ASSERT_EQ(LCB_SUCCESS, err);
+    ASSERT_EQ(0, dropped);
+
+    lcb_destroy(instance);
+    conlogger->minlevel = oldlevel;
+    lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &oldfp);
+
+    string contents;
+    char buf[4096];
+    size_t nr;
+    rewind(fp);
+    while ((nr = fread(buf, 1, sizeof buf, fp)) > 0) {
+        contents.append(buf, nr);
+    }
+    fclose(fp);
+
+    ASSERT_NE(string::npos, contents.find("[INFO] (asynctest - L:"));
+    ASSERT_NE(string::npos, contents.find(
+        "int=-42 uint=42 long=123456789 u64=18446744073709551615 hex=0xff "
+        "str=hello sub=abc dbl=3.14 pct=% c=z pad=[   ab] star=[   7]\n"));
+    ASSERT_NE(string::npos, contents.find("[DEBUG] (asynctest - L:"));
+    ASSERT_NE(string::npos, contents.find("null=(null)\n"));
+}
+
+TEST_F(Logger, testAsyncConsoleDestroy)
+{
+    lcb_t instance;
+    lcb_error_t err;
+    FILE *fp = tmpfile();
+    ASSERT_FALSE(fp == NULL);
+
+    struct lcb_CONSOLELOGGER *conlogger =
+            (struct lcb_CONSOLELOGGER *)lcb_console_logprocs;
+    int oldlevel = conlogger->minlevel;
+    FILE *oldfp = conlogger->fp;
+
+    lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &fp);
+    int enabled = 1;
+    err = lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_ASYNC, &enabled);
+    if (err == LCB_NOT_SUPPORTED) {
+        lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &oldfp);
+        fclose(fp);
+        return;
+    }
+    ASSERT_EQ(LCB_SUCCESS, err);
+
+    lcb_create(&instance, NULL);
+    conlogger->minlevel = LCB_LOG_TRACE;
+    lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_LOGGER, lcb_console_logprocs);
+    lcb_log(instance->getSettings(), "asynctest", LCB_LOG_INFO, __FILE__, __LINE__,
+        "logged before destroy");
+
+    // Destroying the last instance should stop the writer thread, once it
+    // has written out everything pending
+    lcb_destroy(instance);
+    conlogger->minlevel = oldlevel;
+
+    string contents;
+    char buf[4096];
+    size_t nr;
+    rewind(fp);
+    while ((nr = fread(buf, 1, sizeof buf, fp)) > 0) {
+        contents.append(buf, nr);
+    }
+    ASSERT_NE(string::npos, contents.find("logged before destroy\n"));
+
+    enabled = 0;
+    lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_ASYNC, &enabled);
+    lcb_cntl(NULL, LCB_CNTL_SET, LCB_CNTL_CONLOGGER_FP, &oldfp);
+    fclose(fp);
+}
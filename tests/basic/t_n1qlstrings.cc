@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <libcouchbase/couchbase.h>
 #include "n1ql/n1ql-internal.h"
+#include "freqsketch.h"
 
 class N1qLStringTests : public ::testing::Test {
 };
@@ -16,3 +17,107 @@ TEST_F(N1qLStringTests, testParseTimeout)
     ASSERT_EQ(0, lcb_n1qlreq_parsetmo("124"));
     ASSERT_EQ(0, lcb_n1qlreq_parsetmo("99z"));
 }
+
+TEST_F(N1qLStringTests, testNormalize)
+{
+    std::string out;
+    lcb_n1qlreq_normalize("  SELECT *\n\tFROM   default ;", out);
+    ASSERT_EQ("SELECT * FROM default", out);
+    lcb_n1qlreq_normalize("SELECT * FROM default", out);
+    ASSERT_EQ("SELECT * FROM default", out);
+
+    // Literals and identifiers are left alone
+    lcb_n1qlreq_normalize("SELECT 'a  b', \"c\\\"  d\" FROM `my  bucket`", out);
+    ASSERT_EQ("SELECT 'a  b', \"c\\\"  d\" FROM `my  bucket`", out);
+    lcb_n1qlreq_normalize("SELECT ';  '", out);
+    ASSERT_EQ("SELECT ';  '", out);
+
+    // Comments are dropped, since they might otherwise run on to the end
+    lcb_n1qlreq_normalize("SELECT a -- note\nFROM b", out);
+    ASSERT_EQ("SELECT a FROM b", out);
+    lcb_n1qlreq_normalize("SELECT a/* note\n */FROM b -- last", out);
+    ASSERT_EQ("SELECT a FROM b", out);
+    lcb_n1qlreq_normalize("SELECT a /* unterminated", out);
+    ASSERT_EQ("SELECT a", out);
+    lcb_n1qlreq_normalize("SELECT '--', \"/*\" FROM b", out);
+    ASSERT_EQ("SELECT '--', \"/*\" FROM b", out);
+}
+
+TEST_F(N1qLStringTests, testFreqSketch)
+{
+    lcb::FrequencySketch<lcb_U16, 0xffff> sketch(16);
+    for (unsigned ii = 1; ii <= 20; ii++) {
+        ASSERT_EQ(ii, sketch.increment("SELECT 1"));
+    }
+    ASSERT_EQ(20, sketch.frequency("SELECT 1"));
+    ASSERT_EQ(1, sketch.increment("SELECT 2"));
+
+    // Counts may be overestimated, but never underestimated
+    char buf[64];
+    for (unsigned ii = 0; ii < 100; ii++) {
+        sprintf(buf, "SELECT %u", 1000 + ii);
+        sketch.increment(buf);
+    }
+    ASSERT_LE(20, sketch.frequency("SELECT 1"));
+
+    // Old counts decay
+    for (unsigned ii = 0; ii < 2000; ii++) {
+        sprintf(buf, "SELECT %u", 5000 + ii);
+        sketch.increment(buf);
+    }
+    ASSERT_GT(20, sketch.frequency("SELECT 1"));
+
+    sketch.clear();
+    ASSERT_EQ(0, sketch.frequency("SELECT 1"));
+
+    // The default (small) counters saturate
+    lcb::FrequencySketch<> small(16);
+    for (unsigned ii = 0; ii < 20; ii++) {
+        small.increment("SELECT 1");
+    }
+    ASSERT_EQ(15, small.frequency("SELECT 1"));
+
+    // An empty sketch counts nothing
+    lcb::FrequencySketch<> empty;
+    ASSERT_EQ(0, empty.increment("SELECT 1"));
+    ASSERT_EQ(0, empty.frequency("SELECT 1"));
+}
+
+TEST_F(N1qLStringTests, testWatchStatement)
+{
+    std::set<std::pair<std::string, std::string> > indexes;
+    indexes.insert(std::make_pair("default", "ix1"));
+    indexes.insert(std::make_pair("default", ""));
+    indexes.insert(std::make_pair("other", "a\"b"));
+
+    // Names and keyspaces are quoted, and the primary index is found by
+    // is_primary
+    std::string out;
+    lcb_n1xwatch_statement(indexes, out);
+    ASSERT_EQ("SELECT name, keyspace_id, namespace_id, `using`, state, is_primary "
+        "FROM system:indexes WHERE "
+        "(keyspace_id=\"default\" AND is_primary=true) OR "
+        "(keyspace_id=\"default\" AND name=\"ix1\") OR "
+        "(keyspace_id=\"other\" AND name=\"a\\\"b\")", out);
+}
+
+TEST_F(N1qLStringTests, testWatchBackoff)
+{
+    lcb_U32 interval = 100;
+
+    // The interval doubles while nothing changes, up to the maximum
+    ASSERT_EQ(100, lcb_n1xwatch_backoff(interval, 100, 500, false));
+    ASSERT_EQ(200, lcb_n1xwatch_backoff(interval, 100, 500, false));
+    ASSERT_EQ(400, lcb_n1xwatch_backoff(interval, 100, 500, false));
+    ASSERT_EQ(500, lcb_n1xwatch_backoff(interval, 100, 500, false));
+    ASSERT_EQ(500, lcb_n1xwatch_backoff(interval, 100, 500, false));
+
+    // and starts again from the minimum after a change
+    ASSERT_EQ(100, lcb_n1xwatch_backoff(interval, 100, 500, true));
+    ASSERT_EQ(200, lcb_n1xwatch_backoff(interval, 100, 500, false));
+
+    // Large intervals don't overflow
+    interval = 0x90000000;
+    ASSERT_EQ(0x90000000, lcb_n1xwatch_backoff(interval, 100, 0xf0000000, false));
+    ASSERT_EQ(0xf0000000, interval);
+}
@@ -444,3 +444,159 @@ TEST_F(NetbufTest, testOutOfOrder)
 
     clean_check(&mgr);
 }
+
+TEST_F(NetbufTest, testAdaptiveSize)
+{
+    nb_MGR mgr;
+    nb_SETTINGS settings;
+    nb_SPAN spans[1000];
+    int ii;
+
+    netbuf_default_settings(&settings);
+    settings.data_minalloc = 1024;
+    settings.data_maxalloc = 65536;
+    netbuf_init(&mgr, &settings);
+
+    // The first blocks are of the base size
+    spans[0].size = 16;
+    ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[0]));
+    ASSERT_EQ(NB_DATA_BASEALLOC, spans[0].parent->nalloc);
+    netbuf_mblock_release(&mgr, &spans[0]);
+
+    // Blocks for small spans shrink, down to the minimum. The larger block
+    // is freed rather than reused
+    for (ii = 0; ii < 100; ii++) {
+        spans[ii].size = 8;
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+        netbuf_mblock_release(&mgr, &spans[ii]);
+    }
+    for (ii = 0; ii < 1000; ii++) {
+        spans[ii].size = 8;
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+    }
+    ASSERT_EQ(1024, spans[999].parent->nalloc);
+    for (ii = 0; ii < 1000; ii++) {
+        netbuf_mblock_release(&mgr, &spans[ii]);
+    }
+
+    // And grow for large spans, up to the maximum
+    for (ii = 0; ii < 100; ii++) {
+        spans[ii].size = 4000;
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+    }
+    ASSERT_EQ(65536, spans[99].parent->nalloc);
+    for (ii = 0; ii < 100; ii++) {
+        netbuf_mblock_release(&mgr, &spans[ii]);
+    }
+
+    // A span is never split, whatever the recent sizes
+    spans[0].size = 100000;
+    ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[0]));
+    ASSERT_LE(100000, spans[0].parent->nalloc);
+    netbuf_mblock_release(&mgr, &spans[0]);
+
+    clean_check(&mgr);
+}
+
+TEST_F(NetbufTest, testTrim)
+{
+    nb_MGR mgr;
+    nb_SETTINGS settings;
+    nb_SPAN spans[3];
+    nb_STATS stats;
+    int ii;
+
+    netbuf_default_settings(&settings);
+    settings.data_basealloc = 64;
+    netbuf_init(&mgr, &settings);
+
+    // Each span fills a block
+    for (ii = 0; ii < 3; ii++) {
+        spans[ii].size = 64;
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+    }
+    for (ii = 0; ii < 3; ii++) {
+        netbuf_mblock_release(&mgr, &spans[ii]);
+    }
+
+    // Blocks are only freed once they have gone unused between two trims
+    ASSERT_EQ(0, netbuf_trim(&mgr));
+
+    spans[0].size = 64;
+    ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[0]));
+    netbuf_mblock_release(&mgr, &spans[0]);
+    ASSERT_EQ(128, netbuf_trim(&mgr));
+
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(64, stats.cached);
+
+    ASSERT_EQ(64, netbuf_trim(&mgr));
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(0, stats.cached);
+
+    // Freed cache blocks can be used again
+    for (ii = 0; ii < 3; ii++) {
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+        memset(SPAN_BUFFER(&spans[ii]), 0xff, spans[ii].size);
+    }
+    for (ii = 0; ii < 3; ii++) {
+        netbuf_mblock_release(&mgr, &spans[ii]);
+    }
+
+    clean_check(&mgr);
+}
+
+TEST_F(NetbufTest, testStats)
+{
+    nb_MGR mgr;
+    nb_SETTINGS settings;
+    nb_SPAN spans[3];
+    nb_STATS stats;
+    int ii;
+
+    netbuf_default_settings(&settings);
+    settings.data_basealloc = 100;
+    netbuf_init(&mgr, &settings);
+
+    spans[0].size = 40;
+    spans[1].size = 30;
+    spans[2].size = 20;
+    for (ii = 0; ii < 3; ii++) {
+        ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[ii]));
+    }
+
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(100, stats.allocated);
+    ASSERT_EQ(90, stats.used);
+    ASSERT_EQ(0, stats.wasted);
+
+    // Wrap around: the last 10 bytes can't be used until the block unwraps
+    netbuf_mblock_release(&mgr, &spans[0]);
+    spans[0].size = 30;
+    ASSERT_EQ(0, netbuf_mblock_reserve(&mgr, &spans[0]));
+    ASSERT_EQ(0, spans[0].offset);
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(80, stats.used);
+    ASSERT_EQ(10, stats.wasted);
+
+    // Released out of order, so it can't be used yet
+    netbuf_mblock_release(&mgr, &spans[2]);
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(60, stats.used);
+    ASSERT_EQ(30, stats.wasted);
+
+    netbuf_mblock_release(&mgr, &spans[1]);
+    netbuf_mblock_release(&mgr, &spans[0]);
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&mgr, &stats);
+    ASSERT_EQ(0, stats.used);
+    ASSERT_EQ(0, stats.wasted);
+    ASSERT_EQ(100, stats.cached);
+
+    clean_check(&mgr);
+}
@@ -0,0 +1,125 @@
+#include "config.h"
+#include <gtest/gtest.h>
+#include <libcouchbase/couchbase.h>
+#include "internal.h"
+#include "rowflow.h"
+#include <string>
+#include <vector>
+
+using lcb::RowFlow;
+
+class RowFlowTest : public ::testing::Test {
+};
+
+namespace {
+struct TestSink : RowFlow::Sink {
+    TestSink() : flow(NULL), pause_after(0), nbuffered(0), ndone(0) {}
+
+    void flow_row(const char *row, size_t nrow, bool buffered) {
+        rows.push_back(std::string(row, nrow));
+        nbuffered += buffered ? 1 : 0;
+        if (pause_after && rows.size() == pause_after) {
+            flow->pause();
+        }
+    }
+    void flow_done() {
+        ndone++;
+    }
+
+    RowFlow *flow;
+    std::vector<std::string> rows;
+    size_t pause_after; /**< Pause once this many rows were received */
+    size_t nbuffered;
+    int ndone;
+};
+}
+
+TEST_F(RowFlowTest, testWatermarks)
+{
+    lcb_t instance;
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+    lcb_U32 highwat = 100, lowwat = 40;
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_ROWBUF_HIGHWAT, &highwat));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_ROWBUF_LOWWAT, &lowwat));
+
+    {
+        TestSink sink;
+        lcb_http_request_t htreq = NULL;
+        RowFlow flow(instance, &htreq, &sink);
+        sink.flow = &flow;
+        const std::string row(30, 'x');
+
+        // Rows are passed through until paused
+        flow.row(row.c_str(), row.size());
+        ASSERT_EQ(1, sink.rows.size());
+        ASSERT_TRUE(flow.reading());
+
+        // Reading continues until the high watermark is reached
+        flow.pause();
+        for (int ii = 0; ii < 3; ii++) {
+            flow.row(row.c_str(), row.size());
+            ASSERT_TRUE(flow.reading());
+        }
+        flow.row(row.c_str(), row.size());
+        ASSERT_FALSE(flow.reading());
+        ASSERT_EQ(1, sink.rows.size());
+
+        // The final response is held until the rows are delivered
+        lcb_RESPHTTP htresp = { 0 };
+        htresp.htstatus = 200;
+        htresp.rflags = LCB_RESP_F_FINAL;
+        ASSERT_TRUE(flow.hold_final(&htresp));
+        ASSERT_TRUE(flow.final_response() != NULL);
+        ASSERT_EQ(200, flow.final_response()->htstatus);
+
+        // 60 bytes still buffered; above the low watermark
+        sink.pause_after = 3;
+        flow.resume();
+        ASSERT_EQ(1, sink.rows.size());
+        lcb_wait(instance);
+        ASSERT_EQ(3, sink.rows.size());
+        ASSERT_FALSE(flow.reading());
+        ASSERT_EQ(0, sink.ndone);
+
+        // 30 bytes buffered; reading resumes
+        sink.pause_after = 4;
+        flow.resume();
+        lcb_wait(instance);
+        ASSERT_EQ(4, sink.rows.size());
+        ASSERT_TRUE(flow.reading());
+        ASSERT_EQ(0, sink.ndone);
+
+        sink.pause_after = 0;
+        flow.resume();
+        lcb_wait(instance);
+        ASSERT_EQ(5, sink.rows.size());
+        ASSERT_EQ(4, sink.nbuffered);
+        ASSERT_EQ(1, sink.ndone);
+        ASSERT_TRUE(flow.reading());
+    }
+    lcb_destroy(instance);
+}
+
+TEST_F(RowFlowTest, testNoPrefetch)
+{
+    lcb_t instance;
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+
+    {
+        // With the default high watermark of 0, reading stops on pause
+        TestSink sink;
+        lcb_http_request_t htreq = NULL;
+        RowFlow flow(instance, &htreq, &sink);
+        sink.flow = &flow;
+
+        flow.pause();
+        ASSERT_FALSE(flow.reading());
+        ASSERT_TRUE(flow.hold_final(NULL));
+        ASSERT_TRUE(flow.final_response() == NULL);
+        flow.resume();
+        ASSERT_TRUE(flow.reading());
+        lcb_wait(instance);
+        ASSERT_EQ(1, sink.ndone);
+    }
+    lcb_destroy(instance);
+}
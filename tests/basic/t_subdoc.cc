@@ -0,0 +1,171 @@
+#include "config.h"
+#include <gtest/gtest.h>
+#include <libcouchbase/couchbase.h>
+#include <libcouchbase/subdoc.h>
+#include "internal.h"
+#include <memcached/protocol_binary.h>
+
+using std::string;
+
+/**
+ * Tests for the encoding of multi-path subdoc commands. The instance is
+ * bootstrapped from a cached cluster map, and the packets are inspected
+ * within the scheduling context (and then discarded), so no server is needed.
+ */
+class SubdocEncodingTest : public ::testing::Test {
+protected:
+    void SetUp();
+    void TearDown();
+
+    /**
+     * Schedule the command and return the encoded packet's opcode and value.
+     * The command is discarded afterwards.
+     */
+    void encode(const lcb_CMDSUBDOC *cmd, lcb_U8 *opcode, string& value);
+
+    lcb_t instance;
+    string cfgpath;
+};
+
+void
+SubdocEncodingTest::SetUp()
+{
+    char buf[64];
+    sprintf(buf, "/lcb_sdtest_%p.json", (void *)this);
+    cfgpath = string(lcb_get_tmpdir()) + buf;
+    FILE *fp = fopen(cfgpath.c_str(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "%s{{{fb85b563d0a8f65fa8d3d58f1b3a0708}}}",
+        "{\"rev\":1,\"name\":\"default\",\"nodeLocator\":\"vbucket\",\"uuid\":\"x\","
+        "\"nodes\":[{\"hostname\":\"127.0.0.1:8091\",\"ports\":{\"direct\":11210}}],"
+        "\"vBucketServerMap\":{\"hashAlgorithm\":\"CRC\",\"numReplicas\":0,"
+        "\"serverList\":[\"127.0.0.1:11210\"],\"vBucketMap\":[[0],[0]]}}");
+    fclose(fp);
+
+    string connstr = "couchbase://127.0.0.1/default?config_cache=" + cfgpath;
+    struct lcb_create_st cropts = { 0 };
+    cropts.version = 3;
+    cropts.v.v3.connstr = connstr.c_str();
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, &cropts));
+    ASSERT_EQ(LCB_SUCCESS, lcb_connect(instance));
+    lcb_wait(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get_bootstrap_status(instance));
+}
+
+void
+SubdocEncodingTest::TearDown()
+{
+    lcb_destroy(instance);
+    remove(cfgpath.c_str());
+}
+
+void
+SubdocEncodingTest::encode(const lcb_CMDSUBDOC *cmd, lcb_U8 *opcode, string& value)
+{
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_subdoc3(instance, NULL, cmd));
+
+    mc_PIPELINE *pl = instance->cmdq.pipelines[0];
+    ASSERT_FALSE(SLLIST_IS_EMPTY(&pl->ctxqueued));
+    mc_PACKET *pkt = SLLIST_ITEM(SLLIST_FIRST(&pl->ctxqueued), mc_PACKET, slnode);
+
+    protocol_binary_request_header hdr;
+    memcpy(hdr.bytes, SPAN_BUFFER(&pkt->kh_span), sizeof hdr.bytes);
+    *opcode = hdr.request.opcode;
+    value.assign(SPAN_BUFFER(&pkt->u_value.single), pkt->u_value.single.size);
+    ASSERT_EQ(ntohl(hdr.request.bodylen),
+        hdr.request.extlen + ntohs(hdr.request.keylen) + value.size());
+    lcb_sched_fail(instance);
+}
+
+/** Append the encoding of a spec: opcode, flags, path and value lengths... */
+static void
+appendSpec(string& s, lcb_U8 opcode, lcb_U8 flags, const string& path,
+    const string *value)
+{
+    s += (char)opcode;
+    s += (char)flags;
+    s += (char)(path.size() >> 8);
+    s += (char)(path.size() & 0xff);
+    if (value) {
+        lcb_U32 n = value->size();
+        s += (char)(n >> 24);
+        s += (char)((n >> 16) & 0xff);
+        s += (char)((n >> 8) & 0xff);
+        s += (char)(n & 0xff);
+    }
+    s += path;
+    if (value) {
+        s += *value;
+    }
+}
+
+TEST_F(SubdocEncodingTest, testLookup)
+{
+    lcb_SDSPEC specs[2] = {};
+    specs[0].sdcmd = LCB_SDCMD_GET;
+    LCB_SDSPEC_SET_PATH(&specs[0], "a.b", 3);
+    specs[1].sdcmd = LCB_SDCMD_EXISTS;
+    LCB_SDSPEC_SET_PATH(&specs[1], "c", 1);
+
+    lcb_CMDSUBDOC cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, "key", 3);
+    cmd.specs = specs;
+    cmd.nspecs = 2;
+
+    lcb_U8 opcode;
+    string value;
+    encode(&cmd, &opcode, value);
+    ASSERT_EQ(PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP, opcode);
+
+    string expected;
+    appendSpec(expected, PROTOCOL_BINARY_CMD_SUBDOC_GET, 0, "a.b", NULL);
+    appendSpec(expected, PROTOCOL_BINARY_CMD_SUBDOC_EXISTS, 0, "c", NULL);
+    ASSERT_EQ(expected, value);
+}
+
+TEST_F(SubdocEncodingTest, testMutation)
+{
+    // Every spec (and each fragment of an IOV value) must be encoded intact
+    lcb_IOV iov[2];
+    iov[0].iov_base = const_cast<char*>("[1,");
+    iov[0].iov_len = 3;
+    iov[1].iov_base = const_cast<char*>("2]");
+    iov[1].iov_len = 2;
+
+    lcb_SDSPEC specs[3] = {};
+    specs[0].sdcmd = LCB_SDCMD_DICT_UPSERT;
+    specs[0].options = LCB_SDSPEC_F_MKINTERMEDIATES;
+    LCB_SDSPEC_SET_PATH(&specs[0], "a.b", 3);
+    LCB_SDSPEC_SET_VALUE(&specs[0], "42", 2);
+    specs[1].sdcmd = LCB_SDCMD_REMOVE;
+    LCB_SDSPEC_SET_PATH(&specs[1], "c", 1);
+    specs[2].sdcmd = LCB_SDCMD_DICT_UPSERT;
+    LCB_SDSPEC_SET_PATH(&specs[2], "d", 1);
+    specs[2].value.vtype = LCB_KV_IOV;
+    specs[2].value.u_buf.multi.iov = iov;
+    specs[2].value.u_buf.multi.niov = 2;
+    // An inaccurate total_length must not truncate (or overflow) it
+    specs[2].value.u_buf.multi.total_length = 1;
+
+    lcb_CMDSUBDOC cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, "key", 3);
+    cmd.specs = specs;
+    cmd.nspecs = 3;
+
+    lcb_U8 opcode;
+    string value;
+    encode(&cmd, &opcode, value);
+    ASSERT_EQ(PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION, opcode);
+
+    string expected, v42("42"), vempty, viov("[1,2]");
+    appendSpec(expected, PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT,
+        SUBDOC_FLAG_MKDIR_P, "a.b", &v42);
+    appendSpec(expected, PROTOCOL_BINARY_CMD_SUBDOC_DELETE, 0, "c", &vempty);
+    appendSpec(expected, PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT, 0, "d", &viov);
+    ASSERT_EQ(expected, value);
+
+    // Lookup and mutation specs may not be mixed
+    specs[1].sdcmd = LCB_SDCMD_GET;
+    ASSERT_EQ(LCB_OPTIONS_CONFLICT, lcb_subdoc3(instance, NULL, &cmd));
+}
@@ -0,0 +1,179 @@
+#include "httpserver.h"
+#include <algorithm>
+#include <cctype>
+#ifdef _WIN32
+#define sleep_ms(ms) Sleep(ms)
+#else
+#define sleep_ms(ms) usleep((ms) * 1000)
+#endif
+
+using namespace LCBTest;
+
+static std::string
+lowercase(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+std::string
+HttpServer::Request::header(const std::string& name) const
+{
+    std::string needle = "\r\n" + lowercase(name) + ":";
+    std::string lhead = lowercase(head);
+    size_t pos = lhead.find(needle);
+    if (pos == std::string::npos) {
+        return std::string();
+    }
+    pos += needle.size();
+    size_t end = head.find("\r\n", pos);
+    while (pos < end && head[pos] == ' ') {
+        pos++;
+    }
+    return head.substr(pos, end - pos);
+}
+
+HttpServer::HttpServer() : nactive(0), maxactive(0), respond_early(false)
+{
+}
+
+HttpServer::~HttpServer()
+{
+    shutdown();
+}
+
+std::vector<HttpServer::Request>
+HttpServer::getRequests()
+{
+    mutex.lock();
+    std::vector<Request> ret = requests;
+    mutex.unlock();
+    return ret;
+}
+
+unsigned
+HttpServer::getMaxActive()
+{
+    mutex.lock();
+    unsigned ret = maxactive;
+    mutex.unlock();
+    return ret;
+}
+
+void
+HttpServer::setRespondEarly(bool enabled)
+{
+    mutex.lock();
+    respond_early = enabled;
+    mutex.unlock();
+}
+
+void
+HttpServer::handle(const Request&, Response&)
+{
+}
+
+void
+HttpServer::serve(Connection *conn)
+{
+    Request req;
+    size_t end;
+    while (readHead(conn, req, end)) {
+        mutex.lock();
+        maxactive = std::max(maxactive, ++nactive);
+        bool early = respond_early;
+        mutex.unlock();
+
+        if (!early && !readBody(conn, req, end)) {
+            return;
+        }
+
+        Response resp;
+        handle(req, resp);
+        if (resp.delay_ms) {
+            sleep_ms(resp.delay_ms);
+        }
+
+        char buf[128];
+        sprintf(buf, "HTTP/1.1 %d Status\r\nContent-Length: %u\r\n",
+            resp.status, (unsigned)resp.body.size());
+        std::string out(buf);
+        if (resp.close) {
+            out += "Connection: close\r\n";
+        }
+        out += resp.headers;
+        out += "\r\n";
+        out += resp.body;
+
+        // Record the request before responding, so it is visible to the
+        // client once the response has been received
+        mutex.lock();
+        requests.push_back(req);
+        nactive--;
+        mutex.unlock();
+
+        if (!conn->sendAll(out) || resp.close) {
+            return;
+        }
+        // The rest of the body must still be consumed before the next
+        // request on the connection can be read
+        if (early && !readBody(conn, req, end)) {
+            return;
+        }
+    }
+}
+
+bool
+HttpServer::readHead(Connection *conn, Request& req, size_t& end)
+{
+    std::string& rbuf = conn->rbuf;
+    size_t pos = conn->find("\r\n\r\n", 0);
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    req = Request();
+    req.head = rbuf.substr(0, pos + 4);
+    size_t sp1 = req.head.find(' ');
+    size_t sp2 = req.head.find(' ', sp1 + 1);
+    req.method = req.head.substr(0, sp1);
+    req.path = req.head.substr(sp1 + 1, sp2 - sp1 - 1);
+    req.chunked = lowercase(req.header("Transfer-Encoding")) == "chunked";
+    end = pos + 4;
+    return true;
+}
+
+bool
+HttpServer::readBody(Connection *conn, Request& req, size_t& end)
+{
+    std::string& rbuf = conn->rbuf;
+    if (req.chunked) {
+        for (;;) {
+            size_t eol = conn->find("\r\n", end);
+            if (eol == std::string::npos) {
+                return false;
+            }
+            size_t nchunk = strtoul(rbuf.c_str() + end, NULL, 16);
+            end = eol + 2;
+            if (!conn->fill(end + nchunk + 2)) {
+                return false;
+            }
+            req.body += rbuf.substr(end, nchunk);
+            end += nchunk + 2;
+            if (!nchunk) {
+                break;
+            }
+        }
+    } else {
+        size_t nbody = strtoul(req.header("Content-Length").c_str(), NULL, 10);
+        if (!conn->fill(end + nbody)) {
+            return false;
+        }
+        req.body = rbuf.substr(end, nbody);
+        end += nbody;
+    }
+
+    req.raw = rbuf.substr(0, end);
+    rbuf.erase(0, end);
+    return true;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file
+ * A minimal HTTP/1.1 server, used to stand in for the cluster's REST services
+ * when testing the library's HTTP requests against a loopback socket.
+ */
+
+#ifndef LCBTEST_HTTPSERVER_H
+#define LCBTEST_HTTPSERVER_H
+
+#include "threadedserver.h"
+#include <map>
+
+namespace LCBTest {
+
+class HttpServer : public ThreadedServer {
+public:
+    /** A request, as received by the server */
+    struct Request {
+        std::string method;
+        std::string path;
+        /** Request line and headers, including the terminating blank line */
+        std::string head;
+        /** Body, with any chunked framing removed */
+        std::string body;
+        /** Every byte received for the request */
+        std::string raw;
+        /** Whether the body was sent with chunked transfer encoding */
+        bool chunked;
+
+        /**
+         * Get the value of a header
+         * @param name the name of the header (case insensitive)
+         * @return the value, or an empty string if there is no such header
+         */
+        std::string header(const std::string& name) const;
+    };
+
+    struct Response {
+        Response() : status(200), delay_ms(0), close(false) {}
+        int status;
+        std::string body;
+        /** Additional headers, each terminated by `\r\n` */
+        std::string headers;
+        /** How long to wait before sending the response */
+        unsigned delay_ms;
+        /** Close the connection once the response has been sent */
+        bool close;
+    };
+
+    HttpServer();
+    virtual ~HttpServer();
+
+    /** @return the requests received so far, in the order they completed */
+    std::vector<Request> getRequests();
+
+    /** @return the largest number of requests being handled at once */
+    unsigned getMaxActive();
+
+    /**
+     * Respond to each request as soon as its headers have been received,
+     * before reading its body. The request passed to handle() has no body.
+     */
+    void setRespondEarly(bool enabled);
+
+protected:
+    /**
+     * Handle a request. The default implementation responds with an empty
+     * `200 OK`. This is invoked from the connection's own thread.
+     */
+    virtual void handle(const Request& req, Response& resp);
+
+private:
+    void serve(Connection *conn);
+    /** Read the request line and headers. `end` is set to the end of them */
+    static bool readHead(Connection *conn, Request& req, size_t& end);
+    /** Read the body following the headers, and remove the whole request */
+    static bool readBody(Connection *conn, Request& req, size_t& end);
+
+    std::vector<Request> requests;
+    unsigned nactive;
+    unsigned maxactive;
+    bool respond_early;
+};
+
+}
+
+#endif
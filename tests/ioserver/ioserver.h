@@ -4,6 +4,9 @@
  * core `lcbio` functionality.
  */
 
+#ifndef LCBTEST_IOSERVER_H
+#define LCBTEST_IOSERVER_H
+
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
@@ -476,3 +479,5 @@ private:
 };
 
 }
+
+#endif
@@ -0,0 +1,127 @@
+#include "memdserver.h"
+#include <memcached/protocol_binary.h>
+#ifdef _WIN32
+#define sleep_ms(ms) Sleep(ms)
+#else
+#define sleep_ms(ms) usleep((ms) * 1000)
+#endif
+
+using namespace LCBTest;
+
+MemdServer::MemdServer()
+    : config_delay(0), config_fails(false), stopping(false)
+{
+}
+
+MemdServer::~MemdServer()
+{
+    stopping = true;
+    shutdown();
+}
+
+void
+MemdServer::setConfig(const std::string& config_)
+{
+    mutex.lock();
+    config = config_;
+    mutex.unlock();
+}
+
+void
+MemdServer::setConfigDelay(unsigned ms)
+{
+    mutex.lock();
+    config_delay = ms;
+    mutex.unlock();
+}
+
+void
+MemdServer::setConfigFails(bool fails)
+{
+    mutex.lock();
+    config_fails = fails;
+    mutex.unlock();
+}
+
+unsigned
+MemdServer::getRequests(uint8_t opcode)
+{
+    mutex.lock();
+    unsigned ret = nrequests[opcode];
+    mutex.unlock();
+    return ret;
+}
+
+bool
+MemdServer::waitClosed(Connection *conn, unsigned ms)
+{
+    // Wait in steps, so that the server can be destroyed meanwhile
+    for (unsigned ii = 0; ii < ms && !stopping; ii += 10) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(*conn->sock, &rfds);
+        struct timeval tv = { 0, 10000 };
+        if (select(*conn->sock + 1, &rfds, NULL, NULL, &tv) != 1) {
+            continue;
+        }
+        char c;
+        if (recv(*conn->sock, &c, 1, MSG_PEEK) <= 0) {
+            return true;
+        }
+        // The client sent more; don't spin on it
+        sleep_ms(10);
+    }
+    return false;
+}
+
+void
+MemdServer::serve(Connection *conn)
+{
+    const size_t hdrsize = sizeof(protocol_binary_request_header);
+    while (conn->fill(hdrsize)) {
+        protocol_binary_request_header req;
+        memcpy(&req, conn->rbuf.c_str(), hdrsize);
+        size_t nbody = ntohl(req.request.bodylen);
+        if (!conn->fill(hdrsize + nbody)) {
+            return;
+        }
+        conn->rbuf.erase(0, hdrsize + nbody);
+
+        mutex.lock();
+        nrequests[req.request.opcode]++;
+        mutex.unlock();
+
+        uint16_t status = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+        std::string value;
+        if (req.request.opcode == PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG) {
+            mutex.lock();
+            value = config;
+            unsigned delay = config_delay;
+            bool fails = config_fails;
+            mutex.unlock();
+
+            if (delay && waitClosed(conn, delay)) {
+                return;
+            }
+            if (fails || stopping) {
+                return;
+            }
+        } else if (req.request.opcode != PROTOCOL_BINARY_CMD_SASL_LIST_MECHS) {
+            status = PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND;
+        }
+
+        protocol_binary_response_header resp;
+        memset(&resp, 0, sizeof resp);
+        resp.response.magic = PROTOCOL_BINARY_RES;
+        resp.response.opcode = req.request.opcode;
+        resp.response.status = htons(status);
+        resp.response.bodylen = htonl(value.size());
+        resp.response.opaque = req.request.opaque;
+
+        std::string out(reinterpret_cast<const char*>(resp.bytes), sizeof resp.bytes);
+        out += value;
+        if (!conn->sendAll(out)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/**
+ * @file
+ * A minimal memcached server, which answers the requests the library makes
+ * while bootstrapping: SASL negotiation (with no mechanisms, so that no
+ * authentication is needed) and GET_CLUSTER_CONFIG. Any other request is
+ * counted and answered with UNKNOWN_COMMAND.
+ */
+
+#ifndef LCBTEST_MEMDSERVER_H
+#define LCBTEST_MEMDSERVER_H
+
+#include "threadedserver.h"
+#include <map>
+
+namespace LCBTest {
+
+class MemdServer : public ThreadedServer {
+public:
+    MemdServer();
+    virtual ~MemdServer();
+
+    /** Set the configuration returned by GET_CLUSTER_CONFIG */
+    void setConfig(const std::string& config);
+
+    /** Wait this long before answering GET_CLUSTER_CONFIG. If the client
+     * closes the connection meanwhile, it is not answered */
+    void setConfigDelay(unsigned ms);
+
+    /** Close the connection rather than answer GET_CLUSTER_CONFIG */
+    void setConfigFails(bool fails);
+
+    /** @return the number of requests received with the given opcode */
+    unsigned getRequests(uint8_t opcode);
+
+private:
+    void serve(Connection *conn);
+
+    /** Wait up to `ms` milliseconds. @return true if the peer closed */
+    bool waitClosed(Connection *conn, unsigned ms);
+
+    std::string config;
+    unsigned config_delay;
+    bool config_fails;
+    std::map<uint8_t, unsigned> nrequests;
+    volatile bool stopping;
+};
+
+}
+
+#endif
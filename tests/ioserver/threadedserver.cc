@@ -0,0 +1,153 @@
+#include "threadedserver.h"
+
+using namespace LCBTest;
+
+ThreadedServer::ThreadedServer() : nclosed(0), closed(false)
+{
+    lsn = SockFD::newListener();
+    thr = new Thread(acceptFunc, this);
+}
+
+ThreadedServer::~ThreadedServer()
+{
+    shutdown();
+    mutex.close();
+}
+
+void
+ThreadedServer::shutdown()
+{
+    mutex.lock();
+    if (closed) {
+        mutex.unlock();
+        return;
+    }
+    closed = true;
+    mutex.unlock();
+
+    lsn->close();
+    delete thr;
+    delete lsn;
+
+    // No new connections can be added now
+    std::list<Connection*>::iterator it;
+    for (it = conns.begin(); it != conns.end(); ++it) {
+        (*it)->sock->close();
+        delete (*it)->thr;
+        delete (*it)->sock;
+        delete *it;
+    }
+    conns.clear();
+}
+
+std::string
+ThreadedServer::getHostPort()
+{
+    char buf[64];
+    sprintf(buf, "%s:%d", lsn->getLocalHost().c_str(), getListenPort());
+    return buf;
+}
+
+size_t
+ThreadedServer::getConnectionCount()
+{
+    mutex.lock();
+    size_t ret = conns.size();
+    mutex.unlock();
+    return ret;
+}
+
+size_t
+ThreadedServer::getClosedCount()
+{
+    mutex.lock();
+    size_t ret = nclosed;
+    mutex.unlock();
+    return ret;
+}
+
+void
+ThreadedServer::acceptFunc(void *arg)
+{
+    reinterpret_cast<ThreadedServer*>(arg)->acceptLoop();
+}
+
+void
+ThreadedServer::connectionFunc(void *arg)
+{
+    Connection *conn = reinterpret_cast<Connection*>(arg);
+    conn->parent->serve(conn);
+    ::shutdown(*conn->sock, SHUT_RDWR);
+
+    conn->parent->mutex.lock();
+    conn->parent->nclosed++;
+    conn->parent->mutex.unlock();
+}
+
+void
+ThreadedServer::acceptLoop()
+{
+    while (!closed) {
+        struct sockaddr_in newaddr;
+        socklen_t naddr = sizeof(newaddr);
+        int newsock = accept(*lsn, (struct sockaddr *)&newaddr, &naddr);
+        if (newsock == -1) {
+            break;
+        }
+
+        Connection *conn = new Connection();
+        conn->parent = this;
+        conn->sock = new SockFD(newsock);
+
+        mutex.lock();
+        if (closed) {
+            mutex.unlock();
+            delete conn->sock;
+            delete conn;
+            break;
+        }
+        conns.push_back(conn);
+        conn->thr = new Thread(connectionFunc, conn);
+        mutex.unlock();
+    }
+}
+
+bool
+ThreadedServer::Connection::fill(size_t n)
+{
+    char buf[4096];
+    while (rbuf.size() < n) {
+        ssize_t rv = sock->recv(buf, sizeof buf);
+        if (rv <= 0) {
+            return false;
+        }
+        rbuf.append(buf, rv);
+    }
+    return true;
+}
+
+size_t
+ThreadedServer::Connection::find(const char *s, size_t from)
+{
+    size_t pos;
+    while ((pos = rbuf.find(s, from)) == std::string::npos) {
+        if (!fill(rbuf.size() + 1)) {
+            return std::string::npos;
+        }
+    }
+    return pos;
+}
+
+bool
+ThreadedServer::Connection::sendAll(const std::string& s)
+{
+    size_t nsent = 0;
+    while (nsent < s.size()) {
+        ssize_t rv = sock->send(s.c_str() + nsent, s.size() - nsent);
+        if (rv <= 0) {
+            return false;
+        }
+        nsent += rv;
+    }
+    return true;
+}
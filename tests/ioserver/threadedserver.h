@@ -0,0 +1,80 @@
+/**
+ * @file
+ * Base class for the stand-in servers used to test the library against
+ * loopback sockets. Each connection is served by its own thread.
+ */
+
+#ifndef LCBTEST_THREADEDSERVER_H
+#define LCBTEST_THREADEDSERVER_H
+
+#include "ioserver.h"
+
+namespace LCBTest {
+
+class ThreadedServer {
+public:
+    ThreadedServer();
+    virtual ~ThreadedServer();
+
+    uint16_t getListenPort() { return lsn->getLocalPort(); }
+
+    /** @return the server's address, as `host:port` */
+    std::string getHostPort();
+
+    /** @return the number of connections accepted so far */
+    size_t getConnectionCount();
+
+    /** @return the number of connections which have since been closed (by
+     * either side) */
+    size_t getClosedCount();
+
+protected:
+    struct Connection {
+        SockFD *sock;
+        Thread *thr;
+        ThreadedServer *parent;
+        /** Data received but not yet consumed */
+        std::string rbuf;
+
+        /** Receive until #rbuf has at least `n` bytes. false if closed */
+        bool fill(size_t n);
+
+        /** Receive until `s` is found in #rbuf (at or after `from`)
+         * @return its offset, or `std::string::npos` if closed */
+        size_t find(const char *s, size_t from);
+
+        /** Send the whole of `s`. false if closed */
+        bool sendAll(const std::string& s);
+    };
+
+    /**
+     * Serve a connection until it is closed. This is invoked from the
+     * connection's own thread.
+     */
+    virtual void serve(Connection *conn) = 0;
+
+    /**
+     * Close the listener and all connections, and wait for their threads.
+     * This must be called by the destructor of each subclass, since serve()
+     * may not be invoked once it has begun.
+     */
+    void shutdown();
+
+    /** Guards the server's state, including that of subclasses */
+    Mutex mutex;
+
+private:
+    static void acceptFunc(void *arg);
+    static void connectionFunc(void *arg);
+    void acceptLoop();
+
+    SockFD *lsn;
+    Thread *thr;
+    std::list<Connection*> conns;
+    size_t nclosed;
+    volatile bool closed;
+};
+
+}
+
+#endif
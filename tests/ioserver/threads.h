@@ -2,6 +2,8 @@
  * @file
  * Simple cross-platform thread abstraction
  */
+#ifndef LCBTEST_THREADS_H
+#define LCBTEST_THREADS_H
 #ifndef _WIN32
 #include <pthread.h>
 #endif
@@ -64,3 +66,5 @@ private:
     pthread_cond_t cond;
 #endif
 };
+
+#endif
@@ -141,3 +141,84 @@ TEST_F(ArithmeticUnitTest, testArithmeticCreate)
     lcb_arithmetic(instance, NULL, 1, cmds);
     lcb_wait(instance);
 }
+
+struct AggregateCookie {
+    int ncalled;
+    lcb_U64 value;
+    int order;
+};
+
+static int aggregate_order;
+
+extern "C" {
+    static void aggregate_callback(lcb_t, int, const lcb_RESPBASE *rb)
+    {
+        const lcb_RESPCOUNTER *resp = (const lcb_RESPCOUNTER *)rb;
+        AggregateCookie *cookie = (AggregateCookie *)resp->cookie;
+        ASSERT_EQ(LCB_SUCCESS, resp->rc);
+        cookie->ncalled++;
+        cookie->value = resp->value;
+        cookie->order = aggregate_order++;
+    }
+}
+
+/**
+ * @test Arithmetic (Aggregated)
+ * @pre Enable counter aggregation and schedule a number of increments and
+ * decrements of the same key. Then schedule more, but fail the context.
+ *
+ * @post Each operation's callback is invoked once, in scheduling order, with
+ * the value reflecting the net delta. The operations in the failed context
+ * are not applied.
+ */
+TEST_F(ArithmeticUnitTest, testAggregated)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    createConnection(hw, instance);
+
+    initArithmeticKey(instance, "aggcounter", 100);
+    lcb_install_callback3(instance, LCB_CALLBACK_COUNTER, aggregate_callback);
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window", "0.01"));
+
+    const int nops = 10;
+    AggregateCookie cookies[nops] = {};
+    lcb_CMDCOUNTER cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, "aggcounter", 10);
+
+    aggregate_order = 0;
+    lcb_sched_enter(instance);
+    for (int ii = 0; ii < nops; ii++) {
+        cmd.delta = ii % 2 ? -1 : 3;
+        ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &cookies[ii], &cmd));
+    }
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+
+    for (int ii = 0; ii < nops; ii++) {
+        ASSERT_EQ(1, cookies[ii].ncalled);
+        ASSERT_EQ(110, cookies[ii].value);
+        ASSERT_EQ(ii, cookies[ii].order);
+    }
+
+    AggregateCookie failed = {};
+    cmd.delta = 1000;
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &failed, &cmd));
+    lcb_sched_fail(instance);
+    lcb_wait(instance);
+    ASSERT_EQ(0, failed.ncalled);
+
+    // With an operation limit, the window need not close
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window", "60"));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window_ops", "2"));
+    AggregateCookie limited[2] = {};
+    cmd.delta = 1;
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &limited[0], &cmd));
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &limited[1], &cmd));
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+    ASSERT_EQ(112, limited[0].value);
+    ASSERT_EQ(112, limited[1].value);
+}
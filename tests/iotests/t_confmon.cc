@@ -222,3 +222,17 @@ TEST_F(ConfmonTest, testBootstrapMethods)
     ASSERT_TRUE(instance->confmon->is_refreshing());
     instance->confmon->stop();
 }
+
+TEST_F(ConfmonTest, testRacingBootstrap)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    MockEnvironment::getInstance()->createConnection(hw, instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_setu32(instance, LCB_CNTL_BOOTSTRAP_RACE, 3));
+    ASSERT_EQ(0, lcb_cntl_getu32(instance, LCB_CNTL_BOOTSTRAP_TIME));
+
+    ASSERT_EQ(LCB_SUCCESS, lcb_connect(instance));
+    lcb_wait(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get_bootstrap_status(instance));
+    ASSERT_GT(lcb_cntl_getu32(instance, LCB_CNTL_BOOTSTRAP_TIME), 0);
+}
@@ -614,6 +614,103 @@ TEST_F(DurabilityUnitTest, testMulti)
     dmop.assertAllMatch(opts, items_stored, items_missing);
 }
 
+/**
+ * @test Seqno-based durability for multiple items
+ *
+ * @pre Store several items and check their durability in a single context
+ * using seqno-based polling. Do this twice, so that the second run may make
+ * use of the sequence numbers learned by the first
+ *
+ * @post All items satisfy the durability criteria
+ */
+TEST_F(DurabilityUnitTest, testMultiSeqno)
+{
+    const unsigned limit = 32;
+    HandleWrap hwrap;
+    lcb_t instance;
+
+    createConnection(hwrap, instance);
+    if (!supportsMutationTokens(instance)) {
+        return;
+    }
+    lcb_cntl_setu32(instance, LCB_CNTL_DURABILITY_TIMEOUT, LCB_MS2US(10000));
+
+    vector<Item> items;
+    for (unsigned ii = 0; ii < limit; ii++) {
+        char buf[64];
+        sprintf(buf, "key-seqno-multi-%u", ii);
+        Item itm(buf, buf, 0);
+        KVOperation kvo(&itm);
+        kvo.store(instance);
+        items.push_back(kvo.result);
+    }
+
+    lcb_durability_opts_t opts = { 0 };
+    defaultOptions(instance, opts);
+    opts.version = 1;
+    opts.v.v0.pollopts = LCB_DURABILITY_MODE_SEQNO;
+
+    DurabilityMultiOperation dmop;
+    dmop.run(instance, &opts, items);
+    dmop.assertAllMatch(opts, items, vector<Item>());
+
+    dmop = DurabilityMultiOperation();
+    dmop.run(instance, &opts, items);
+    dmop.assertAllMatch(opts, items, vector<Item>());
+}
+
+/**
+ * @test Adaptive durability polling
+ *
+ * @pre Enable adaptive polling and check durability of several items
+ *
+ * @post All items satisfy the criteria, and a persistence estimate is
+ * available for the master of the first item
+ */
+TEST_F(DurabilityUnitTest, testAdaptiveInterval)
+{
+    LCB_TEST_REQUIRE_FEATURE("observe");
+    const unsigned limit = 10;
+    HandleWrap hwrap;
+    lcb_t instance;
+
+    createConnection(hwrap, instance);
+    lcb_cntl_setu32(instance, LCB_CNTL_DURABILITY_TIMEOUT, LCB_MS2US(10000));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "durability_adaptive", "true"));
+
+    vector<Item> items;
+    for (unsigned ii = 0; ii < limit; ii++) {
+        char buf[64];
+        sprintf(buf, "key-adaptive-%u", ii);
+        Item itm(buf, buf, 0);
+        KVOperation kvo(&itm);
+        kvo.store(instance);
+        items.push_back(kvo.result);
+    }
+
+    lcb_durability_opts_t opts = { 0 };
+    defaultOptions(instance, opts);
+
+    for (int ii = 0; ii < 2; ii++) {
+        DurabilityMultiOperation dmop;
+        dmop.run(instance, &opts, items);
+        dmop.assertAllMatch(opts, items, vector<Item>());
+    }
+
+    lcb_cntl_vbinfo_t vbi = { 0 };
+    vbi.v.v0.key = items[0].key.c_str();
+    vbi.v.v0.nkey = items[0].key.size();
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_VBMAP, &vbi));
+
+    lcb_DURABILITYLAG lag = { 0 };
+    lag.server_index = vbi.v.v0.server_index;
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_DURABILITY_LAG, &lag));
+    ASSERT_NE(0, lag.persist_lag);
+
+    lag.server_index = -1;
+    ASSERT_EQ(LCB_ECTL_BADARG, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_DURABILITY_LAG, &lag));
+}
+
 struct cb_cookie {
     int is_observe;
     int count;
@@ -459,6 +459,17 @@ TEST_F(GetUnitTest, testGetReplica)
     lcb_wait(instance);
     ASSERT_EQ(0, rck.remaining);
 
+    // The "Fastest" mode should also find it, regardless of which replica
+    // it tries first
+    rcmd.strategy = LCB_REPLICA_FASTEST;
+    rck.remaining = 1;
+    lcb_sched_enter(instance);
+    err = lcb_rget3(instance, &rck, &rcmd);
+    ASSERT_EQ(LCB_SUCCESS, err);
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+    ASSERT_EQ(0, rck.remaining);
+
     // Test with an invalid index
     rcmd.index = nreplicas;
     rcmd.strategy = LCB_REPLICA_SELECT;
@@ -510,3 +521,247 @@ TEST_F(GetUnitTest, testGetReplica)
     lcb_sched_leave(instance);
     lcb_wait(instance);
 }
+
+extern "C" {
+static void hedgedGetCallback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPGET *resp = (const lcb_RESPGET *)rb;
+    std::map<std::string, int> *counts = (std::map<std::string, int> *)resp->cookie;
+    EXPECT_NE(0, resp->rflags & LCB_RESP_F_FINAL);
+    if (resp->rc == LCB_SUCCESS) {
+        EXPECT_EQ("hedged_value", std::string((const char *)resp->value, resp->nvalue));
+        (*counts)["hit"]++;
+    } else {
+        EXPECT_EQ(LCB_KEY_ENOENT, resp->rc);
+        (*counts)["miss"]++;
+    }
+}
+}
+
+/**
+ * @test Hedged reads
+ *
+ * @pre Make many hedged reads of an existing key and of a missing key, with
+ * the hedge percentile and budget set so that replica reads will be sent
+ *
+ * @post Each read is answered exactly once, and the statistics are
+ * consistent. Reads still in flight when the instance is destroyed do not
+ * leak.
+ */
+TEST_F(GetUnitTest, testHedgedGet)
+{
+    SKIP_UNLESS_MOCK();
+    HandleWrap hw;
+    lcb_t instance;
+    createConnection(hw, instance);
+    if (!lcb_get_num_replicas(instance)) {
+        printf("Not enough replicas for hedged get test\n");
+        return;
+    }
+
+    std::string key("a_key_HEDGED");
+    std::string missing("a_missing_key_HEDGED");
+    storeKey(instance, key, "hedged_value");
+    removeKey(instance, missing);
+
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "hedge_percentile", "1"));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "hedge_budget", "100"));
+    lcb_U32 pct = 0;
+    ASSERT_EQ(LCB_ECTL_BADARG, lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_HEDGE_PERCENTILE, &pct));
+
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, hedgedGetCallback);
+    std::map<std::string, int> counts;
+    const int niters = 200;
+
+    lcb_sched_enter(instance);
+    for (int ii = 0; ii < niters; ii++) {
+        lcb_CMDGET cmd = { 0 };
+        cmd.cmdflags = LCB_CMDGET_F_HEDGE;
+        LCB_CMD_SET_KEY(&cmd, key.c_str(), key.size());
+        ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &counts, &cmd));
+        LCB_CMD_SET_KEY(&cmd, missing.c_str(), missing.size());
+        ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &counts, &cmd));
+    }
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+
+    ASSERT_EQ(niters, counts["hit"]);
+    ASSERT_EQ(niters, counts["miss"]);
+
+    lcb_HEDGESTATS stats = { 0 };
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_HEDGE_STATS, &stats));
+    ASSERT_LE(stats.won, stats.issued);
+    ASSERT_LE(stats.issued, (lcb_U64)niters * 2 + 10);
+
+    // Leave some reads in flight. Their state must be released when the
+    // instance is destroyed (checked when running under valgrind)
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, NULL);
+    lcb_sched_enter(instance);
+    for (int ii = 0; ii < 10; ii++) {
+        lcb_CMDGET cmd = { 0 };
+        cmd.cmdflags = LCB_CMDGET_F_HEDGE;
+        LCB_CMD_SET_KEY(&cmd, key.c_str(), key.size());
+        ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, NULL, &cmd));
+    }
+    lcb_sched_leave(instance);
+}
+
+extern "C" {
+static void coalescedGetCallback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPGET *resp = (const lcb_RESPGET *)rb;
+    int *ncalled = (int *)resp->cookie;
+    EXPECT_EQ(LCB_SUCCESS, resp->rc);
+    EXPECT_NE(0, resp->rflags & LCB_RESP_F_FINAL);
+    EXPECT_EQ("coalesced_value", std::string((const char *)resp->value, resp->nvalue));
+    (*ncalled)++;
+}
+
+static void coalescedValueCallback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPGET *resp = (const lcb_RESPGET *)rb;
+    std::string *value = (std::string *)resp->cookie;
+    EXPECT_EQ(LCB_SUCCESS, resp->rc);
+    value->assign((const char *)resp->value, resp->nvalue);
+}
+}
+
+/**
+ * @test Coalesced reads
+ *
+ * @pre Enable GET coalescing and make several concurrent reads of the same
+ * key. Then attach a read to an outstanding one, and fail its context.
+ * Finally read, store and read the key again within one context.
+ *
+ * @post Each read is answered exactly once with the value. The read in the
+ * failed context is not answered. A read issued after a store of the key
+ * returns the stored value.
+ */
+TEST_F(GetUnitTest, testCoalescedGet)
+{
+    HandleWrap hw;
+    lcb_t instance;
+    createConnection(hw, instance);
+
+    std::string key("a_key_COALESCED");
+    storeKey(instance, key, "coalesced_value");
+
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "get_coalesce", "true"));
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, coalescedGetCallback);
+
+    lcb_CMDGET cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, key.c_str(), key.size());
+
+    const int ncookies = 20;
+    int counts[ncookies] = { 0 };
+    lcb_sched_enter(instance);
+    for (int ii = 0; ii < ncookies; ii++) {
+        ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &counts[ii], &cmd));
+    }
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+    for (int ii = 0; ii < ncookies; ii++) {
+        ASSERT_EQ(1, counts[ii]);
+    }
+
+    int leader = 0, failed = 0;
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &leader, &cmd));
+    lcb_sched_leave(instance);
+
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &failed, &cmd));
+    lcb_sched_fail(instance);
+    lcb_wait(instance);
+    ASSERT_EQ(1, leader);
+    ASSERT_EQ(0, failed);
+
+    // A read issued after a store is not attached to a read issued before it
+    std::string before, after;
+    lcb_CMDSTORE scmd = { 0 };
+    scmd.operation = LCB_SET;
+    LCB_CMD_SET_KEY(&scmd, key.c_str(), key.size());
+    LCB_CMD_SET_VALUE(&scmd, "coalesced_value_2", strlen("coalesced_value_2"));
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, coalescedValueCallback);
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &before, &cmd));
+    ASSERT_EQ(LCB_SUCCESS, lcb_store3(instance, NULL, &scmd));
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &after, &cmd));
+    lcb_sched_leave(instance);
+    lcb_wait(instance);
+    ASSERT_EQ("coalesced_value", before);
+    ASSERT_EQ("coalesced_value_2", after);
+}
+
+extern "C" {
+static void nearCacheGetCallback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPGET *resp = (const lcb_RESPGET *)rb;
+    std::string *value = (std::string *)resp->cookie;
+    EXPECT_EQ(LCB_SUCCESS, resp->rc);
+    EXPECT_NE(0, resp->rflags & LCB_RESP_F_FINAL);
+    value->assign((const char *)resp->value, resp->nvalue);
+}
+}
+
+/**
+ * @test Near cache
+ *
+ * @pre Enable the near cache and read a key twice. Modify the key and read it
+ * again, then read it with revalidation of expired items
+ *
+ * @post The second read is served from the cache. The read after the
+ * modification returns the new value
+ */
+TEST_F(GetUnitTest, testNearCache)
+{
+    HandleWrap hw;
+    lcb_t instance;
+    createConnection(hw, instance);
+
+    std::string key("a_key_NEARCACHE");
+    storeKey(instance, key, "value_1");
+
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "nearcache_size", "100"));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "nearcache_ttl", "60"));
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, nearCacheGetCallback);
+
+    lcb_CMDGET cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, key.c_str(), key.size());
+    lcb_NEARCACHESTATS stats;
+
+    for (int ii = 0; ii < 2; ii++) {
+        std::string value;
+        ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &value, &cmd));
+        lcb_wait(instance);
+        ASSERT_EQ("value_1", value);
+    }
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_NEARCACHE_STATS, &stats));
+    ASSERT_EQ(1, stats.misses);
+    ASSERT_EQ(1, stats.hits);
+
+    // A hit in a failed context is not delivered
+    std::string failed;
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &failed, &cmd));
+    lcb_sched_fail(instance);
+    lcb_wait(instance);
+    ASSERT_TRUE(failed.empty());
+
+    // Our own mutation invalidates the entry
+    storeKey(instance, key, "value_2");
+    lcb_install_callback3(instance, LCB_CALLBACK_GET, nearCacheGetCallback);
+    std::string value;
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &value, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ("value_2", value);
+
+    // Expired entries are revalidated (or fetched again)
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "nearcache_revalidate", "true"));
+    lcb_U32 ttl = 1;
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_NEARCACHE_TTL, &ttl));
+    value.clear();
+    ASSERT_EQ(LCB_SUCCESS, lcb_get3(instance, &value, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ("value_2", value);
+}
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "iotests.h"
 #include <map>
+#include <algorithm>
 
 #define DESIGN_DOC_NAME "lcb_design_doc"
 #define VIEW_NAME "lcb-test-view"
@@ -350,6 +351,76 @@ TEST_F(HttpUnitTest, testAdminApi)
 }
 
 
+extern "C" {
+static lcb_SSIZE bodySource_read(void *cookie, char *buf, lcb_SIZE nbuf)
+{
+    std::string *remaining = reinterpret_cast<std::string*>(cookie);
+    size_t n = std::min(remaining->size(), (size_t)nbuf);
+    memcpy(buf, remaining->c_str(), n);
+    remaining->erase(0, n);
+    return n;
+}
+}
+
+// Streamed request bodies. As in testAdminApi, the requests must be cancelled
+// since the mock does not accept request bodies
+TEST_F(HttpUnitTest, testStreamedBody)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    std::string pth;
+    createConnection(hw, instance);
+    lcb_install_callback3(instance, LCB_CALLBACK_HTTP, http_callback);
+
+    lcb_CMDHTTP cmd = { 0 };
+    makeAdminReq(cmd, pth);
+    cmd.method = LCB_HTTP_METHOD_PUT;
+
+    std::string remaining("FOOBAR");
+    lcb_HTTPBODYSOURCE source = { bodySource_read, &remaining, 0 };
+    lcb_IOV iov[2];
+    iov[0].iov_base = (void *)"FOO";
+    iov[0].iov_len = 3;
+    iov[1].iov_base = (void *)"BAR";
+    iov[1].iov_len = 3;
+
+    // Only one kind of body may be used, and a source needs a callback
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYIOV|LCB_CMDHTTP_F_BODYSTREAM;
+    cmd.body = (const char *)iov;
+    cmd.nbody = 2;
+    ASSERT_EQ(LCB_EINVAL, lcb_http3(instance, NULL, &cmd));
+
+    lcb_HTTPBODYSOURCE nosource = { NULL, NULL, 0 };
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYSTREAM;
+    cmd.body = (const char *)&nosource;
+    ASSERT_EQ(LCB_EINVAL, lcb_http3(instance, NULL, &cmd));
+
+    lcb_http_request_t reqh = NULL;
+    cmd.reqhandle = &reqh;
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYIOV;
+    cmd.body = (const char *)iov;
+    cmd.nbody = 2;
+    lcb_sched_enter(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, NULL, &cmd));
+    ASSERT_FALSE(reqh == NULL);
+    lcb_sched_leave(instance);
+    lcb_cancel_http_request(instance, reqh);
+
+    // Chunked transfer encoding, and then a known length
+    for (size_t ii = 0; ii < 2; ii++) {
+        reqh = NULL;
+        source.length = ii ? remaining.size() : 0;
+        cmd.cmdflags = LCB_CMDHTTP_F_BODYSTREAM;
+        cmd.body = (const char *)&source;
+        cmd.nbody = 0;
+        lcb_sched_enter(instance);
+        ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, NULL, &cmd));
+        ASSERT_FALSE(reqh == NULL);
+        lcb_sched_leave(instance);
+        lcb_cancel_http_request(instance, reqh);
+    }
+}
+
 extern "C" {
 static void doubleCancel_callback(lcb_t instance, int, const lcb_RESPBASE *rb)
 {
@@ -184,6 +184,34 @@ TEST_F(QueryUnitTest, testPrepareOk)
     ASSERT_FALSE(plan.empty());
 }
 
+TEST_F(QueryUnitTest, testAutoPrepare)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    if (!createQueryConnection(hw, instance)) {
+        SKIP_QUERY_TEST();
+    }
+    lcb_U32 threshold = 2;
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_SET, LCB_CNTL_N1QL_AUTOPREPARE, &threshold));
+
+    string query("SELECT mockrow");
+    string plan;
+    for (int ii = 0; ii < 2; ii++) {
+        lcb_CMDN1QL cmd = { 0 };
+        N1QLResult res;
+        // Differences in whitespace are the same statement
+        makeCommand(ii ? "SELECT  mockrow " : "SELECT mockrow", cmd);
+        ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_query(instance, &res, &cmd));
+        lcb_wait(instance);
+        ASSERT_EQ(LCB_SUCCESS, res.rc);
+        ASSERT_EQ(1, res.rows.size());
+
+        lcb_n1qlcache_getplan(instance->n1ql_cache, query, plan);
+        // Prepared once seen often enough
+        ASSERT_EQ(ii == 0, plan.empty());
+    }
+}
+
 TEST_F(QueryUnitTest, testPrepareStale)
 {
     lcb_t instance;
@@ -268,3 +296,174 @@ TEST_F(QueryUnitTest, testCancellation)
     lcb_wait(instance);
     ASSERT_FALSE(res.called);
 }
+
+struct PausedResult : N1QLResult {
+    lcb_t instance;
+    lcb_N1QLHANDLE handle;
+    lcbio_pTIMER resume_timer;
+    bool pause_on_row;
+    bool called_while_paused;
+    bool paused;
+};
+
+extern "C" {
+static void paused_rowcb(lcb_t instance, int cbtype, const lcb_RESPN1QL *resp)
+{
+    PausedResult *res = reinterpret_cast<PausedResult*>(resp->cookie);
+    if (res->paused) {
+        res->called_while_paused = true;
+    }
+    rowcb(instance, cbtype, resp);
+    if (res->pause_on_row && !(resp->rflags & LCB_RESP_F_FINAL)) {
+        lcb_n1ql_pause(instance, res->handle);
+        res->paused = true;
+        lcbio_timer_rearm(res->resume_timer, LCB_MS2US(200));
+    }
+}
+
+static void resume_query(void *arg)
+{
+    PausedResult *res = reinterpret_cast<PausedResult*>(arg);
+    res->paused = false;
+    lcb_n1ql_resume(res->instance, res->handle);
+}
+}
+
+TEST_F(QueryUnitTest, testPauseResume)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    if (!createQueryConnection(hw, instance)) {
+        SKIP_QUERY_TEST();
+    }
+
+    PausedResult res;
+    res.instance = instance;
+    res.handle = NULL;
+    res.resume_timer = lcbio_timer_new(instance->iotable, &res, resume_query);
+
+    // Pause before any rows arrive, and then from within the row callback
+    for (int pause_on_row = 0; pause_on_row < 2; pause_on_row++) {
+        lcb_CMDN1QL cmd = { 0 };
+        makeCommand("SELECT mockrow", cmd);
+        cmd.callback = paused_rowcb;
+        cmd.handle = &res.handle;
+        res.reset();
+        res.pause_on_row = pause_on_row;
+        res.called_while_paused = false;
+        res.paused = false;
+
+        ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_query(instance, &res, &cmd));
+        if (!pause_on_row) {
+            lcb_n1ql_pause(instance, res.handle);
+            res.paused = true;
+            lcbio_timer_rearm(res.resume_timer, LCB_MS2US(200));
+        }
+        lcb_wait(instance);
+
+        ASSERT_FALSE(res.called_while_paused);
+        ASSERT_FALSE(res.paused);
+        ASSERT_EQ(LCB_SUCCESS, res.rc);
+        ASSERT_EQ(1, res.rows.size());
+    }
+    lcbio_timer_destroy(res.resume_timer);
+}
+
+struct GroupResult {
+    std::vector<N1QLResult> results;
+    size_t nfinal;
+    size_t ncalls;
+    lcb_N1QLGROUPHANDLE handle;
+    /** Cancel the group from within the first final callback */
+    bool cancel;
+};
+
+extern "C" {
+static void groupcb(lcb_t instance, size_t index, const lcb_RESPN1QL *resp)
+{
+    GroupResult *gres = reinterpret_cast<GroupResult*>(resp->cookie);
+    N1QLResult& res = gres->results[index];
+    gres->ncalls++;
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        res.rc = resp->rc;
+        gres->nfinal++;
+        if (gres->cancel) {
+            gres->cancel = false;
+            lcb_n1ql_group_cancel(instance, gres->handle);
+        }
+    } else {
+        res.rows.push_back(string(static_cast<const char*>(resp->row), resp->nrow));
+    }
+    res.called = true;
+}
+}
+
+TEST_F(QueryUnitTest, testGroup)
+{
+    lcb_t instance;
+    HandleWrap hw;
+    if (!createQueryConnection(hw, instance)) {
+        SKIP_QUERY_TEST();
+    }
+
+    const size_t nstmts = 10;
+    std::vector<lcb_CMDN1QL> cmds(nstmts);
+    std::vector<string> queries(nstmts);
+    for (size_t ii = 0; ii < nstmts; ii++) {
+        lcb_CMDN1QL cmd = { 0 };
+        makeCommand("SELECT mockrow", cmd);
+        // The group copies the statements
+        queries[ii].assign(cmd.query, cmd.nquery);
+        cmds[ii] = cmd;
+        cmds[ii].query = queries[ii].c_str();
+    }
+
+    GroupResult gres;
+    gres.results.resize(nstmts);
+    gres.nfinal = 0;
+    gres.ncalls = 0;
+    gres.handle = NULL;
+    gres.cancel = false;
+
+    lcb_CMDN1QLGROUP gcmd = { 0 };
+    gcmd.cmds = &cmds[0];
+    gcmd.ncmds = nstmts;
+    gcmd.max_per_node = 1;
+    ASSERT_EQ(LCB_EINVAL, lcb_n1ql_group(instance, &gres, &gcmd));
+
+    gcmd.callback = groupcb;
+    gcmd.handle = &gres.handle;
+    ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_group(instance, &gres, &gcmd));
+    ASSERT_TRUE(gres.handle != NULL);
+    lcb_wait(instance);
+
+    ASSERT_EQ(nstmts, gres.nfinal);
+    for (size_t ii = 0; ii < nstmts; ii++) {
+        ASSERT_EQ(LCB_SUCCESS, gres.results[ii].rc);
+        ASSERT_EQ(1, gres.results[ii].rows.size());
+    }
+
+    // With one statement in progress per node, cancelling the group from the
+    // first final callback leaves at most one statement per query node
+    // completed, and the rest are never issued
+    lcbvb_CONFIG *vbc;
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl(instance, LCB_CNTL_GET, LCB_CNTL_VBCONFIG, &vbc));
+    size_t nnodes = 0;
+    for (unsigned ii = 0; ii < LCBVB_NSERVERS(vbc); ii++) {
+        if (lcbvb_get_port(vbc, ii, LCBVB_SVCTYPE_N1QL, LCBVB_SVCMODE_PLAIN)) {
+            nnodes++;
+        }
+    }
+    gres.results.assign(nstmts, N1QLResult());
+    gres.nfinal = gres.ncalls = 0;
+    gres.cancel = true;
+    ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_group(instance, &gres, &gcmd));
+    lcb_wait(instance);
+    ASSERT_EQ(1, gres.nfinal);
+    ASSERT_LE(gres.ncalls, nnodes + 1);
+    size_t ncalled = 0;
+    for (size_t ii = 0; ii < nstmts; ii++) {
+        ncalled += gres.results[ii].called;
+    }
+    ASSERT_LE(ncalled, nnodes);
+}
@@ -86,6 +86,7 @@ struct MultiResult {
     lcb_error_t rc;
     unsigned cbtype;
     bool is_single;
+    bool indexed_ok;
 
     void clear() {
         cas = 0;
@@ -93,6 +94,7 @@ struct MultiResult {
         cbtype = 0;
         rc = LCB_AUTH_CONTINUE;
         is_single = false;
+        indexed_ok = false;
     }
 
     size_t size() const {
@@ -209,10 +211,24 @@ subdocCallback(lcb_t, int cbtype, const lcb_RESPBASE *rb)
         mr->is_single = true;
     }
     size_t iterval = 0;
+    size_t first = mr->results.size();
     lcb_SDENTRY cur_res;
     while (lcb_sdresult_next(resp, &cur_res, &iterval)) {
         mr->results.push_back(Result(&cur_res));
     }
+
+    // Random access must yield the same results, in any order
+    size_t count = lcb_sdresult_count(resp);
+    mr->indexed_ok = count == mr->results.size() - first &&
+            !lcb_sdresult_at(resp, count, &cur_res);
+    for (size_t ii = count; ii > 0 && mr->indexed_ok; --ii) {
+        const Result& expected = mr->results[first + ii - 1];
+        Result actual;
+        mr->indexed_ok = lcb_sdresult_at(resp, ii - 1, &cur_res) != 0;
+        actual.assign(&cur_res);
+        mr->indexed_ok = mr->indexed_ok && actual.rc == expected.rc &&
+                actual.index == expected.index && actual.value == expected.value;
+    }
 }
 }
 
@@ -677,6 +693,7 @@ TEST_F(SubdocUnitTest, testMultiLookup)
 
     ASSERT_EQ(LCB_SUBDOC_MULTI_FAILURE, mr.rc);
     ASSERT_EQ(4, mr.results.size());
+    ASSERT_TRUE(mr.indexed_ok);
 //    ASSERT_NE(0, mr.cas);
 
     ASSERT_EQ("\"dictval\"", mr.results[0].value);
@@ -745,6 +762,7 @@ TEST_F(SubdocUnitTest, testMultiMutations)
 
     // COUNTER returns a value
     ASSERT_EQ(1, mr.results.size());
+    ASSERT_TRUE(mr.indexed_ok);
     ASSERT_EQ("42", mr.results[0].value);
     ASSERT_EQ(1, mr.results[0].index);
     ASSERT_EQ(LCB_SUCCESS, mr.results[0].rc);
@@ -820,3 +838,65 @@ TEST_F(SubdocUnitTest, testGetCount) {
     ASSERT_EQ(LCB_SUCCESS, mres.results[1].rc);
     ASSERT_EQ("5", mres.results[1].value);
 }
+
+TEST_F(SubdocUnitTest, testMultiEncoding)
+{
+    HandleWrap hw;
+    lcb_t instance;
+    CREATE_SUBDOC_CONNECTION(hw, instance);
+
+    const size_t maxspecs = 16;
+    std::vector<std::string> paths, values;
+    for (size_t ii = 0; ii < maxspecs; ++ii) {
+        char buf[32];
+        sprintf(buf, "path%u", (unsigned)ii);
+        paths.push_back(buf);
+        sprintf(buf, "%u", (unsigned)(ii * 1000));
+        values.push_back(buf);
+    }
+
+    // Every spec (and each fragment of an IOV value) must be encoded intact
+    lcb_IOV iov[2];
+    iov[0].iov_base = const_cast<char*>("[1,");
+    iov[0].iov_len = 3;
+    iov[1].iov_base = const_cast<char*>("2]");
+    iov[1].iov_len = 2;
+
+    std::vector<lcb_SDSPEC> specs(maxspecs);
+    for (size_t ii = 0; ii < maxspecs; ++ii) {
+        lcb_SDSPEC *spec = &specs[ii];
+        memset(spec, 0, sizeof *spec);
+        spec->sdcmd = LCB_SDCMD_DICT_UPSERT;
+        LCB_SDSPEC_SET_PATH(spec, paths[ii].c_str(), paths[ii].size());
+        if (ii == maxspecs - 1) {
+            spec->value.vtype = LCB_KV_IOV;
+            spec->value.u_buf.multi.iov = iov;
+            spec->value.u_buf.multi.niov = 2;
+            // An inaccurate total_length must not truncate (or overflow) it
+            spec->value.u_buf.multi.total_length = 1;
+        } else {
+            LCB_SDSPEC_SET_VALUE(spec, values[ii].c_str(), values[ii].size());
+        }
+    }
+
+    MultiResult mr;
+    lcb_CMDSUBDOC cmd = { 0 };
+    LCB_CMD_SET_KEY(&cmd, key.c_str(), key.size());
+    cmd.specs = &specs[0];
+    cmd.nspecs = maxspecs;
+    ASSERT_EQ(LCB_SUCCESS, schedwait(instance, &mr, &cmd, lcb_subdoc3));
+    ASSERT_EQ(LCB_SUCCESS, mr.rc);
+
+    for (size_t ii = 0; ii < maxspecs; ++ii) {
+        specs[ii].sdcmd = LCB_SDCMD_GET;
+        LCB_SDSPEC_SET_VALUE(&specs[ii], NULL, 0);
+    }
+    ASSERT_EQ(LCB_SUCCESS, schedwait(instance, &mr, &cmd, lcb_subdoc3));
+    ASSERT_EQ(LCB_SUCCESS, mr.rc);
+    ASSERT_EQ(maxspecs, mr.size());
+    ASSERT_TRUE(mr.indexed_ok);
+    for (size_t ii = 0; ii < maxspecs - 1; ++ii) {
+        ASSERT_EQ(values[ii], mr.results[ii].value);
+    }
+    ASSERT_EQ("[1,2]", mr.results[maxspecs - 1].value);
+}
@@ -41,6 +41,7 @@ struct CQWrap : mc_CMDQUEUE {
             SLLIST_ITERFOR(&pipeline->requests, &iter) {
                 mc_PACKET *pkt = SLLIST_ITEM(iter.cur, mc_PACKET, slnode);
                 sllist_iter_remove(&pipeline->requests, &iter);
+                pipeline->nrequests--;
                 mcreq_wipe_packet(pipeline, pkt);
                 mcreq_release_packet(pipeline, pkt);
             }
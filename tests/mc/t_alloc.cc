@@ -1,4 +1,5 @@
 #include "mctest.h"
+#include <vector>
 
 class McAlloc : public ::testing::Test {
 protected:
@@ -267,3 +268,62 @@ TEST_F(McAlloc, testRdataExDtor)
     mcreq_sched_fail(&q);
     ASSERT_EQ(0, ec.remaining);
 }
+
+// Allocate and release packets with values of varying sizes, with a fixed
+// number in flight, and report the rate. Also check that the buffers used
+// during a burst of large values are returned afterwards.
+TEST_F(McAlloc, testThroughput)
+{
+    static const lcb_size_t sizes[] = { 32, 65536, 32, 1024 };
+    const unsigned nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    const unsigned window = 256;
+    mc_PIPELINE pipeline;
+    std::vector<mc_PACKET*> inflight(window);
+    nb_STATS stats;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    setupPipeline(&pipeline);
+
+    for (unsigned ii = 0; ii < nsizes; ii++) {
+        unsigned nops = 16 * 1024 * 1024 / (sizes[ii] + 24);
+        if (nops > 200000) {
+            nops = 200000;
+        }
+        hrtime_t begin = gethrtime();
+        for (unsigned jj = 0; jj < nops + window; jj++) {
+            mc_PACKET *&slot = inflight[jj % window];
+            if (jj >= window) {
+                mcreq_wipe_packet(&pipeline, slot);
+                mcreq_release_packet(&pipeline, slot);
+            }
+            if (jj >= nops) {
+                continue;
+            }
+            slot = mcreq_allocate_packet(&pipeline);
+            ASSERT_TRUE(slot != NULL);
+            ASSERT_EQ(LCB_SUCCESS, mcreq_reserve_header(&pipeline, slot, 24));
+            ASSERT_EQ(LCB_SUCCESS, mcreq_reserve_value2(&pipeline, slot, sizes[ii]));
+        }
+        hrtime_t elapsed = gethrtime() - begin;
+        if (!elapsed) {
+            elapsed = 1;
+        }
+
+        // As the server's timer would, free what went unused in this run
+        netbuf_trim(&pipeline.nbmgr);
+        memset(&stats, 0, sizeof stats);
+        netbuf_get_stats(&pipeline.nbmgr, &stats);
+        printf("Value size %lu: %.0f ops/sec, %.1f MB/sec, %u bytes allocated\n",
+            (unsigned long)sizes[ii], nops * 1e9 / elapsed,
+            nops * (sizes[ii] + 24) * 1e3 / elapsed, stats.allocated);
+        ASSERT_EQ(0, stats.used);
+    }
+
+    // Nothing is in use, so everything left is freed by the next trim
+    netbuf_trim(&pipeline.nbmgr);
+    memset(&stats, 0, sizeof stats);
+    netbuf_get_stats(&pipeline.nbmgr, &stats);
+    ASSERT_EQ(0, stats.allocated);
+
+    mcreq_pipeline_cleanup(&pipeline);
+}
@@ -98,3 +98,48 @@ TEST_F(McContext, testFailedContext)
         ASSERT_EQ(0, mcreq_flush_iov_fill(pl, iov, 1, NULL));
     }
 }
+
+TEST_F(McContext, testRequestCount)
+{
+    CQWrap cq;
+    CtxCookie cookie;
+
+    mcreq_sched_enter(&cq);
+
+    for (int ii = 0; ii < 20; ii++) {
+        PacketWrap pw;
+        char kbuf[128];
+        sprintf(kbuf, "key_%d", ii);
+        pw.setCopyKey(kbuf);
+
+        ASSERT_TRUE(pw.reservePacket(&cq));
+
+        pw.setHeaderSize();
+        pw.copyHeader();
+        pw.setCookie(&cookie);
+        mcreq_sched_add(pw.pipeline, pw.pkt);
+        ASSERT_EQ(0, pw.pipeline->nrequests);
+    }
+
+    mcreq_sched_leave(&cq, 0);
+
+    unsigned total = 0;
+    for (unsigned ii = 0; ii < cq.npipelines; ii++) {
+        total += cq.pipelines[ii]->nrequests;
+    }
+    ASSERT_EQ(20, total);
+
+    for (unsigned ii = 0; ii < cq.npipelines; ii++) {
+        mc_PIPELINE *pl = cq.pipelines[ii];
+        unsigned nrequests = pl->nrequests;
+        cookie.plLength = 0;
+        ASSERT_EQ(nrequests, mcreq_pipeline_fail(pl, LCB_ERROR, failcb, NULL));
+        ASSERT_EQ(0, pl->nrequests);
+
+        nb_IOV iov[50];
+        unsigned toFlush = mcreq_flush_iov_fill(pl, iov, 50, NULL);
+        ASSERT_EQ(cookie.plLength, toFlush);
+        mcreq_flush_done(pl, toFlush, toFlush);
+    }
+    ASSERT_EQ(20, cookie.ncalled);
+}
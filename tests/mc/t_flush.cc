@@ -183,3 +183,44 @@ TEST_F(McFlush, testPartialFlush)
     mcreq_packet_handled(pw.pipeline, pw.pkt);
     ASSERT_EQ(1, cookie.ncalled);
 }
+
+TEST_F(McFlush, testTrace)
+{
+    CQWrap cq;
+    PacketWrap pw;
+    MyCookie cookie;
+
+    cq.trace = 1;
+    pw.setCopyKey("Hello");
+    ASSERT_TRUE(pw.reservePacket(&cq));
+    pw.setHeaderSize();
+    pw.copyHeader();
+    pw.setCookie(&cookie);
+
+    mcreq_sched_enter(&cq);
+    mcreq_sched_add(pw.pipeline, pw.pkt);
+    ASSERT_FALSE(pw.pkt->trace == NULL);
+    ASSERT_NE(0, pw.pkt->trace->sched);
+    ASSERT_EQ(0, pw.pkt->trace->enqueue);
+    mcreq_sched_leave(&cq, 0);
+
+    mc_PKTTRACE *trace = pw.pkt->trace;
+    ASSERT_GE(trace->enqueue, trace->sched);
+    ASSERT_EQ(0, trace->flush_start);
+
+    // Partial write: the write has started but is not complete
+    nb_IOV iov[10];
+    unsigned toFlush = mcreq_flush_iov_fill(pw.pipeline, iov, 10, NULL);
+    mcreq_flush_done(pw.pipeline, 1, toFlush);
+    ASSERT_GE(trace->flush_start, trace->enqueue);
+    ASSERT_EQ(0, trace->flush_done);
+
+    hrtime_t flush_start = trace->flush_start;
+    toFlush = mcreq_flush_iov_fill(pw.pipeline, iov, 10, NULL);
+    mcreq_flush_done(pw.pipeline, toFlush, toFlush);
+    ASSERT_EQ(flush_start, trace->flush_start);
+    ASSERT_GE(trace->flush_done, trace->flush_start);
+
+    mcreq_pipeline_remove(pw.pipeline, pw.pkt->opaque);
+    mcreq_packet_handled(pw.pipeline, pw.pkt);
+}
@@ -0,0 +1,132 @@
+#include "socktest.h"
+#include <ioserver/memdserver.h>
+#include <memcached/protocol_binary.h>
+
+/**
+ * Tests for racing CCCP bootstrap (the "bootstrap_race" setting) against
+ * loopback stand-in memcached servers
+ */
+class BootstrapRaceTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        instance = NULL;
+    }
+    void TearDown() {
+        if (instance) {
+            lcb_destroy(instance);
+        }
+    }
+
+    /**
+     * Connect to the given servers (in order), racing `race` of them at a
+     * time. Each server's configuration names `kvserver` as the only node.
+     * @return the bootstrap status
+     */
+    lcb_error_t connect(const std::vector<MemdServer*>& servers,
+        MemdServer *kvserver, unsigned race);
+
+    lcb_t instance;
+};
+
+lcb_error_t
+BootstrapRaceTest::connect(const std::vector<MemdServer*>& servers,
+    MemdServer *kvserver, unsigned race)
+{
+    char buf[1024];
+    unsigned kvport = kvserver->getListenPort();
+    sprintf(buf, "{\"rev\":1,\"name\":\"default\","
+        "\"nodeLocator\":\"vbucket\",\"uuid\":\"x\","
+        "\"nodes\":[{\"hostname\":\"127.0.0.1:8091\",\"ports\":{\"direct\":%u}}],"
+        "\"nodesExt\":[{\"hostname\":\"127.0.0.1\",\"services\":{\"mgmt\":8091,\"kv\":%u}}],"
+        "\"vBucketServerMap\":{\"hashAlgorithm\":\"CRC\",\"numReplicas\":0,"
+        "\"serverList\":[\"127.0.0.1:%u\"],\"vBucketMap\":[[0],[0]]}}",
+        kvport, kvport, kvport);
+    for (size_t ii = 0; ii < servers.size(); ii++) {
+        servers[ii]->setConfig(buf);
+    }
+
+    std::string connstr = "couchbase://";
+    for (size_t ii = 0; ii < servers.size(); ii++) {
+        sprintf(buf, "%s127.0.0.1:%u=mcd", ii ? "," : "",
+            (unsigned)servers[ii]->getListenPort());
+        connstr += buf;
+    }
+    sprintf(buf, "/default?bootstrap_on=cccp&randomize_nodes=false"
+        "&bootstrap_race=%u&config_node_timeout=10&config_total_timeout=20",
+        race);
+    connstr += buf;
+
+    struct lcb_create_st cropts = { 0 };
+    cropts.version = 3;
+    cropts.v.v3.connstr = connstr.c_str();
+    lcb_error_t rc = lcb_create(&instance, &cropts);
+    if (rc != LCB_SUCCESS) {
+        return rc;
+    }
+    if ((rc = lcb_connect(instance)) != LCB_SUCCESS) {
+        return rc;
+    }
+    lcb_wait(instance);
+    return lcb_get_bootstrap_status(instance);
+}
+
+TEST_F(BootstrapRaceTest, testFirstResponseWins)
+{
+    MemdServer slow, fast;
+    slow.setConfigDelay(8000);
+    // Give the slow attempt time to send its request, so that it is still
+    // waiting for a response when it loses
+    fast.setConfigDelay(200);
+    std::vector<MemdServer*> servers;
+    servers.push_back(&slow);
+    servers.push_back(&fast);
+
+    lcb_U64 begin = lcb_nstime();
+    ASSERT_EQ(LCB_SUCCESS, connect(servers, &fast, 2));
+    lcb_U64 elapsed = (lcb_nstime() - begin) / 1000000;
+
+    // The fast server answered, and the slow one was not waited for
+    ASSERT_LT(elapsed, 4000U);
+    ASSERT_EQ(1, slow.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+    ASSERT_EQ(1, fast.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+
+    // The losing attempt was still waiting for its response, so it cannot be
+    // pooled. It must have been closed.
+    for (int ii = 0; ii < 200 && slow.getClosedCount() == 0; ii++) {
+        usleep(10000);
+    }
+    ASSERT_EQ(1, slow.getConnectionCount());
+    ASSERT_EQ(1, slow.getClosedCount());
+}
+
+TEST_F(BootstrapRaceTest, testFailedAttemptFallsBack)
+{
+    MemdServer bad1, bad2, good;
+    bad1.setConfigFails(true);
+    bad2.setConfigFails(true);
+    std::vector<MemdServer*> servers;
+    servers.push_back(&bad1);
+    servers.push_back(&bad2);
+    servers.push_back(&good);
+
+    // Only two nodes are raced at a time, so the third is only tried once
+    // one of the others fails
+    ASSERT_EQ(LCB_SUCCESS, connect(servers, &good, 2));
+    ASSERT_EQ(1, bad1.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+    ASSERT_EQ(1, bad2.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+    ASSERT_EQ(1, good.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+}
+
+TEST_F(BootstrapRaceTest, testAllFail)
+{
+    MemdServer bad1, bad2;
+    bad1.setConfigFails(true);
+    bad2.setConfigFails(true);
+    std::vector<MemdServer*> servers;
+    servers.push_back(&bad1);
+    servers.push_back(&bad2);
+
+    ASSERT_NE(LCB_SUCCESS, connect(servers, &bad1, 2));
+    ASSERT_EQ(1, bad1.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+    ASSERT_EQ(1, bad2.getRequests(PROTOCOL_BINARY_CMD_GET_CLUSTER_CONFIG));
+}
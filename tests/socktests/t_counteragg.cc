@@ -0,0 +1,78 @@
+#include "socktest.h"
+#include <ioserver/memdserver.h>
+#include <memcached/protocol_binary.h>
+
+/**
+ * Tests for counter aggregation (the "counter_window" setting) against a
+ * loopback stand-in memcached server. The server doesn't implement
+ * INCREMENT, but counts the requests it receives.
+ */
+class CounterAggTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        char buf[1024];
+        unsigned port = server.getListenPort();
+        sprintf(buf, "{\"rev\":1,\"name\":\"default\","
+            "\"nodeLocator\":\"vbucket\",\"uuid\":\"x\","
+            "\"nodes\":[{\"hostname\":\"127.0.0.1:8091\",\"ports\":{\"direct\":%u}}],"
+            "\"nodesExt\":[{\"hostname\":\"127.0.0.1\",\"services\":{\"mgmt\":8091,\"kv\":%u}}],"
+            "\"vBucketServerMap\":{\"hashAlgorithm\":\"CRC\",\"numReplicas\":0,"
+            "\"serverList\":[\"127.0.0.1:%u\"],\"vBucketMap\":[[0],[0]]}}",
+            port, port, port);
+        server.setConfig(buf);
+
+        sprintf(buf, "couchbase://127.0.0.1:%u=mcd/default?bootstrap_on=cccp", port);
+        struct lcb_create_st cropts = { 0 };
+        cropts.version = 3;
+        cropts.v.v3.connstr = buf;
+        ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, &cropts));
+        ASSERT_EQ(LCB_SUCCESS, lcb_connect(instance));
+        lcb_wait(instance);
+        ASSERT_EQ(LCB_SUCCESS, lcb_get_bootstrap_status(instance));
+    }
+    void TearDown() {
+        lcb_destroy(instance);
+    }
+
+    MemdServer server;
+    lcb_t instance;
+};
+
+extern "C" {
+static void counter_callback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    (*(int *)rb->cookie)++;
+}
+}
+
+TEST_F(CounterAggTest, testImplicitFullBatches)
+{
+    lcb_install_callback3(instance, LCB_CALLBACK_COUNTER, counter_callback);
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window", "60"));
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window_ops", "3"));
+
+    int ncalled[5] = { 0 };
+    lcb_CMDCOUNTER cmd = { 0 };
+    cmd.delta = 1;
+
+    // Without an explicit scheduling context; none of the batches is full
+    LCB_CMD_SET_KEY(&cmd, "A", 1);
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &ncalled[0], &cmd));
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &ncalled[1], &cmd));
+    LCB_CMD_SET_KEY(&cmd, "B", 1);
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &ncalled[2], &cmd));
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &ncalled[3], &cmd));
+
+    // Now both batches are full, and are sent when the implicit context of
+    // this operation is left. Sending the first must not send the second
+    // again from within it.
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "counter_window_ops", "1"));
+    LCB_CMD_SET_KEY(&cmd, "A", 1);
+    ASSERT_EQ(LCB_SUCCESS, lcb_counter3(instance, &ncalled[4], &cmd));
+    lcb_wait(instance);
+
+    for (int ii = 0; ii < 5; ii++) {
+        ASSERT_EQ(1, ncalled[ii]);
+    }
+    ASSERT_EQ(2, server.getRequests(PROTOCOL_BINARY_CMD_INCREMENT));
+}
@@ -0,0 +1,901 @@
+#include "socktest.h"
+#include <ioserver/httpserver.h>
+#include <libcouchbase/n1ql.h>
+#include <libcouchbase/cbft.h>
+#include <libcouchbase/ixmgmt.h>
+#include "contrib/lcb-jsoncpp/lcb-jsoncpp.h"
+#include <algorithm>
+
+/**
+ * Tests for HTTP requests made against a loopback stand-in server, which
+ * records the bytes it receives
+ */
+class HttpLoopbackTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+    }
+    void TearDown() {
+        lcb_destroy(instance);
+        if (!cfgpath.empty()) {
+            remove(cfgpath.c_str());
+        }
+    }
+
+    /**
+     * Replace the instance with one bootstrapped from a cached cluster map,
+     * in which each server is a node running the given service
+     */
+    void bootstrap(const char *svc, const std::vector<HttpServer*>& servers);
+
+    lcb_t instance;
+    std::string cfgpath;
+};
+
+void
+HttpLoopbackTest::bootstrap(const char *svc, const std::vector<HttpServer*>& servers)
+{
+    std::string nodes, nodesext;
+    for (size_t ii = 0; ii < servers.size(); ii++) {
+        char buf[256];
+        sprintf(buf, "%s{\"hostname\":\"127.0.0.1:%u\",\"ports\":{\"direct\":%u}}",
+            ii ? "," : "", 8091 + (unsigned)ii, 11210 + (unsigned)ii);
+        nodes += buf;
+        sprintf(buf, "%s{\"hostname\":\"127.0.0.1\",\"services\":"
+            "{\"mgmt\":%u,\"kv\":%u,\"%s\":%u}}", ii ? "," : "",
+            8091 + (unsigned)ii, 11210 + (unsigned)ii, svc,
+            servers[ii]->getListenPort());
+        nodesext += buf;
+    }
+    std::string config = "{\"rev\":1,\"name\":\"default\","
+        "\"nodeLocator\":\"vbucket\",\"uuid\":\"x\","
+        "\"nodes\":[" + nodes + "],\"nodesExt\":[" + nodesext + "],"
+        "\"vBucketServerMap\":{\"hashAlgorithm\":\"CRC\",\"numReplicas\":0,"
+        "\"serverList\":[\"127.0.0.1:11210\"],\"vBucketMap\":[[0],[0]]}}";
+
+    char buf[64];
+    sprintf(buf, "/lcb_httptest_%p.json", (void *)this);
+    cfgpath = std::string(lcb_get_tmpdir()) + buf;
+    FILE *fp = fopen(cfgpath.c_str(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "%s{{{fb85b563d0a8f65fa8d3d58f1b3a0708}}}", config.c_str());
+    fclose(fp);
+
+    lcb_destroy(instance);
+    std::string connstr = "couchbase://127.0.0.1/default?config_cache=" + cfgpath;
+    struct lcb_create_st cropts = { 0 };
+    cropts.version = 3;
+    cropts.v.v3.connstr = connstr.c_str();
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, &cropts));
+    ASSERT_EQ(LCB_SUCCESS, lcb_connect(instance));
+    lcb_wait(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_get_bootstrap_status(instance));
+}
+
+namespace {
+struct HttpResult {
+    HttpResult() : called(0), rc(LCB_ERROR), htstatus(0) {}
+    int called;
+    lcb_error_t rc;
+    short htstatus;
+};
+
+/** Supplies the body in pieces of at most `maxpiece` bytes */
+struct BodySource {
+    std::string remaining;
+    size_t maxpiece;
+    size_t nreads;
+};
+}
+
+extern "C" {
+static void http_callback(lcb_t, int, const lcb_RESPBASE *rb)
+{
+    const lcb_RESPHTTP *resp = (const lcb_RESPHTTP *)rb;
+    HttpResult *res = (HttpResult *)resp->cookie;
+    res->called++;
+    res->rc = resp->rc;
+    res->htstatus = resp->htstatus;
+}
+
+static lcb_SSIZE bodySource_read(void *cookie, char *buf, lcb_SIZE nbuf)
+{
+    BodySource *src = reinterpret_cast<BodySource*>(cookie);
+    size_t n = std::min(std::min(src->remaining.size(), (size_t)nbuf), src->maxpiece);
+    memcpy(buf, src->remaining.c_str(), n);
+    src->remaining.erase(0, n);
+    src->nreads++;
+    return n;
+}
+}
+
+static std::string
+makeBody(size_t n)
+{
+    std::string ret;
+    for (size_t ii = 0; ii < n; ii++) {
+        ret += (char)('a' + (ii * 7) % 26);
+    }
+    return ret;
+}
+
+static void
+initRawCmd(lcb_CMDHTTP& cmd, const std::string& host)
+{
+    memset(&cmd, 0, sizeof cmd);
+    cmd.type = LCB_HTTP_TYPE_RAW;
+    cmd.method = LCB_HTTP_METHOD_PUT;
+    cmd.host = host.c_str();
+    LCB_CMD_SET_KEY(&cmd, "/upload", strlen("/upload"));
+    cmd.content_type = "application/octet-stream";
+}
+
+TEST_F(HttpLoopbackTest, testIovBody)
+{
+    HttpServer server;
+    std::string host = server.getHostPort();
+    lcb_install_callback3(instance, LCB_CALLBACK_HTTP, http_callback);
+
+    std::string big = makeBody(40000);
+    lcb_IOV iov[3];
+    iov[0].iov_base = (void *)"FOO";
+    iov[0].iov_len = 3;
+    iov[1].iov_base = (void *)big.c_str();
+    iov[1].iov_len = big.size();
+    iov[2].iov_base = (void *)"BAR";
+    iov[2].iov_len = 3;
+
+    HttpResult res;
+    lcb_CMDHTTP cmd;
+    initRawCmd(cmd, host);
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYIOV;
+    cmd.body = (const char *)iov;
+    cmd.nbody = 3;
+    ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, &res, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ(1, res.called);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(200, res.htstatus);
+
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(1, reqs.size());
+    ASSERT_EQ("PUT", reqs[0].method);
+    ASSERT_EQ("/upload", reqs[0].path);
+    ASSERT_FALSE(reqs[0].chunked);
+    ASSERT_EQ("40006", reqs[0].header("Content-Length"));
+    ASSERT_EQ("FOO" + big + "BAR", reqs[0].body);
+    ASSERT_EQ(reqs[0].head + "FOO" + big + "BAR", reqs[0].raw);
+}
+
+TEST_F(HttpLoopbackTest, testStreamedBodyChunked)
+{
+    HttpServer server;
+    std::string host = server.getHostPort();
+    lcb_install_callback3(instance, LCB_CALLBACK_HTTP, http_callback);
+
+    BodySource src;
+    std::string body = makeBody(40000);
+    src.remaining = body;
+    src.maxpiece = 10000;
+    src.nreads = 0;
+    lcb_HTTPBODYSOURCE source = { bodySource_read, &src, 0 };
+
+    HttpResult res;
+    lcb_CMDHTTP cmd;
+    initRawCmd(cmd, host);
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYSTREAM;
+    cmd.body = (const char *)&source;
+    ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, &res, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ(1, res.called);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(200, res.htstatus);
+    ASSERT_TRUE(src.remaining.empty());
+
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(1, reqs.size());
+    ASSERT_TRUE(reqs[0].chunked);
+    ASSERT_EQ("", reqs[0].header("Content-Length"));
+    ASSERT_EQ(body, reqs[0].body);
+
+    // Each read is sent as its own chunk, followed by the last chunk
+    std::string framed = reqs[0].head;
+    for (size_t ii = 0; ii < body.size(); ii += 10000) {
+        char hdr[32];
+        sprintf(hdr, "%x\r\n", 10000);
+        framed += hdr + body.substr(ii, 10000) + "\r\n";
+    }
+    framed += "0\r\n\r\n";
+    ASSERT_EQ(framed, reqs[0].raw);
+}
+
+TEST_F(HttpLoopbackTest, testStreamedBodyLength)
+{
+    HttpServer server;
+    std::string host = server.getHostPort();
+    lcb_install_callback3(instance, LCB_CALLBACK_HTTP, http_callback);
+
+    BodySource src;
+    std::string body = makeBody(40000);
+    src.remaining = body;
+    src.maxpiece = 7000;
+    src.nreads = 0;
+    lcb_HTTPBODYSOURCE source = { bodySource_read, &src, body.size() };
+
+    HttpResult res;
+    lcb_CMDHTTP cmd;
+    initRawCmd(cmd, host);
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYSTREAM;
+    cmd.body = (const char *)&source;
+    ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, &res, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ(1, res.called);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(200, res.htstatus);
+    ASSERT_LE(6, src.nreads);
+
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(1, reqs.size());
+    ASSERT_FALSE(reqs[0].chunked);
+    ASSERT_EQ("40000", reqs[0].header("Content-Length"));
+    ASSERT_EQ(reqs[0].head + body, reqs[0].raw);
+}
+
+namespace {
+/** Answers every N1QL query with a single row */
+class QueryServer : public HttpServer {
+public:
+    QueryServer() : delay_ms(0), close(false) {}
+    unsigned delay_ms;
+    std::string headers;
+    bool close;
+
+protected:
+    void handle(const Request&, Response& resp) {
+        resp.body = "{\"results\":[{\"n\":1}],\"status\":\"success\"}";
+        resp.delay_ms = delay_ms;
+        resp.headers = headers;
+        resp.close = close;
+    }
+};
+
+struct QueryResult {
+    QueryResult() : nrows(0), nfinal(0), rc(LCB_ERROR) {}
+    int nrows;
+    int nfinal;
+    lcb_error_t rc;
+};
+}
+
+extern "C" {
+static void n1ql_callback(lcb_t, int, const lcb_RESPN1QL *resp)
+{
+    QueryResult *res = (QueryResult *)resp->cookie;
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        res->nfinal++;
+        res->rc = resp->rc;
+    } else {
+        res->nrows++;
+    }
+}
+}
+
+/** Issue `n` distinct queries, without waiting for them */
+static void
+issueQueries(lcb_t instance, std::vector<QueryResult>& results, size_t n)
+{
+    results.assign(n, QueryResult());
+    for (size_t ii = 0; ii < n; ii++) {
+        char query[64];
+        sprintf(query, "{\"statement\":\"SELECT %u\"}", (unsigned)ii);
+        lcb_CMDN1QL cmd = { 0 };
+        cmd.query = query;
+        cmd.nquery = strlen(query);
+        cmd.callback = n1ql_callback;
+        ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_query(instance, &results[ii], &cmd));
+    }
+}
+
+static void
+checkQueries(const std::vector<QueryResult>& results)
+{
+    for (size_t ii = 0; ii < results.size(); ii++) {
+        ASSERT_EQ(1, results[ii].nrows);
+        ASSERT_EQ(1, results[ii].nfinal);
+        ASSERT_EQ(LCB_SUCCESS, results[ii].rc);
+    }
+}
+
+TEST_F(HttpLoopbackTest, testDispatchLimit)
+{
+    QueryServer server;
+    server.delay_ms = 50;
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "http_max_concurrent", "2"));
+    // Keep both connections in the pool when their requests complete together
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "http_poolsize", "2"));
+
+    // Requests beyond the limit are queued until others complete, and
+    // then reuse their connections
+    std::vector<QueryResult> results;
+    issueQueries(instance, results, 6);
+    lcb_wait(instance);
+    checkQueries(results);
+    ASSERT_EQ(6, server.getRequests().size());
+    ASSERT_EQ(2, server.getMaxActive());
+    ASSERT_EQ(2, server.getConnectionCount());
+
+    // Queued requests are started in order
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "http_max_concurrent", "1"));
+    server.delay_ms = 10;
+    issueQueries(instance, results, 4);
+    lcb_wait(instance);
+    checkQueries(results);
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(10, reqs.size());
+    for (size_t ii = 0; ii < 4; ii++) {
+        char stmt[32];
+        sprintf(stmt, "SELECT %u\"", (unsigned)ii);
+        ASSERT_NE(std::string::npos, reqs[6 + ii].body.find(stmt)) << reqs[6 + ii].body;
+    }
+}
+
+TEST_F(HttpLoopbackTest, testDispatchLeastOutstanding)
+{
+    QueryServer server1, server2;
+    server1.delay_ms = server2.delay_ms = 50;
+    std::vector<HttpServer*> servers;
+    servers.push_back(&server1);
+    servers.push_back(&server2);
+    bootstrap("n1ql", servers);
+
+    // Each request goes to the node with the fewest in progress
+    std::vector<QueryResult> results;
+    issueQueries(instance, results, 6);
+    lcb_wait(instance);
+    checkQueries(results);
+    ASSERT_EQ(3, server1.getRequests().size());
+    ASSERT_EQ(3, server2.getRequests().size());
+    ASSERT_EQ(3, server1.getMaxActive());
+    ASSERT_EQ(3, server2.getMaxActive());
+}
+
+TEST_F(HttpLoopbackTest, testKeepAlive)
+{
+    QueryServer server, shortlived, closing;
+    shortlived.headers = "Keep-Alive: timeout=1\r\n";
+    closing.close = true;
+    QueryServer *all[] = { &server, &shortlived, &closing };
+
+    for (size_t ii = 0; ii < 3; ii++) {
+        std::vector<HttpServer*> servers(1, all[ii]);
+        bootstrap("n1ql", servers);
+        for (size_t jj = 0; jj < 3; jj++) {
+            std::vector<QueryResult> results;
+            issueQueries(instance, results, 1);
+            lcb_wait(instance);
+            checkQueries(results);
+        }
+    }
+
+    // The connection is returned to the pool and reused, unless the server
+    // closes it or would do so within a second
+    ASSERT_EQ(1, server.getConnectionCount());
+    ASSERT_EQ(3, shortlived.getConnectionCount());
+    ASSERT_EQ(3, closing.getConnectionCount());
+}
+
+extern "C" {
+static lcb_SSIZE endlessSource_read(void *cookie, char *buf, lcb_SIZE nbuf)
+{
+    size_t n = std::min((size_t)nbuf, (size_t)4096);
+    memset(buf, 'x', n);
+    (*(size_t *)cookie)++;
+    return n;
+}
+}
+
+TEST_F(HttpLoopbackTest, testEarlyResponse)
+{
+    QueryServer server;
+    server.setRespondEarly(true);
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+    ASSERT_EQ(LCB_SUCCESS, lcb_cntl_string(instance, "n1ql_timeout", "2"));
+    lcb_install_callback3(instance, LCB_CALLBACK_HTTP, http_callback);
+
+    // The server responds before the (never ending) body has been sent
+    size_t nreads = 0;
+    lcb_HTTPBODYSOURCE source = { endlessSource_read, &nreads, 0 };
+    HttpResult res;
+    lcb_CMDHTTP cmd = { 0 };
+    cmd.type = LCB_HTTP_TYPE_N1QL;
+    cmd.method = LCB_HTTP_METHOD_POST;
+    LCB_CMD_SET_KEY(&cmd, "/query/service", strlen("/query/service"));
+    cmd.content_type = "application/json";
+    cmd.cmdflags = LCB_CMDHTTP_F_BODYSTREAM;
+    cmd.body = (const char *)&source;
+    ASSERT_EQ(LCB_SUCCESS, lcb_http3(instance, &res, &cmd));
+    lcb_wait(instance);
+    ASSERT_EQ(1, res.called);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(200, res.htstatus);
+    ASSERT_LT(0, nreads);
+
+    // The rest of the body would be taken as part of the next request on the
+    // connection, so it must not be reused
+    std::vector<QueryResult> results;
+    issueQueries(instance, results, 1);
+    lcb_wait(instance);
+    checkQueries(results);
+    ASSERT_EQ(2, server.getConnectionCount());
+}
+
+namespace {
+/**
+ * Serves the FTS configuration, and queries of the index partitions (pindexes)
+ * it holds
+ */
+class FtsServer : public HttpServer {
+public:
+    std::string cfg;
+    /** Response body for each partition, by name */
+    std::map<std::string, std::string> pindexes;
+
+protected:
+    void handle(const Request& req, Response& resp) {
+        const std::string prefix = "/api/pindex/", suffix = "/query";
+        const std::string& path = req.path;
+        if (path == "/api/cfg") {
+            resp.body = cfg;
+            return;
+        }
+        if (path.size() > prefix.size() + suffix.size() &&
+                path.compare(0, prefix.size(), prefix) == 0 &&
+                path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            std::string name = path.substr(prefix.size(),
+                path.size() - prefix.size() - suffix.size());
+            if (pindexes.count(name)) {
+                resp.body = pindexes[name];
+                return;
+            }
+        }
+        resp.status = 404;
+    }
+};
+
+struct FtsResult {
+    FtsResult() : nfinal(0), rc(LCB_ERROR) {}
+    std::vector<std::string> rows;
+    std::string meta;
+    int nfinal;
+    lcb_error_t rc;
+};
+}
+
+extern "C" {
+static void fts_callback(lcb_t, int, const lcb_RESPFTS *resp)
+{
+    FtsResult *res = (FtsResult *)resp->cookie;
+    std::string row(resp->row, resp->nrow);
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        res->nfinal++;
+        res->rc = resp->rc;
+        res->meta = row;
+    } else {
+        res->rows.push_back(row);
+    }
+}
+}
+
+static std::string
+ftsHit(const char *id, double score)
+{
+    char buf[128];
+    sprintf(buf, "{\"id\":\"%s\",\"score\":%g}", id, score);
+    return buf;
+}
+
+static std::string
+ftsPartition(const std::string& hits, unsigned total_hits, double max_score, double took)
+{
+    char buf[128];
+    sprintf(buf, "],\"total_hits\":%u,\"max_score\":%g,\"took\":%g}",
+        total_hits, max_score, took);
+    return "{\"status\":{\"total\":1,\"failed\":0,\"successful\":1},"
+        "\"hits\":[" + hits + buf;
+}
+
+TEST_F(HttpLoopbackTest, testFtsScatter)
+{
+    FtsServer server1, server2;
+    std::vector<HttpServer*> servers;
+    servers.push_back(&server1);
+    servers.push_back(&server2);
+    bootstrap("fts", servers);
+
+    // p1 is on node 1. p2 is read from node 2, which has the better priority
+    // of its two copies. p3 belongs to another index.
+    char buf[1024];
+    sprintf(buf, "{\"planPIndexes\":{\"planPIndexes\":{"
+        "\"p1\":{\"indexName\":\"ix\",\"nodes\":"
+            "{\"n1\":{\"canRead\":true,\"priority\":0}}},"
+        "\"p2\":{\"indexName\":\"ix\",\"nodes\":"
+            "{\"n1\":{\"canRead\":true,\"priority\":1},"
+            "\"n2\":{\"canRead\":true,\"priority\":0}}},"
+        "\"p3\":{\"indexName\":\"other\",\"nodes\":"
+            "{\"n1\":{\"canRead\":true,\"priority\":0}}}}},"
+        "\"nodeDefsWanted\":{\"nodeDefs\":{"
+        "\"n1\":{\"hostPort\":\"127.0.0.1:%u\"},"
+        "\"n2\":{\"hostPort\":\"127.0.0.1:%u\"}}}}",
+        server1.getListenPort(), server2.getListenPort());
+    server1.cfg = server2.cfg = buf;
+    server1.pindexes["p1"] = ftsPartition(ftsHit("a", 5) + "," +
+        ftsHit("c", 3) + "," + ftsHit("e", 2), 10, 5, 0.5);
+    server2.pindexes["p2"] = ftsPartition(ftsHit("b", 4) + "," +
+        ftsHit("d", 1), 7, 4, 0.25);
+
+    FtsResult res;
+    std::string query = "{\"indexName\":\"ix\",\"query\":{\"match\":\"x\"},"
+        "\"from\":1,\"size\":3}";
+    lcb_CMDFTS cmd = { 0 };
+    cmd.cmdflags = LCB_CMDFTS_F_SCATTER;
+    cmd.query = query.c_str();
+    cmd.nquery = query.size();
+    cmd.callback = fts_callback;
+    ASSERT_EQ(LCB_SUCCESS, lcb_fts_query(instance, &res, &cmd));
+    lcb_wait(instance);
+
+    // The hits are merged by score, and then paged
+    ASSERT_EQ(1, res.nfinal);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(3, res.rows.size());
+    ASSERT_EQ(ftsHit("b", 4), res.rows[0]);
+    ASSERT_EQ(ftsHit("c", 3), res.rows[1]);
+    ASSERT_EQ(ftsHit("e", 2), res.rows[2]);
+
+    // The metadata is combined from the partitions
+    Json::Value meta;
+    ASSERT_TRUE(Json::Reader().parse(res.meta, meta)) << res.meta;
+    ASSERT_EQ(17, meta["total_hits"].asInt());
+    ASSERT_EQ(5, meta["max_score"].asDouble());
+    ASSERT_EQ(0.5, meta["took"].asDouble());
+    ASSERT_EQ(2, meta["status"]["total"].asInt());
+    ASSERT_EQ(2, meta["status"]["successful"].asInt());
+    ASSERT_EQ(0, meta["status"]["failed"].asInt());
+
+    // The configuration is read once, and each partition is queried (only)
+    // on the node chosen for it, for the whole of the page
+    std::vector<HttpServer::Request> reqs1 = server1.getRequests();
+    std::vector<HttpServer::Request> reqs2 = server2.getRequests();
+    std::vector<HttpServer::Request> pqueries;
+    size_t ncfg = 0;
+    for (size_t ii = 0; ii < reqs1.size() + reqs2.size(); ii++) {
+        const HttpServer::Request& req =
+                ii < reqs1.size() ? reqs1[ii] : reqs2[ii - reqs1.size()];
+        if (req.path == "/api/cfg") {
+            ncfg++;
+        } else {
+            pqueries.push_back(req);
+        }
+    }
+    ASSERT_EQ(1, ncfg);
+    ASSERT_EQ(2, pqueries.size());
+    for (size_t ii = 0; ii < reqs1.size(); ii++) {
+        ASSERT_NE("/api/pindex/p2/query", reqs1[ii].path);
+        ASSERT_NE("/api/pindex/p3/query", reqs1[ii].path);
+    }
+    for (size_t ii = 0; ii < pqueries.size(); ii++) {
+        Json::Value body;
+        ASSERT_TRUE(Json::Reader().parse(pqueries[ii].body, body));
+        ASSERT_EQ(0, body["from"].asInt());
+        ASSERT_EQ(4, body["size"].asInt());
+    }
+}
+
+namespace {
+struct GroupState {
+    enum { CANCEL_NEVER, CANCEL_ON_ROW, CANCEL_ON_FINAL };
+    GroupState() : handle(NULL), cancel_on(CANCEL_NEVER), breakout(false),
+        ncalls(0), nrows(0), nfinal(0) {}
+    lcb_N1QLGROUPHANDLE handle;
+    /** Cancel the group from within the first callback of this kind */
+    int cancel_on;
+    /** Stop waiting for the group after the first final callback */
+    bool breakout;
+    int ncalls;
+    int nrows;
+    int nfinal;
+};
+}
+
+extern "C" {
+static void group_callback(lcb_t instance, size_t, const lcb_RESPN1QL *resp)
+{
+    GroupState *state = (GroupState *)resp->cookie;
+    int kind;
+    state->ncalls++;
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        EXPECT_EQ(LCB_SUCCESS, resp->rc);
+        state->nfinal++;
+        kind = GroupState::CANCEL_ON_FINAL;
+        if (state->breakout) {
+            lcb_breakout(instance);
+        }
+    } else {
+        state->nrows++;
+        kind = GroupState::CANCEL_ON_ROW;
+    }
+    if (state->cancel_on == kind) {
+        state->cancel_on = GroupState::CANCEL_NEVER;
+        lcb_n1ql_group_cancel(instance, state->handle);
+    }
+}
+}
+
+/** Run a group of `n` distinct queries */
+static void
+runGroup(lcb_t instance, GroupState& state, size_t n, unsigned max_per_node)
+{
+    std::vector<std::string> queries(n);
+    std::vector<lcb_CMDN1QL> cmds(n);
+    for (size_t ii = 0; ii < n; ii++) {
+        char query[64];
+        sprintf(query, "{\"statement\":\"SELECT %u\"}", (unsigned)ii);
+        queries[ii] = query;
+        lcb_CMDN1QL cmd = { 0 };
+        cmd.query = queries[ii].c_str();
+        cmd.nquery = queries[ii].size();
+        cmds[ii] = cmd;
+    }
+    lcb_CMDN1QLGROUP gcmd = { 0 };
+    gcmd.cmds = &cmds[0];
+    gcmd.ncmds = n;
+    gcmd.max_per_node = max_per_node;
+    gcmd.callback = group_callback;
+    gcmd.handle = &state.handle;
+    ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_group(instance, &state, &gcmd));
+    lcb_wait(instance);
+}
+
+TEST_F(HttpLoopbackTest, testGroupPerNode)
+{
+    QueryServer fast, slow;
+    fast.delay_ms = 10;
+    slow.delay_ms = 100;
+    std::vector<HttpServer*> servers;
+    servers.push_back(&fast);
+    servers.push_back(&slow);
+    bootstrap("n1ql", servers);
+
+    // The fast node is preferred, but never has more than one of the group's
+    // statements in progress, even while the slow node is busy
+    GroupState state;
+    runGroup(instance, state, 20, 1);
+    ASSERT_EQ(20, state.nfinal);
+    ASSERT_EQ(20, state.nrows);
+    ASSERT_EQ(1, fast.getMaxActive());
+    ASSERT_EQ(1, slow.getMaxActive());
+    ASSERT_EQ(20, fast.getRequests().size() + slow.getRequests().size());
+    ASSERT_LT(slow.getRequests().size(), fast.getRequests().size());
+}
+
+TEST_F(HttpLoopbackTest, testGroupCancel)
+{
+    QueryServer server;
+    server.delay_ms = 10;
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+
+    // Statements which were not yet issued are dropped
+    GroupState state;
+    state.cancel_on = GroupState::CANCEL_ON_FINAL;
+    runGroup(instance, state, 5, 1);
+    ASSERT_EQ(2, state.ncalls);
+    ASSERT_EQ(1, state.nfinal);
+    ASSERT_EQ(1, server.getRequests().size());
+
+    // Statements in progress receive no further callbacks
+    state = GroupState();
+    state.cancel_on = GroupState::CANCEL_ON_ROW;
+    runGroup(instance, state, 5, 0);
+    ASSERT_EQ(1, state.ncalls);
+    ASSERT_EQ(1, state.nrows);
+    ASSERT_EQ(0, state.nfinal);
+}
+
+TEST_F(HttpLoopbackTest, testGroupDestroy)
+{
+    QueryServer server;
+    server.delay_ms = 10;
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+
+    // A group still in progress is destroyed along with the instance
+    GroupState state;
+    state.breakout = true;
+    runGroup(instance, state, 5, 1);
+    ASSERT_EQ(1, state.nfinal);
+    lcb_destroy(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+    ASSERT_EQ(1, state.nfinal);
+
+    // Including one whose statements were not yet issued
+    bootstrap("n1ql", servers);
+    state = GroupState();
+    lcb_CMDN1QL cmd = { 0 };
+    cmd.query = "{\"statement\":\"SELECT 1\"}";
+    cmd.nquery = strlen(cmd.query);
+    lcb_CMDN1QLGROUP gcmd = { 0 };
+    gcmd.cmds = &cmd;
+    gcmd.ncmds = 1;
+    gcmd.callback = group_callback;
+    ASSERT_EQ(LCB_SUCCESS, lcb_n1ql_group(instance, &state, &gcmd));
+    lcb_destroy(instance);
+    ASSERT_EQ(LCB_SUCCESS, lcb_create(&instance, NULL));
+    ASSERT_EQ(0, state.ncalls);
+}
+
+namespace {
+/**
+ * Answers each check of the index states with the next of a sequence of
+ * results (repeating the last)
+ */
+class IndexServer : public HttpServer {
+public:
+    IndexServer() : nchecks(0) {}
+    std::vector<std::string> results;
+
+protected:
+    void handle(const Request&, Response& resp) {
+        mutex.lock();
+        size_t ix = std::min(nchecks++, results.size() - 1);
+        mutex.unlock();
+        resp.body = "{\"results\":[" + results[ix] + "],\"status\":\"success\"}";
+    }
+
+private:
+    Mutex mutex;
+    size_t nchecks;
+};
+
+struct WatchResult {
+    WatchResult() : called(0), rc(LCB_ERROR), nspecs(0) {}
+    int called;
+    lcb_error_t rc;
+    size_t nspecs;
+    /** The states reported by the state callback, in order */
+    std::vector<std::string> states;
+};
+}
+
+extern "C" {
+static void watch_callback(lcb_t, int, const lcb_RESPN1XMGMT *resp)
+{
+    WatchResult *res = (WatchResult *)resp->cookie;
+    res->called++;
+    res->rc = resp->rc;
+    res->nspecs = resp->nspecs;
+}
+
+static void watch_state_callback(lcb_t, int, const lcb_RESPN1XMGMT *resp)
+{
+    WatchResult *res = (WatchResult *)resp->cookie;
+    for (size_t ii = 0; ii < resp->nspecs; ii++) {
+        res->states.push_back(std::string(resp->specs[ii]->name, resp->specs[ii]->nname) +
+            "=" + std::string(resp->specs[ii]->state, resp->specs[ii]->nstate));
+    }
+}
+}
+
+static std::string
+indexRow(const char *name, const char *state)
+{
+    char buf[256];
+    sprintf(buf, "{\"name\":\"%s\",\"keyspace_id\":\"default\","
+        "\"namespace_id\":\"default\",\"using\":\"gsi\",\"state\":\"%s\"}",
+        name, state);
+    return buf;
+}
+
+/** Watch one index, without waiting */
+static void
+watchIndex(lcb_t instance, WatchResult& res, const std::string& spec)
+{
+    lcb_N1XSPEC ixspec = { 0 };
+    ixspec.rawjson = spec.c_str();
+    ixspec.nrawjson = spec.size();
+    const lcb_N1XSPEC *specs[] = { &ixspec };
+    lcb_CMDN1XWATCH cmd = { 0 };
+    cmd.specs = specs;
+    cmd.nspec = 1;
+    cmd.interval = LCB_MS2US(5);
+    cmd.max_interval = LCB_MS2US(20);
+    cmd.timeout = LCB_S2US(10);
+    cmd.callback = watch_callback;
+    cmd.state_callback = watch_state_callback;
+    ASSERT_EQ(LCB_SUCCESS, lcb_n1x_watchbuild(instance, &res, &cmd));
+}
+
+TEST_F(HttpLoopbackTest, testWatchIndexes)
+{
+    IndexServer server;
+    server.results.push_back(indexRow("ix1", "pending") + "," + indexRow("ix2", "pending"));
+    server.results.push_back(indexRow("ix1", "building") + "," + indexRow("ix2", "pending"));
+    server.results.push_back(indexRow("ix1", "online") + "," + indexRow("ix2", "pending"));
+    server.results.push_back(indexRow("ix2", "building"));
+    server.results.push_back(indexRow("ix2", "online"));
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+
+    WatchResult res1, res2;
+    watchIndex(instance, res1, indexRow("ix1", "deferred"));
+    watchIndex(instance, res2, indexRow("ix2", "deferred"));
+    lcb_wait(instance);
+
+    ASSERT_EQ(1, res1.called);
+    ASSERT_EQ(LCB_SUCCESS, res1.rc);
+    ASSERT_EQ(1, res1.nspecs);
+    ASSERT_EQ(3, res1.states.size());
+    ASSERT_EQ("ix1=pending", res1.states[0]);
+    ASSERT_EQ("ix1=building", res1.states[1]);
+    ASSERT_EQ("ix1=online", res1.states[2]);
+
+    ASSERT_EQ(1, res2.called);
+    ASSERT_EQ(LCB_SUCCESS, res2.rc);
+    ASSERT_EQ(3, res2.states.size());
+    ASSERT_EQ("ix2=pending", res2.states[0]);
+    ASSERT_EQ("ix2=building", res2.states[1]);
+    ASSERT_EQ("ix2=online", res2.states[2]);
+
+    // Both watchers share each check, which only lists the indexes still
+    // being watched
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(5, reqs.size());
+    for (size_t ii = 0; ii < reqs.size(); ii++) {
+        bool has_ix1 = reqs[ii].body.find("ix1") != std::string::npos;
+        ASSERT_EQ(ii < 3, has_ix1) << reqs[ii].body;
+        ASSERT_NE(std::string::npos, reqs[ii].body.find("ix2")) << reqs[ii].body;
+    }
+
+    // An index which disappears fails the watch
+    WatchResult res3;
+    server.results.assign(1, "");
+    watchIndex(instance, res3, indexRow("ix3", "deferred"));
+    lcb_wait(instance);
+    ASSERT_EQ(1, res3.called);
+    ASSERT_EQ(LCB_KEY_ENOENT, res3.rc);
+}
+
+TEST_F(HttpLoopbackTest, testWatchPrimaryIndex)
+{
+    IndexServer server;
+    const char *fmt = "{\"name\":\"#primary\",\"keyspace_id\":\"default\","
+        "\"namespace_id\":\"default\",\"using\":\"gsi\",\"state\":\"%s\","
+        "\"is_primary\":true}";
+    char buf[256];
+    sprintf(buf, fmt, "building");
+    server.results.push_back(buf);
+    sprintf(buf, fmt, "online");
+    server.results.push_back(buf);
+    std::vector<HttpServer*> servers(1, &server);
+    bootstrap("n1ql", servers);
+
+    // The primary index is watched as it is created, without a name, but is
+    // listed by the server under its default name
+    WatchResult res;
+    watchIndex(instance, res, "{\"name\":\"\",\"keyspace_id\":\"default\","
+        "\"namespace_id\":\"default\",\"using\":\"gsi\",\"is_primary\":true}");
+    lcb_wait(instance);
+    ASSERT_EQ(1, res.called);
+    ASSERT_EQ(LCB_SUCCESS, res.rc);
+    ASSERT_EQ(1, res.nspecs);
+    ASSERT_EQ(2, res.states.size());
+    ASSERT_EQ("=building", res.states[0]);
+    ASSERT_EQ("=online", res.states[1]);
+
+    std::vector<HttpServer::Request> reqs = server.getRequests();
+    ASSERT_EQ(2, reqs.size());
+    ASSERT_NE(std::string::npos, reqs[0].body.find("is_primary=true")) << reqs[0].body;
+}
@@ -177,3 +177,98 @@ TEST_F(SockMgrTest, testMaxIdle)
         delete otherSocks[ii];
     }
 }
+
+static string dumpPool(lcbio_MGR *mgr)
+{
+    string ret;
+    char buf[4096];
+    size_t nr;
+    FILE *fp = tmpfile();
+    lcbio_mgr_dump(mgr, fp);
+    rewind(fp);
+    while ((nr = fread(buf, 1, sizeof buf, fp)) > 0) {
+        ret.append(buf, nr);
+    }
+    fclose(fp);
+    return ret;
+}
+
+class PoolDumpBreakCondition : public BreakCondition {
+public:
+    PoolDumpBreakCondition(lcbio_MGR *mgr, const string& s, unsigned n = 0)
+        : mgr(mgr), needle(s), minpolls(n) {}
+protected:
+    bool shouldBreakImpl() {
+        if (minpolls) {
+            minpolls--;
+            return false;
+        }
+        return dumpPool(mgr).find(needle) != string::npos;
+    }
+private:
+    lcbio_MGR *mgr;
+    string needle;
+    unsigned minpolls;
+};
+
+TEST_F(SockMgrTest, testMinIdle)
+{
+    lcb_host_t host;
+    loop->populateHost(&host);
+    loop->sockpool->minidle = 2;
+    loop->sockpool->tmoidle = LCB_MS2US(2);
+
+    lcbio_mgr_warmup(loop->sockpool, &host);
+    PoolDumpBreakCondition bcWarm(loop->sockpool, "Idle=2,");
+    loop->setBreakCondition(&bcWarm);
+    loop->start();
+    ASSERT_TRUE(bcWarm.didBreak());
+
+    // Connections within the minimum should not be expired
+    PoolDumpBreakCondition bcExpire(loop->sockpool, "Idle=2,", 10);
+    loop->setBreakCondition(&bcExpire);
+    loop->start();
+    ASSERT_TRUE(bcExpire.didBreak());
+
+    ESocket *sock = new ESocket();
+    loop->connectPooled(sock);
+    ASSERT_TRUE(sock->sock != NULL);
+    ASSERT_NE(string::npos, dumpPool(loop->sockpool).find("hits=1, misses=0"));
+
+    // Discarding a leased connection should cause the pool to be refilled
+    lcbio_ctx_close(sock->ctx, NULL, NULL);
+    sock->clear();
+    delete sock;
+    PoolDumpBreakCondition bcRefill(loop->sockpool, "Idle=2,");
+    loop->setBreakCondition(&bcRefill);
+    loop->start();
+    ASSERT_TRUE(bcRefill.didBreak());
+}
+
+TEST_F(SockMgrTest, testMinIdleMaxTotal)
+{
+    lcb_host_t host;
+    loop->populateHost(&host);
+    loop->sockpool->maxidle = 4;
+    loop->sockpool->minidle = 3;
+    loop->sockpool->maxtotal = 2;
+
+    // The pool is only warmed up to the maximum total
+    lcbio_mgr_warmup(loop->sockpool, &host);
+    PoolDumpBreakCondition bcWarm(loop->sockpool, "Pending=0", 20);
+    loop->setBreakCondition(&bcWarm);
+    loop->start();
+    ASSERT_TRUE(bcWarm.didBreak());
+    ASSERT_NE(string::npos, dumpPool(loop->sockpool).find("Idle=2, Pending=0"));
+
+    // A leased connection still counts towards the total
+    ESocket *sock = new ESocket();
+    loop->connectPooled(sock);
+    ASSERT_TRUE(sock->sock != NULL);
+    PoolDumpBreakCondition bcLeased(loop->sockpool, "Pending=0", 20);
+    loop->setBreakCondition(&bcLeased);
+    loop->start();
+    ASSERT_TRUE(bcLeased.didBreak());
+    ASSERT_NE(string::npos, dumpPool(loop->sockpool).find("Idle=1, Pending=0, Leased=1"));
+    delete sock;
+}
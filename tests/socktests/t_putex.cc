@@ -254,3 +254,26 @@ TEST_F(SockPutexTest, testClosed)
 
     ASSERT_TRUE(buflist->bufs.empty());
 }
+
+TEST_F(SockPutexTest, testFlushNow)
+{
+    RecvFuture rf(100);
+    for (int ii = 0; ii < 100; ii++) {
+        buflist->append("@");
+    }
+
+    // The data should be written without waiting for the event loop, and
+    // without requesting write events
+    sock.conn->setRecv(&rf);
+    lcbio_ctx_wflush(sock.ctx);
+    ASSERT_EQ(100, bufActions.totalFlushed);
+    ASSERT_TRUE(buflist->bufs.empty());
+    ASSERT_EQ(0, sock.ctx->wwant);
+
+    sock.schedule();
+    FutureBreakCondition fbc(&rf);
+    loop->setBreakCondition(&fbc);
+    loop->start();
+    rf.wait();
+    ASSERT_EQ(string(100, '@'), rf.getString());
+}